@@ -1395,38 +1395,38 @@ def main():
 
     util.log('Checking web interface')
 
-    index_html_src_paths = []
-    index_html_src_datas = []
+    web_assets_src_paths = []
+    web_assets_src_datas = []
 
     for name in sorted(os.listdir('web')):
         path = os.path.join('web', name)
 
         if os.path.isfile(path):
-            index_html_src_paths.append(path)
+            web_assets_src_paths.append(path)
 
     for root, dirs, files in sorted(os.walk('web/src', followlinks=True)):
         for name in sorted(files):
-            index_html_src_paths.append(os.path.join(root, name))
+            web_assets_src_paths.append(os.path.join(root, name))
 
-    index_html_src_paths += node_modules_digest_paths
+    web_assets_src_paths += node_modules_digest_paths
 
     for frontend_module in frontend_modules: # ensure changes to the frontend modules change the digest
-        index_html_src_datas.append(frontend_module.under.encode('utf-8'))
+        web_assets_src_datas.append(frontend_module.under.encode('utf-8'))
 
     # FIXME: Scons runs this script using exec(), resulting in __file__ being not available
-    #index_html_src_paths.append(__file__)
+    #web_assets_src_paths.append(__file__)
 
-    index_html_needs_update, index_html_reason, index_html_digest = util.check_digest(index_html_src_paths, index_html_src_datas, 'src', 'index_html', env=env)
+    web_assets_needs_update, web_assets_reason, web_assets_digest = util.check_digest(web_assets_src_paths, web_assets_src_datas, 'src', 'web_assets', env=env)
 
-    if not index_html_needs_update and os.path.exists('src/index_html.embedded.h') and os.path.exists('src/index_html.embedded.cpp'):
+    if not web_assets_needs_update and os.path.exists('src/web_assets.embedded.h') and os.path.exists('src/web_assets.embedded.cpp'):
         util.log('Web interface is up-to-date')
     else:
-        if not os.path.exists('src/index_html.embedded.h') or not os.path.exists('src/index_html.embedded.cpp'):
-            index_html_reason = 'embedded file missing'
+        if not os.path.exists('src/web_assets.embedded.h') or not os.path.exists('src/web_assets.embedded.cpp'):
+            web_assets_reason = 'embedded file missing'
 
-        print('Web interface is not up-to-date ({0}), building now'.format(index_html_reason))
+        print('Web interface is not up-to-date ({0}), building now'.format(web_assets_reason))
 
-        util.remove_digest('src', 'index_html', env=env)
+        util.remove_digest('src', 'web_assets', env=env)
 
         try:
             shutil.rmtree('web/build')
@@ -1449,24 +1449,31 @@ def main():
                     print(e, file=sys.stderr)
                 sys.exit(1)
 
-        with open('web/build/main.min.css', 'r', encoding='utf-8') as f:
-            css = f.read()
+        # index.html first: It is the only asset without a hash in its path.
+        asset_files = [('/', 'web/build/index.min.html', 'text/html; charset=utf-8', False)]
 
-        with open('web/build/bundle.min.js', 'r', encoding='utf-8') as f:
-            js = f.read()
+        for name in sorted(os.listdir('web/build/assets')):
+            content_type = {'.js': 'text/javascript; charset=utf-8', '.css': 'text/css; charset=utf-8'}[os.path.splitext(name)[1]]
+            asset_files.append(('/assets/' + name, os.path.join('web/build/assets', name), content_type, True))
 
-        with open('web/build/index.min.html', 'r', encoding='utf-8') as f:
-            html = f.read()
+        assets = []
 
-        html = html.replace('<link href=css/main.css rel=stylesheet>', '<style rel=stylesheet>{0}</style>'.format(css))
-        html = html.replace('<script src=js/bundle.js></script>', '<script>{0}</script>'.format(js))
-        html_bytes = html.encode('utf-8')
+        for path, file_path, content_type, immutable in asset_files:
+            with open(file_path, 'rb') as f:
+                data = f.read()
 
-        with open('web/build/index.standalone.html', 'wb') as f:
-            f.write(html_bytes)
+            gzip_data = util.gzip_compress(data)
+            brotli_data = util.brotli_compress(data)
 
-        util.embed_data(util.gzip_compress(html_bytes), 'src', 'index_html', 'char')
-        util.store_digest(index_html_digest, 'src', 'index_html', env=env)
+            # Only worth the flash if it is smaller.
+            if brotli_data is not None and len(brotli_data) >= len(gzip_data):
+                brotli_data = None
+
+            util.log('Web asset {0}: {1} bytes, {2} gzip, {3} Brotli'.format(path, len(data), len(gzip_data), '-' if brotli_data is None else len(brotli_data)))
+            assets.append((path, content_type, gzip_data, brotli_data, immutable))
+
+        util.embed_web_assets(assets, 'src', 'web_assets')
+        util.store_digest(web_assets_digest, 'src', 'web_assets', env=env)
 
     if web_only:
         print('Stopping build after web')
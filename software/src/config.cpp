@@ -55,6 +55,8 @@ size_t object_buf_size = 0;
 Config::ConfUnion::Slot *union_buf = nullptr;
 size_t union_buf_size = 0;
 
+ConfigSlotStats config_slot_stats = {};
+
 static ConfigRoot nullconf = Config{Config::ConfVariant{}};
 static ConfigRoot confirmconf;
 
@@ -305,6 +307,36 @@ const Config::ConstWrap Config::get(const String &s) const
     return get(s.c_str(), s.length());
 }
 
+Config::Wrap Config::get(const Key &key)
+{
+    ASSERT_MAIN_THREAD();
+    if (!this->is<Config::ConfObject>()) {
+        abort_on_object_get_failure(this, "<resolved key>");
+    }
+    Wrap wrap(value.val.o.get(key));
+
+    return wrap;
+}
+
+const Config::ConstWrap Config::get(const Key &key) const
+{
+    ASSERT_MAIN_THREAD();
+    if (!this->is<Config::ConfObject>()) {
+        abort_on_object_get_failure(this, "<resolved key>");
+    }
+    ConstWrap wrap(value.val.o.get(key));
+
+    return wrap;
+}
+
+Config::Key Config::resolveKey(const char *s) const
+{
+    if (!this->is<Config::ConfObject>()) {
+        abort_on_object_get_failure(this, s);
+    }
+    return value.val.o.resolveKey(s);
+}
+
 [[gnu::noinline]]
 [[gnu::noreturn]]
 static void abort_on_array_get_failure(const Config *conf, size_t i)
@@ -640,6 +672,11 @@ size_t Config::string_length() const
     return Config::apply_visitor(string_length_visitor{}, value);
 }
 
+size_t Config::msgpack_length() const
+{
+    return Config::apply_visitor(msgpack_length_visitor{}, value);
+}
+
 DynamicJsonDocument Config::to_json(const char *const *keys_to_censor, size_t keys_to_censor_len) const
 {
     DynamicJsonDocument doc(json_size(true));
@@ -767,6 +804,11 @@ void Config::to_string_except(const char *const *keys_to_censor, size_t keys_to_
     }
 }
 
+void Config::to_msgpack_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const
+{
+    Config::apply_visitor(::to_msgpack{sb, keys_to_censor, keys_to_censor_len}, value);
+}
+
 uint8_t Config::was_updated(uint8_t api_backend_flag)
 {
     ASSERT_MAIN_THREAD();
@@ -845,8 +887,20 @@ static void shrinkToFit(typename T::Slot * &buf, size_t &buf_size) {
         new_buf[i] = std::move(buf[i]);
 
     T::freeSlotBuf(buf);
+    ++config_slot_stats.reallocations;
+    config_slot_stats.bytes_moved += (last_used_slot + 1) * sizeof(typename T::Slot);
+
     buf = new_buf;
     buf_size = new_size;
+
+    // Slots behind the last used one were cut off, the empty ones before it can still be taken.
+    SlotFreeList &free_list = SlotFreeLists<T>::list;
+    free_list.reset(last_used_slot + 1);
+
+    for (size_t i = last_used_slot + 1; i > 0; --i) {
+        if (T::slotEmpty(i - 1))
+            free_list.release(i - 1);
+    }
 }
 
 void config_post_setup()
@@ -58,6 +58,7 @@ struct ConfIntSlot;
 struct ConfUintSlot;
 struct ConfArraySlot;
 struct ConfObjectSlot;
+struct ConfObjectSchema;
 struct ConfUnionSlot;
 
 struct ConfUnionPrototypeInternal;
@@ -228,6 +229,14 @@ struct Config {
         ConfArray &operator=(ConfArray &&cpy);
     };
 
+    // Position of a member in the schema of a ConfObject.
+    // Resolve once with Config::resolveKey and pass to Config::get in hot paths to skip the key search.
+    // Only valid for objects with the schema it was resolved against, i.e. copies of the same prototype.
+    struct Key {
+        const ConfObjectSchema *schema = nullptr;
+        uint16_t idx = 0;
+    };
+
     struct ConfObject {
         friend struct api_info;
         using Slot = ConfObjectSlot;
@@ -243,6 +252,9 @@ struct Config {
 
         Config *get(const char *s, size_t s_len);
         const Config *get(const char *s, size_t s_len) const;
+        Config *get(const Key &key);
+        const Config *get(const Key &key) const;
+        Key resolveKey(const char *s) const;
         const Slot *getSlot() const;
         Slot *getSlot();
 
@@ -433,6 +445,10 @@ struct Config {
 
     ConfVariant value;
 
+// API backends use the lower bits of ConfVariant::updated.
+// The highest bit tracks changes since the last ConfigJsonCache serialization.
+#define CONFIG_UPDATED_JSON_CACHE_FLAG 0x80
+
     uint8_t was_updated(uint8_t api_backend_flag);
     void clear_updated(uint8_t api_backend_flag);
     void set_updated(uint8_t api_backend_flag);
@@ -597,6 +613,9 @@ public:
     const ConstWrap get(const char *s, size_t s_len = 0) const;
     Wrap get(const String &s);
     const ConstWrap get(const String &s) const;
+    Wrap get(const Key &key);
+    const ConstWrap get(const Key &key) const;
+    Key resolveKey(const char *s) const;
 
     // for ConfArray
                Wrap get(int8_t )       = delete;
@@ -768,6 +787,7 @@ public:
     size_t json_size(bool zero_copy) const;
     size_t max_string_length() const;
     size_t string_length() const;
+    size_t msgpack_length() const;
 
     void save_to_file(File &file);
 
@@ -779,6 +799,9 @@ public:
     String to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len) const;
     void to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const;
 
+    // sb must have at least msgpack_length() bytes left.
+    void to_msgpack_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const;
+
     [[gnu::const]] static const Config *get_prototype_float_nan();
     [[gnu::const]] static const Config *get_prototype_int16_0();
     [[gnu::const]] static const Config *get_prototype_int32_0();
@@ -820,6 +843,9 @@ public:
     String update_from_cstr(char *c, size_t payload_len);
     String get_updated_copy(char *c, size_t payload_len, Config *out_config, ConfigSource source);
 
+    String update_from_msgpack(const char *c, size_t payload_len);
+    String get_updated_copy_from_msgpack(const char *c, size_t payload_len, Config *out_config, ConfigSource source);
+
     String update_from_json(JsonVariant root, bool force_same_keys, ConfigSource source);
     String get_updated_copy(JsonVariant root, bool force_same_keys, Config *out_config, ConfigSource source);
 
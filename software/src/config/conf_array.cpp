@@ -119,6 +119,8 @@ Config::ConfArray::~ConfArray()
     slot->minElements = 0;
     slot->maxElements = 0;
     slot->variantType = 0;
+
+    releaseSlot<Config::ConfArray>(idx);
 }
 
 Config::ConfArray &Config::ConfArray::operator=(const ConfArray &cpy)
@@ -98,6 +98,8 @@ Config::ConfFloat::~ConfFloat()
     slot->val = 0;
     slot->min = 0;
     slot->max = 0;
+
+    releaseSlot<Config::ConfFloat>(idx);
 }
 
 Config::ConfFloat &Config::ConfFloat::operator=(const ConfFloat &cpy)
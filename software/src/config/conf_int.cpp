@@ -66,6 +66,8 @@ Config::ConfInt::~ConfInt()
     slot->val = 0;
     slot->min = 0;
     slot->max = 0;
+
+    releaseSlot<Config::ConfInt>(idx);
 }
 
 Config::ConfInt &Config::ConfInt::operator=(const ConfInt &cpy)
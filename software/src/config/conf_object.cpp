@@ -52,13 +52,11 @@ Config *Config::ConfObject::get(const char *needle, size_t needle_len)
     const auto *slot = this->getSlot();
     const auto schema = slot->schema;
     const auto size = schema->length;
-    const auto keys = schema->keys;
 
     if (string_is_in_rodata(needle)) {
-        for (size_t i = 0; i < size; ++i) {
-            if (keys[i].val == needle) { // Address comparison, not string comparison
-                return &slot->values[i];
-            }
+        size_t i = conf_object_schema_find_address(schema, needle);
+        if (i < size) {
+            return &slot->values[i];
         }
 #ifdef DEBUG_FS_ENABLE
         logger.printfln("Key '%s' in rodata but not in keys.", needle);
@@ -69,12 +67,9 @@ Config *Config::ConfObject::get(const char *needle, size_t needle_len)
         needle_len = strlen(needle);
     }
 
-    for (size_t i = 0; i < size; ++i) {
-        if (keys[i].length != needle_len)
-            continue;
-
-        if (memcmp(keys[i].val, needle, needle_len) == 0)
-            return &slot->values[i];
+    size_t i = conf_object_schema_find_name(schema, needle, needle_len);
+    if (i < size) {
+        return &slot->values[i];
     }
 
     abort_on_key_not_found(needle);
@@ -85,13 +80,11 @@ const Config *Config::ConfObject::get(const char *needle, size_t needle_len) con
     const auto *slot = this->getSlot();
     const auto schema = slot->schema;
     const auto size = schema->length;
-    const auto keys = schema->keys;
 
     if (string_is_in_rodata(needle)) {
-        for (size_t i = 0; i < size; ++i) {
-            if (keys[i].val == needle) { // Address comparison, not string comparison
-                return &slot->values[i];
-            }
+        size_t i = conf_object_schema_find_address(schema, needle);
+        if (i < size) {
+            return &slot->values[i];
         }
 #ifdef DEBUG_FS_ENABLE
         logger.printfln("Key '%s' in rodata but not in keys.", needle);
@@ -102,17 +95,51 @@ const Config *Config::ConfObject::get(const char *needle, size_t needle_len) con
         needle_len = strlen(needle);
     }
 
-    for (size_t i = 0; i < size; ++i) {
-        if (keys[i].length != needle_len)
-            continue;
-
-        if (memcmp(keys[i].val, needle, needle_len) == 0)
-            return &slot->values[i];
+    size_t i = conf_object_schema_find_name(schema, needle, needle_len);
+    if (i < size) {
+        return &slot->values[i];
     }
 
     abort_on_key_not_found(needle);
 }
 
+[[gnu::noinline]]
+[[gnu::noreturn]]
+static void abort_on_schema_mismatch(uint16_t key_idx)
+{
+    char msg[64];
+    snprintf(msg, ARRAY_SIZE(msg), "Config key %u resolved against another schema!", key_idx);
+    esp_system_abort(msg);
+}
+
+Config *Config::ConfObject::get(const Key &key)
+{
+    auto *slot = this->getSlot();
+
+    if (slot->schema != key.schema)
+        abort_on_schema_mismatch(key.idx);
+
+    return &slot->values[key.idx];
+}
+
+const Config *Config::ConfObject::get(const Key &key) const
+{
+    const auto *slot = this->getSlot();
+
+    if (slot->schema != key.schema)
+        abort_on_schema_mismatch(key.idx);
+
+    return &slot->values[key.idx];
+}
+
+Config::Key Config::ConfObject::resolveKey(const char *needle) const
+{
+    const auto *slot = this->getSlot();
+    const Config *value = this->get(needle, 0);
+
+    return Key{slot->schema, static_cast<uint16_t>(value - slot->values)};
+}
+
 const Config::ConfObject::Slot *Config::ConfObject::getSlot() const { return &object_buf[idx]; }
 Config::ConfObject::Slot *Config::ConfObject::getSlot() { return &object_buf[idx]; }
 
@@ -179,6 +206,8 @@ Config::ConfObject::~ConfObject()
         delete[] slot->values;
 
     slot->values = nullptr;
+
+    releaseSlot<Config::ConfObject>(idx);
 }
 
 Config::ConfObject &Config::ConfObject::operator=(const ConfObject &cpy)
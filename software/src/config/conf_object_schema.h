@@ -0,0 +1,64 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+struct ConfObjectSchema {
+    struct Key {
+        size_t length;
+        const char *val;
+    };
+    size_t length;
+    Key keys[];
+};
+
+// Returns the index of the key with the same address as needle or schema->length.
+static inline size_t conf_object_schema_find_address(const ConfObjectSchema *schema, const char *needle)
+{
+    const auto size = schema->length;
+    const auto keys = schema->keys;
+
+    for (size_t i = 0; i < size; ++i) {
+        if (keys[i].val == needle) { // Address comparison, not string comparison
+            return i;
+        }
+    }
+
+    return size;
+}
+
+// Returns the index of the key that equals needle or schema->length.
+static inline size_t conf_object_schema_find_name(const ConfObjectSchema *schema, const char *needle, size_t needle_len)
+{
+    const auto size = schema->length;
+    const auto keys = schema->keys;
+
+    for (size_t i = 0; i < size; ++i) {
+        if (keys[i].length != needle_len)
+            continue;
+
+        if (memcmp(keys[i].val, needle, needle_len) == 0)
+            return i;
+    }
+
+    return size;
+}
@@ -98,6 +98,8 @@ Config::ConfString::~ConfString()
     slot->val.make_invalid();
     slot->minChars = 0;
     slot->maxChars = 0;
+
+    releaseSlot<Config::ConfString>(idx);
 }
 
 Config::ConfString &Config::ConfString::operator=(const ConfString &cpy)
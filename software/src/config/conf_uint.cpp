@@ -65,6 +65,8 @@ Config::ConfUint::~ConfUint()
     slot->val = 0;
     slot->min = 0;
     slot->max = 0;
+
+    releaseSlot<Config::ConfUint>(idx);
 }
 
 Config::ConfUint &Config::ConfUint::operator=(const ConfUint &cpy)
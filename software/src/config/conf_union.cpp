@@ -96,6 +96,8 @@ Config::ConfUnion::~ConfUnion()
     slot->tag = 0;
     slot->prototypes_len = 0;
     slot->prototypes = nullptr;
+
+    releaseSlot<Config::ConfUnion>(idx);
 }
 
 Config::ConfUnion &Config::ConfUnion::operator=(const ConfUnion &cpy)
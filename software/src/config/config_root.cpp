@@ -73,6 +73,42 @@ String ConfigRoot::get_updated_copy(char *c, size_t payload_len, Config *out_con
     }
 }
 
+String ConfigRoot::update_from_msgpack(const char *c, size_t len)
+{
+    ASSERT_MAIN_THREAD();
+    Config copy;
+    String err = this->get_updated_copy_from_msgpack(c, len, &copy, ConfigSource::API);
+    if (!err.isEmpty())
+        return err;
+
+    this->update_from_copy(&copy);
+    return "";
+}
+
+// MessagePack strings are not null-terminated, so ArduinoJson has to copy them.
+String ConfigRoot::get_updated_copy_from_msgpack(const char *c, size_t payload_len, Config *out_config, ConfigSource source)
+{
+    DynamicJsonDocument doc(this->json_size(false));
+    DeserializationError error = deserializeMsgPack(doc, c, payload_len);
+
+    switch (error.code()) {
+        case DeserializationError::Ok:
+            return this->get_updated_copy(doc.as<JsonVariant>(), true, out_config, source);
+        case DeserializationError::NoMemory:
+            return String("Failed to deserialize: MessagePack payload was longer than expected and possibly contained unknown keys.");
+        case DeserializationError::EmptyInput:
+            return String("Failed to deserialize: Payload was empty. Please send valid MessagePack.");
+        case DeserializationError::IncompleteInput:
+            return String("Failed to deserialize: MessagePack payload incomplete or truncated");
+        case DeserializationError::InvalidInput:
+            return String("Failed to deserialize: MessagePack payload could not be parsed");
+        case DeserializationError::TooDeep:
+            return String("Failed to deserialize: MessagePack payload nested too deep");
+        default:
+            return String("Failed to deserialize MessagePack: ") + String(error.c_str());
+    }
+}
+
 String ConfigRoot::update_from_json(JsonVariant root, bool force_same_keys, ConfigSource source)
 {
     Config copy;
@@ -0,0 +1,292 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config/json_cache.h"
+
+#include "config/private.h"
+#include "config/visitors.h"
+#include "string_builder.h"
+#include "tools.h"
+
+// Serializes a single value with ArduinoJson so that
+// floats and escaped strings look exactly like in to_json.
+static void emit_leaf(Config *config, StringBuilder *sb)
+{
+    // Strings are linked, not copied. No memory pool required.
+    StaticJsonDocument<16> doc;
+    Config::apply_visitor(to_json{doc.to<JsonVariant>(), nullptr, 0}, config->value);
+
+    size_t written = serializeJson(doc, sb->getRemainingPtr(), sb->getRemainingLength() + 1); // +1 for NUL-terminator
+    sb->setLength(sb->getLength() + written);
+}
+
+bool ConfigJsonCache::emit(Config *config, Node *node, const char *old_json, bool force, StringBuilder *sb)
+{
+    size_t start = sb->getLength();
+
+    bool is_object = config->is<Config::ConfObject>();
+    bool is_array  = config->is<Config::ConfArray>();
+
+    if (!is_object && !is_array) {
+        node->child_count = 0;
+        node->children = nullptr;
+
+        if (config->is<Config::ConfUnion>()) {
+            config->to_string_except(keys_to_censor, keys_to_censor_len, sb);
+        } else {
+            emit_leaf(config, sb);
+        }
+    } else {
+        const ConfObjectSlot *obj_slot = is_object ? config->value.val.o.getSlot() : nullptr;
+        std::vector<Config> *arr = is_array ? config->value.val.a.getVal() : nullptr;
+        size_t count = is_object ? obj_slot->schema->length : arr->size();
+
+        if (count > std::numeric_limits<decltype(Node::child_count)>::max())
+            return false;
+
+        // Array size changes and replaced containers set the container's own flag.
+        if (old_json == nullptr || node->children == nullptr || node->child_count != count || (config->value.updated & CONFIG_UPDATED_JSON_CACHE_FLAG) != 0)
+            force = true;
+
+        if (force) {
+            old_json = nullptr;
+
+            if (node->children == nullptr || node->child_count != count) {
+                node->children = heap_alloc_array<Node>(count);
+                node->child_count = count;
+            }
+        }
+
+        sb->putc(is_object ? '{' : '[');
+
+        for (size_t i = 0; i < count; ++i) {
+            if (i != 0)
+                sb->putc(',');
+
+            Node *child_node = &node->children[i];
+            Config *child;
+
+            if (is_object) {
+                const auto &key = obj_slot->schema->keys[i];
+                child = &obj_slot->values[i];
+
+                sb->putc('"');
+                sb->puts(key.val, key.length);
+                sb->puts("\":", 2);
+
+                bool censored = false;
+                for (size_t ktc = 0; ktc < keys_to_censor_len; ++ktc) {
+                    // Same check as in to_json: Both keys point to _rodata.
+                    if (key.val != keys_to_censor[ktc])
+                        continue;
+
+                    censored = !(child->is<Config::ConfString>() && child->asString().length() == 0);
+                    break;
+                }
+
+                if (censored) {
+                    child_node->offset = sb->getLength() - start;
+                    child_node->length = 4;
+                    child_node->child_count = 0;
+                    child_node->children = nullptr;
+                    sb->puts("null", 4);
+                    continue;
+                }
+            } else {
+                child = &(*arr)[i];
+            }
+
+            size_t child_start = sb->getLength();
+
+            if (!force && !child->was_updated(CONFIG_UPDATED_JSON_CACHE_FLAG)) {
+                // Unchanged subtree: The relative offsets of its children stay valid.
+                sb->puts(old_json + child_node->offset, child_node->length);
+                copied_bytes += child_node->length;
+            } else if (!emit(child, child_node, force ? nullptr : old_json + child_node->offset, force, sb)) {
+                return false;
+            }
+
+            child_node->offset = child_start - start;
+        }
+
+        sb->putc(is_object ? '}' : ']');
+    }
+
+    size_t length = sb->getLength() - start;
+
+    if (length > std::numeric_limits<decltype(Node::length)>::max())
+        return false;
+
+    node->length = length;
+
+    return true;
+}
+
+String ConfigJsonCache::to_string_except(Config *config, const char *const *keys_to_censor, size_t keys_to_censor_len)
+{
+    // The censored keys are baked into the cached JSON.
+    bool force = json == nullptr || keys_to_censor != this->keys_to_censor || keys_to_censor_len != this->keys_to_censor_len;
+
+    if (!force && !config->was_updated(CONFIG_UPDATED_JSON_CACHE_FLAG)) {
+        return String(json.get());
+    }
+
+    this->keys_to_censor = keys_to_censor;
+    this->keys_to_censor_len = keys_to_censor_len;
+
+    StringBuilder sb;
+
+    // string_length never underestimates numbers. +1 to detect truncation caused by escaped strings.
+    bool ok = sb.setCapacity(config->string_length() + 1)
+           && emit(config, &root, force ? nullptr : json.get(), force, &sb)
+           && sb.getRemainingLength() > 0;
+
+    if (!ok) {
+        json = nullptr;
+        json_len = 0;
+        root.children = nullptr;
+        root.child_count = 0;
+
+        return config->to_string_except(keys_to_censor, keys_to_censor_len);
+    }
+
+    sb.shrink();
+    json_len = sb.getLength();
+    ++serializations;
+    total_bytes += json_len;
+    json = sb.take();
+
+    config->clear_updated(CONFIG_UPDATED_JSON_CACHE_FLAG);
+
+    return String(json.get());
+}
+
+#define JSON_PATCH_MAX_POINTER_LENGTH 128
+
+static bool emit_patch_ops(Config *config, uint8_t updated_flag, char *pointer, size_t pointer_len, const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb, bool *first)
+{
+    bool is_object = config->is<Config::ConfObject>();
+
+    const ConfObjectSlot *obj_slot = is_object ? config->value.val.o.getSlot() : nullptr;
+    std::vector<Config> *arr = is_object ? nullptr : config->value.val.a.getVal();
+    size_t count = is_object ? obj_slot->schema->length : arr->size();
+
+    for (size_t i = 0; i < count; ++i) {
+        Config *child = is_object ? &obj_slot->values[i] : &(*arr)[i];
+
+        if (!child->was_updated(updated_flag))
+            continue;
+
+        size_t child_pointer_len = pointer_len;
+        bool censored = false;
+
+        if (is_object) {
+            const auto &key = obj_slot->schema->keys[i];
+
+            pointer[child_pointer_len++] = '/';
+
+            // Escape as defined by RFC 6901.
+            for (size_t k = 0; k < key.length; ++k) {
+                if (child_pointer_len + 2 >= JSON_PATCH_MAX_POINTER_LENGTH)
+                    return false;
+
+                char c = key.val[k];
+
+                if (c == '~' || c == '/') {
+                    pointer[child_pointer_len++] = '~';
+                    c = c == '~' ? '0' : '1';
+                }
+
+                pointer[child_pointer_len++] = c;
+            }
+
+            for (size_t ktc = 0; ktc < keys_to_censor_len; ++ktc) {
+                // Same check as in to_json: Both keys point to _rodata.
+                if (key.val != keys_to_censor[ktc])
+                    continue;
+
+                censored = !(child->is<Config::ConfString>() && child->asString().length() == 0);
+                break;
+            }
+        } else {
+            int written = snprintf(pointer + child_pointer_len, JSON_PATCH_MAX_POINTER_LENGTH - child_pointer_len, "/%u", i);
+
+            if (written < 0 || child_pointer_len + written >= JSON_PATCH_MAX_POINTER_LENGTH)
+                return false;
+
+            child_pointer_len += written;
+        }
+
+        bool is_container = child->is<Config::ConfObject>() || child->is<Config::ConfArray>();
+
+        // Only descend if the container itself was not replaced or resized.
+        if (!censored && is_container && (child->value.updated & updated_flag) == 0) {
+            if (!emit_patch_ops(child, updated_flag, pointer, child_pointer_len, keys_to_censor, keys_to_censor_len, sb, first))
+                return false;
+
+            continue;
+        }
+
+        if (!*first)
+            sb->putc(',');
+
+        *first = false;
+
+        sb->puts("[\"", 2);
+        sb->puts(pointer, child_pointer_len);
+        sb->puts("\",", 2);
+
+        if (censored) {
+            sb->puts("null", 4);
+        } else if (is_container || child->is<Config::ConfUnion>()) {
+            child->to_string_except(keys_to_censor, keys_to_censor_len, sb);
+        } else {
+            emit_leaf(child, sb);
+        }
+
+        sb->putc(']');
+
+        if (sb->getRemainingLength() == 0)
+            return false;
+    }
+
+    return true;
+}
+
+bool config_to_json_patch(Config *config, uint8_t updated_flag, const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb)
+{
+    if (!config->is<Config::ConfObject>() && !config->is<Config::ConfArray>())
+        return false;
+
+    if ((config->value.updated & updated_flag) != 0)
+        return false;
+
+    char pointer[JSON_PATCH_MAX_POINTER_LENGTH];
+    bool first = true;
+
+    sb->putc('[');
+
+    if (!emit_patch_ops(config, updated_flag, pointer, 0, keys_to_censor, keys_to_censor_len, sb, &first))
+        return false;
+
+    sb->putc(']');
+
+    // A full buffer means the patch was probably truncated.
+    return sb->getRemainingLength() > 0;
+}
@@ -0,0 +1,78 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "config.h"
+
+class StringBuilder;
+
+// Keeps the JSON serialization of a config and the position of every
+// object member and array element in it. Subtrees that were not updated
+// since the last call are copied from the previous serialization
+// instead of being serialized again. Produces exactly the same output as
+// Config::to_string_except.
+//
+// Uses CONFIG_UPDATED_JSON_CACHE_FLAG of the ConfVariant updated flags,
+// so only one cache may be used per config.
+class ConfigJsonCache
+{
+public:
+    ConfigJsonCache() = default;
+    ConfigJsonCache(const ConfigJsonCache &other) = delete;
+    ConfigJsonCache &operator=(const ConfigJsonCache &other) = delete;
+
+    String to_string_except(Config *config, const char *const *keys_to_censor, size_t keys_to_censor_len);
+
+    size_t get_json_length() const { return json_len; }
+
+    // For the debug report: Serializations since boot, their total length and time
+    // and how many of the bytes were copied from the previous JSON.
+    uint32_t serializations = 0;
+    uint64_t total_bytes = 0;
+    uint64_t copied_bytes = 0;
+    uint64_t total_time_us = 0;
+
+private:
+    // Offsets are relative to the start of the parent container's JSON.
+    struct Node {
+        uint16_t offset;
+        uint16_t length;
+        uint16_t child_count;
+        std::unique_ptr<Node[]> children;
+    };
+
+    bool emit(Config *config, Node *node, const char *old_json, bool force, StringBuilder *sb);
+
+    std::unique_ptr<char> json;
+    size_t json_len = 0;
+    Node root = {0, 0, 0, nullptr};
+
+    const char *const *keys_to_censor = nullptr;
+    size_t keys_to_censor_len = 0;
+};
+
+// Writes the changes of a config since updated_flag was last cleared as a
+// list of [JSON pointer, value] pairs. Members and elements whose own flag
+// is set are replaced as a whole; applying the list to the last sent JSON
+// is idempotent. Returns false if the config itself has to be replaced
+// or if the patch does not fit into sb.
+bool config_to_json_patch(Config *config, uint8_t updated_flag, const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb);
@@ -0,0 +1,135 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "string_builder.h"
+
+// Writes MessagePack values into a StringBuilder. Used by the to_msgpack
+// visitor; the *_length functions return the exact encoded length.
+
+// MessagePack uses big endian for all multi-byte values.
+static inline void msgpack_put_be(StringBuilder *sb, uint32_t v, size_t bytes)
+{
+    for (size_t i = bytes; i > 0; --i)
+        sb->putc(static_cast<char>(v >> ((i - 1) * 8)));
+}
+
+static inline void msgpack_put_uint(StringBuilder *sb, uint32_t v)
+{
+    if (v <= 0x7F) {
+        sb->putc(static_cast<char>(v)); // positive fixint
+    } else if (v <= 0xFF) {
+        sb->putc(static_cast<char>(0xCC));
+        msgpack_put_be(sb, v, 1);
+    } else if (v <= 0xFFFF) {
+        sb->putc(static_cast<char>(0xCD));
+        msgpack_put_be(sb, v, 2);
+    } else {
+        sb->putc(static_cast<char>(0xCE));
+        msgpack_put_be(sb, v, 4);
+    }
+}
+
+static inline void msgpack_put_int(StringBuilder *sb, int32_t v)
+{
+    if (v >= 0) {
+        msgpack_put_uint(sb, static_cast<uint32_t>(v));
+    } else if (v >= -32) {
+        sb->putc(static_cast<char>(v)); // negative fixint
+    } else if (v >= INT8_MIN) {
+        sb->putc(static_cast<char>(0xD0));
+        msgpack_put_be(sb, static_cast<uint32_t>(v), 1);
+    } else if (v >= INT16_MIN) {
+        sb->putc(static_cast<char>(0xD1));
+        msgpack_put_be(sb, static_cast<uint32_t>(v), 2);
+    } else {
+        sb->putc(static_cast<char>(0xD2));
+        msgpack_put_be(sb, static_cast<uint32_t>(v), 4);
+    }
+}
+
+// fix_type is the fixstr, fixarray or fixmap marker; type_16 is followed by the 16 and 32 bit variants.
+static inline void msgpack_put_header(StringBuilder *sb, uint8_t fix_type, size_t fix_max, uint8_t type_16, size_t len)
+{
+    if (len <= fix_max) {
+        sb->putc(static_cast<char>(fix_type | len));
+    } else if (len <= 0xFFFF) {
+        sb->putc(static_cast<char>(type_16));
+        msgpack_put_be(sb, static_cast<uint32_t>(len), 2);
+    } else {
+        sb->putc(static_cast<char>(type_16 + 1));
+        msgpack_put_be(sb, static_cast<uint32_t>(len), 4);
+    }
+}
+
+static inline void msgpack_put_str(StringBuilder *sb, const char *str, size_t len)
+{
+    // Strings have an additional 8 bit length variant.
+    if (len > 31 && len <= 0xFF) {
+        sb->putc(static_cast<char>(0xD9));
+        msgpack_put_be(sb, static_cast<uint32_t>(len), 1);
+    } else {
+        msgpack_put_header(sb, 0xA0, 31, 0xDA, len);
+    }
+
+    sb->puts(str, static_cast<ssize_t>(len));
+}
+
+static inline size_t msgpack_uint_length(uint32_t v)
+{
+    return v <= 0x7F ? 1 : v <= 0xFF ? 2 : v <= 0xFFFF ? 3 : 5;
+}
+
+static inline size_t msgpack_int_length(int32_t v)
+{
+    if (v >= 0)
+        return msgpack_uint_length(static_cast<uint32_t>(v));
+
+    return v >= -32 ? 1 : v >= INT8_MIN ? 2 : v >= INT16_MIN ? 3 : 5;
+}
+
+static inline size_t msgpack_header_length(size_t fix_max, size_t len)
+{
+    return len <= fix_max ? 1 : len <= 0xFFFF ? 3 : 5;
+}
+
+static inline size_t msgpack_str_length(size_t len)
+{
+    return (len > 31 && len <= 0xFF ? 2 : msgpack_header_length(31, len)) + len;
+}
+
+// Floats are written as 32 bit floats.
+static inline void msgpack_put_float(StringBuilder *sb, float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    sb->putc(static_cast<char>(0xCA));
+    msgpack_put_be(sb, bits, 4);
+}
+
+static inline size_t msgpack_float_length()
+{
+    return 5;
+}
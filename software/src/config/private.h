@@ -20,6 +20,8 @@
 #pragma once
 
 #include "config.h"
+#include "config/conf_object_schema.h"
+#include "config/slot_free_list.h"
 #include "tools.h"
 
 #define SLOT_HEADROOM 20
@@ -57,15 +59,6 @@ struct ConfArraySlot {
     bool inUse = false;
 };
 
-struct ConfObjectSchema {
-    struct Key {
-        size_t length;
-        const char *val;
-    };
-    size_t length;
-    Key keys[];
-};
-
 struct ConfObjectSlot {
     const ConfObjectSchema *schema = nullptr;
     Config *values;
@@ -99,25 +92,52 @@ extern size_t object_buf_size;
 extern Config::ConfUnion::Slot *union_buf;
 extern size_t union_buf_size;
 
+struct ConfigSlotStats {
+    uint32_t allocations;
+    uint32_t reallocations;
+    uint32_t bytes_moved;
+};
+
+extern ConfigSlotStats config_slot_stats;
+
+template<typename T>
+struct SlotFreeLists {
+    static SlotFreeList list;
+};
+
+template<typename T>
+SlotFreeList SlotFreeLists<T>::list;
+
 template<typename T>
 static size_t nextSlot(typename T::Slot *&buf, size_t &buf_size) {
     ASSERT_MAIN_THREAD();
-    for (size_t i = 0; i < buf_size; i++)
-    {
-        if (!T::slotEmpty(i))
-            continue;
+    ++config_slot_stats.allocations;
 
-        return i;
-    }
+    // Taking the slot from the free list marks it as taken before the caller fills it:
+    // Nested configs allocate their slots while the outer one is still empty.
+    size_t result = SlotFreeLists<T>::list.take(buf_size);
+    if (result < buf_size)
+        return result;
 
-    auto new_buf = T::allocSlotBuf(buf_size + SLOT_HEADROOM);
+    // Grow geometrically to keep allocations amortized O(1) when many configs are created.
+    // config_post_setup shrinks the buffers again.
+    size_t new_size = buf_size + std::max((size_t)SLOT_HEADROOM, buf_size / 4);
+    auto new_buf = T::allocSlotBuf(new_size);
 
     for (size_t i = 0; i < buf_size; ++i)
         new_buf[i] = std::move(buf[i]);
 
     T::freeSlotBuf(buf);
+    ++config_slot_stats.reallocations;
+    config_slot_stats.bytes_moved += buf_size * sizeof(typename T::Slot);
+
     buf = new_buf;
-    size_t result = buf_size;
-    buf_size = buf_size + SLOT_HEADROOM;
+    buf_size = new_size;
     return result;
 }
+
+// Call after clearing a slot.
+template<typename T>
+static void releaseSlot(size_t idx) {
+    SlotFreeLists<T>::list.release(idx);
+}
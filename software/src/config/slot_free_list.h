@@ -0,0 +1,61 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Free slots of one slot buffer. Slots below end were handed out before,
+// the released ones of them are on the free list. Slots from end on were
+// never handed out. Both take and release are O(1).
+struct SlotFreeList {
+    std::vector<uint16_t> free_slots;
+    size_t end = 0;
+
+    // Returns buf_size if the buffer is full. The caller then grows the buffer and uses that slot.
+    size_t take(size_t buf_size)
+    {
+        if (!free_slots.empty()) {
+            size_t idx = free_slots.back();
+            free_slots.pop_back();
+            return idx;
+        }
+
+        if (end < buf_size)
+            return end++;
+
+        end = buf_size + 1;
+        return buf_size;
+    }
+
+    void release(size_t idx)
+    {
+        free_slots.push_back(static_cast<uint16_t>(idx));
+    }
+
+    // Forgets all slots from new_end on. The caller releases the free slots below new_end again.
+    void reset(size_t new_end)
+    {
+        free_slots.clear();
+        free_slots.shrink_to_fit();
+        end = new_end;
+    }
+};
@@ -22,6 +22,7 @@
 #include "config/private.h"
 
 #include "header_logger.h"
+#include "config/msgpack_writer.h"
 
 #include "tools.h"
 
@@ -239,6 +240,89 @@ struct to_json {
     size_t keys_to_censor_len;
 };
 
+// Writes the same structure as to_json, but encoded as MessagePack.
+// Floats are written as 32 bit floats.
+struct to_msgpack {
+    void operator()(const Config::ConfString &x)
+    {
+        const auto *val = x.getVal();
+        msgpack_put_str(sb, val->c_str(), val->length());
+    }
+    void operator()(const Config::ConfFloat &x)
+    {
+        msgpack_put_float(sb, x.getVal());
+    }
+    void operator()(const Config::ConfInt &x)
+    {
+        msgpack_put_int(sb, *x.getVal());
+    }
+    void operator()(const Config::ConfUint &x)
+    {
+        msgpack_put_uint(sb, *x.getVal());
+    }
+    void operator()(const Config::ConfBool &x)
+    {
+        sb->putc(static_cast<char>(*x.getVal() ? 0xC3 : 0xC2));
+    }
+    void operator()(const Config::ConfVariant::Empty &x)
+    {
+        sb->putc(static_cast<char>(0xC0));
+    }
+    void operator()(const Config::ConfArray &x)
+    {
+        const auto *val = x.getVal();
+        const auto size = val->size();
+
+        msgpack_put_header(sb, 0x90, 15, 0xDC, size);
+
+        for (size_t i = 0; i < size; ++i) {
+            Config::apply_visitor(to_msgpack{sb, keys_to_censor, keys_to_censor_len}, (*val)[i].value);
+        }
+    }
+    void operator()(const Config::ConfObject &x)
+    {
+        const auto *slot = x.getSlot();
+        const auto *schema = slot->schema;
+        const auto size = schema->length;
+
+        msgpack_put_header(sb, 0x80, 15, 0xDE, size);
+
+        for (size_t i = 0; i < size; ++i) {
+            const auto &key = schema->keys[i];
+            const Config &child = slot->values[i];
+
+            msgpack_put_str(sb, key.val, key.length);
+
+            bool censored = false;
+            for (size_t ktc = 0; ktc < keys_to_censor_len; ++ktc) {
+                // Same check as in to_json: Both keys point to _rodata.
+                if (key.val != keys_to_censor[ktc])
+                    continue;
+
+                censored = !(child.is<Config::ConfString>() && child.asString().length() == 0);
+                break;
+            }
+
+            if (censored) {
+                sb->putc(static_cast<char>(0xC0));
+                continue;
+            }
+
+            Config::apply_visitor(to_msgpack{sb, keys_to_censor, keys_to_censor_len}, child.value);
+        }
+    }
+    void operator()(const Config::ConfUnion &x)
+    {
+        sb->putc(static_cast<char>(0x92)); // [tag, value]
+        msgpack_put_uint(sb, x.getSlot()->tag);
+        Config::apply_visitor(to_msgpack{sb, keys_to_censor, keys_to_censor_len}, x.getVal()->value);
+    }
+
+    StringBuilder *sb;
+    const char *const *keys_to_censor;
+    size_t keys_to_censor_len;
+};
+
 static const uint8_t leading_zeros_to_char_count[33] = {10,10,10,9,9,9,8,8,8,7,7,7,7,6,6,6,5,5,5,4,4,4,4,3,3,3,2,2,2,1,1,1,1};
 
 // Never underestimates length. Overestimates by 0.12 chars on average.
@@ -396,6 +480,65 @@ struct string_length_visitor {
     }
 };
 
+// Exact length of the to_msgpack output without censored keys.
+// Censoring only makes the output shorter.
+struct msgpack_length_visitor {
+    size_t operator()(const Config::ConfString &x)
+    {
+        return msgpack_str_length(x.getVal()->length());
+    }
+    size_t operator()(const Config::ConfFloat &x)
+    {
+        return msgpack_float_length();
+    }
+    size_t operator()(const Config::ConfInt &x)
+    {
+        return msgpack_int_length(*x.getVal());
+    }
+    size_t operator()(const Config::ConfUint &x)
+    {
+        return msgpack_uint_length(*x.getVal());
+    }
+    size_t operator()(const Config::ConfBool &x)
+    {
+        return 1;
+    }
+    size_t operator()(const Config::ConfVariant::Empty &x)
+    {
+        return 1;
+    }
+    size_t operator()(const Config::ConfArray &x)
+    {
+        const auto *val = x.getVal();
+        const auto size = val->size();
+
+        size_t sum = msgpack_header_length(15, size);
+        for (size_t i = 0; i < size; ++i) {
+            sum += Config::apply_visitor(msgpack_length_visitor{}, (*val)[i].value);
+        }
+
+        return sum;
+    }
+    size_t operator()(const Config::ConfObject &x)
+    {
+        const auto *slot = x.getSlot();
+        const auto *schema = slot->schema;
+        const auto size = schema->length;
+
+        size_t sum = msgpack_header_length(15, size);
+        for (size_t i = 0; i < size; ++i) {
+            sum += msgpack_str_length(schema->keys[i].length);
+            sum += Config::apply_visitor(msgpack_length_visitor{}, slot->values[i].value);
+        }
+        return sum;
+    }
+
+    size_t operator()(const Config::ConfUnion &x)
+    {
+        return Config::apply_visitor(msgpack_length_visitor{}, x.getVal()->value) + msgpack_uint_length(x.getTag()) + 1; // fixarray
+    }
+};
+
 struct json_length_visitor {
     size_t operator()(const Config::ConfString &x)
     {
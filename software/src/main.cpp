@@ -27,7 +27,7 @@
 #include "event_log_prefix.h"
 #include "main_dependencies.h"
 #include "modules.h"
-#include "index_html.embedded.h"
+#include "web_assets.embedded.h"
 #include "bindings/hal_common.h"
 #include "build.h"
 #include "tools.h"
@@ -83,16 +83,49 @@ static bool is_safari(const String &user_agent) {
            user_agent.indexOf("Chromium/") == -1;
 }
 
-static WebServerRequestReturnProtect send_index_html(WebServerRequest &request) {
-    request.addResponseHeader("Content-Encoding", "gzip");
-    request.addResponseHeader("ETag", build_timestamp_hex_str());
+static WebServerRequestReturnProtect send_web_asset(WebServerRequest &request, const WebAsset *asset) {
+    bool brotli = asset->brotli_data != nullptr && accepts_content_coding(request.header("Accept-Encoding").c_str(), "br");
+
+    request.addResponseHeader("Content-Encoding", brotli ? "br" : "gzip");
+    request.addResponseHeader("Vary", "Accept-Encoding");
     request.addResponseHeader("X-Clacks-Overhead", "GNU Terry Pratchett");
 
-    if (request.header("If-None-Match") == build_timestamp_hex_str()) {
-        return request.send(304);
+    if (asset->immutable) {
+        // A new build that changes the asset changes its path, too.
+        request.addResponseHeader("Cache-Control", "public, max-age=31536000, immutable");
+    } else {
+        // Always revalidate, so that a firmware update is picked up with the paths of its assets.
+        // The ETag contains the encoding: A cache must not answer a request without br with a Brotli body it validated before.
+        char etag[32];
+        snprintf(etag, sizeof(etag), "%s-%s", build_timestamp_hex_str(), brotli ? "br" : "gzip");
+
+        request.addResponseHeader("Cache-Control", "no-cache");
+        request.addResponseHeader("ETag", etag);
+
+        if (request.header("If-None-Match") == etag) {
+            return request.send(304);
+        }
+    }
+
+    if (brotli) {
+        return request.send(200, asset->content_type, asset->brotli_data, static_cast<ssize_t>(asset->brotli_length));
+    }
+
+    return request.send(200, asset->content_type, asset->gzip_data, static_cast<ssize_t>(asset->gzip_length));
+}
+
+static WebServerRequestReturnProtect send_index_html(WebServerRequest &request) {
+    return send_web_asset(request, find_web_asset(web_assets, web_assets_count, "/"));
+}
+
+static WebServerRequestReturnProtect send_hashed_asset(WebServerRequest &request) {
+    const WebAsset *asset = find_web_asset(web_assets, web_assets_count, request.uriCStr());
+
+    if (asset == nullptr) {
+        return request.send(404);
     }
 
-    return request.send(200, "text/html; charset=utf-8", index_html_data, index_html_length);
+    return send_web_asset(request, asset);
 }
 
 #define PRE_REBOOT_MAX_DURATION (5 * 60 * 1000)
@@ -179,6 +212,10 @@ static void register_default_urls() {
         return send_index_html(request);
     });
 
+    server.on_HTTPThread("/assets/*", HTTP_GET, [](WebServerRequest request) {
+        return send_hashed_asset(request);
+    });
+
     api.addCommand("reboot", Config::Null(), {}, [](String &/*errmsg*/) {
         trigger_reboot("API", 1_s);
     }, true);
@@ -194,6 +231,9 @@ static void register_default_urls() {
     server.onNotAuthorized_HTTPThread([](WebServerRequest request) {
         if (request.uri() == "/") {
             return send_index_html(request);
+        } else if (strncmp(request.uriCStr(), "/assets/", 8) == 0) {
+            // The login page needs the scripts and styles, too.
+            return send_hashed_asset(request);
         } else if (request.uri() == "/login_state") {
             // Force Safari to send credentials proactively.
             // This still is broken for the ws:// handler,
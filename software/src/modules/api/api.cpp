@@ -33,6 +33,9 @@
 
 extern TF_HAL hal;
 
+// States with a shorter JSON representation are cheap enough to serialize from scratch.
+#define STATE_JSON_CACHE_MIN_LENGTH 512
+
 API::API()
 {
 }
@@ -117,7 +120,8 @@ void API::setup()
             // - there is no registration for this state index (MQTT)
             // we don't have to do anything.
             if (wsu == IAPIBackend::WantsStateUpdate::No) {
-                reg.config->clear_updated(0xFF);
+                // Only clear the backend flags, the JSON cache still has to see this update.
+                reg.config->clear_updated((1 << backend_count) - 1);
                 continue;
             }
 
@@ -125,7 +129,7 @@ void API::setup()
             // If no backend wants the state update as string
             // don't serialize the payload.
             if (wsu == IAPIBackend::WantsStateUpdate::AsString)
-                payload = reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len);
+                payload = serializeState(state_idx);
 
             uint8_t sent = 0;
 
@@ -198,6 +202,7 @@ void API::addCommand(const char * const path, ConfigRoot *config, std::initializ
     });
 
     auto commandIdx = commands.size() - 1;
+    path_index.add(path, path_len, APIPathKind::Command, commandIdx);
 
     for (auto *backend : this->backends) {
         backend->addCommand(commandIdx, commands[commandIdx]);
@@ -215,6 +220,11 @@ void API::addCommand(const String &path, ConfigRoot *config, std::initializer_li
 }
 
 void API::addState(const char * const path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor, std::initializer_list<const char *> keys_to_censor_in_debug_report, bool low_latency)
+{
+    this->addState(path, config, nullptr, keys_to_censor, keys_to_censor_in_debug_report, low_latency);
+}
+
+void API::addState(const char * const path, ConfigRoot *config, IRawState *raw_state, std::initializer_list<const char *> keys_to_censor, std::initializer_list<const char *> keys_to_censor_in_debug_report, bool low_latency)
 {
     size_t path_len = strlen(path);
 
@@ -274,6 +284,7 @@ void API::addState(const char * const path, ConfigRoot *config, std::initializer
         ktc,
         ktc_debug,
         config,
+        raw_state,
         path_len,
         ktc_size,
         ktc_debug_size,
@@ -281,6 +292,8 @@ void API::addState(const char * const path, ConfigRoot *config, std::initializer
     });
 
     auto stateIdx = states.size() - 1;
+    path_index.add(path, path_len, APIPathKind::State, stateIdx);
+    state_json_caches.emplace_back(nullptr);
 
     for (auto *backend : this->backends) {
         backend->addState(stateIdx, states[stateIdx]);
@@ -292,6 +305,54 @@ void API::addState(const String &path, ConfigRoot *config, std::initializer_list
     this->addState(strdup(path.c_str()), config, keys_to_censor, keys_to_censor_in_debug_report, low_latency);
 }
 
+void API::addRawState(const String &path, ConfigRoot *config, IRawState *raw_state, bool low_latency)
+{
+    this->addState(strdup(path.c_str()), config, raw_state, {}, {}, low_latency);
+}
+
+size_t StateRegistration::string_length() const
+{
+    return raw_state != nullptr ? raw_state->string_length() : config->string_length();
+}
+
+void StateRegistration::to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const
+{
+    if (raw_state != nullptr) {
+        raw_state->to_json(sb);
+    } else {
+        config->to_string_except(keys_to_censor, keys_to_censor_len, sb);
+    }
+}
+
+String StateRegistration::to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len) const
+{
+    if (raw_state == nullptr) {
+        return config->to_string_except(keys_to_censor, keys_to_censor_len);
+    }
+
+    StringBuilder sb;
+    if (!sb.setCapacity(raw_state->string_length())) {
+        return "";
+    }
+
+    raw_state->to_json(&sb);
+    return String(sb.getPtr());
+}
+
+size_t StateRegistration::msgpack_length() const
+{
+    return raw_state != nullptr ? raw_state->msgpack_length() : config->msgpack_length();
+}
+
+void StateRegistration::to_msgpack_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const
+{
+    if (raw_state != nullptr) {
+        raw_state->to_msgpack(sb);
+    } else {
+        config->to_msgpack_except(keys_to_censor, keys_to_censor_len, sb);
+    }
+}
+
 bool API::addPersistentConfig(const String &path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor)
 {
     if (path.length() > 63) {
@@ -404,6 +465,7 @@ void API::addResponse(const char * const path, ConfigRoot *config, std::initiali
         (uint8_t)ktc_size
     });
     auto responseIdx = responses.size() - 1;
+    path_index.add(path, path_len, APIPathKind::Response, responseIdx);
 
     for (auto *backend : this->backends) {
         backend->addResponse(responseIdx, responses[responseIdx]);
@@ -701,13 +763,42 @@ void API::register_urls()
             result += buf;
         }
 
+        result += "]";
+        result += ",\n \"state_json_caches\": [";
+
+        // Compare the cache with serializing the whole state like a state without cache.
+        bool first_cache = true;
+        for (size_t state_idx = 0; state_idx < states.size(); ++state_idx) {
+            const ConfigJsonCache *cache = state_json_caches[state_idx].get();
+            if (cache == nullptr || cache->serializations == 0)
+                continue;
+
+            const StateRegistration &reg = states[state_idx];
+
+            micros_t start = now_us();
+            String full = reg.to_string_except(reg.keys_to_censor, reg.keys_to_censor_len);
+            uint32_t full_us = static_cast<uint32_t>(static_cast<int64_t>(now_us() - start));
+
+            char buf[256];
+            snprintf(buf, sizeof(buf), "%c{\"path\": \"%s\", \"length\": %u, \"serializations\": %u, \"copied_percent\": %u, \"cached_us_avg\": %u, \"full_us\": %u}",
+                     first_cache ? ' ' : ',',
+                     reg.path,
+                     full.length(),
+                     cache->serializations,
+                     static_cast<uint32_t>(cache->copied_bytes * 100 / cache->total_bytes),
+                     static_cast<uint32_t>(cache->total_time_us / cache->serializations),
+                     full_us);
+            result += buf;
+            first_cache = false;
+        }
+
         result += "]";
 
         for (auto &reg : states) {
             result += ",\n \"";
             result += reg.path;
             result += "\": ";
-            result += reg.config->to_string_except(reg.keys_to_censor_in_debug_report, reg.keys_to_censor_in_debug_report_len);
+            result += reg.to_string_except(reg.keys_to_censor_in_debug_report, reg.keys_to_censor_in_debug_report_len);
         }
 
         for (auto &reg : commands) {
@@ -737,12 +828,43 @@ size_t API::registerBackend(IAPIBackend *backend)
 {
     size_t backendIdx = backends.size();
 
+    if ((1 << backendIdx) >= CONFIG_UPDATED_JSON_CACHE_FLAG) {
+        esp_system_abort("Too many API backends: No free updated flag left.");
+    }
+
     backends.push_back(backend);
 
     return backendIdx;
 }
 
-String API::callCommand(CommandRegistration &reg, char *payload, size_t len)
+String API::serializeState(size_t stateIdx)
+{
+    auto &reg = states[stateIdx];
+    auto &cache = state_json_caches[stateIdx];
+
+    if (cache != nullptr) {
+        micros_t start = now_us();
+        String payload = cache->to_string_except(reg.config, reg.keys_to_censor, reg.keys_to_censor_len);
+        cache->total_time_us += static_cast<uint64_t>(static_cast<int64_t>(now_us() - start));
+        return payload;
+    }
+
+    String payload = reg.to_string_except(reg.keys_to_censor, reg.keys_to_censor_len);
+
+    if (reg.raw_state != nullptr) {
+        return payload;
+    }
+
+    // Large states often change only a few values per update.
+    // From now on only serialize the changed parts of them.
+    if (payload.length() >= STATE_JSON_CACHE_MIN_LENGTH) {
+        cache.reset(new ConfigJsonCache());
+    }
+
+    return payload;
+}
+
+String API::callCommand(CommandRegistration &reg, char *payload, size_t len, APIPayloadEncoding encoding)
 {
     if (running_in_main_task()) {
         return "Use ConfUpdate overload of callCommand in main thread!";
@@ -751,14 +873,18 @@ String API::callCommand(CommandRegistration &reg, char *payload, size_t len)
     String result;
 
     auto await_result = task_scheduler.await(
-        [&result, reg, payload, len]() mutable {
+        [&result, reg, payload, len, encoding]() mutable {
             if (payload == nullptr && !reg.config->is_null()) {
                 result = "empty payload only allowed for null configs";
                 return;
             }
 
             if (payload != nullptr) {
-                result = reg.config->update_from_cstr(payload, len);
+                if (encoding == APIPayloadEncoding::MessagePack)
+                    result = reg.config->update_from_msgpack(payload, len);
+                else
+                    result = reg.config->update_from_cstr(payload, len);
+
                 if (!result.isEmpty())
                     return;
             }
@@ -823,31 +949,13 @@ String API::callCommand(const char *path, Config::ConfUpdate payload)
         return "Use char *, size_t overload of callCommand in non-main thread!";
     }
 
-    CommandRegistration *reg = nullptr;
+    APIPathLookup lookup = lookupPath(path, strlen(path));
 
-    // If the called path is in rodata, try a quick address check first.
-    if (string_is_in_rodata(path)) {
-        for (CommandRegistration &chk_reg : commands) {
-            if (chk_reg.path == path) { // Address comparison
-                reg = &chk_reg;
-                break;
-            }
-        }
+    if (lookup.kind != APIPathKind::Command) {
+        return StringSumHelper("Unknown command: ") + path;
     }
 
-    // If the address check didn't find a match, try string comparison instead.
-    if (!reg) {
-        for (CommandRegistration &chk_reg : commands) {
-            if (strcmp(chk_reg.path, path) == 0) {
-                reg = &chk_reg;
-                break;
-            }
-        }
-
-        if (!reg) {
-            return StringSumHelper("Unknown command: ") + path;
-        }
-    }
+    CommandRegistration *reg = &commands[lookup.idx];
 
     String error = reg->config->update(&payload);
 
@@ -866,25 +974,14 @@ const Config *API::getState(const char *path, bool log_if_not_found, size_t path
         return nullptr;
     }
 
-    // If the requested path is in rodata, try a quick address check first.
-    if (string_is_in_rodata(path)) {
-        for (const auto &reg : states) {
-            if (path == reg.path) { // Address check
-                return reg.config;
-            }
-        }
-    }
-
     if (!path_len) {
         path_len = strlen(path);
     }
 
-    for (const auto &reg : states) {
-        if (path_len != reg.path_len || strcmp(path, reg.path) != 0) {
-            continue;
-        }
+    APIPathLookup lookup = lookupPath(path, path_len);
 
-        return reg.config;
+    if (lookup.kind == APIPathKind::State) {
+        return states[lookup.idx].config;
     }
 
     if (log_if_not_found) {
@@ -916,24 +1013,52 @@ void API::addFeature(const char *name)
 
 bool API::already_registered(const char *path, size_t path_len, const char *api_type)
 {
-    for (auto &reg : this->states) {
-        if (path_len != reg.path_len || memcmp(path, reg.path, path_len) != 0)
-            continue;
-        logger.printfln("Can't register %s %s. Already registered as state!", api_type, path);
-        return true;
-    }
-    for (auto &reg : this->commands) {
-        if (path_len != reg.path_len || memcmp(path, reg.path, path_len) != 0)
-            continue;
-        logger.printfln("Can't register %s %s. Already registered as command!", api_type, path);
-        return true;
-    }
-    for (auto &reg : this->responses) {
-        if (path_len != reg.path_len || memcmp(path, reg.path, path_len) != 0)
-            continue;
-        logger.printfln("Can't register %s %s. Already registered as response!", api_type, path);
-        return true;
+    switch (lookupPath(path, path_len).kind) {
+        case APIPathKind::None:
+            return false;
+        case APIPathKind::State:
+            logger.printfln("Can't register %s %s. Already registered as state!", api_type, path);
+            return true;
+        case APIPathKind::Command:
+            logger.printfln("Can't register %s %s. Already registered as command!", api_type, path);
+            return true;
+        case APIPathKind::Response:
+            logger.printfln("Can't register %s %s. Already registered as response!", api_type, path);
+            return true;
     }
 
     return false;
 }
+
+bool API::pathMatches(APIPathKind kind, size_t idx, const char *path, size_t path_len) const
+{
+    const char *reg_path;
+    size_t reg_path_len;
+
+    switch (kind) {
+        case APIPathKind::State:
+            reg_path     = states[idx].path;
+            reg_path_len = states[idx].path_len;
+            break;
+        case APIPathKind::Command:
+            reg_path     = commands[idx].path;
+            reg_path_len = commands[idx].path_len;
+            break;
+        case APIPathKind::Response:
+            reg_path     = responses[idx].path;
+            reg_path_len = responses[idx].path_len;
+            break;
+        case APIPathKind::None:
+        default:
+            return false;
+    }
+
+    return reg_path_len == path_len && memcmp(reg_path, path, path_len) == 0;
+}
+
+APIPathLookup API::lookupPath(const char *path, size_t path_len) const
+{
+    return path_index.find(path, path_len, [this, path, path_len](APIPathKind kind, size_t idx) {
+        return pathMatches(kind, idx, path, path_len);
+    });
+}
@@ -27,20 +27,48 @@
 #include "module.h"
 #include "config.h"
 #include "chunked_response.h"
+#include "config/json_cache.h"
+#include "api_path_index.h"
 #include "tools.h"
 #include "modules/web_server/web_server.h"
 
+// A state that its owner serializes from its own data instead of from a Config tree,
+// for example the values of a meter, which are kept in a float array.
+// The config of its registration holds no values. It only carries the updated flags:
+// Call set_updated(0xFF) on it after the data changed.
+class IRawState
+{
+public:
+    virtual ~IRawState() {}
+
+    // Never underestimates the JSON length.
+    virtual size_t string_length() const = 0;
+    virtual void to_json(StringBuilder *sb) const = 0;
+
+    virtual size_t msgpack_length() const = 0;
+    virtual void to_msgpack(StringBuilder *sb) const = 0;
+};
+
 // Will be stored in IRAM -> use 32 bit integers even if a bool would be sufficient
 struct StateRegistration {
     const char *const path;
     const char *const *const keys_to_censor;
     const char *const *const keys_to_censor_in_debug_report;
     ConfigRoot *const config;
+    IRawState *const raw_state; // nullptr if the state is serialized from config.
 
     const size_t path_len;
     const size_t keys_to_censor_len;
     const size_t keys_to_censor_in_debug_report_len;
     const uint32_t low_latency;
+
+    // Use these instead of the config's functions to support raw states.
+    // Raw states contain no keys to censor.
+    size_t string_length() const;
+    void to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const;
+    String to_string_except(const char *const *keys_to_censor, size_t keys_to_censor_len) const;
+    size_t msgpack_length() const;
+    void to_msgpack_except(const char *const *keys_to_censor, size_t keys_to_censor_len, StringBuilder *sb) const;
 };
 
 // Will be stored in IRAM -> use 32 bit integers even if a bool would be sufficient
@@ -65,6 +93,13 @@ struct ResponseRegistration {
     const size_t keys_to_censor_in_debug_report_len;
 };
 
+// Only the HTTP backend negotiates the encoding. MQTT and WebSocket clients
+// always get JSON: Their consumers would need an opt-in first.
+enum class APIPayloadEncoding {
+    JSON,
+    MessagePack
+};
+
 class IAPIBackend
 {
 public:
@@ -91,7 +126,7 @@ public:
     void register_urls() override;
 
     // Call this method only if you are a IAPIBackend and run in another FreeRTOS task!
-    String callCommand(CommandRegistration &reg, char *payload, size_t len);
+    String callCommand(CommandRegistration &reg, char *payload, size_t len, APIPayloadEncoding encoding = APIPayloadEncoding::JSON);
 
     // Call this method only if you are a IAPIBackend and run in another FreeRTOS task!
     void callCommandNonBlocking(CommandRegistration &reg, char *payload, size_t len, const std::function<void(const String &errmsg)> &done_cb);
@@ -103,6 +138,10 @@ public:
     const Config *getState(const char *path, bool log_if_not_found = true, size_t path_len = 0);
     const Config *getState(const String &path, bool log_if_not_found = true);
 
+    // Resolves a registered state, command or response path to its index in the
+    // corresponding registration vector. Returns APIPathKind::None if the path is unknown.
+    APIPathLookup lookupPath(const char *path, size_t path_len) const;
+
     void addFeature(const char *name);
 
     // Prefer this version of addCommand over the one below.
@@ -111,6 +150,8 @@ public:
 
     void addState(const char * const path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor = {}, std::initializer_list<const char *> keys_to_censor_in_debug_report = {}, bool low_latency = false);
     void addState(const String &path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor = {}, std::initializer_list<const char *> keys_to_censor_in_debug_report = {}, bool low_latency = false);
+    // config only carries the updated flags, see IRawState.
+    void addRawState(const String &path, ConfigRoot *config, IRawState *raw_state, bool low_latency = false);
 
     bool addPersistentConfig(const String &path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor = {});
     void addResponse(const char * const path, ConfigRoot *config, std::initializer_list<const char *> keys_to_censor_in_debug_report, std::function<void(IChunkedResponse *, Ownership *, uint32_t)> &&callback);
@@ -145,10 +186,20 @@ public:
     uint8_t state_update_counter = 0;
 
 private:
+    String serializeState(size_t stateIdx);
+
+    void addState(const char * const path, ConfigRoot *config, IRawState *raw_state, std::initializer_list<const char *> keys_to_censor, std::initializer_list<const char *> keys_to_censor_in_debug_report, bool low_latency);
+
     bool already_registered(const char *path, size_t path_len, const char *api_type);
+    bool pathMatches(APIPathKind kind, size_t idx, const char *path, size_t path_len) const;
 
     void executeCommand(const CommandRegistration &reg, Config::ConfUpdate payload);
 
     Config features_prototype;
     Config modified_prototype;
+
+    APIPathIndex<IRAMAlloc> path_index;
+
+    // Parallel to states. Only large states get a cache, the others are serialized from scratch.
+    std::vector<std::unique_ptr<ConfigJsonCache>> state_json_caches;
 };
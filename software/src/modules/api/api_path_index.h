@@ -0,0 +1,130 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+enum class APIPathKind : uint32_t {
+    None,
+    State,
+    Command,
+    Response
+};
+
+struct APIPathLookup {
+    APIPathKind kind;
+    size_t idx;
+};
+
+// FNV-1a
+static inline uint32_t hash_api_path(const char *path, size_t path_len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < path_len; ++i) {
+        hash ^= static_cast<uint8_t>(path[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Open addressing hash table over all registered paths. Capacity is always a power of two
+// and kept at most half full so that probe sequences stay short.
+// Only stores the hashes: The paths stay in the registration vectors.
+template<template<class> class Alloc = std::allocator>
+class APIPathIndex
+{
+public:
+    void add(const char *path, size_t path_len, APIPathKind kind, size_t idx)
+    {
+        if ((used + 1) * 2 > entries.size()) {
+            grow();
+        }
+
+        insert({hash_api_path(path, path_len), kind, static_cast<uint32_t>(idx)});
+        ++used;
+    }
+
+    // Calls is_match(kind, idx) for each registration with the same path hash, because hashes can collide.
+    template<typename F>
+    APIPathLookup find(const char *path, size_t path_len, F &&is_match) const
+    {
+        if (path == nullptr || entries.empty()) {
+            return {APIPathKind::None, 0};
+        }
+
+        uint32_t hash = hash_api_path(path, path_len);
+        size_t mask = entries.size() - 1;
+
+        // The table is never more than half full, so the probe sequence always reaches an empty slot.
+        for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+            const Entry &entry = entries[slot];
+
+            if (entry.kind == APIPathKind::None) {
+                return {APIPathKind::None, 0};
+            }
+
+            if (entry.hash == hash && is_match(entry.kind, entry.idx)) {
+                return {entry.kind, entry.idx};
+            }
+        }
+    }
+
+    size_t size() const { return used; }
+
+private:
+    // Will be stored in IRAM -> use 32 bit integers
+    struct Entry {
+        uint32_t hash;
+        APIPathKind kind;
+        uint32_t idx;
+    };
+
+    void insert(const Entry &entry)
+    {
+        size_t mask = entries.size() - 1;
+        size_t slot = entry.hash & mask;
+
+        while (entries[slot].kind != APIPathKind::None) {
+            slot = (slot + 1) & mask;
+        }
+
+        entries[slot] = entry;
+    }
+
+    void grow()
+    {
+        std::vector<Entry, Alloc<Entry>> old_entries(entries.empty() ? 64 : entries.size() * 2, Entry{0, APIPathKind::None, 0});
+        entries.swap(old_entries);
+
+        for (const Entry &entry : old_entries) {
+            if (entry.kind != APIPathKind::None) {
+                insert(entry);
+            }
+        }
+    }
+
+    std::vector<Entry, Alloc<Entry>> entries;
+    size_t used = 0;
+};
@@ -71,7 +71,7 @@ void Automation::pre_setup()
             {"tasks", Config::Array(
                 {},
                 &config_tasks_prototype,
-                0, 14, Config::type_id<Config::ConfObject>())
+                0, AUTOMATION_MAX_TASKS, Config::type_id<Config::ConfObject>())
             }
         }),
         [this](const Config &cfg, ConfigSource source) -> String {
@@ -140,6 +140,7 @@ void Automation::setup()
     api.restorePersistentConfig("automation/config", &config);
 
     config_in_use = config;
+    build_rule_index();
 
     if (has_task_with_trigger(AutomationTriggerID::Cron)) {
         task_scheduler.scheduleWithFixedDelay([this]() {
@@ -238,97 +239,3 @@ void Automation::set_enabled(AutomationTriggerID id, bool enable)
         enabled_triggers->add()->updateEnum(id);
     }
 }
-
-bool Automation::trigger(AutomationTriggerID number, void *data, IAutomationBackend *backend)
-{
-    if (config_in_use.is_null()) {
-        logger.printfln("Received trigger '%s' (%u) before loading config. Event lost.", get_automation_trigger_id_name(number), static_cast<uint32_t>(number));
-        return false;
-    }
-    bool triggered = false;
-    int current_rule = 1;
-    for (Config &conf : config_in_use.get("tasks")) {
-        Config *trigger = static_cast<Config *>(conf.get("trigger"));
-        if (trigger->getTag<AutomationTriggerID>() == number && backend->has_triggered(trigger, data)) {
-            triggered = true;
-            logger.printfln("Running rule #%d", current_rule);
-            const Config *action = static_cast<const Config *>(conf.get("action"));
-            AutomationActionID action_ident = action->getTag<AutomationActionID>();
-            if (action_ident != AutomationActionID::None && action_map.find(action_ident) != action_map.end()) {
-                action_map[action_ident].callback(static_cast<const Config *>(action->get()));
-            } else {
-                logger.printfln("There is no action with ID %u!", (uint8_t)action_ident);
-            }
-        }
-        current_rule++;
-    }
-    return triggered;
-}
-
-bool Automation::has_task_with_trigger(AutomationTriggerID number)
-{
-    for (const Config &conf : config_in_use.get("tasks")) {
-        if (conf.get("trigger")->getTag<AutomationTriggerID>() == number) {
-            return true;
-        }
-    }
-    return false;
-}
-
-Automation::ConfigVec Automation::get_configured_triggers(AutomationTriggerID number)
-{
-    ConfigVec vec;
-    Config *tasks = static_cast<Config *>(config_in_use.get("tasks"));
-    size_t task_count = tasks->count();
-    for (size_t idx = 0; idx < task_count; idx++) {
-        auto trigger = tasks->get(idx)->get("trigger");
-        if (trigger->getTag<AutomationTriggerID>() == number) {
-            vec.push_back({idx, static_cast<Config *>(trigger->get())});
-        }
-    }
-    return vec;
-}
-
-static bool is_last_day(struct tm time)
-{
-    const int mon = time.tm_mon;
-    time_t next_day = mktime(&time) + 86400;
-    time = *localtime(&next_day);
-    return time.tm_mon != mon;
-}
-
-bool Automation::has_triggered(const Config *conf, void *data)
-{
-    const Config *cfg = static_cast<const Config *>(conf->get());
-    tm *time_struct = (tm *)data;
-    bool triggered = false;
-
-    int32_t wday = cfg->get("wday")->asInt();
-    if (wday == -1) {
-        int32_t mday = cfg->get("mday")->asInt();
-        triggered |= mday == time_struct->tm_mday || mday == -1 || mday == 0;
-        triggered |= mday == 32 && is_last_day(*time_struct);
-    } else if (wday > 7) {
-        triggered |= wday == 8 && time_struct->tm_wday > 0 && time_struct->tm_wday < 6;
-        triggered |= wday == 9 && (time_struct->tm_wday == 0 || time_struct->tm_wday >= 6);
-    } else {
-        triggered |= (wday % 7) == time_struct->tm_wday;
-    }
-
-    int32_t hour = cfg->get("hour")->asInt();
-    triggered = (hour == time_struct->tm_hour || hour == -1) && triggered;
-    int32_t minute = cfg->get("minute")->asInt();
-    triggered = (minute == time_struct->tm_min || minute == -1) && triggered;
-
-    switch (conf->getTag<AutomationTriggerID>()) {
-        case AutomationTriggerID::Cron:
-            if (triggered) {
-                return true;
-            }
-            break;
-
-        default:
-            return false;
-    }
-    return false;
-}
@@ -27,6 +27,9 @@
 #include "automation_trigger_id.enum.h"
 #include "automation_action_id.enum.h"
 #include "automation_backend.h"
+#include "cron_matcher.h"
+
+#define AUTOMATION_MAX_TASKS 14
 
 class Automation : public IModule, public IAutomationBackend
 {
@@ -64,9 +67,20 @@ public:
     bool trigger(AutomationTriggerID number, void *data, IAutomationBackend *backend);
     bool has_task_with_trigger(AutomationTriggerID number);
     bool has_triggered(const Config *conf, void *data) override;
+    bool has_rule_triggered(size_t rule_idx, const Config *conf, void *data) override;
     ConfigVec get_configured_triggers(AutomationTriggerID number);
 
 private:
+    struct Rule {
+        Config *trigger;
+        const Config *action;
+        const ActionCb *callback;
+        AutomationActionID action_id;
+        uint16_t task_idx;
+    };
+
+    void build_rule_index();
+
     Config config_tasks_prototype;
     ConfigRoot config;
     ConfigRoot config_in_use;
@@ -76,4 +90,8 @@ private:
     TriggerMap  trigger_map;
     std::vector<ConfUnionPrototype<AutomationTriggerID>>    trigger_prototypes;
     std::vector<ConfUnionPrototype<AutomationActionID>>     action_prototypes;
+
+    // Tasks of config_in_use grouped by trigger ID, in task order.
+    std::vector<Rule> rules[AUTOMATION_TRIGGER_ID_COUNT];
+    std::vector<CronMatcher> cron_matchers;
 };
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <stddef.h>
+
 class Config;
 
 class IAutomationBackend
@@ -27,4 +29,12 @@ public:
     virtual ~IAutomationBackend() = default;
 
     virtual bool has_triggered(const Config *conf, void *data) = 0;
+
+    // rule_idx is the rule's position in Automation::get_configured_triggers() for the trigger's ID.
+    // Backends that precompile their trigger configs override this to skip the config lookups.
+    virtual bool has_rule_triggered(size_t rule_idx, const Config *conf, void *data)
+    {
+        (void)rule_idx;
+        return has_triggered(conf, data);
+    }
 };
@@ -0,0 +1,131 @@
+/* esp32-firmware
+ * Copyright (C) 2023 Frederic Henrichs <frederic@tinkerforge.com>
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "automation.h"
+
+#include "event_log_prefix.h"
+#include "module_dependencies.h"
+
+void Automation::build_rule_index()
+{
+    Config *tasks = static_cast<Config *>(config_in_use.get("tasks"));
+    size_t task_count = tasks->count();
+
+    for (size_t idx = 0; idx < task_count; idx++) {
+        auto task = tasks->get(idx);
+        Config *trigger = static_cast<Config *>(task->get("trigger"));
+        const Config *action = static_cast<const Config *>(task->get("action"));
+        size_t trigger_id = static_cast<size_t>(trigger->getTag<AutomationTriggerID>());
+        AutomationActionID action_id = action->getTag<AutomationActionID>();
+
+        if (trigger_id >= AUTOMATION_TRIGGER_ID_COUNT) {
+            continue;
+        }
+
+        const ActionCb *callback = nullptr;
+        auto action_it = action_map.find(action_id);
+        if (action_id != AutomationActionID::None && action_it != action_map.end()) {
+            callback = &action_it->second.callback;
+        }
+
+        rules[trigger_id].push_back({trigger, static_cast<const Config *>(action->get()), callback, action_id, static_cast<uint16_t>(idx)});
+    }
+
+    for (const Rule &rule : rules[static_cast<size_t>(AutomationTriggerID::Cron)]) {
+        const Config *cfg = static_cast<const Config *>(rule.trigger->get());
+        cron_matchers.push_back(CronMatcher::compile(cfg->get("mday")->asInt(), cfg->get("wday")->asInt(), cfg->get("hour")->asInt(), cfg->get("minute")->asInt()));
+    }
+}
+
+bool Automation::trigger(AutomationTriggerID number, void *data, IAutomationBackend *backend)
+{
+    if (config_in_use.is_null()) {
+        logger.printfln("Received trigger '%s' (%u) before loading config. Event lost.", get_automation_trigger_id_name(number), static_cast<uint32_t>(number));
+        return false;
+    }
+
+    if (static_cast<size_t>(number) >= AUTOMATION_TRIGGER_ID_COUNT) {
+        return false;
+    }
+
+    const std::vector<Rule> &trigger_rules = rules[static_cast<size_t>(number)];
+    size_t rule_count = trigger_rules.size();
+    bool triggered = false;
+
+    for (size_t rule_idx = 0; rule_idx < rule_count; rule_idx++) {
+        const Rule &rule = trigger_rules[rule_idx];
+        if (!backend->has_rule_triggered(rule_idx, rule.trigger, data)) {
+            continue;
+        }
+
+        triggered = true;
+        logger.printfln("Running rule #%u", rule.task_idx + 1u);
+        if (rule.callback != nullptr) {
+            (*rule.callback)(rule.action);
+        } else {
+            logger.printfln("There is no action with ID %u!", static_cast<uint8_t>(rule.action_id));
+        }
+    }
+    return triggered;
+}
+
+bool Automation::has_task_with_trigger(AutomationTriggerID number)
+{
+    if (static_cast<size_t>(number) >= AUTOMATION_TRIGGER_ID_COUNT) {
+        return false;
+    }
+
+    return !rules[static_cast<size_t>(number)].empty();
+}
+
+Automation::ConfigVec Automation::get_configured_triggers(AutomationTriggerID number)
+{
+    ConfigVec vec;
+    if (static_cast<size_t>(number) >= AUTOMATION_TRIGGER_ID_COUNT) {
+        return vec;
+    }
+
+    const std::vector<Rule> &trigger_rules = rules[static_cast<size_t>(number)];
+    vec.reserve(trigger_rules.size());
+    for (const Rule &rule : trigger_rules) {
+        vec.push_back({rule.task_idx, static_cast<Config *>(rule.trigger->get())});
+    }
+    return vec;
+}
+
+bool Automation::has_triggered(const Config *conf, void *data)
+{
+    if (conf->getTag<AutomationTriggerID>() != AutomationTriggerID::Cron) {
+        return false;
+    }
+
+    const Config *cfg = static_cast<const Config *>(conf->get());
+    CronMatcher matcher = CronMatcher::compile(cfg->get("mday")->asInt(), cfg->get("wday")->asInt(), cfg->get("hour")->asInt(), cfg->get("minute")->asInt());
+    return matcher.matches(static_cast<const tm *>(data));
+}
+
+bool Automation::has_rule_triggered(size_t rule_idx, const Config *conf, void *data)
+{
+    if (conf->getTag<AutomationTriggerID>() != AutomationTriggerID::Cron || rule_idx >= cron_matchers.size()) {
+        return has_triggered(conf, data);
+    }
+
+    return cron_matchers[rule_idx].matches(static_cast<const tm *>(data));
+}
@@ -0,0 +1,76 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "cron_matcher.h"
+
+CronMatcher CronMatcher::compile(int32_t mday, int32_t wday, int32_t hour, int32_t minute)
+{
+    CronMatcher matcher = {};
+
+    if (wday == -1) {
+        if (mday == -1 || mday == 0) {
+            matcher.mdays = UINT32_MAX;
+        } else if (mday >= 1 && mday <= 31) {
+            matcher.mdays = 1u << mday;
+        } else if (mday == 32) {
+            matcher.last_mday = true;
+        }
+    } else if (wday == 8) {
+        matcher.wdays = 0x3E;
+    } else if (wday == 9) {
+        matcher.wdays = 0x41;
+    } else if (wday >= 0 && wday <= 7) {
+        matcher.wdays = static_cast<uint8_t>(1u << (wday % 7));
+    }
+
+    if (hour == -1) {
+        matcher.hours = (1u << 24) - 1;
+    } else if (hour >= 0 && hour <= 23) {
+        matcher.hours = 1u << hour;
+    }
+
+    if (minute == -1) {
+        matcher.minutes = (1ull << 60) - 1;
+    } else if (minute >= 0 && minute <= 59) {
+        matcher.minutes = 1ull << minute;
+    }
+
+    return matcher;
+}
+
+static bool is_last_day(tm time)
+{
+    const int mon = time.tm_mon;
+    time_t next_day = mktime(&time) + 86400;
+    localtime_r(&next_day, &time);
+    return time.tm_mon != mon;
+}
+
+bool CronMatcher::matches(const tm *time) const
+{
+    if ((minutes >> time->tm_min & 1) == 0 || (hours >> time->tm_hour & 1) == 0) {
+        return false;
+    }
+
+    if ((mdays >> time->tm_mday & 1) != 0 || (wdays >> time->tm_wday & 1) != 0) {
+        return true;
+    }
+
+    return last_mday && is_last_day(*time);
+}
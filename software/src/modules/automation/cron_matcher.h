@@ -0,0 +1,40 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// A cron trigger's day, hour and minute settings as bitsets, so that the
+// once-a-minute check is a few shifts instead of reading the trigger config.
+struct CronMatcher {
+    uint64_t minutes; // Bit n set: Matches tm_min == n.
+    uint32_t hours;   // Bit n set: Matches tm_hour == n.
+    uint32_t mdays;   // Bit n set: Matches tm_mday == n.
+    uint8_t wdays;    // Bit n set: Matches tm_wday == n.
+    bool last_mday;   // Matches the last day of the month.
+
+    // Same value ranges as the cron trigger config: -1 is any, mday 0 is any
+    // and 32 is the last day of the month, wday 0 and 7 are Sunday,
+    // 8 is Monday to Friday and 9 is Saturday and Sunday.
+    static CronMatcher compile(int32_t mday, int32_t wday, int32_t hour, int32_t minute);
+
+    bool matches(const tm *time) const;
+};
@@ -76,7 +76,7 @@ static PhaseRotation convert_phase_rotation(CMPhaseRotation pr) {
 
 void ChargeManager::pre_setup()
 {
-    this->trace_buffer_index = logger.alloc_trace_buffer("charge_manager", 1 << 20);
+    this->trace_buffer_index = logger.alloc_trace_buffer("charge_manager", 1 << 20, true);
 
     config_chargers_prototype = Config::Object({
         {"host", Config::Str("", 0, 64)},
@@ -258,6 +258,27 @@ void ChargeManager::pre_setup()
         )}
     });
 
+    // update_charger_state_config runs for every charger after each allocation. Don't search the keys each time.
+    state_keys.chargers = state.resolveKey("chargers");
+    state_keys.s  = state_chargers_prototype.resolveKey("s");
+    state_keys.e  = state_chargers_prototype.resolveKey("e");
+    state_keys.ac = state_chargers_prototype.resolveKey("ac");
+    state_keys.ap = state_chargers_prototype.resolveKey("ap");
+    state_keys.sc = state_chargers_prototype.resolveKey("sc");
+    state_keys.sp = state_chargers_prototype.resolveKey("sp");
+    state_keys.lu = state_chargers_prototype.resolveKey("lu");
+    state_keys.u  = state_chargers_prototype.resolveKey("u");
+
+    low_level_state_keys.chargers = low_level_state.resolveKey("chargers");
+    low_level_state_keys.b  = low_level_state_chargers_prototype.resolveKey("b");
+    low_level_state_keys.rc = low_level_state_chargers_prototype.resolveKey("rc");
+    low_level_state_keys.ae = low_level_state_chargers_prototype.resolveKey("ae");
+    low_level_state_keys.ar = low_level_state_chargers_prototype.resolveKey("ar");
+    low_level_state_keys.ls = low_level_state_chargers_prototype.resolveKey("ls");
+    low_level_state_keys.lp = low_level_state_chargers_prototype.resolveKey("lp");
+    low_level_state_keys.lw = low_level_state_chargers_prototype.resolveKey("lw");
+    low_level_state_keys.ip = low_level_state_chargers_prototype.resolveKey("ip");
+
     available_current = ConfigRoot{Config::Object({
         {"current", Config::Uint32(0)},
     }), [this](const Config &conf, ConfigSource source) -> String {
@@ -309,6 +330,11 @@ void ChargeManager::pre_setup()
 #endif
 }
 
+static bool send_command(size_t idx, const ChargerAllocationState &allocation)
+{
+    return cm_networking.send_manager_update(static_cast<uint8_t>(idx), allocation.allocated_current, allocation.cp_disconnect, allocation.allocated_phases);
+}
+
 void ChargeManager::start_manager_task()
 {
     auto charger_count = config.get("chargers")->count();
@@ -336,18 +362,15 @@ void ChargeManager::start_manager_task()
         //TODO: should we call update_charger_state_config(client_id); here? This is currently missing but smells weird.
     });
 
-    millis_t cm_send_delay = 1000_ms / millis_t{charger_count};
+    static_assert(MAX_CONTROLLED_CHARGERS <= CommandFanOut::MAX_CHARGERS, "CommandFanOut has one bit per charger");
 
-    task_scheduler.scheduleWithFixedDelay([this, charger_count]() mutable {
-        static int i = 0;
-
-        if (i >= charger_count)
-            i = 0;
-
-        auto &charger_alloc = this->charger_allocation_state[i];
-        if(cm_networking.send_manager_update(i, charger_alloc.allocated_current, charger_alloc.cp_disconnect, charger_alloc.allocated_phases))
-            ++i;
+    // Changed commands are sent right after the allocation.
+    // Resend the current command to each charger once per second to keep it managed
+    // and retry commands that could not be sent without waiting for the other chargers.
+    millis_t cm_send_delay = 1000_ms / millis_t{charger_count};
 
+    task_scheduler.scheduleWithFixedDelay([this]() {
+        command_fan_out.keep_alive(this->charger_allocation_state, send_command);
     }, cm_send_delay);
 }
 
@@ -414,6 +437,8 @@ void ChargeManager::setup()
     ca_config->charger_count = this->charger_count;
     this->charger_state = (ChargerState*) heap_caps_calloc_prefer(this->charger_count, sizeof(ChargerState), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
     this->charger_allocation_state = (ChargerAllocationState*) heap_caps_calloc_prefer(this->charger_count, sizeof(ChargerAllocationState), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    // Sends every charger its initial command.
+    command_fan_out.setup(this->charger_count, (CommandFanOut::SentCommand*) heap_caps_calloc_prefer(this->charger_count, sizeof(CommandFanOut::SentCommand), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
 
     for (size_t i = 0; i < config.get("chargers")->count(); ++i) {
         charger_state[i].phase_rotation = convert_phase_rotation(config.get("chargers")->get(i)->get("rot")->asEnum<CMPhaseRotation>());
@@ -480,6 +505,10 @@ void ChargeManager::setup()
             this->state.get("l_max_pv")->updateInt(tmp_limits.max_pv);
             this->low_level_state.get("last_hyst_reset")->updateUint(this->ca_state->last_hysteresis_reset.millis());
 
+            // Don't wait for the keep-alive rotation to reach chargers whose allocation changed.
+            command_fan_out.queue_changed(this->charger_allocation_state);
+            command_fan_out.send_pending(this->charger_allocation_state, send_command);
+
             for (int i = 0; i < this->charger_count; ++i) {
                 update_charger_state_config(i);
             }
@@ -646,26 +675,26 @@ void ChargeManager::register_urls()
 void ChargeManager::update_charger_state_config(uint8_t idx) {
     auto &charger = charger_state[idx];
     auto &charger_alloc = charger_allocation_state[idx];
-    auto *charger_cfg = (Config *)this->state.get("chargers")->get(idx);
-    auto *ll_charger_cfg = (Config *)this->low_level_state.get("chargers")->get(idx);
-    charger_cfg->get("s")->updateUint(charger_alloc.state);
-    charger_cfg->get("e")->updateUint(charger_alloc.error);
-    charger_cfg->get("ac")->updateUint(charger_alloc.allocated_current);
-    charger_cfg->get("ap")->updateUint(charger_alloc.allocated_phases);
-    charger_cfg->get("sc")->updateUint(charger.supported_current);
-    charger_cfg->get("sp")->updateUint((charger.phase_switch_supported ? 4 : 0) | (charger.phases));
-    charger_cfg->get("lu")->updateUint(charger.last_update);
-    charger_cfg->get("u")->updateUint(charger.uid);
+    auto *charger_cfg = (Config *)this->state.get(state_keys.chargers)->get(idx);
+    auto *ll_charger_cfg = (Config *)this->low_level_state.get(low_level_state_keys.chargers)->get(idx);
+    charger_cfg->get(state_keys.s )->updateUint(charger_alloc.state);
+    charger_cfg->get(state_keys.e )->updateUint(charger_alloc.error);
+    charger_cfg->get(state_keys.ac)->updateUint(charger_alloc.allocated_current);
+    charger_cfg->get(state_keys.ap)->updateUint(charger_alloc.allocated_phases);
+    charger_cfg->get(state_keys.sc)->updateUint(charger.supported_current);
+    charger_cfg->get(state_keys.sp)->updateUint((charger.phase_switch_supported ? 4 : 0) | (charger.phases));
+    charger_cfg->get(state_keys.lu)->updateUint(charger.last_update);
+    charger_cfg->get(state_keys.u )->updateUint(charger.uid);
 
     uint8_t bits = (charger.phases << 3) | (charger.phase_switch_supported << 2) | (charger.cp_disconnect_state << 1) | charger.cp_disconnect_supported;
-    ll_charger_cfg->get("b")->updateUint(bits);
-    ll_charger_cfg->get("rc")->updateUint(charger.requested_current);
-    ll_charger_cfg->get("ae")->updateUint(charger.allocated_energy * 1000);
-    ll_charger_cfg->get("ar")->updateUint(charger.allocated_energy_this_rotation * 1000);
-    ll_charger_cfg->get("ls")->updateUint(charger.last_switch_on.millis());
-    ll_charger_cfg->get("lp")->updateUint(charger.last_plug_in.millis());
-    ll_charger_cfg->get("lw")->updateUint(charger.last_wakeup.millis());
-    ll_charger_cfg->get("ip")->updateUint(charger.use_supported_current.millis());
+    ll_charger_cfg->get(low_level_state_keys.b )->updateUint(bits);
+    ll_charger_cfg->get(low_level_state_keys.rc)->updateUint(charger.requested_current);
+    ll_charger_cfg->get(low_level_state_keys.ae)->updateUint(charger.allocated_energy * 1000);
+    ll_charger_cfg->get(low_level_state_keys.ar)->updateUint(charger.allocated_energy_this_rotation * 1000);
+    ll_charger_cfg->get(low_level_state_keys.ls)->updateUint(charger.last_switch_on.millis());
+    ll_charger_cfg->get(low_level_state_keys.lp)->updateUint(charger.last_plug_in.millis());
+    ll_charger_cfg->get(low_level_state_keys.lw)->updateUint(charger.last_wakeup.millis());
+    ll_charger_cfg->get(low_level_state_keys.ip)->updateUint(charger.use_supported_current.millis());
 }
 
 uint32_t ChargeManager::get_maximum_available_current()
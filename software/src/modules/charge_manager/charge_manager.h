@@ -28,6 +28,7 @@
 #endif
 
 #include "current_limits.h"
+#include "command_fan_out.h"
 
 struct CurrentAllocatorConfig;
 struct CurrentAllocatorState;
@@ -99,6 +100,14 @@ private:
     Config state_chargers_prototype;
     Config low_level_state_chargers_prototype;
 
+    struct {
+        Config::Key chargers, s, e, ac, ap, sc, sp, lu, u;
+    } state_keys;
+
+    struct {
+        Config::Key chargers, b, rc, ae, ar, ls, lp, lw, ip;
+    } low_level_state_keys;
+
     CurrentLimits limits, limits_post_allocation;
     Cost allocated_currents;
 
@@ -112,6 +121,8 @@ private:
     uint16_t requested_current_margin;
 
     ChargerAllocationState *charger_allocation_state = nullptr;
+    CommandFanOut command_fan_out;
+
     CurrentAllocatorConfig *ca_config = nullptr;
     CurrentAllocatorState *ca_state = nullptr;
 };
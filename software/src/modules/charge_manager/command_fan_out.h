@@ -0,0 +1,121 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sends the commands of chargers whose allocation changed right away and
+// resends the current command to one charger per keep-alive tick.
+// A command that could not be sent stays pending and is retried on the next
+// tick without holding up the other chargers.
+// Allocation needs the members allocated_current, allocated_phases and cp_disconnect.
+// send(idx, allocation) returns false if the command should be retried.
+class CommandFanOut
+{
+public:
+    struct SentCommand {
+        uint16_t allocated_current;
+        int8_t allocated_phases;
+        bool cp_disconnect;
+    };
+
+    static constexpr size_t MAX_CHARGERS = 64;
+
+    // sent_commands_ must hold charger_count_ entries. Every charger is sent its initial command.
+    void setup(size_t charger_count_, SentCommand *sent_commands_)
+    {
+        charger_count = charger_count_;
+        sent_commands = sent_commands_;
+        pending = charger_count == MAX_CHARGERS ? UINT64_MAX : (1ull << charger_count) - 1;
+        next_keep_alive = 0;
+    }
+
+    // Marks the commands of chargers whose allocation differs from the last command that was sent.
+    template<typename Allocation>
+    void queue_changed(const Allocation *allocations)
+    {
+        for (size_t i = 0; i < charger_count; ++i) {
+            const auto &allocation = allocations[i];
+            const auto &sent = sent_commands[i];
+
+            if (allocation.allocated_current != sent.allocated_current
+             || allocation.allocated_phases  != sent.allocated_phases
+             || allocation.cp_disconnect     != sent.cp_disconnect) {
+                pending |= 1ull << i;
+            }
+        }
+    }
+
+    template<typename Allocation, typename Send>
+    void send_pending(const Allocation *allocations, Send &&send)
+    {
+        uint64_t to_send = pending;
+
+        while (to_send != 0) {
+            size_t idx = static_cast<size_t>(__builtin_ctzll(to_send));
+            to_send &= to_send - 1;
+
+            send_command(idx, allocations, send);
+        }
+    }
+
+    // Retries pending commands, then resends the command of the next charger in the rotation.
+    template<typename Allocation, typename Send>
+    void keep_alive(const Allocation *allocations, Send &&send)
+    {
+        send_pending(allocations, send);
+
+        if (charger_count == 0) {
+            return;
+        }
+
+        if (next_keep_alive >= charger_count) {
+            next_keep_alive = 0;
+        }
+
+        // A failed send leaves the command pending instead of stalling the rotation.
+        send_command(next_keep_alive, allocations, send);
+        ++next_keep_alive;
+    }
+
+private:
+    template<typename Allocation, typename Send>
+    void send_command(size_t idx, const Allocation *allocations, Send &send)
+    {
+        const auto &allocation = allocations[idx];
+        uint64_t bit = 1ull << idx;
+
+        if (!send(idx, allocation)) {
+            pending |= bit;
+            return;
+        }
+
+        sent_commands[idx] = {allocation.allocated_current, allocation.allocated_phases, allocation.cp_disconnect};
+        pending &= ~bit;
+    }
+
+    size_t charger_count = 0;
+    // Last command that was handed to the network stack, per charger.
+    SentCommand *sent_commands = nullptr;
+    // One bit per charger. Set if the charger's command changed or could not be sent.
+    uint64_t pending = 0;
+    size_t next_keep_alive = 0;
+};
@@ -159,25 +159,60 @@ int filter_chargers_impl(filter_fn filter_, int *idx_array, const int32_t *curre
     return matches;
 }
 
-// Sorts the indices of chargers by first grouping them with the group function and then comparing in groups with the sort function.
-void sort_chargers_impl(group_fn group, compare_fn compare, int *idx_array, const int32_t *current_allocation, const uint8_t *phase_allocation, const ChargerState *charger_state, size_t charger_count, CurrentLimits *limits, const CurrentAllocatorConfig *cfg) {
-    int groups[MAX_CONTROLLED_CHARGERS] = {};
+// Sorts the indices of chargers by their sort keys.
+// Each key is computed once per charger instead of in every comparison.
+void sort_chargers_impl(sort_key_fn sort_key, int *idx_array, const int32_t *current_allocation, const uint8_t *phase_allocation, const ChargerState *charger_state, size_t charger_count, const CurrentLimits *limits, const CurrentAllocatorConfig *cfg) {
+    SortKey keys[MAX_CONTROLLED_CHARGERS];
 
     for(int i = 0; i < charger_count; ++i)
-        groups[idx_array[i]] = group(current_allocation[idx_array[i]], phase_allocation[idx_array[i]], &charger_state[idx_array[i]], cfg);
-
-    std::stable_sort(
-        idx_array,
-        idx_array + charger_count,
-        [&groups, &compare, &current_allocation, &phase_allocation, &charger_state, &limits, &cfg] (int left, int right) {
-            if (groups[left] != groups[right])
-                return groups[left] < groups[right];
-
-            return compare({current_allocation[left], phase_allocation[left], &charger_state[left]},
-                           {current_allocation[right], phase_allocation[right], &charger_state[right]},
-                           limits, cfg);
+        keys[i] = sort_key(current_allocation[idx_array[i]], phase_allocation[idx_array[i]], &charger_state[idx_array[i]], limits, cfg, i);
+
+    // Insertion sort: There are at most MAX_CONTROLLED_CHARGERS entries.
+    for(int i = 1; i < charger_count; ++i) {
+        SortKey key = keys[i];
+        int idx = idx_array[i];
+
+        int j = i;
+        for (; j > 0; --j) {
+            const SortKey &prev = keys[j - 1];
+
+            if (prev.group != key.group) {
+                if (prev.group < key.group)
+                    break;
+            } else if (prev.key != key.key) {
+                if (prev.key < key.key)
+                    break;
+            } else if (prev.tie < key.tie) {
+                break;
+            }
+
+            keys[j] = prev;
+            idx_array[j] = idx_array[j - 1];
         }
-    );
+
+        keys[j] = key;
+        idx_array[j] = idx;
+    }
+}
+
+// Map values to sort keys that compare the same way as the values.
+static uint64_t sort_key_int(int64_t x) {
+    return static_cast<uint64_t>(x) ^ (1ull << 63);
+}
+
+static uint64_t sort_key_micros(micros_t t) {
+    return sort_key_int(static_cast<int64_t>(t));
+}
+
+static uint64_t sort_key_float(float f) {
+    // Adding +0.0 turns -0.0 into +0.0. Both compare equal.
+    f += 0.0f;
+
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    // Negative floats sort in reverse order of their bit patterns.
+    return (bits & (1u << 31)) != 0 ? ~bits : (bits | (1u << 31));
 }
 
 GridPhase get_phase(PhaseRotation rot, ChargerPhase phase) {
@@ -249,6 +284,8 @@ bool cost_exceeds_limits(Cost cost, const CurrentLimits* limits, int stage)
         }
         default:
             assert(false && "Unknown charge management stage!");
+            // Allocate nothing in an unknown stage.
+            return true;
     }
 }
 
@@ -379,9 +416,7 @@ void stage_2(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
     filter_chargers(was_just_plugged_in(state));
 
     // Charger that is plugged in for the longest time first.
-    sort_chargers(0,
-        left.state->last_plug_in < right.state->last_plug_in
-    );
+    sort_chargers(0, sort_key_micros(state->last_plug_in));
 
     trace_sort(2);
 
@@ -580,7 +615,7 @@ void stage_3(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
     // if phases are overloaded in every iteration.
     sort_chargers(
         was_just_plugged_in(state) ? 1 : 0,
-        was_just_plugged_in(left.state) ? (left.state->last_plug_in < right.state->last_plug_in) : (left.state->last_switch_on < right.state->last_switch_on)
+        sort_key_micros(was_just_plugged_in(state) ? state->last_plug_in : state->last_switch_on)
     );
 
     trace_sort(3);
@@ -877,9 +912,7 @@ void stage_4(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
     // A charger that was rotated has 0 allocated phases but is still charging.
     filter_chargers(allocated_phases == 0 && (state->wants_to_charge || state->is_charging));
 
-    sort_chargers(0,
-        left.state->allocated_energy < right.state->allocated_energy
-    );
+    sort_chargers(0, sort_key_float(state->allocated_energy));
 
     trace_sort(4);
 
@@ -974,9 +1007,7 @@ void stage_5(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
 
     filter_chargers(allocated_phases == 1 && state->phase_switch_supported && deadline_elapsed(state->last_phase_switch + _cfg->global_hysteresis));
 
-    sort_chargers(0,
-        left.state->allocated_energy < right.state->allocated_energy
-    );
+    sort_chargers(0, sort_key_float(state->allocated_energy));
 
     trace_sort(5);
 
@@ -1152,7 +1183,7 @@ void stage_7(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
 
     sort_chargers(
         3 - allocated_phases,
-        current_capacity(_limits, left.state, left.allocated_current, left.allocated_phases, _cfg) < current_capacity(_limits, right.state, right.allocated_current, right.allocated_phases, _cfg)
+        sort_key_int(current_capacity(_limits, state, allocated_current, allocated_phases, _cfg))
     );
 
     trace_sort(7);
@@ -1219,7 +1250,7 @@ void stage_8(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
 
     sort_chargers(
         3 - allocated_phases,
-        current_capacity(_limits, left.state, left.allocated_current, left.allocated_phases, _cfg) < current_capacity(_limits, right.state, right.allocated_current, right.allocated_phases, _cfg)
+        sort_key_int(current_capacity(_limits, state, allocated_current, allocated_phases, _cfg))
     );
 
     trace_sort(8);
@@ -1278,19 +1309,22 @@ static int stage_9_group(const ChargerState *state, const CurrentAllocatorConfig
     return NEVER_ATTEMPTED_TO_WAKE_UP;
 }
 
-static bool stage_9_sort(const ChargerState *left_state, const ChargerState *right_state, const CurrentAllocatorConfig *cfg) {
-    switch(stage_9_group(left_state, cfg)) {
+static SortKey stage_9_sort_key(const ChargerState *state, const CurrentAllocatorConfig *cfg, int position) {
+    int group = stage_9_group(state, cfg);
+
+    switch(group) {
         case CURRENTLY_WAKING_UP_CAR:
             // Prefer newer timestamps, i.e. cars that we have just now allocated current to.
-            return left_state->last_wakeup >= right_state->last_wakeup;
+            // Chargers woken up in the same allocation share the timestamp: Prefer the one that was filtered last.
+            return {group, ~sort_key_micros(state->last_wakeup), -position};
         case NEVER_ATTEMPTED_TO_WAKE_UP:
             // Prefer older timestamps, i.e. cars that have been switched off longer.
-            return left_state->last_switch_on < right_state->last_switch_on;
+            return {group, sort_key_micros(state->last_switch_on), position};
         case CAR_DID_NOT_WAKE_UP:
             // Prefer older timestamps, i.e. cars that we longer did not attempt to wake up.
-            return left_state->last_wakeup < right_state->last_wakeup;
+            return {group, sort_key_micros(state->last_wakeup), position};
     }
-    return false;
+    return {group, 0, position};
 }
 
 // Stage 9: Wake up chargers.
@@ -1309,10 +1343,7 @@ void stage_9(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
     if (matched == 0)
         return;
 
-    sort_chargers(
-        stage_9_group(state, _cfg),
-        stage_9_sort(left.state, right.state, _cfg)
-    );
+    sort_chargers_by_key(stage_9_sort_key(state, _cfg, position));
 
     trace_sort(9);
 
@@ -1517,23 +1548,33 @@ int allocate_current(
 
     //auto start = micros();
     trace_alloc(0, limits, current_array, phases_array, cfg->charger_count, charger_state);
+    stage_done(0);
     stage_1(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(1);
     //trace_alloc(1, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_2(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(2);
     //trace_alloc(2, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_3(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(3);
     //trace_alloc(3, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_4(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(4);
     //trace_alloc(4, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_5(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(5);
     //trace_alloc(5, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_6(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(6);
     //trace_alloc(6, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_7(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(7);
     //trace_alloc(7, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_8(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(8);
     //trace_alloc(8, limits, current_array, phases_array, cfg->charger_count, charger_state);
     stage_9(idx_array, current_array, phases_array, limits, charger_state, cfg->charger_count, cfg, ca_state);
+    stage_done(9);
     trace_alloc(9, limits, current_array, phases_array, cfg->charger_count, charger_state);
     //auto end = micros();
     //logger.printfln("Took %u µs", end - start);
@@ -1746,7 +1787,7 @@ bool update_from_client_packet(
 
     target.is_charging = v1->charger_state == 3;
     if (v1->charger_state != 1 && v1->charger_state != 2)
-        target.last_wakeup = 0;
+        target.last_wakeup = 0_us;
 
     // Reset allocated energy if no car is connected
     if (v1->charger_state == 0) {
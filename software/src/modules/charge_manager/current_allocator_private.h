@@ -25,16 +25,17 @@ typedef bool(*filter_fn)(int32_t /*allocated_current*/, uint8_t /*allocated_phas
 
 int filter_chargers_impl(filter_fn filter, int *idx_array, const int32_t *current_allocation, const uint8_t *phase_allocation, const ChargerState *charger_state, size_t charger_count);
 
-typedef int(*group_fn)(int32_t /*allocated_current*/, uint8_t /*allocated_phases*/, const ChargerState */*state*/, const CurrentAllocatorConfig * /*cfg*/);
-
-struct CompareInfo {
-    int32_t allocated_current;
-    uint8_t allocated_phases;
-    const ChargerState *state;
+// Chargers are sorted by group, then by key, then by tie, all ascending.
+struct SortKey {
+    int32_t group;
+    uint64_t key;
+    // Orders chargers with the same group and key.
+    // Usually the position in the filtered index array, which keeps the sort stable.
+    int32_t tie;
 };
-typedef bool(*compare_fn)(CompareInfo /*left*/, CompareInfo /*right*/, CurrentLimits * /*limits*/, const CurrentAllocatorConfig * /*cfg*/);
+typedef SortKey(*sort_key_fn)(int32_t /*allocated_current*/, uint8_t /*allocated_phases*/, const ChargerState */*state*/, const CurrentLimits * /*limits*/, const CurrentAllocatorConfig * /*cfg*/, int /*position*/);
 
-void sort_chargers_impl(group_fn group, compare_fn compare, int *idx_array, const int32_t *current_allocation, const uint8_t *phase_allocation, const ChargerState *charger_state, size_t charger_count, CurrentLimits *limits, const CurrentAllocatorConfig *cfg);
+void sort_chargers_impl(sort_key_fn sort_key, int *idx_array, const int32_t *current_allocation, const uint8_t *phase_allocation, const ChargerState *charger_state, size_t charger_count, const CurrentLimits *limits, const CurrentAllocatorConfig *cfg);
 
 GridPhase get_phase(PhaseRotation rot, ChargerPhase phase);
 
@@ -53,6 +54,16 @@ void stage_4(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
 void stage_5(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocation, CurrentLimits *limits, const ChargerState *charger_state, size_t charger_count, const CurrentAllocatorConfig *cfg, CurrentAllocatorState *ca_state);
 void stage_6(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocation, CurrentLimits *limits, const ChargerState *charger_state, size_t charger_count, const CurrentAllocatorConfig *cfg, CurrentAllocatorState *ca_state);
 void stage_7(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocation, CurrentLimits *limits, const ChargerState *charger_state, size_t charger_count, const CurrentAllocatorConfig *cfg, CurrentAllocatorState *ca_state);
+void stage_8(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocation, CurrentLimits *limits, const ChargerState *charger_state, size_t charger_count, const CurrentAllocatorConfig *cfg, CurrentAllocatorState *ca_state);
+void stage_9(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocation, CurrentLimits *limits, const ChargerState *charger_state, size_t charger_count, const CurrentAllocatorConfig *cfg, CurrentAllocatorState *ca_state);
+
+// Host builds can define CURRENT_ALLOCATOR_STAGE_HOOK to get called before stage 1 (stage 0) and after each stage.
+#ifdef CURRENT_ALLOCATOR_STAGE_HOOK
+void current_allocator_stage_hook(int stage);
+#define stage_done(stage) current_allocator_stage_hook(stage)
+#else
+#define stage_done(stage) do {} while (0)
+#endif
 
 #define filter_chargers(x) do { \
     matched = filter_chargers_impl([](int32_t allocated_current, uint8_t allocated_phases, const CurrentAllocatorConfig *_cfg, const ChargerState *state) { \
@@ -66,13 +77,10 @@ void stage_7(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
         charger_count); \
     } while(0)
 
-#define sort_chargers(group, filter) do {\
+#define sort_chargers_by_key(sort_key) do {\
     sort_chargers_impl( \
-        [](int32_t allocated_current, uint8_t allocated_phases, const ChargerState *state, const CurrentAllocatorConfig *_cfg) { \
-            return (group); \
-        }, \
-        [](CompareInfo left, CompareInfo right, CurrentLimits *_limits, const CurrentAllocatorConfig *_cfg) { \
-            return (filter); \
+        [](int32_t allocated_current, uint8_t allocated_phases, const ChargerState *state, const CurrentLimits *_limits, const CurrentAllocatorConfig *_cfg, int position) { \
+            return SortKey(sort_key); \
         }, \
         idx_array, \
         current_allocation, \
@@ -82,3 +90,5 @@ void stage_7(int *idx_array, int32_t *current_allocation, uint8_t *phase_allocat
         limits, \
         cfg); \
     } while (0)
+
+#define sort_chargers(group, key) sort_chargers_by_key((SortKey{(group), (key), position}))
@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <LittleFS.h>
+#include <TFJson.h>
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
@@ -46,6 +47,7 @@ struct [[gnu::packed]] Charge {
 };
 
 static bool repair_logic(Charge *);
+static float charged_energy(const ChargeStart &cs, const ChargeEnd &ce);
 
 static_assert(sizeof(ChargeEnd) == 7, "Unexpected size of ChargeEnd");
 
@@ -142,7 +144,11 @@ bool ChargeTracker::repair_last(float meter_start)
         r_file.read(reinterpret_cast<uint8_t *>(&charges[1]), sizeof(Charge));
     }
 
+    Charge unrepaired = charges[1];
     if (repair_logic(&charges[1])) {
+        index.remove_record(last_charge_record, unrepaired.cs.timestamp_minutes, unrepaired.cs.user_id, unrepaired.ce.charge_duration, charged_energy(unrepaired.cs, unrepaired.ce));
+        index.add_record(last_charge_record, charges[1].cs.timestamp_minutes, charges[1].cs.user_id, charges[1].ce.charge_duration, charged_energy(charges[1].cs, charges[1].ce));
+
         r_file.seek(r_file.size() - sizeof(Charge));
         r_file.write(reinterpret_cast<uint8_t *>(&charges[1]), sizeof(Charge));
         logger.printfln("Repaired previous broken charge.");
@@ -172,6 +178,7 @@ bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, u
         logger.printfln("Last charge record file %s is full. Creating the new file %s", file.name(), new_file_name.c_str());
         file.close();
 
+        index.add_file(this->last_charge_record);
         removeOldRecords();
         updateState();
 
@@ -186,6 +193,7 @@ bool ChargeTracker::startCharge(uint32_t timestamp_minutes, float meter_start, u
     memcpy(buf, &cs, sizeof(cs));
 
     file.write(buf, sizeof(cs));
+    index.add_start(this->last_charge_record, timestamp_minutes, user_id);
     logger.printfln("Tracked start of charge.");
 
     current_charge.get("user_id")->updateInt(user_id);
@@ -228,6 +236,14 @@ void ChargeTracker::endCharge(uint32_t charge_duration_seconds, float meter_end)
         last_charges.remove(0);
 
     File f = LittleFS.open(chargeRecordFilename(this->last_charge_record));
+    f.seek(-CHARGE_RECORD_SIZE, SeekMode::SeekEnd);
+
+    ChargeStart cs;
+    uint8_t buf[sizeof(cs)] = {0};
+    f.read(buf, sizeof(cs));
+    memcpy(&cs, buf, sizeof(cs));
+    index.add_record(this->last_charge_record, cs.timestamp_minutes, cs.user_id, ce.charge_duration, charged_energy(cs, ce));
+
     f.seek(-CHARGE_RECORD_SIZE, SeekMode::SeekEnd);
     this->readNRecords(&f, 1);
 
@@ -243,63 +259,39 @@ void ChargeTracker::endCharge(uint32_t charge_duration_seconds, float meter_end)
 
 bool ChargeTracker::is_user_tracked(uint8_t user_id)
 {
-    const size_t user_id_offset = offsetof(ChargeStart, user_id);
-
-    for (int file = this->first_charge_record; file <= this->last_charge_record; ++file) {
-        File f = LittleFS.open(chargeRecordFilename(file));
-        size_t size = f.size();
-        // LittleFS caches internally, so we can read single bytes without a huge performance loss.
-        for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-            f.seek(i + user_id_offset);
-            int read_user_id = f.read();
-            if (read_user_id < 0)
-                continue;
-            if (user_id == read_user_id)
-                return true;
-        }
-    }
-    return false;
+    return index.is_user_tracked(user_id);
 }
 
 void ChargeTracker::removeOldRecords()
 {
-    const size_t user_id_offset = offsetof(ChargeStart, user_id);
-
     uint32_t users_to_delete[8] = {0}; // one bit per user
 
     while (this->last_charge_record - this->first_charge_record >= 30) {
         String name = chargeRecordFilename(this->first_charge_record);
         logger.printfln("Got %u charge records. Dropping the first one (%s)", this->last_charge_record - this->first_charge_record, name.c_str());
-        {
+
+        const ChargeTrackerFileIndex *dropped = index.get_file(this->first_charge_record);
+        if (dropped != nullptr) {
+            for (size_t i = 0; i < ARRAY_SIZE(users_to_delete); ++i)
+                users_to_delete[i] |= dropped->users[i];
+
+            // Take the dropped charges out of the totals.
             File f = LittleFS.open(name, "r");
-            size_t size = f.size();
-            for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-                f.seek(i + user_id_offset);
-                int x = f.read();
-                if (x < 0)
-                    continue;
-                uint8_t user_id = x;
-                users_to_delete[user_id / 32] |= (1 << (user_id % 32));
-            }
+            Charge c;
+            while (f.read(reinterpret_cast<uint8_t *>(&c), sizeof(c)) == sizeof(c))
+                index.remove_record(this->first_charge_record, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
         }
+        index.remove_first_file();
+
         LittleFS.remove(name);
         ++this->first_charge_record;
     }
 
     //users_to_delete has now set a bit for every user_id that was used in the deleted charge records.
     //Clear this bit for every user that is still used in the current charge records.
-    for (int file = this->first_charge_record; file < this->last_charge_record; ++file) {
-        File f = LittleFS.open(chargeRecordFilename(file));
-        size_t size = f.size();
-        // LittleFS caches internally, so we can read single bytes without a huge performance loss.
-        for (size_t i = 0; i < size; i += CHARGE_RECORD_SIZE) {
-            f.seek(i + user_id_offset);
-            int x = f.read();
-            if (x < 0)
-                continue;
-            uint8_t user_id = x;
-            users_to_delete[user_id / 32] &= ~(1 << (user_id % 32));
-        }
+    for (const ChargeTrackerFileIndex &file : index.get_files()) {
+        for (size_t i = 0; i < ARRAY_SIZE(users_to_delete); ++i)
+            users_to_delete[i] &= ~file.users[i];
     }
 
     // Now only users that are safe to remove remain.
@@ -414,6 +406,11 @@ bool charged_invalid(ChargeStart cs, ChargeEnd ce)
     return isnan(cs.meter_start) || isnan(ce.meter_end) || ce.meter_end < cs.meter_start;
 }
 
+static float charged_energy(const ChargeStart &cs, const ChargeEnd &ce)
+{
+    return charged_invalid(cs, ce) ? NAN : ce.meter_end - cs.meter_start;
+}
+
 void ChargeTracker::readNRecords(File *f, size_t records_to_read)
 {
     uint8_t buf[CHARGE_RECORD_SIZE];
@@ -437,20 +434,16 @@ void ChargeTracker::readNRecords(File *f, size_t records_to_read)
 
 void ChargeTracker::updateState()
 {
-    auto records = this->last_charge_record - this->first_charge_record + 1;
-    state.get("tracked_charges")->updateUint((records - 1) * (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE) + completeRecordsInLastFile());
+    const std::vector<ChargeTrackerFileIndex> &files = index.get_files();
 
-    File f = LittleFS.open(chargeRecordFilename(this->first_charge_record));
-    ChargeStart cs;
-    if (f.size() >= sizeof(cs)) {
-        uint8_t buf[sizeof(cs)];
+    uint32_t tracked_charges = 0;
+    for (const ChargeTrackerFileIndex &file : files)
+        tracked_charges += file.records;
 
-        memset(buf, 0, sizeof(buf));
-        f.read(buf, sizeof(cs));
+    state.get("tracked_charges")->updateUint(tracked_charges);
 
-        memcpy(&cs, buf, sizeof(cs));
-        state.get("first_charge_timestamp")->updateUint(cs.timestamp_minutes);
-    }
+    if (!files.empty() && (files.front().records > 0 || files.front().first_timestamp_min != 0))
+        state.get("first_charge_timestamp")->updateUint(files.front().first_timestamp_min);
 }
 
 void ChargeTracker::setup()
@@ -518,49 +511,11 @@ static size_t timestamp_min_to_date_time_string(char buf[17], uint32_t timestamp
     return sprintf_u(buf, "%2.2i.%2.2i.%4.4i %2.2i:%2.2i", t.tm_mday, t.tm_mon + 1, t.tm_year + 1900, t.tm_hour, t.tm_min);
 }
 
-static_assert(DISPLAY_NAME_LENGTH == 32, "Unexpected display name length");
-struct display_name_entry {
-    uint32_t length;
-    uint32_t name[DISPLAY_NAME_LENGTH / sizeof(uint32_t)];
-};
-
-static size_t get_display_name(uint8_t user_id, char *ret_buf, display_name_entry *display_name_cache)
-{
-    if (display_name_cache[user_id].length > DISPLAY_NAME_LENGTH) {
-        size_t length = 0;
-        uint32_t buf[9] = {}; // Make sure that short names are zero-padded.
-        task_scheduler.await([&length, user_id, &buf]() {length = users.get_display_name(user_id, reinterpret_cast<char *>(buf));});
-        if (length > sizeof(display_name_cache[user_id].name)) {
-            logger.printfln("Returned user name too long: [%.*s]", length, reinterpret_cast<char *>(buf));
-            display_name_cache[user_id].length = 0;
-        } else {
-            // Ignore actual name length in order to copy zero-padding as well.
-            uint32_t *src = buf;
-            uint32_t *dst_start = display_name_cache[user_id].name;
-            uint32_t *dst_end = dst_start + ARRAY_SIZE(display_name_cache[user_id].name);
-            do {
-                *dst_start++ = *src++;
-            } while (dst_start < dst_end);
-
-            display_name_cache[user_id].length = length;
-        }
-    }
-
-    uint32_t *src_start = display_name_cache[user_id].name;
-    uint32_t *src_end = src_start + (display_name_cache[user_id].length + 3) / 4; // Round up; copies some buffer slack that must be zero-filled. See padding above.
-    uint32_t *dst = reinterpret_cast<uint32_t *>(ret_buf);
-    while (src_start < src_end) {
-        *dst++ = *src_start++;
-    }
-
-    return display_name_cache[user_id].length;
-}
-
-static char *tracked_charge_to_string(char *buf, ChargeStart cs, ChargeEnd ce, bool english, uint32_t electricity_price, display_name_entry *display_name_cache)
+static char *tracked_charge_to_string(char *buf, ChargeStart cs, ChargeEnd ce, bool english, uint32_t electricity_price)
 {
     buf += 1 + timestamp_min_to_date_time_string(buf, cs.timestamp_minutes, english);
 
-    size_t name_len = get_display_name(cs.user_id, buf, display_name_cache);
+    size_t name_len = users.get_display_name(cs.user_id, buf);
     buf += 1 + name_len;
 
     if (charged_invalid(cs, ce)) {
@@ -690,10 +645,14 @@ void ChargeTracker::repair_charges()
     Charge transfer;
     transfer.ce.meter_end = NAN;
 
+    index.clear();
+
     for (int i = this->first_charge_record; i <= this->last_charge_record; ++i) {
         bool file_needs_repair = false;
         memset(reinterpret_cast<uint8_t *>(&buf[1]), 0, sizeof(Charge) * 257);
 
+        index.add_file(i);
+
         File f = LittleFS.open(chargeRecordFilename(i));
         if (i < this->last_charge_record) {
             File next_f = LittleFS.open(chargeRecordFilename(i + 1));
@@ -719,6 +678,16 @@ void ChargeTracker::repair_charges()
             File write_f = LittleFS.open(chargeRecordFilename(i), "w");
             write_f.write(reinterpret_cast<uint8_t *>(&buf[1]), read);
         }
+
+        // The file is in memory and repaired anyway, so index it now instead of reading it again.
+        size_t complete_records = read / sizeof(Charge);
+        for (size_t a = 1; a <= complete_records; ++a) {
+            index.add_record(i, buf[a].cs.timestamp_minutes, buf[a].cs.user_id, buf[a].ce.charge_duration, charged_energy(buf[a].cs, buf[a].ce));
+        }
+        if (read % sizeof(Charge) >= sizeof(ChargeStart)) {
+            index.add_start(i, buf[complete_records + 1].cs.timestamp_minutes, buf[complete_records + 1].cs.user_id);
+        }
+
         buf[0] = buf[256];
     }
     if (num_repaired != 0) {
@@ -726,6 +695,26 @@ void ChargeTracker::repair_charges()
     }
 }
 
+// Large enough for one aggregate, see build_total_json.
+#define TOTALS_ENTRY_MAX_LENGTH 256
+#define TOTALS_CHUNK_SIZE 2048
+
+static size_t build_total_json(const ChargeTrackerAggregate &total, char *buf, size_t len)
+{
+    TFJsonSerializer json{buf, len};
+    json.addObject();
+        // Charges without a known start time have year and month 0.
+        json.addMemberNumber("year", total.month / 12);
+        json.addMemberNumber("month", total.month == 0 ? 0 : total.month % 12 + 1);
+        json.addMemberNumber("user_id", total.user_id);
+        json.addMemberNumber("charges", total.charges);
+        json.addMemberNumber("charges_without_meter", total.charges_without_meter);
+        json.addMemberNumber("energy_charged", total.energy_kwh);
+        json.addMemberNumber("charge_duration", total.duration_s);
+    json.endObject();
+    return json.end();
+}
+
 void ChargeTracker::register_urls()
 {
     // We have to do this here, not at the end of setup,
@@ -762,6 +751,42 @@ void ChargeTracker::register_urls()
         return request.endChunkedResponse();
     });
 
+    // Energy and duration of all tracked charges by month and user. Answered from the index without reading the records.
+    // Streamed in chunks like the charge log, so that the response needs no buffer for all totals.
+    server.on_HTTPThread("/charge_tracker/totals", HTTP_GET, [this](WebServerRequest request) {
+        std::lock_guard<std::mutex> lock{records_mutex};
+
+        auto chunk_buf = heap_alloc_array<char>(TOTALS_CHUNK_SIZE);
+        if (chunk_buf == nullptr) {
+            return request.send(507);
+        }
+
+        char *buf = chunk_buf.get();
+        size_t written = 0;
+        buf[written++] = '[';
+
+        request.beginChunkedResponse(200, "application/json; charset=utf-8");
+
+        const std::vector<ChargeTrackerAggregate> &totals = index.get_totals();
+        for (size_t i = 0; i < totals.size(); ++i) {
+            // One more for the comma, one more for the closing bracket.
+            if (TOTALS_CHUNK_SIZE - written < TOTALS_ENTRY_MAX_LENGTH + 2) {
+                request.sendChunk(buf, static_cast<ssize_t>(written));
+                written = 0;
+            }
+
+            if (i != 0) {
+                buf[written++] = ',';
+            }
+
+            written += build_total_json(totals[i], buf + written, TOTALS_CHUNK_SIZE - written - 1);
+        }
+
+        buf[written++] = ']';
+        request.sendChunk(buf, static_cast<ssize_t>(written));
+        return request.endChunkedResponse();
+    });
+
     api.addState("charge_tracker/last_charges", &last_charges);
     api.addState("charge_tracker/current_charge", &current_charge);
     api.addState("charge_tracker/state", &state);
@@ -868,12 +893,34 @@ void ChargeTracker::register_urls()
             return request.send(500, "text/plain", "Failed to generate PDF: Task timed out");
         }
 
+        // One bit per user ID that passes the user filter.
+        uint32_t user_mask[8] = {};
+        if (user_filter == USER_FILTER_ALL_USERS) {
+            memset(user_mask, 0xFF, sizeof(user_mask));
+        } else if (user_filter == USER_FILTER_DELETED_USERS) {
+            memset(user_mask, 0xFF, sizeof(user_mask));
+            for (int i = 0; i < MAX_ACTIVE_USERS; ++i)
+                user_mask[configured_users[i] / 32] &= ~(1u << (configured_users[i] % 32));
+        } else if (user_filter >= 0 && user_filter < 256) {
+            user_mask[user_filter / 32] = 1u << (user_filter % 32);
+        }
+
+        // Files outside of this range can't contain exported charges.
+        uint32_t search_first_file;
+        uint32_t search_last_file;
+        index.get_file_range(start_timestamp_min, end_timestamp_min, &search_first_file, &search_last_file);
+
         {
             char charge_buf[sizeof(ChargeStart) + sizeof(ChargeEnd)];
             ChargeStart cs;
             ChargeEnd ce;
 
-            for (int i = this->first_charge_record; i <= this->last_charge_record; ++i) {
+            for (int i = search_first_file; i <= search_last_file; ++i) {
+                // The first and last file of the range can reset or end the search. Files in between only matter if they contain a filtered user.
+                const ChargeTrackerFileIndex *file_index = index.get_file(i);
+                if (i != search_first_file && i != search_last_file && file_index != nullptr && !file_index->has_any_user(user_mask))
+                    continue;
+
                 File f = LittleFS.open(chargeRecordFilename(i));
 
                 for (int j = 0; j < (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE); ++j) {
@@ -929,15 +976,6 @@ void ChargeTracker::register_urls()
         }
 search_done:
 
-        display_name_entry *display_name_cache = static_cast<decltype(display_name_cache)>(heap_caps_malloc(MAX_PASSIVE_USERS * sizeof(display_name_cache[0]), MALLOC_CAP_32BIT));
-        if (!display_name_cache) {
-            return request.send(500, "text/plain", "Failed to generate PDF: No memory");;
-        }
-
-        for (size_t i = 0; i < MAX_PASSIVE_USERS; i++) {
-            display_name_cache[i].length = UINT32_MAX;
-        }
-
         char *stats_head = stats_buf;
         stats_head += 1 + sprintf_u(stats_head, "%s: %s", english ? "Charger" : "Wallbox", dev_name.c_str());
 
@@ -950,7 +988,7 @@ search_done:
         else if (user_filter == -1)
             stats_head += sprintf_u(stats_head, "%s", english ? "deleted users" : "Gelöschte Benutzer");
         else
-            stats_head += get_display_name(user_filter, stats_head, display_name_cache);
+            stats_head += users.get_display_name(user_filter, stats_head);
         ++stats_head;
 
         stats_head += sprintf_u(stats_head, "%s: ", english ? "Exported period" : "Exportierter Zeitraum");
@@ -1027,7 +1065,13 @@ search_done:
         if (!any_charges_tracked)
             charge_records = 1;
 
-        init_pdf_generator(&request,
+        init_pdf_generator([&request](const void *buf, size_t len) -> ssize_t {
+                               int rc = request.sendChunk((const char *)buf, len);
+                               if (rc != ESP_OK)
+                                   return -abs(rc);
+
+                               return len;
+                           },
                            english ? "WARP Charge Log" : "WARP Ladelog",
                            stats_buf, (electricity_price == 0) ? 5 : 6,
                            letterhead.get(), letterhead_lines,
@@ -1046,7 +1090,7 @@ search_done:
                             electricity_price,
                             english,
                             configured_users,
-                            &display_name_cache,
+                            user_mask,
                             any_charges_tracked]
                            (const char * * table_lines) {
             memset(table_lines_buffer, 0, ARRAY_SIZE(table_lines_buffer));
@@ -1067,6 +1111,14 @@ search_done:
                 }
 
                 if (!f) {
+                    const ChargeTrackerFileIndex *file_index = index.get_file(current_file);
+                    if (file_index != nullptr && !file_index->has_any_user(user_mask)) {
+                        // No line of this file would pass the user filter.
+                        ++current_file;
+                        current_charge = 0;
+                        continue;
+                    }
+
                     f =  LittleFS.open(chargeRecordFilename(current_file));
                     f.seek(CHARGE_RECORD_SIZE * current_charge);
                 }
@@ -1086,7 +1138,7 @@ search_done:
                         continue;
 
 
-                    table_lines_head = tracked_charge_to_string(table_lines_head, cs, ce, english, electricity_price, display_name_cache);
+                    table_lines_head = tracked_charge_to_string(table_lines_head, cs, ce, english, electricity_price);
                     ++lines_generated;
                 }
 
@@ -1114,7 +1166,6 @@ search_done:
 
             return lines_generated;
         });
-        free(display_name_cache);
         logger.printfln("PDF generation done.");
         return request.endChunkedResponse();
     });
@@ -21,6 +21,7 @@
 
 #include "module.h"
 #include "config.h"
+#include "charge_tracker_index.h"
 
 #define CHARGE_TRACKER_MAX_REPAIR 200
 #define CHARGE_RECORD_FOLDER "/charge-records"
@@ -62,5 +63,8 @@ private:
     bool repair_last(float);
     void repair_charges();
 
+    // Only modified with records_mutex held.
+    ChargeTrackerIndex index;
+
     Config last_charges_prototype;
 };
@@ -0,0 +1,232 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "charge_tracker_index.h"
+
+#include <algorithm>
+#include <math.h>
+#include <time.h>
+
+bool ChargeTrackerFileIndex::has_any_user(const uint32_t user_mask[8]) const
+{
+    for (size_t i = 0; i < 8; ++i) {
+        if ((users[i] & user_mask[i]) != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ChargeTrackerIndex::clear()
+{
+    files.clear();
+    totals.clear();
+}
+
+void ChargeTrackerIndex::add_file(uint32_t file)
+{
+    if (!files.empty() && files.back().file + 1 != file) {
+        return;
+    }
+
+    ChargeTrackerFileIndex index = {};
+    index.file = file;
+    index.min_timestamp_min = UINT32_MAX;
+    files.push_back(std::move(index));
+}
+
+void ChargeTrackerIndex::remove_first_file()
+{
+    if (files.empty()) {
+        return;
+    }
+
+    files.erase(files.begin());
+    prune_totals();
+}
+
+void ChargeTrackerIndex::prune_totals()
+{
+    uint32_t oldest_timestamp_min = UINT32_MAX;
+    for (const ChargeTrackerFileIndex &index : files) {
+        oldest_timestamp_min = std::min(oldest_timestamp_min, index.min_timestamp_min);
+    }
+
+    // month_of uses the local time. A time zone change shifts it by less than a day, so by at most one month.
+    uint16_t first_month = oldest_timestamp_min == UINT32_MAX ? UINT16_MAX : static_cast<uint16_t>(month_of(oldest_timestamp_min) - 1);
+
+    totals.erase(std::remove_if(totals.begin(), totals.end(), [first_month](const ChargeTrackerAggregate &aggregate) {
+        return aggregate.month != 0 && aggregate.month < first_month;
+    }), totals.end());
+}
+
+ChargeTrackerFileIndex *ChargeTrackerIndex::find_file(uint32_t file)
+{
+    if (files.empty() || file < files.front().file || file > files.back().file) {
+        return nullptr;
+    }
+
+    return &files[file - files.front().file];
+}
+
+const ChargeTrackerFileIndex *ChargeTrackerIndex::get_file(uint32_t file) const
+{
+    return const_cast<ChargeTrackerIndex *>(this)->find_file(file);
+}
+
+uint16_t ChargeTrackerIndex::month_of(uint32_t timestamp_min)
+{
+    if (timestamp_min == 0) {
+        return 0;
+    }
+
+    time_t timestamp = static_cast<time_t>(timestamp_min) * 60;
+    struct tm t;
+    localtime_r(&timestamp, &t);
+
+    return static_cast<uint16_t>((t.tm_year + 1900) * 12 + t.tm_mon);
+}
+
+std::vector<ChargeTrackerAggregate>::iterator ChargeTrackerIndex::find_total(uint16_t month, uint8_t user_id)
+{
+    // Records are mostly added in time order, so most lookups end at the last element.
+    if (!totals.empty() && (totals.back().month < month || (totals.back().month == month && totals.back().user_id < user_id))) {
+        return totals.end();
+    }
+
+    return std::lower_bound(totals.begin(), totals.end(), ChargeTrackerAggregate{month, user_id, 0, 0, 0, 0}, [](const ChargeTrackerAggregate &a, const ChargeTrackerAggregate &b) {
+        return a.month != b.month ? a.month < b.month : a.user_id < b.user_id;
+    });
+}
+
+void ChargeTrackerIndex::add_start(uint32_t file, uint32_t timestamp_min, uint8_t user_id)
+{
+    ChargeTrackerFileIndex *index = find_file(file);
+    if (index == nullptr) {
+        return;
+    }
+
+    if (index->records == 0 && index->first_timestamp_min == 0) {
+        index->first_timestamp_min = timestamp_min;
+    }
+
+    index->users[user_id / 32] |= 1u << (user_id % 32);
+}
+
+void ChargeTrackerIndex::add_record(uint32_t file, uint32_t timestamp_min, uint8_t user_id, uint32_t duration_s, float energy_kwh)
+{
+    ChargeTrackerFileIndex *index = find_file(file);
+    if (index == nullptr) {
+        return;
+    }
+
+    add_start(file, timestamp_min, user_id);
+
+    ++index->records;
+
+    if (timestamp_min != 0 && timestamp_min < index->min_timestamp_min) {
+        index->min_timestamp_min = timestamp_min;
+    }
+
+    if (timestamp_min > index->max_timestamp_min) {
+        index->max_timestamp_min = timestamp_min;
+    }
+
+    uint16_t month = month_of(timestamp_min);
+    auto aggregate = find_total(month, user_id);
+
+    if (aggregate == totals.end() || aggregate->month != month || aggregate->user_id != user_id) {
+        aggregate = totals.insert(aggregate, ChargeTrackerAggregate{month, user_id, 0, 0, 0, 0});
+    }
+
+    ++aggregate->charges;
+    aggregate->duration_s += duration_s;
+
+    if (isnan(energy_kwh)) {
+        ++aggregate->charges_without_meter;
+    } else {
+        aggregate->energy_kwh += energy_kwh;
+    }
+}
+
+void ChargeTrackerIndex::remove_record(uint32_t file, uint32_t timestamp_min, uint8_t user_id, uint32_t duration_s, float energy_kwh)
+{
+    ChargeTrackerFileIndex *index = find_file(file);
+    if (index == nullptr || index->records == 0) {
+        return;
+    }
+
+    uint16_t month = month_of(timestamp_min);
+    auto aggregate = find_total(month, user_id);
+
+    if (aggregate == totals.end() || aggregate->month != month || aggregate->user_id != user_id) {
+        return;
+    }
+
+    --index->records;
+    --aggregate->charges;
+    aggregate->duration_s -= duration_s;
+
+    if (isnan(energy_kwh)) {
+        --aggregate->charges_without_meter;
+    } else {
+        aggregate->energy_kwh -= energy_kwh;
+    }
+
+    if (aggregate->charges == 0) {
+        totals.erase(aggregate);
+    }
+}
+
+bool ChargeTrackerIndex::is_user_tracked(uint8_t user_id) const
+{
+    for (const ChargeTrackerFileIndex &index : files) {
+        if (index.has_user(user_id)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ChargeTrackerIndex::get_file_range(uint32_t start_timestamp_min, uint32_t end_timestamp_min, uint32_t *first_file, uint32_t *last_file) const
+{
+    if (files.empty()) {
+        *first_file = 1;
+        *last_file = 0;
+        return;
+    }
+
+    *first_file = files.front().file;
+    *last_file = files.back().file;
+
+    for (const ChargeTrackerFileIndex &index : files) {
+        // A charge after the end stops the search. Earlier files can still contain included charges.
+        if (end_timestamp_min != 0 && index.max_timestamp_min > end_timestamp_min) {
+            *last_file = index.file;
+            break;
+        }
+
+        // A charge before the start drops everything found so far.
+        if (start_timestamp_min != 0 && index.min_timestamp_min < start_timestamp_min) {
+            *first_file = index.file;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Charges of one user that started in one month.
+struct ChargeTrackerAggregate {
+    uint16_t month;                 // Year * 12 + month (0-11) of the charge start in local time. 0 if the start time is unknown.
+    uint8_t user_id;
+    uint16_t charges;
+    uint16_t charges_without_meter; // Included in charges but not in energy_kwh.
+    uint32_t duration_s;
+    double energy_kwh;
+};
+
+struct ChargeTrackerFileIndex {
+    uint32_t file;
+    uint16_t records;               // Complete records. A started charge is only in users.
+    uint32_t first_timestamp_min;   // Start of the first record, also if it is not complete yet. 0 if unknown.
+    uint32_t min_timestamp_min;     // Smallest known start time. UINT32_MAX if there is none.
+    uint32_t max_timestamp_min;     // Largest start time. 0 if there is none.
+    uint32_t users[8];              // One bit per user ID, including a started charge.
+
+    bool has_user(uint8_t user_id) const
+    {
+        return (users[user_id / 32] & (1u << (user_id % 32))) != 0;
+    }
+
+    // True if the file has a user whose bit is set in user_mask.
+    bool has_any_user(const uint32_t user_mask[8]) const;
+};
+
+// Summary of the charge record files, so that queries don't have to read every file.
+// Built from the records at boot and updated whenever a record is written.
+//
+// The index is bounded by the record files: ChargeTracker::removeOldRecords keeps at most
+// CHARGE_RECORD_FILE_COUNT + 1 files, and every aggregate holds at least one of their records.
+// remove_record can miss the aggregate of a record if the time zone changed since add_record.
+// remove_first_file drops such leftovers once no remaining file can contain their month.
+class ChargeTrackerIndex
+{
+public:
+    void clear();
+
+    // Files must be added in ascending order without gaps.
+    void add_file(uint32_t file);
+
+    // Call remove_record for every record of the file first to take it out of the totals.
+    // Also drops the totals of months before the remaining files.
+    void remove_first_file();
+
+    void add_start(uint32_t file, uint32_t timestamp_min, uint8_t user_id);
+
+    // energy_kwh is NAN if the meter values of the charge are invalid.
+    void add_record(uint32_t file, uint32_t timestamp_min, uint8_t user_id, uint32_t duration_s, float energy_kwh);
+
+    // Takes back add_record for the record count and totals, for example before adding the repaired record.
+    // The time range and users of the file are kept.
+    void remove_record(uint32_t file, uint32_t timestamp_min, uint8_t user_id, uint32_t duration_s, float energy_kwh);
+
+    const ChargeTrackerFileIndex *get_file(uint32_t file) const;
+    const std::vector<ChargeTrackerFileIndex> &get_files() const { return files; }
+
+    bool is_user_tracked(uint8_t user_id) const;
+
+    // Sorted by month, then user ID.
+    const std::vector<ChargeTrackerAggregate> &get_totals() const { return totals; }
+
+    // A filter over the start time touches records from first_file to last_file only:
+    // Files before the last one with a start before start_timestamp_min and files after
+    // the first one with a start after end_timestamp_min can't contain included charges.
+    // 0 means no limit, like in the PDF export.
+    void get_file_range(uint32_t start_timestamp_min, uint32_t end_timestamp_min, uint32_t *first_file, uint32_t *last_file) const;
+
+    static uint16_t month_of(uint32_t timestamp_min);
+
+private:
+    ChargeTrackerFileIndex *find_file(uint32_t file);
+    void prune_totals();
+    std::vector<ChargeTrackerAggregate>::iterator find_total(uint16_t month, uint8_t user_id);
+
+    std::vector<ChargeTrackerFileIndex> files;
+    std::vector<ChargeTrackerAggregate> totals;
+};
@@ -19,6 +19,7 @@
 
 #include "pdf_charge_log.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -96,7 +97,7 @@ static int get_streams_per_page(bool first_page, int *table_lines_to_place)
     return result;
 }
 
-int init_pdf_generator(WebServerRequest *request,
+int init_pdf_generator(std::function<ssize_t(const void *buf, size_t len)> &&write_cb,
                        const char *title,
                        const char *stats,
                        int stats_lines,
@@ -104,20 +105,16 @@ int init_pdf_generator(WebServerRequest *request,
                        int letterhead_lines,
                        const char *table_header,
                        uint16_t tracked_charges,
-                       const std::function<int(const char **)> &table_lines_cb)
+                       const std::function<int(const char **)> &table_lines_cb,
+                       bool compress_streams)
 {
     struct pdf_info info;
     memset(&info, 0, sizeof(info));
     strncpy(info.title, title, ARRAY_SIZE(info.title) - 1);
 
     struct pdf_doc *pdf = pdf_create(PDF_A4_WIDTH, PDF_A4_HEIGHT, &info);
-    pdf_add_write_callback(pdf, [request](const void *buf, size_t len) -> int {
-        int rc = request->sendChunk((const char *)buf, len);
-        if (rc != ESP_OK)
-            return -abs(rc);
-
-        return len;
-    });
+    pdf_set_compression(pdf, compress_streams);
+    pdf_add_write_callback(pdf, std::move(write_cb));
     int pages_created = 0;
     int pages_to_be_created = 0;
     int table_lines_last_page = 0;
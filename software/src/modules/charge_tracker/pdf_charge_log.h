@@ -20,11 +20,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <algorithm>
+#include <functional>
 
-#include "modules/web_server/web_server.h"
-
-int init_pdf_generator(WebServerRequest *request,
+// write_cb is called with each part of the PDF as soon as a page is done.
+// It returns the number of bytes written or a negative error code.
+int init_pdf_generator(std::function<ssize_t(const void *buf, size_t len)> &&write_cb,
                        const char *title,
                        const char *stats,
                        int stats_lines,
@@ -32,4 +34,5 @@ int init_pdf_generator(WebServerRequest *request,
                        int letterhead_lines,
                        const char *table_header,
                        uint16_t tracked_charges,
-                       const std::function<int(const char **)> &table_lines_cb);
+                       const std::function<int(const char **)> &table_lines_cb,
+                       bool compress_streams = true);
@@ -0,0 +1,504 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "pdf_deflate.h"
+
+#include <string.h>
+
+#define WINDOW_SIZE (1u << PDF_DEFLATE_WINDOW_BITS)
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_BITS 15
+#define MAX_CODE_LENGTH_BITS 7
+#define END_OF_BLOCK 256
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static const uint8_t code_length_order[PDF_DEFLATE_CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Extra bits of the code length symbols 16 (repeat), 17 and 18 (zeros).
+static const uint8_t code_length_extra[3] = {2, 3, 7};
+
+struct bit_writer {
+    uint8_t *out;
+    size_t out_len;
+    size_t pos;
+    uint32_t bits;
+    uint32_t bit_count;
+    bool overflow;
+};
+
+static void put_bits(struct bit_writer *w, uint32_t value, uint32_t count)
+{
+    w->bits |= value << w->bit_count;
+    w->bit_count += count;
+
+    while (w->bit_count >= 8) {
+        if (w->pos < w->out_len)
+            w->out[w->pos++] = (uint8_t)w->bits;
+        else
+            w->overflow = true;
+
+        w->bits >>= 8;
+        w->bit_count -= 8;
+    }
+}
+
+static uint32_t length_symbol(uint32_t length)
+{
+    uint32_t l = 28;
+    while (length_base[l] > length)
+        --l;
+    return l;
+}
+
+static uint32_t dist_symbol(uint32_t distance)
+{
+    uint32_t d = 29;
+    while (dist_base[d] > distance)
+        --d;
+    return d;
+}
+
+static uint32_t hash3(const uint8_t *p)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) * 2654435761u >> (32 - PDF_DEFLATE_HASH_BITS);
+}
+
+static void insert(struct pdf_deflate_state *state, const uint8_t *in, size_t pos)
+{
+    uint32_t h = hash3(in + pos);
+    state->prev[pos & WINDOW_MASK] = state->head[h];
+    state->head[h] = (uint16_t)(pos + 1);
+}
+
+// Greedy LZ77 with hash chains. Sink::literal and Sink::match receive the result.
+template<typename Sink>
+static void lz77(struct pdf_deflate_state *state, const uint8_t *in, size_t in_len, Sink &sink)
+{
+    memset(state->head, 0, sizeof(state->head));
+
+    size_t pos = 0;
+    while (pos < in_len) {
+        uint32_t best_length = 0;
+        uint32_t best_distance = 0;
+
+        if (pos + MIN_MATCH <= in_len) {
+            uint32_t max_length = in_len - pos < MAX_MATCH ? (uint32_t)(in_len - pos) : MAX_MATCH;
+            uint32_t candidate = state->head[hash3(in + pos)];
+
+            for (int chain = 0; candidate != 0 && chain < PDF_DEFLATE_MAX_CHAIN; ++chain) {
+                size_t match_pos = candidate - 1;
+                uint32_t distance = (uint32_t)(pos - match_pos);
+                if (distance > WINDOW_SIZE)
+                    break;
+
+                uint32_t length = 0;
+                while (length < max_length && in[match_pos + length] == in[pos + length])
+                    ++length;
+
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = distance;
+                    if (length == max_length)
+                        break;
+                }
+
+                candidate = state->prev[match_pos & WINDOW_MASK];
+            }
+
+            insert(state, in, pos);
+        }
+
+        if (best_length < MIN_MATCH) {
+            sink.literal(in[pos]);
+            ++pos;
+            continue;
+        }
+
+        sink.match(best_length, best_distance);
+
+        // Insert the skipped positions, so that later matches can start inside this one.
+        size_t end = pos + best_length;
+        for (++pos; pos < end; ++pos) {
+            if (pos + MIN_MATCH <= in_len)
+                insert(state, in, pos);
+        }
+    }
+}
+
+struct count_sink {
+    struct pdf_deflate_state *state;
+
+    void literal(uint8_t c)
+    {
+        ++state->lit_freq[c];
+    }
+
+    void match(uint32_t length, uint32_t distance)
+    {
+        ++state->lit_freq[257 + length_symbol(length)];
+        ++state->dist_freq[dist_symbol(distance)];
+    }
+};
+
+struct write_sink {
+    struct pdf_deflate_state *state;
+    struct bit_writer *w;
+
+    void literal(uint8_t c)
+    {
+        put_bits(w, state->lit_code[c], state->lit_len[c]);
+    }
+
+    void match(uint32_t length, uint32_t distance)
+    {
+        uint32_t l = length_symbol(length);
+        put_bits(w, state->lit_code[257 + l], state->lit_len[257 + l]);
+        put_bits(w, length - length_base[l], length_extra[l]);
+
+        uint32_t d = dist_symbol(distance);
+        put_bits(w, state->dist_code[d], state->dist_len[d]);
+        put_bits(w, distance - dist_base[d], dist_extra[d]);
+    }
+};
+
+// Huffman code lengths of at most max_bits for the symbols with nonzero frequencies.
+static void build_lengths(struct pdf_deflate_state *state, const uint16_t *freq, size_t n, uint32_t max_bits, uint8_t *lengths)
+{
+    uint16_t *leaves = state->leaves;
+    size_t count = 0;
+
+    // Insertion sort by frequency: There are only a few hundred symbols.
+    for (size_t i = 0; i < n; ++i) {
+        lengths[i] = 0;
+        if (freq[i] == 0)
+            continue;
+
+        size_t k = count++;
+        while (k > 0 && freq[leaves[k - 1]] > freq[i]) {
+            leaves[k] = leaves[k - 1];
+            --k;
+        }
+        leaves[k] = (uint16_t)i;
+    }
+
+    if (count == 0)
+        return;
+
+    // zlib rejects incomplete code length codes: Pad a single symbol with an unused one.
+    if (count == 1) {
+        lengths[leaves[0]] = 1;
+        lengths[leaves[0] == 0 ? 1 : 0] = 1;
+        return;
+    }
+
+    // If the tree is too deep, flatten the frequencies and try again.
+    for (uint32_t shift = 0;; ++shift) {
+        uint32_t *weight = state->node_weight;
+        uint16_t *parent = state->node_parent;
+
+        for (size_t k = 0; k < count; ++k) {
+            uint32_t f = freq[leaves[k]] >> shift;
+            weight[k] = f > 0 ? f : 1;
+        }
+
+        // Two queues: The sorted leaves and the internal nodes, which are created in ascending order.
+        size_t next_leaf = 0;
+        size_t next_node = count;
+        size_t nodes = count;
+
+        for (size_t k = 0; k < count - 1; ++k) {
+            size_t pick[2];
+
+            for (size_t j = 0; j < 2; ++j) {
+                if (next_leaf < count && (next_node >= nodes || weight[next_leaf] <= weight[next_node]))
+                    pick[j] = next_leaf++;
+                else
+                    pick[j] = next_node++;
+            }
+
+            weight[nodes] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = (uint16_t)nodes;
+            parent[pick[1]] = (uint16_t)nodes;
+            ++nodes;
+        }
+
+        // Parents are always created after their children, so one pass from the root computes all depths.
+        uint32_t *depth = weight;
+        depth[nodes - 1] = 0;
+        uint32_t max_depth = 0;
+
+        for (size_t k = nodes - 1; k-- > 0;) {
+            depth[k] = depth[parent[k]] + 1;
+            if (k < count && depth[k] > max_depth)
+                max_depth = depth[k];
+        }
+
+        if (max_depth <= max_bits) {
+            for (size_t k = 0; k < count; ++k)
+                lengths[leaves[k]] = (uint8_t)depth[k];
+            return;
+        }
+    }
+}
+
+// Canonical Huffman codes, bit-reversed as they are sent starting with the most significant bit.
+static void build_codes(const uint8_t *lengths, size_t n, uint16_t *codes)
+{
+    uint16_t bl_count[MAX_BITS + 1] = {};
+    uint16_t next_code[MAX_BITS + 1] = {};
+
+    for (size_t i = 0; i < n; ++i)
+        ++bl_count[lengths[i]];
+    bl_count[0] = 0;
+
+    uint32_t code = 0;
+    for (uint32_t bits = 1; bits <= MAX_BITS; ++bits) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = (uint16_t)code;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t length = lengths[i];
+        if (length == 0)
+            continue;
+
+        uint32_t c = next_code[length]++;
+        uint32_t reversed = 0;
+        for (uint32_t b = 0; b < length; ++b) {
+            reversed = (reversed << 1) | (c & 1);
+            c >>= 1;
+        }
+        codes[i] = (uint16_t)reversed;
+    }
+}
+
+static uint32_t combined_length(const struct pdf_deflate_state *state, size_t i, size_t hlit)
+{
+    return i < hlit ? state->lit_len[i] : state->dist_len[i - hlit];
+}
+
+// Run-length encodes the code lengths of both trees into symbols 0-18. Returns the number of symbols.
+// Each symbol takes two bytes in rle: the symbol and its extra bits.
+static size_t encode_code_lengths(const struct pdf_deflate_state *state, size_t hlit, size_t hdist, uint8_t *rle)
+{
+    size_t symbols = 0;
+    size_t n = hlit + hdist;
+    size_t i = 0;
+
+    while (i < n) {
+        uint32_t length = combined_length(state, i, hlit);
+        size_t run = 1;
+        while (i + run < n && combined_length(state, i + run, hlit) == length)
+            ++run;
+
+        i += run;
+
+        if (length == 0) {
+            while (run >= 11) {
+                size_t r = run < 138 ? run : 138;
+                rle[2 * symbols] = 18;
+                rle[2 * symbols++ + 1] = (uint8_t)(r - 11);
+                run -= r;
+            }
+
+            if (run >= 3) {
+                rle[2 * symbols] = 17;
+                rle[2 * symbols++ + 1] = (uint8_t)(run - 3);
+                run = 0;
+            }
+        } else {
+            rle[2 * symbols] = (uint8_t)length;
+            rle[2 * symbols++ + 1] = 0;
+            --run;
+
+            while (run >= 3) {
+                size_t r = run < 6 ? run : 6;
+                rle[2 * symbols] = 16;
+                rle[2 * symbols++ + 1] = (uint8_t)(r - 3);
+                run -= r;
+            }
+        }
+
+        for (; run > 0; --run) {
+            rle[2 * symbols] = (uint8_t)length;
+            rle[2 * symbols++ + 1] = 0;
+        }
+    }
+
+    return symbols;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t len)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+
+    while (len > 0) {
+        // 5552 is the largest block for which b can't overflow before the modulo.
+        size_t block = len < 5552 ? len : 5552;
+        len -= block;
+
+        for (; block > 0; --block) {
+            a += *data++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+size_t pdf_deflate(struct pdf_deflate_state *state, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+    // Positions and symbol frequencies are stored in 16 bits.
+    if (in_len >= UINT16_MAX || out_len < 6)
+        return 0;
+
+    memset(state->lit_freq, 0, sizeof(state->lit_freq));
+    memset(state->dist_freq, 0, sizeof(state->dist_freq));
+
+    struct count_sink counter = {state};
+    lz77(state, in, in_len, counter);
+    state->lit_freq[END_OF_BLOCK] = 1;
+
+    build_lengths(state, state->lit_freq, PDF_DEFLATE_LIT_CODES, MAX_BITS, state->lit_len);
+    build_lengths(state, state->dist_freq, PDF_DEFLATE_DIST_CODES, MAX_BITS, state->dist_len);
+
+    size_t hlit = 286;
+    while (hlit > 257 && state->lit_len[hlit - 1] == 0)
+        --hlit;
+
+    size_t hdist = PDF_DEFLATE_DIST_CODES;
+    while (hdist > 1 && state->dist_len[hdist - 1] == 0)
+        --hdist;
+
+    uint8_t rle[2 * (PDF_DEFLATE_LIT_CODES + PDF_DEFLATE_DIST_CODES)];
+    size_t rle_symbols = encode_code_lengths(state, hlit, hdist, rle);
+
+    uint16_t cl_freq[PDF_DEFLATE_CODE_LENGTH_CODES] = {};
+    uint8_t cl_len[PDF_DEFLATE_CODE_LENGTH_CODES];
+    uint16_t cl_code[PDF_DEFLATE_CODE_LENGTH_CODES] = {};
+
+    for (size_t i = 0; i < rle_symbols; ++i)
+        ++cl_freq[rle[2 * i]];
+
+    build_lengths(state, cl_freq, PDF_DEFLATE_CODE_LENGTH_CODES, MAX_CODE_LENGTH_BITS, cl_len);
+    build_codes(cl_len, PDF_DEFLATE_CODE_LENGTH_CODES, cl_code);
+
+    size_t hclen = PDF_DEFLATE_CODE_LENGTH_CODES;
+    while (hclen > 4 && cl_len[code_length_order[hclen - 1]] == 0)
+        --hclen;
+
+    // Short streams are often smaller with the fixed codes than with the header of the dynamic ones.
+    // Extra bits are the same for both and don't need to be counted.
+    size_t dynamic_bits = 5 + 5 + 4 + 3 * hclen;
+    size_t fixed_bits = 0;
+
+    for (size_t i = 0; i < rle_symbols; ++i) {
+        uint8_t symbol = rle[2 * i];
+        dynamic_bits += cl_len[symbol] + (symbol >= 16 ? code_length_extra[symbol - 16] : 0);
+    }
+
+    for (size_t i = 0; i < PDF_DEFLATE_LIT_CODES; ++i) {
+        dynamic_bits += (size_t)state->lit_freq[i] * state->lit_len[i];
+        fixed_bits += (size_t)state->lit_freq[i] * (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    }
+
+    for (size_t i = 0; i < PDF_DEFLATE_DIST_CODES; ++i) {
+        dynamic_bits += (size_t)state->dist_freq[i] * state->dist_len[i];
+        fixed_bits += (size_t)state->dist_freq[i] * 5;
+    }
+
+    struct bit_writer w = {out, out_len, 0, 0, 0, false};
+
+    // zlib header: deflate with the window size, no preset dictionary.
+    uint32_t header = ((PDF_DEFLATE_WINDOW_BITS - 8) << 12) | (8 << 8);
+    header += 31 - header % 31;
+    put_bits(&w, header >> 8, 8);
+    put_bits(&w, header & 0xFF, 8);
+
+    // A single final block.
+    put_bits(&w, 1, 1);
+
+    if (dynamic_bits < fixed_bits) {
+        put_bits(&w, 2, 2);
+        put_bits(&w, (uint32_t)(hlit - 257), 5);
+        put_bits(&w, (uint32_t)(hdist - 1), 5);
+        put_bits(&w, (uint32_t)(hclen - 4), 4);
+
+        for (size_t i = 0; i < hclen; ++i)
+            put_bits(&w, cl_len[code_length_order[i]], 3);
+
+        for (size_t i = 0; i < rle_symbols; ++i) {
+            uint8_t symbol = rle[2 * i];
+            put_bits(&w, cl_code[symbol], cl_len[symbol]);
+            if (symbol >= 16)
+                put_bits(&w, rle[2 * i + 1], code_length_extra[symbol - 16]);
+        }
+    } else {
+        put_bits(&w, 1, 2);
+
+        for (size_t i = 0; i < PDF_DEFLATE_LIT_CODES; ++i)
+            state->lit_len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+
+        for (size_t i = 0; i < PDF_DEFLATE_DIST_CODES; ++i)
+            state->dist_len[i] = 5;
+    }
+
+    build_codes(state->lit_len, PDF_DEFLATE_LIT_CODES, state->lit_code);
+    build_codes(state->dist_len, PDF_DEFLATE_DIST_CODES, state->dist_code);
+
+    struct write_sink writer = {state, &w};
+    lz77(state, in, in_len, writer);
+    put_bits(&w, state->lit_code[END_OF_BLOCK], state->lit_len[END_OF_BLOCK]);
+
+    if (w.bit_count > 0)
+        put_bits(&w, 0, 8 - w.bit_count); // Flush the last byte.
+
+    uint32_t checksum = adler32(in, in_len);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        put_bits(&w, (checksum >> shift) & 0xFF, 8);
+
+    return w.overflow ? 0 : w.pos;
+}
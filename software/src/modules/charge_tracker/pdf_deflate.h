@@ -0,0 +1,58 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small deflate encoder for PDF content streams (FlateDecode).
+// Content streams are short and repetitive (operators and coordinates),
+// so LZ77 with a small window compresses them well without the memory
+// of a full zlib. The input is passed twice through the matcher: once to
+// count the symbols for the Huffman codes and once to write them.
+
+#define PDF_DEFLATE_WINDOW_BITS 11 // Matches reach back at most 2 KiB.
+#define PDF_DEFLATE_HASH_BITS 9
+#define PDF_DEFLATE_MAX_CHAIN 8
+
+#define PDF_DEFLATE_LIT_CODES 288 // Including the two reserved codes, which are part of the fixed code.
+#define PDF_DEFLATE_DIST_CODES 30
+#define PDF_DEFLATE_CODE_LENGTH_CODES 19
+
+struct pdf_deflate_state {
+    uint16_t head[1 << PDF_DEFLATE_HASH_BITS]; // Last position + 1 of each hash. 0 if none.
+    uint16_t prev[1 << PDF_DEFLATE_WINDOW_BITS]; // Previous position + 1 with the same hash.
+
+    uint16_t lit_freq[PDF_DEFLATE_LIT_CODES];
+    uint16_t dist_freq[PDF_DEFLATE_DIST_CODES];
+    uint8_t lit_len[PDF_DEFLATE_LIT_CODES];
+    uint8_t dist_len[PDF_DEFLATE_DIST_CODES];
+    uint16_t lit_code[PDF_DEFLATE_LIT_CODES];
+    uint16_t dist_code[PDF_DEFLATE_DIST_CODES];
+
+    // Scratch space for building a Huffman tree.
+    uint32_t node_weight[2 * PDF_DEFLATE_LIT_CODES];
+    uint16_t node_parent[2 * PDF_DEFLATE_LIT_CODES];
+    uint16_t leaves[PDF_DEFLATE_LIT_CODES];
+};
+
+// Compresses in into out as a zlib stream.
+// Returns the length of the zlib stream or 0 if it didn't fit into out.
+size_t pdf_deflate(struct pdf_deflate_state *state, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
@@ -130,8 +130,8 @@ typedef SSIZE_T ssize_t;
 #include <functional>
 
 #include "pdfgen.h"
+#include "pdf_deflate.h"
 
-#define PDF_MAX_OBJECTS 2400
 #define PDF_MAX_OBJECTS_PER_PAGE 100
 
 #define RGB_R(c) (((c) >> 16) & 0xff)
@@ -250,6 +250,7 @@ struct pdf_doc {
     std::vector<int> page_indices;
     size_t objects_in_use = 0;
     size_t offsets_in_use = 0;
+    size_t offsets_size = 0;
     int current_page_id = 0;
     int pages_index = 0;
     int page_count = 0;
@@ -275,6 +276,11 @@ struct pdf_doc {
 
     struct dstr scratch_str;
 
+    bool compress_streams = true;
+    std::unique_ptr<struct pdf_deflate_state> deflate_state;
+    std::unique_ptr<uint8_t[]> deflate_buf;
+    size_t deflate_buf_size = 0;
+
     struct {
         int current_obj_index;
         bool is_image;
@@ -531,7 +537,6 @@ struct pdf_doc *pdf_create(float width, float height, const struct pdf_info *inf
     pdf->width = width;
     pdf->height = height;
     pdf->objects = std::unique_ptr<struct pdf_object[]>(new struct pdf_object[PDF_MAX_OBJECTS_PER_PAGE]());
-    pdf->offsets = std::unique_ptr<uint16_t[]>(new uint16_t[PDF_MAX_OBJECTS]());
 
     /* We don't want to use ID 0 */
     pdf_add_object(pdf, OBJ_none);
@@ -695,15 +700,22 @@ static void pdf_flush_write_buf(struct pdf_doc *pdf, int target_free_space) {
     if (target_free_space > ARRAY_SIZE(pdf->write_buf))
         target_free_space = ARRAY_SIZE(pdf->write_buf);
 
-    while (target_free_space > (ARRAY_SIZE(pdf->write_buf) - pdf->write_buf_used)) {
+    while (pdf->write_buf_used > 0 && target_free_space > (ARRAY_SIZE(pdf->write_buf) - pdf->write_buf_used)) {
         ssize_t written = pdf->write_fn(head, pdf->write_buf_used);
         if (written <= 0) {
             printf("write_fn failed %zd.", written);
             pdf->write_error_occurred = true;
+            // Drop the buffer: Nothing will be written after an error anyway.
+            pdf->write_buf_used = 0;
+            return;
         }
         pdf->write_buf_used -= written;
         head += written;
     }
+
+    // Keep the rest of a partial write at the start of the buffer.
+    if (head != pdf->write_buf && pdf->write_buf_used > 0)
+        memmove(pdf->write_buf, head, pdf->write_buf_used);
 }
 
 static int pdf_printf(struct pdf_doc *pdf, const char *fmt, ...)
@@ -774,6 +786,9 @@ static int pdf_save_object(struct pdf_doc *pdf, int index)
     if (object->type == OBJ_none)
         return -ENOENT;
 
+    if (pdf->offsets_in_use >= pdf->offsets_size)
+        return pdf_set_err(pdf, -ENOMEM, "More objects than announced by pdf_notify_page");
+
     pdf->offsets[pdf->offsets_in_use++] = pdf->write_buf_written - pdf->last_write_buf_written;
     pdf->last_write_buf_written = pdf->write_buf_written;
 
@@ -946,6 +961,11 @@ int pdf_save_file(struct pdf_doc *pdf)
     time_t now = time(nullptr);
     char saved_locale[32];
 
+    // All objects are known from the pdf_notify_page calls: The header objects,
+    // the objects of all pages and the pages and catalog objects at the end.
+    pdf->offsets_size = (pdf->pages_index == 0 ? pdf->objects_in_use : pdf->pages_index) + 2;
+    pdf->offsets = std::unique_ptr<uint16_t[]>(new uint16_t[pdf->offsets_size]());
+
     force_locale(saved_locale, sizeof(saved_locale));
 
     pdf_printf(pdf, "%%PDF-1.3\r\n");
@@ -992,6 +1012,9 @@ int pdf_save_file(struct pdf_doc *pdf)
                 pdf->objects_in_use -= to_delete;
             }
         }
+
+        // Send every page right away, so that the first bytes don't have to wait for the write buffer to fill.
+        pdf_flush_write_buf(pdf, ARRAY_SIZE(pdf->write_buf));
     }
 
 /*
@@ -1078,6 +1101,25 @@ static int pdf_add_stream(struct pdf_doc *pdf, const char *buffer)
     while (len >= 1 && (buffer[len - 1] == '\r' || buffer[len - 1] == '\n'))
         len--;
 
+    if (pdf->compress_streams && len > 0) {
+        if (!pdf->deflate_state)
+            pdf->deflate_state = std::unique_ptr<struct pdf_deflate_state>(new struct pdf_deflate_state);
+
+        // Only compress if that makes the stream shorter.
+        if (pdf->deflate_buf_size < len) {
+            pdf->deflate_buf_size = len + 512;
+            pdf->deflate_buf = std::unique_ptr<uint8_t[]>(new uint8_t[pdf->deflate_buf_size]);
+        }
+
+        size_t compressed_len = pdf_deflate(pdf->deflate_state.get(), (const uint8_t *)buffer, len, pdf->deflate_buf.get(), len - 1);
+        if (compressed_len > 0) {
+            pdf_printf(pdf, "<< /Length %zu /Filter /FlateDecode >>stream\r\n", compressed_len);
+            pdf_write(pdf, (const char *)pdf->deflate_buf.get(), compressed_len);
+            pdf_printf(pdf, "\r\nendstream\r\n");
+            return 0;
+        }
+    }
+
     pdf_printf(pdf, "<< /Length %zu >>stream\r\n", len);
     pdf_write(pdf, buffer, len);
     pdf_printf(pdf, "\r\nendstream\r\n");
@@ -2302,3 +2344,7 @@ int pdf_add_page_callback(struct pdf_doc *pdf, std::function<int(struct pdf_doc
     pdf->page_fn = std::move(cb);
     return 0;
 }
+
+void pdf_set_compression(struct pdf_doc *pdf, bool compress_streams) {
+    pdf->compress_streams = compress_streams;
+}
@@ -443,6 +443,14 @@ int pdf_add_page_callback(struct pdf_doc *pdf, std::function<int(struct pdf_doc
 
 void pdf_notify_page(struct pdf_doc *pdf, uint32_t stream_count, uint32_t image_count);
 
+/**
+ * Enable or disable FlateDecode compression of content streams.
+ * Streams are compressed by default, unless that doesn't make them shorter.
+ * @param pdf PDF document to update
+ * @param compress_streams true to compress content streams
+ */
+void pdf_set_compression(struct pdf_doc *pdf, bool compress_streams);
+
 /*int pdf_add_image(struct pdf_doc *pdf, struct pdf_object *page,
                          struct pdf_object *image, float x, float y,
                          float width, float height);*/
@@ -157,6 +157,9 @@ void Debug::pre_setup()
         {"conf_array_buf_size", Config::Uint32(0)},
         {"conf_object_buf_size", Config::Uint32(0)},
         {"conf_union_buf_size", Config::Uint32(0)},
+        {"conf_slot_allocs", Config::Uint32(0)},
+        {"conf_slot_reallocs", Config::Uint32(0)},
+        {"conf_slot_bytes_moved", Config::Uint32(0)},
     });
 
     state_hwm_prototype = Config::Object({
@@ -216,6 +219,9 @@ void Debug::setup()
         state_slow.get("conf_array_buf_size")->updateUint(array_buf_size * sizeof(ConfArraySlot));
         state_slow.get("conf_object_buf_size")->updateUint(object_buf_size * sizeof(ConfObjectSlot));
         state_slow.get("conf_union_buf_size")->updateUint(union_buf_size * sizeof(ConfUnionSlot));
+        state_slow.get("conf_slot_allocs")->updateUint(config_slot_stats.allocations);
+        state_slow.get("conf_slot_reallocs")->updateUint(config_slot_stats.reallocations);
+        state_slow.get("conf_slot_bytes_moved")->updateUint(config_slot_stats.bytes_moved);
 
         if (dram_info.largest_free_block < 2000) {
             logger.printfln("Heap full. Largest block is %u bytes.", dram_info.largest_free_block);
@@ -344,7 +350,7 @@ void Debug::register_urls()
         StringWriter sw(buf, sizeof(buf));
         task_scheduler.await([&sw]() {
             for (const auto &reg : api.states) {
-                sw.printf("%4u %s\n", reg.config->string_length(), reg.path);
+                sw.printf("%4u %s\n", reg.string_length(), reg.path);
             }
         });
         return req.send(200, "text/plain", sw.getPtr(), static_cast<ssize_t>(sw.getLength()));
@@ -28,7 +28,7 @@
 
 void Eco::pre_setup()
 {
-    this->trace_buffer_index = logger.alloc_trace_buffer("eco", 1 << 20);
+    this->trace_buffer_index = logger.alloc_trace_buffer("eco", 1 << 20, true);
 
     config = ConfigRoot{Config::Object({
         {"charge_plan_active", Config::Bool(false)},
@@ -135,8 +135,15 @@ void EMEnergyAnalysis::register_events()
 
             uint32_t power_index;
             if (meters.get_cached_power_index(slot, &power_index)) {
-                event.registerEvent(meters.get_path(slot, Meters::PathType::Values), {power_index}, [this, slot](const Config *config_power) {
-                    update_history_meter_power(slot, config_power->asFloat());
+                // meters/N/values has no Config per value: Read the power from the meter on every values update.
+                event.registerEvent(meters.get_path(slot, Meters::PathType::Values), {}, [this, slot, power_index](const Config */*config_values*/) {
+                    float power;
+                    meters.get_value_by_index(slot, power_index, &power);
+
+                    if (!isnan(power)) {
+                        update_history_meter_power(slot, power);
+                    }
+
                     return EventResult::OK;
                 });
             } else {
@@ -41,12 +41,9 @@ int64_t Event::registerEvent(const String &path, const std::vector<ConfPath> val
         logger.printfln("Attempted to register event for %s before the REGISTER_EVENTS BootStage!", path.c_str());
     }
 
-    auto api_states = api.states.size();
-    for (size_t i = 0; i < api_states; i++) {
-        if (path.length() != api.states[i].path_len || path != api.states[i].path) {
-            continue;
-        }
-
+    APIPathLookup lookup = api.lookupPath(path.c_str(), path.length());
+    if (lookup.kind == APIPathKind::State) {
+        size_t i = lookup.idx;
         Config *config = api.states[i].config;
         Config *ptr = config;
 
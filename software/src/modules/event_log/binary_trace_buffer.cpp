@@ -0,0 +1,574 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "binary_trace_buffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define RECORD_HEADER_SIZE (sizeof(uint32_t) + 2 * sizeof(const char *) + 3)
+
+static_assert(RECORD_HEADER_SIZE + BINARY_TRACE_MAX_ARG_LENGTH <= BINARY_TRACE_MAX_SLOTS_PER_RECORD * BINARY_TRACE_SLOT_DATA_SIZE, "Records don't fit into the maximum number of slots");
+static_assert(BINARY_TRACE_MAX_ARG_LENGTH <= UINT8_MAX, "Argument length must fit into a byte");
+
+#define STRING_INLINE  0
+#define STRING_POINTER 1
+
+enum class ArgType : uint8_t {
+    None, // %% and unsupported conversions
+    Int,
+    Long,
+    LongLong,
+    Size,
+    IntMax,
+    PtrDiff,
+    Double,
+    LongDouble,
+    String,
+    Pointer,
+    Count, // %n
+};
+
+struct ConversionSpec {
+    const char *start;
+    const char *end;
+    ArgType type;
+    bool width_star;
+    bool precision_star;
+    int precision; // -1 if not given.
+};
+
+// Parses the conversion starting at the '%' at fmt.
+// Both sides use this, so that the arguments are read back with the types they were stored with.
+static bool parse_spec(const char *fmt, ConversionSpec *spec)
+{
+    const char *p = fmt + 1;
+
+    spec->start = fmt;
+    spec->type = ArgType::None;
+    spec->width_star = false;
+    spec->precision_star = false;
+    spec->precision = -1;
+
+    if (*p == '%') {
+        spec->end = p + 1;
+        return true;
+    }
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        ++p;
+    }
+
+    if (*p == '*') {
+        spec->width_star = true;
+        ++p;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            ++p;
+        }
+    }
+
+    if (*p == '.') {
+        ++p;
+        spec->precision = 0;
+
+        if (*p == '*') {
+            spec->precision_star = true;
+            ++p;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                spec->precision = spec->precision * 10 + (*p - '0');
+                ++p;
+            }
+        }
+    }
+
+    ArgType int_type = ArgType::Int;
+    bool long_double = false;
+
+    if (p[0] == 'h') {
+        p += p[1] == 'h' ? 2 : 1;
+    } else if (p[0] == 'l') {
+        if (p[1] == 'l') {
+            int_type = ArgType::LongLong;
+            p += 2;
+        } else {
+            int_type = ArgType::Long;
+            ++p;
+        }
+    } else if (p[0] == 'z') {
+        int_type = ArgType::Size;
+        ++p;
+    } else if (p[0] == 'j') {
+        int_type = ArgType::IntMax;
+        ++p;
+    } else if (p[0] == 't') {
+        int_type = ArgType::PtrDiff;
+        ++p;
+    } else if (p[0] == 'L') {
+        long_double = true;
+        ++p;
+    }
+
+    switch (*p) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            spec->type = int_type;
+            break;
+
+        case 'c':
+            if (int_type != ArgType::Int) {
+                return false;
+            }
+            spec->type = ArgType::Int;
+            break;
+
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec->type = long_double ? ArgType::LongDouble : ArgType::Double;
+            break;
+
+        case 's':
+            if (int_type != ArgType::Int) {
+                return false;
+            }
+            spec->type = ArgType::String;
+            break;
+
+        case 'p':
+            spec->type = ArgType::Pointer;
+            break;
+
+        case 'n':
+            spec->type = ArgType::Count;
+            break;
+
+        default:
+            return false;
+    }
+
+    spec->end = p + 1;
+    return true;
+}
+
+static size_t arg_size(ArgType type)
+{
+    switch (type) {
+        case ArgType::Int:        return sizeof(int);
+        case ArgType::Long:       return sizeof(long);
+        case ArgType::LongLong:   return sizeof(long long);
+        case ArgType::Size:       return sizeof(size_t);
+        case ArgType::IntMax:     return sizeof(intmax_t);
+        case ArgType::PtrDiff:    return sizeof(ptrdiff_t);
+        case ArgType::Double:     return sizeof(double);
+        case ArgType::LongDouble: return sizeof(double);
+        case ArgType::Pointer:    return sizeof(void *);
+        default:                  return 0;
+    }
+}
+
+template<typename T>
+static void put(uint8_t *buf, size_t *pos, T value)
+{
+    memcpy(buf + *pos, &value, sizeof(value));
+    *pos += sizeof(value);
+}
+
+template<typename T>
+static T take(const uint8_t *buf, size_t *pos)
+{
+    T value;
+    memcpy(&value, buf + *pos, sizeof(value));
+    *pos += sizeof(value);
+    return value;
+}
+
+// Returns the number of bytes written to args. Sets BINARY_TRACE_FLAG_TRUNCATED if not all arguments fit.
+static size_t encode_args(const char *fmt, va_list args, bool (*is_static)(const char *str), uint8_t *out, uint8_t *flags)
+{
+    size_t pos = 0;
+
+    for (const char *p = strchr(fmt, '%'); p != nullptr; p = strchr(p, '%')) {
+        ConversionSpec spec;
+
+        if (!parse_spec(p, &spec)) {
+            break;
+        }
+
+        p = spec.end;
+
+        size_t needed = (spec.width_star ? sizeof(int) : 0) + (spec.precision_star ? sizeof(int) : 0) + arg_size(spec.type);
+        if (spec.type == ArgType::String) {
+            needed += 1 + sizeof(const char *);
+        }
+
+        if (pos + needed > BINARY_TRACE_MAX_ARG_LENGTH) {
+            *flags |= BINARY_TRACE_FLAG_TRUNCATED;
+            break;
+        }
+
+        if (spec.width_star) {
+            put(out, &pos, va_arg(args, int));
+        }
+
+        int precision = spec.precision;
+        if (spec.precision_star) {
+            precision = va_arg(args, int);
+            put(out, &pos, precision);
+        }
+
+        switch (spec.type) {
+            case ArgType::None:                                                             break;
+            case ArgType::Int:        put(out, &pos, va_arg(args, int));                   break;
+            case ArgType::Long:       put(out, &pos, va_arg(args, long));                  break;
+            case ArgType::LongLong:   put(out, &pos, va_arg(args, long long));             break;
+            case ArgType::Size:       put(out, &pos, va_arg(args, size_t));                break;
+            case ArgType::IntMax:     put(out, &pos, va_arg(args, intmax_t));              break;
+            case ArgType::PtrDiff:    put(out, &pos, va_arg(args, ptrdiff_t));             break;
+            case ArgType::Double:     put(out, &pos, va_arg(args, double));                break;
+            case ArgType::LongDouble: put(out, &pos, static_cast<double>(va_arg(args, long double))); break;
+            case ArgType::Pointer:    put(out, &pos, va_arg(args, void *));                break;
+            case ArgType::Count:      (void)va_arg(args, void *);                          break;
+
+            case ArgType::String: {
+                const char *str = va_arg(args, const char *);
+                if (str == nullptr) {
+                    str = "(null)";
+                }
+
+                if (is_static(str)) {
+                    out[pos++] = STRING_POINTER;
+                    put(out, &pos, str);
+                    break;
+                }
+
+                // The string might not be NUL-terminated if a precision is given.
+                size_t len = precision >= 0 ? strnlen(str, static_cast<size_t>(precision)) : strlen(str);
+                size_t space = BINARY_TRACE_MAX_ARG_LENGTH - pos - 2; // -2 for the tag and the NUL-terminator
+
+                if (len > space) {
+                    len = space;
+                    *flags |= BINARY_TRACE_FLAG_TRUNCATED;
+                }
+
+                out[pos++] = STRING_INLINE;
+                memcpy(out + pos, str, len);
+                pos += len;
+                out[pos++] = '\0';
+                break;
+            }
+        }
+
+        if ((*flags & BINARY_TRACE_FLAG_TRUNCATED) != 0) {
+            break;
+        }
+    }
+
+    return pos;
+}
+
+void BinaryTraceBuffer::setup(void *memory, size_t size, bool (*is_static_fn)(const char *str))
+{
+    slots = static_cast<Slot *>(memory);
+    slots_len = static_cast<uint32_t>(size / sizeof(Slot));
+    is_static = is_static_fn;
+
+    if (slots_len < BINARY_TRACE_MAX_SLOTS_PER_RECORD) {
+        slots_len = 0;
+    }
+}
+
+void BinaryTraceBuffer::vrecord(uint32_t timestamp_ms, uint8_t flags, const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+{
+    if (slots_len == 0) {
+        return;
+    }
+
+    if (!is_static(fmt)) {
+        char text[BINARY_TRACE_MAX_ARG_LENGTH];
+        vsnprintf(text, sizeof(text), fmt, args);
+        record(timestamp_ms, flags, prefix, prefix_len, "%s", text);
+        return;
+    }
+
+    if (prefix != nullptr && !is_static(prefix)) {
+        prefix = "";
+        prefix_len = 0;
+    }
+
+    uint8_t payload[RECORD_HEADER_SIZE + BINARY_TRACE_MAX_ARG_LENGTH];
+    size_t arg_len = encode_args(fmt, args, is_static, payload + RECORD_HEADER_SIZE, &flags);
+
+    size_t pos = 0;
+    put(payload, &pos, timestamp_ms);
+    put(payload, &pos, fmt);
+    put(payload, &pos, prefix);
+    payload[pos++] = static_cast<uint8_t>(prefix_len > UINT8_MAX ? UINT8_MAX : prefix_len);
+    payload[pos++] = flags;
+    payload[pos++] = static_cast<uint8_t>(arg_len);
+
+    size_t payload_len = RECORD_HEADER_SIZE + arg_len;
+    uint32_t span = static_cast<uint32_t>((payload_len + BINARY_TRACE_SLOT_DATA_SIZE - 1) / BINARY_TRACE_SLOT_DATA_SIZE);
+    uint32_t first = head.fetch_add(span, std::memory_order_relaxed);
+
+    for (uint32_t i = 0; i < span; ++i) {
+        slots[(first + i) % slots_len].seq.store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (uint32_t i = 0; i < span; ++i) {
+        Slot *slot = &slots[(first + i) % slots_len];
+        size_t offset = i * BINARY_TRACE_SLOT_DATA_SIZE;
+        size_t len = payload_len - offset < BINARY_TRACE_SLOT_DATA_SIZE ? payload_len - offset : BINARY_TRACE_SLOT_DATA_SIZE;
+
+        slot->span = i == 0 ? static_cast<uint8_t>(span) : 0;
+        memcpy(slot->data, payload + offset, len);
+    }
+
+    for (uint32_t i = 0; i < span; ++i) {
+        slots[(first + i) % slots_len].seq.store(first + i + 1, std::memory_order_release);
+    }
+}
+
+void BinaryTraceBuffer::record(uint32_t timestamp_ms, uint8_t flags, const char *prefix, size_t prefix_len, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vrecord(timestamp_ms, flags, prefix, prefix_len, fmt, args);
+    va_end(args);
+}
+
+uint32_t BinaryTraceBuffer::first_slot() const
+{
+    uint32_t end = head.load(std::memory_order_acquire);
+    return end > slots_len ? end - slots_len : 0;
+}
+
+uint32_t BinaryTraceBuffer::end_slot() const
+{
+    return head.load(std::memory_order_acquire);
+}
+
+uint32_t BinaryTraceBuffer::read_record(uint32_t slot_idx, Record *out) const
+{
+    uint8_t payload[BINARY_TRACE_MAX_SLOTS_PER_RECORD * BINARY_TRACE_SLOT_DATA_SIZE];
+    uint32_t span = 1;
+
+    // Every slot of the record must carry its sequence number before it is copied, span and data included.
+    for (uint32_t i = 0; i < span; ++i) {
+        const Slot *slot = &slots[(slot_idx + i) % slots_len];
+
+        if (slot->seq.load(std::memory_order_acquire) != slot_idx + i + 1) {
+            return 0;
+        }
+
+        uint8_t slot_span = slot->span;
+        memcpy(payload + i * BINARY_TRACE_SLOT_DATA_SIZE, slot->data, BINARY_TRACE_SLOT_DATA_SIZE);
+
+        if (i == 0) {
+            span = slot_span;
+            if (span == 0 || span > BINARY_TRACE_MAX_SLOTS_PER_RECORD) {
+                return 0;
+            }
+        } else if (slot_span != 0) {
+            return 0;
+        }
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // ... and still carry it afterwards. A writer that reserved any of these slots in the meantime changed it.
+    for (uint32_t i = 0; i < span; ++i) {
+        if (slots[(slot_idx + i) % slots_len].seq.load(std::memory_order_relaxed) != slot_idx + i + 1) {
+            return 0;
+        }
+    }
+
+    size_t pos = 0;
+    out->timestamp_ms = take<uint32_t>(payload, &pos);
+    out->fmt = take<const char *>(payload, &pos);
+    out->prefix = take<const char *>(payload, &pos);
+    out->prefix_len = payload[pos++];
+    out->flags = payload[pos++];
+    out->arg_len = payload[pos++];
+
+    if (RECORD_HEADER_SIZE + out->arg_len > span * BINARY_TRACE_SLOT_DATA_SIZE) {
+        return 0;
+    }
+
+    // vrecord stores only static format strings and prefixes. format_message dereferences both.
+    if (out->fmt == nullptr || !is_static(out->fmt) || (out->prefix != nullptr && !is_static(out->prefix))) {
+        return 0;
+    }
+
+    memcpy(out->args, payload + pos, out->arg_len);
+
+    return span;
+}
+
+bool BinaryTraceBuffer::read(uint32_t *cursor, uint32_t end, Record *out) const
+{
+    if (slots_len == 0) {
+        return false;
+    }
+
+    for (;;) {
+        // Writers overwrote the slots at the cursor.
+        uint32_t oldest = first_slot();
+        if (static_cast<int32_t>(oldest - *cursor) > 0) {
+            *cursor = oldest;
+        }
+
+        if (static_cast<int32_t>(end - *cursor) <= 0) {
+            return false;
+        }
+
+        uint32_t span = read_record(*cursor, out);
+
+        if (span > 0) {
+            *cursor += span;
+            return true;
+        }
+
+        ++*cursor;
+    }
+}
+
+size_t BinaryTraceBuffer::format_message(const Record &record, char *buf, size_t buf_len)
+{
+    if (buf_len == 0) {
+        return 0;
+    }
+
+    size_t written = 0;
+    size_t pos = 0;
+    bool stopped = false;
+    const char *p = record.fmt;
+
+    auto append = [&](const char *str, size_t len) {
+        size_t space = buf_len - 1 - written;
+        if (len > space) {
+            len = space;
+        }
+        memcpy(buf + written, str, len);
+        written += len;
+    };
+
+    while (*p != '\0' && !stopped) {
+        const char *percent = strchr(p, '%');
+
+        if (percent == nullptr) {
+            append(p, strlen(p));
+            break;
+        }
+
+        append(p, static_cast<size_t>(percent - p));
+
+        ConversionSpec spec;
+        if (!parse_spec(percent, &spec)) {
+            // Nothing was stored for this and the following conversions.
+            append(percent, strlen(percent));
+            break;
+        }
+
+        p = spec.end;
+
+        if (spec.type == ArgType::None) {
+            append("%", 1);
+            continue;
+        }
+
+        size_t needed = (spec.width_star ? sizeof(int) : 0) + (spec.precision_star ? sizeof(int) : 0) + arg_size(spec.type);
+        if (spec.type == ArgType::String) {
+            needed += 1;
+        }
+
+        if (pos + needed > record.arg_len) {
+            stopped = true;
+            break;
+        }
+
+        // Rebuild the conversion with stored '*' values and without 'L', because long doubles are stored as doubles.
+        char conv[32];
+        size_t conv_len = 0;
+
+        for (const char *c = spec.start; c < spec.end && conv_len < sizeof(conv) - 12; ++c) {
+            if (*c == '*') {
+                conv_len += static_cast<size_t>(snprintf(conv + conv_len, sizeof(conv) - conv_len, "%d", take<int>(record.args, &pos)));
+            } else if (*c != 'L') {
+                conv[conv_len++] = *c;
+            }
+        }
+
+        conv[conv_len] = '\0';
+
+        size_t space = buf_len - written;
+        int res = 0;
+
+        switch (spec.type) {
+            case ArgType::Int:        res = snprintf(buf + written, space, conv, take<int>(record.args, &pos));       break;
+            case ArgType::Long:       res = snprintf(buf + written, space, conv, take<long>(record.args, &pos));      break;
+            case ArgType::LongLong:   res = snprintf(buf + written, space, conv, take<long long>(record.args, &pos)); break;
+            case ArgType::Size:       res = snprintf(buf + written, space, conv, take<size_t>(record.args, &pos));    break;
+            case ArgType::IntMax:     res = snprintf(buf + written, space, conv, take<intmax_t>(record.args, &pos));  break;
+            case ArgType::PtrDiff:    res = snprintf(buf + written, space, conv, take<ptrdiff_t>(record.args, &pos)); break;
+            case ArgType::Double:
+            case ArgType::LongDouble: res = snprintf(buf + written, space, conv, take<double>(record.args, &pos));    break;
+            case ArgType::Pointer:    res = snprintf(buf + written, space, conv, take<void *>(record.args, &pos));    break;
+            case ArgType::Count:                                                                                     break;
+
+            case ArgType::String: {
+                const char *str;
+
+                if (record.args[pos++] == STRING_POINTER) {
+                    if (pos + sizeof(const char *) > record.arg_len) {
+                        stopped = true;
+                        break;
+                    }
+                    str = take<const char *>(record.args, &pos);
+                } else {
+                    str = reinterpret_cast<const char *>(record.args + pos);
+                    pos += strnlen(str, record.arg_len - pos) + 1;
+                }
+
+                res = snprintf(buf + written, space, conv, str);
+                break;
+            }
+
+            case ArgType::None:
+                break;
+        }
+
+        if (res > 0) {
+            written += static_cast<size_t>(res) < space ? static_cast<size_t>(res) : space - 1;
+        }
+
+        // Text between the last stored argument and the first missing one is dropped as well.
+        if ((record.flags & BINARY_TRACE_FLAG_TRUNCATED) != 0 && pos >= record.arg_len) {
+            break;
+        }
+    }
+
+    if ((record.flags & BINARY_TRACE_FLAG_TRUNCATED) != 0) {
+        append("...", 3);
+    }
+
+    buf[written] = '\0';
+    return written;
+}
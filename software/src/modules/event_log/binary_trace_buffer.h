@@ -0,0 +1,103 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BINARY_TRACE_SLOT_SIZE 32
+#define BINARY_TRACE_SLOT_DATA_SIZE (BINARY_TRACE_SLOT_SIZE - sizeof(uint32_t) - 1)
+#define BINARY_TRACE_MAX_SLOTS_PER_RECORD 11
+#define BINARY_TRACE_MAX_ARG_LENGTH 255
+
+#define BINARY_TRACE_FLAG_PREFIXED       0x01 // Timestamp and prefix columns as written by EventLog::vsnprintf_prefixed.
+#define BINARY_TRACE_FLAG_SKIP_PREFIX    0x02 // Prefixed without the prefix column.
+#define BINARY_TRACE_FLAG_TIMESTAMP_ONLY 0x04 // Only the timestamp, as written by EventLog::trace_timestamp.
+#define BINARY_TRACE_FLAG_TRUNCATED      0x08 // The arguments didn't fit. Formatting stops after the last stored one.
+
+// Stores trace messages as the format string pointer and the raw arguments
+// instead of formatting them. The message is formatted when the buffer is read.
+//
+// Any number of tasks can write without locking: A writer reserves consecutive
+// fixed-size slots with a single atomic add and publishes each slot with a
+// sequence number. Readers copy a record and discard it if a sequence number
+// changed in the meantime, so a reader never blocks writers. When the buffer
+// is full, new records overwrite the oldest ones.
+//
+// Format strings and prefixes must outlive the buffer. Format strings for which
+// is_static returns false are formatted immediately and stored as text. String
+// arguments in static memory are stored as pointers, all others are copied.
+class BinaryTraceBuffer
+{
+public:
+    struct Record {
+        uint32_t timestamp_ms;
+        const char *fmt;
+        const char *prefix;
+        uint8_t prefix_len;
+        uint8_t flags;
+        uint8_t arg_len;
+        uint8_t args[BINARY_TRACE_MAX_ARG_LENGTH];
+    };
+
+    BinaryTraceBuffer() {}
+
+    BinaryTraceBuffer(const BinaryTraceBuffer &other) = delete;
+    BinaryTraceBuffer &operator=(const BinaryTraceBuffer &other) = delete;
+
+    // memory must be zero-initialized and stay valid. size is rounded down to whole slots.
+    void setup(void *memory, size_t size, bool (*is_static)(const char *str));
+
+    void vrecord(uint32_t timestamp_ms, uint8_t flags, const char *prefix, size_t prefix_len, const char *fmt, va_list args);
+    void record(uint32_t timestamp_ms, uint8_t flags, const char *prefix, size_t prefix_len, const char *fmt, ...);
+
+    // Slot index range currently held by the buffer. Pass first_slot() as cursor and end_slot() as end to read().
+    uint32_t first_slot() const;
+    uint32_t end_slot() const;
+
+    // Copies the next complete record at or after cursor into out and advances cursor past it.
+    // Returns false when cursor reached end. Records that are still being written are skipped.
+    bool read(uint32_t *cursor, uint32_t end, Record *out) const;
+
+    // Formats the message of a record without timestamp, prefix and line ending.
+    // Returns the length of the message, which is truncated to buf_len - 1.
+    static size_t format_message(const Record &record, char *buf, size_t buf_len);
+
+    size_t slot_count() const { return slots_len; }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq; // Absolute slot index + 1, or 0 while being written.
+        uint8_t span;              // Slots used by the record starting here, 0 for continuation slots.
+        uint8_t data[BINARY_TRACE_SLOT_DATA_SIZE];
+    };
+
+    static_assert(sizeof(Slot) == BINARY_TRACE_SLOT_SIZE, "Unexpected slot padding");
+
+    // Returns the number of slots used by the record or 0 if there is no complete record at slot_idx.
+    uint32_t read_record(uint32_t slot_idx, Record *out) const;
+
+    Slot *slots = nullptr;
+    uint32_t slots_len = 0;
+    bool (*is_static)(const char *str) = nullptr;
+    std::atomic<uint32_t> head{0};
+};
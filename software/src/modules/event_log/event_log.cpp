@@ -39,6 +39,7 @@
 #include "module_dependencies.h"
 #include "build.h"
 #include "tools.h"
+#include "tools/memory.h"
 
 void EventLog::pre_init()
 {
@@ -50,7 +51,7 @@ void EventLog::pre_init()
     printfln_prefixed("", 0, "Last reset reason was: %s", tf_reset_reason());
 }
 
-size_t EventLog::alloc_trace_buffer(const char *name, size_t size) {
+size_t EventLog::alloc_trace_buffer(const char *name, size_t size, bool binary) {
 #if defined(BOARD_HAS_PSRAM)
     if (boot_stage > BootStage::PRE_SETUP){
         esp_system_abort("Using alloc_trace_buffer after the pre_setup is not allowed!");
@@ -64,11 +65,26 @@ size_t EventLog::alloc_trace_buffer(const char *name, size_t size) {
         esp_system_abort("Maximum number of trace buffers exceeded!");
     }
 
-    trace_buffers[trace_buffers_in_use].name = name;
-    trace_buffers[trace_buffers_in_use].buf.setup(size);
+    auto &trace_buffer = trace_buffers[trace_buffers_in_use];
+    trace_buffer.name = name;
+    trace_buffer.binary = binary;
+
+    if (binary) {
+        void *memory = malloc_psram(size);
+        if (memory != nullptr) {
+            memset(memory, 0, size);
+            trace_buffer.binary_buf.setup(memory, size, string_is_in_rodata);
+        }
+    } else {
+        trace_buffer.buf.setup(size);
+    }
+
     ++trace_buffers_in_use;
     return trace_buffers_in_use - 1;
 #else
+    (void)name;
+    (void)size;
+    (void)binary;
     return -1;
 #endif
 }
@@ -117,20 +133,47 @@ void EventLog::register_urls()
 
         for (size_t i = 0; i < trace_buffers_in_use; ++i) {
             auto &trace_buffer = trace_buffers[i];
-            std::lock_guard<std::mutex> lock{trace_buffer.mutex};
-
-            char *first_chunk, *second_chunk;
-            size_t first_len, second_len;
-            trace_buffer.buf.get_chunks(&first_chunk, &first_len, &second_chunk, &second_len);
 
             char buf[128];
             size_t written = snprintf(buf, ARRAY_SIZE(buf), "__begin_%.100s__\n", trace_buffer.name);
             request.sendChunk(buf, written);
 
-            if (first_len > 0)
-                request.sendChunk(first_chunk, first_len);
-            if (second_len > 0)
-                request.sendChunk(second_chunk, second_len);
+            if (trace_buffer.binary) {
+                // Records written while sending are left for the next request.
+                const BinaryTraceBuffer &binary_buf = trace_buffer.binary_buf;
+                uint32_t cursor = binary_buf.first_slot();
+                uint32_t end = binary_buf.end_slot();
+                BinaryTraceBuffer::Record record;
+                char chunk_buf[CHUNK_SIZE]; // The HTTP task's stack is large enough.
+                size_t chunk_len = 0;
+
+                while (binary_buf.read(&cursor, end, &record)) {
+                    char line[EVENT_LOG_TIMESTAMP_LENGTH + 256];
+                    size_t line_len = format_binary_trace_record(record, line, ARRAY_SIZE(line));
+
+                    if (chunk_len + line_len > CHUNK_SIZE) {
+                        request.sendChunk(chunk_buf, chunk_len);
+                        chunk_len = 0;
+                    }
+
+                    memcpy(chunk_buf + chunk_len, line, line_len);
+                    chunk_len += line_len;
+                }
+
+                if (chunk_len > 0)
+                    request.sendChunk(chunk_buf, chunk_len);
+            } else {
+                std::lock_guard<std::mutex> lock{trace_buffer.mutex};
+
+                char *first_chunk, *second_chunk;
+                size_t first_len, second_len;
+                trace_buffer.buf.get_chunks(&first_chunk, &first_len, &second_chunk, &second_len);
+
+                if (first_len > 0)
+                    request.sendChunk(first_chunk, first_len);
+                if (second_len > 0)
+                    request.sendChunk(second_chunk, second_len);
+            }
 
             written = snprintf(buf, ARRAY_SIZE(buf), "__end_%.100s__\n", trace_buffer.name);
             request.sendChunk(buf, written);
@@ -154,20 +197,30 @@ void EventLog::post_setup()
 }
 
 void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */])
+{
+    format_timestamp(buf, millis());
+}
+
+void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */], uint32_t timestamp_ms)
 {
     struct timeval tv_now;
     struct tm timeinfo;
 
     if (rtc.clock_synced(&tv_now)) {
+        // Binary trace records are formatted later. Go back to the time they were written.
+        uint32_t age_ms = millis() - timestamp_ms;
+        int64_t usecs = static_cast<int64_t>(tv_now.tv_sec) * 1000000 + tv_now.tv_usec - static_cast<int64_t>(age_ms) * 1000;
+        tv_now.tv_sec = static_cast<time_t>(usecs / 1000000);
+        tv_now.tv_usec = static_cast<suseconds_t>(usecs % 1000000);
+
         localtime_r(&tv_now.tv_sec, &timeinfo);
 
         // ISO 8601 allows omitting the T between date and time. Also  ',' is the preferred decimal sign.
         size_t written = strftime(buf, EVENT_LOG_TIMESTAMP_LENGTH + 1, "%F %T", &timeinfo);
         snprintf(buf + written, EVENT_LOG_TIMESTAMP_LENGTH + 1 - written, ",%03ld", tv_now.tv_usec / 1000);
     } else {
-        uint32_t now = millis();
-        uint32_t secs = now / 1000;
-        uint32_t ms = now % 1000;
+        uint32_t secs = timestamp_ms / 1000;
+        uint32_t ms = timestamp_ms % 1000;
         size_t to_write = snprintf_u(nullptr, 0, "%" PRIu32, secs) + 4; // +4 for the decimal sign and fractional part
         size_t start = EVENT_LOG_TIMESTAMP_LENGTH - to_write;
 
@@ -181,7 +234,7 @@ void EventLog::format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */
     buf[EVENT_LOG_TIMESTAMP_LENGTH] = '\0';
 }
 
-size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+size_t EventLog::snprintf_prefix(char *buf, size_t buf_len, uint32_t timestamp_ms, const char *prefix, size_t prefix_len)
 {
     if (buf_len < EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */) {
         return 0;
@@ -189,7 +242,7 @@ size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefi
 
     size_t written = 0;
 
-    format_timestamp(buf);
+    format_timestamp(buf, timestamp_ms);
     written += EVENT_LOG_TIMESTAMP_LENGTH;
 
     if (written + 3 <= buf_len) {
@@ -216,13 +269,45 @@ size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefi
         }
     }
 
-    if (written < buf_len) {
+    return written;
+}
+
+size_t EventLog::vsnprintf_prefixed(char *buf, size_t buf_len, const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+{
+    size_t written = snprintf_prefix(buf, buf_len, millis(), prefix, prefix_len);
+
+    if (written > 0 && written < buf_len) {
         written += vsnprintf_u(buf + written, buf_len - written, fmt, args);
     }
 
     return written;
 }
 
+size_t EventLog::format_binary_trace_record(const BinaryTraceBuffer::Record &record, char *buf, size_t buf_len)
+{
+    size_t written = 0;
+
+    if ((record.flags & BINARY_TRACE_FLAG_TIMESTAMP_ONLY) != 0) {
+        format_timestamp(buf, record.timestamp_ms);
+        written = EVENT_LOG_TIMESTAMP_LENGTH;
+    } else {
+        if ((record.flags & BINARY_TRACE_FLAG_PREFIXED) != 0) {
+            bool skip_prefix = (record.flags & BINARY_TRACE_FLAG_SKIP_PREFIX) != 0;
+            written = snprintf_prefix(buf, buf_len, record.timestamp_ms, skip_prefix ? nullptr : record.prefix, skip_prefix ? 0 : record.prefix_len);
+        }
+
+        written += BinaryTraceBuffer::format_message(record, buf + written, buf_len - written - 1 /* \n */);
+
+        // The IDF might log messages ending with "\r\n" via tf_event_log_[v]printfln
+        if (written >= 2 && buf[written - 2] == '\r' && buf[written - 1] == '\n') {
+            written -= 2;
+        }
+    }
+
+    buf[written++] = '\n';
+    return written;
+}
+
 void EventLog::print_drop(size_t count)
 {
     char c = '\n';
@@ -392,6 +477,10 @@ void EventLog::trace_drop(size_t trace_buf_idx, size_t count)
 
     auto *trace_buffer = &this->trace_buffers[trace_buf_idx];
 
+    // Binary buffers overwrite their oldest records on their own.
+    if (trace_buffer->binary)
+        return;
+
     for (int i = 0; i < count; ++i) {
         trace_buffer->buf.pop(&c);
     }
@@ -408,6 +497,11 @@ void EventLog::trace_drop(size_t trace_buf_idx, size_t count)
 void EventLog::trace_timestamp(size_t trace_buf_idx)
 {
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx != -1 && this->trace_buffers[trace_buf_idx].binary) {
+        this->trace_buffers[trace_buf_idx].binary_buf.record(millis(), BINARY_TRACE_FLAG_TIMESTAMP_ONLY, nullptr, 0, "");
+        return;
+    }
+
     char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \n | \0 */];
 
     format_timestamp(buf);
@@ -427,6 +521,17 @@ size_t EventLog::trace_plain(size_t trace_buf_idx, const char *buf, size_t len)
 
     auto *trace_buffer = &this->trace_buffers[trace_buf_idx];
 
+    if (trace_buffer->binary) {
+        size_t stripped_len = len;
+
+        if (len >= 1 && buf[len - 1] == '\n') {
+            stripped_len = len - 1;
+        }
+
+        trace_buffer->binary_buf.record(millis(), 0, nullptr, 0, "%.*s", static_cast<int>(stripped_len), buf);
+        return len;
+    }
+
     std::lock_guard<std::mutex> lock{trace_buffer->mutex};
     bool drop_line = trace_buffer->buf.free() < len;
 
@@ -450,6 +555,15 @@ size_t EventLog::vtracefln_plain(size_t trace_buf_idx, const char *fmt, va_list
 {
     size_t written = 0;
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx == -1)
+        return 0;
+
+    // Formatted when read, so nothing was written yet.
+    if (this->trace_buffers[trace_buf_idx].binary) {
+        this->trace_buffers[trace_buf_idx].binary_buf.vrecord(millis(), 0, nullptr, 0, fmt, args);
+        return 0;
+    }
+
     char buf[256];
     size_t buf_len = ARRAY_SIZE(buf);
 
@@ -490,6 +604,20 @@ size_t EventLog::vtracefln_prefixed(size_t trace_buf_idx, const char *prefix, si
 {
     size_t written = 0;
 #if defined(BOARD_HAS_PSRAM)
+    if (trace_buf_idx == -1)
+        return 0;
+
+    // Formatted when read, so nothing was written yet.
+    if (this->trace_buffers[trace_buf_idx].binary) {
+        uint8_t flags = BINARY_TRACE_FLAG_PREFIXED;
+        if (prefix == nullptr && prefix_len == 0) {
+            flags |= BINARY_TRACE_FLAG_SKIP_PREFIX;
+        }
+
+        this->trace_buffers[trace_buf_idx].binary_buf.vrecord(millis(), flags, prefix, prefix_len, fmt, args);
+        return 0;
+    }
+
     char buf[EVENT_LOG_TIMESTAMP_LENGTH + 256];
     size_t buf_len = ARRAY_SIZE(buf);
 
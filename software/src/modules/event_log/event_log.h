@@ -27,6 +27,7 @@
 #include "config.h"
 #include "ringbuffer.h"
 #include "malloc_tools.h"
+#include "binary_trace_buffer.h"
 
 // Length of an ISO 8601 timestamp. For example "2022-02-11 12:34:56,789"
 // Also change in frontend when changing here!
@@ -80,7 +81,9 @@ public:
     [[gnu::format(__printf__, 2, 3)]] size_t tracefln_debug(const char *fmt, ...);
 
     // Returns id of allocated buffer
-    size_t alloc_trace_buffer(const char *name, size_t size);
+    // Binary buffers store the format string and arguments and format them when /trace_log is read.
+    // Format strings and prefixes should be string literals. Writing to a binary buffer doesn't lock.
+    size_t alloc_trace_buffer(const char *name, size_t size, bool binary = false);
     size_t get_trace_buffer_idx(const char *name);
 
 private:
@@ -102,10 +105,16 @@ private:
         TF_Ringbuffer<char,
                       malloc_psram,
                       heap_caps_free> buf;
+        BinaryTraceBuffer binary_buf;
+        bool binary;
     };
 
     TraceBuffer *find_trace_buffer(const char *prefix);
 
+    void format_timestamp(char buf[EVENT_LOG_TIMESTAMP_LENGTH + 1 /* \0 */], uint32_t timestamp_ms);
+    size_t snprintf_prefix(char *buf, size_t buf_len, uint32_t timestamp_ms, const char *prefix, size_t prefix_len);
+    size_t format_binary_trace_record(const BinaryTraceBuffer::Record &record, char *buf, size_t buf_len);
+
 #if defined(BOARD_HAS_PSRAM)
     std::array<TraceBuffer, 16> trace_buffers;
     size_t trace_buffers_in_use = 0;
@@ -21,37 +21,47 @@
 
 #include "crc32.h"
 
-typedef unsigned int word_t;
-
 // Polynomial for 32-bit CRC in IEEE 802.3.
 #define CRC32_IEEE_802_3_POLYNOMIAL     0xEDB88320UL
 
 // Convenience macro for inverting the CRC.
 #define COMPLEMENT_CRC(c)    ((c) ^ 0xffffffffUL)
 
-// Convenience macro for size of a word.
-#define WORD_SIZE            (sizeof(word_t))
+// Slice-by-8: table[0] is the classic byte-wise table,
+// table[k][b] is the CRC of byte b followed by k zero bytes.
+struct crc32_tables_t {
+	uint32_t table[8][256];
+};
 
-// Bitmask for word-aligning an address.
-#define WORD_ALIGNMENT_MASK  ~((uintptr_t)WORD_SIZE - 1)
+static constexpr crc32_tables_t crc32_make_tables()
+{
+	crc32_tables_t t{};
 
+	for (uint32_t b = 0; b < 256; b++) {
+		uint32_t crc = b;
 
-// Recalculate 32-bit CRC for bytes within a word
-static inline uint32_t _crc32_ieee_802_3_recalculate_bytes_helper(word_t data, uint32_t crc, uint_fast8_t bytes)
-{
-	uint_fast8_t bit;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32_IEEE_802_3_POLYNOMIAL : crc >> 1;
+		}
 
-	crc ^= data;
+		t.table[0][b] = crc;
+	}
 
-	for (bit = 8 * bytes; bit > 0; bit--) {
-		if (crc & 1) {
-			crc = (crc >> 1) ^ CRC32_IEEE_802_3_POLYNOMIAL;
-		} else {
-			crc >>= 1;
+	for (uint32_t b = 0; b < 256; b++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t prev = t.table[k - 1][b];
+			t.table[k][b] = (prev >> 8) ^ t.table[0][prev & 0xff];
 		}
 	}
 
-	return crc;
+	return t;
+}
+
+static constexpr crc32_tables_t crc32_tables = crc32_make_tables();
+
+static inline uint32_t crc32_load_le(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
 //  Recalculate 32-bit CRC for another block
@@ -59,48 +69,33 @@ static inline uint32_t _crc32_ieee_802_3_recalculate_bytes_helper(word_t data, u
 // This function recalculates the CRC according to the polynomial
 // CRC32_POLYNOMIAL for the specified data block and initial CRC value.
 //
-// To reduce the number of databus accesses and thus speed up the calculation,
-// the algorithm is tuned to work with words as much as possible.
+// Eight bytes are processed per step with eight lookup tables.
 void crc32_ieee_802_3_recalculate(const void *data, size_t length, uint32_t *crc)
 {
-    const word_t *word_ptr = (word_t *)((uintptr_t)data & WORD_ALIGNMENT_MASK);
-	size_t temp_length;
+	const uint8_t *p = (const uint8_t *)data;
+	const uint32_t (*t)[256] = crc32_tables.table;
 	uint32_t temp_crc = COMPLEMENT_CRC(*crc);
-	word_t word;
-
-	// Calculate for initial bytes to get word-aligned
-	if(length < WORD_SIZE) {
-		temp_length = length;
-	} else {
-		temp_length = ~WORD_ALIGNMENT_MASK & (WORD_SIZE - (uintptr_t)data);
-	}
 
-	if(temp_length) {
-		length -= temp_length;
-
-		word = *(word_ptr++);
-		word >>= 8 * (WORD_SIZE - temp_length);
-		temp_crc = _crc32_ieee_802_3_recalculate_bytes_helper(word, temp_crc, temp_length);
-	}
-
-	// Calculate for whole words, if any
-	temp_length = length & WORD_ALIGNMENT_MASK;
-
-	if(temp_length) {
-		length -= temp_length;
-		temp_length /= WORD_SIZE;
-
-		while(temp_length--) {
-			word = *(word_ptr++);
-			temp_crc = _crc32_ieee_802_3_recalculate_bytes_helper(word, temp_crc, WORD_SIZE);
-		}
+	while (length >= 8) {
+		uint32_t one = crc32_load_le(p) ^ temp_crc;
+		uint32_t two = crc32_load_le(p + 4);
+
+		temp_crc = t[7][ one        & 0xff] ^
+		           t[6][(one >>  8) & 0xff] ^
+		           t[5][(one >> 16) & 0xff] ^
+		           t[4][ one >> 24        ] ^
+		           t[3][ two        & 0xff] ^
+		           t[2][(two >>  8) & 0xff] ^
+		           t[1][(two >> 16) & 0xff] ^
+		           t[0][ two >> 24        ];
+
+		p += 8;
+		length -= 8;
 	}
 
 	// Calculate for tailing bytes
-	if(length) {
-		word = *word_ptr;
-		word &= 0xffffffffUL >> (8 * (WORD_SIZE - length));
-		temp_crc = _crc32_ieee_802_3_recalculate_bytes_helper(word, temp_crc, length);
+	while (length--) {
+		temp_crc = (temp_crc >> 8) ^ t[0][(temp_crc ^ *p++) & 0xff];
 	}
 
 	*crc = COMPLEMENT_CRC(temp_crc);
@@ -153,6 +153,13 @@ void FirmwareUpdate::pre_setup()
         {"update_version", Config::Str("", 0, 32)},
         {"install_progress", Config::Uint(0, 0, 100)},
         {"install_state", Config::Uint8(static_cast<uint8_t>(InstallState::Idle))},
+        {"install_timing", Config::Object({
+            {"total", Config::Uint32(0)},
+            {"receive", Config::Uint32(0)},
+            {"hash", Config::Uint32(0)},
+            {"flash", Config::Uint32(0)},
+            {"stall", Config::Uint32(0)},
+        })},
     });
 
     install_firmware_config = ConfigRoot{Config::Object({
@@ -273,9 +280,43 @@ InstallState FirmwareUpdate::check_firmware_info(bool detect_downgrade, bool log
     return InstallState::InProgress;
 }
 
+// Waits for pending flash writes before aborting, Update must not be used concurrently.
+void FirmwareUpdate::abort_update()
+{
+    firmware_writer.finish();
+    Update.abort();
+}
+
+void FirmwareUpdate::publish_install_timing()
+{
+    uint32_t total_ms   = static_cast<uint32_t>((now_us() - install_start).millis());
+    uint32_t receive_ms = static_cast<uint32_t>(install_receive_time.millis());
+    uint32_t hash_ms    = static_cast<uint32_t>(install_hash_time.millis());
+    uint32_t flash_ms   = static_cast<uint32_t>(firmware_writer.flash_time.millis());
+    uint32_t stall_ms   = static_cast<uint32_t>(firmware_writer.stall_time.millis());
+
+    logger.printfln("Firmware written in %u ms: receive %u ms, hash %u ms, flash %u ms, stall %u ms", total_ms, receive_ms, hash_ms, flash_ms, stall_ms);
+
+    // Might be called from the HTTP thread.
+    task_scheduler.scheduleOnce([this, total_ms, receive_ms, hash_ms, flash_ms, stall_ms]() {
+        auto timing = state.get("install_timing");
+
+        timing->get("total")->updateUint(total_ms);
+        timing->get("receive")->updateUint(receive_ms);
+        timing->get("hash")->updateUint(hash_ms);
+        timing->get("flash")->updateUint(flash_ms);
+        timing->get("stall")->updateUint(stall_ms);
+    });
+}
+
 InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t *chunk_data, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr)
 {
+    micros_t chunk_start = now_us();
+
     if (chunk_offset == 0) {
+        // A previous install might have been interrupted without an abort.
+        firmware_writer.finish();
+
 #if signature_sodium_public_key_length != 0
         if (signature_override_cookie != 0) {
             signature_override_cookie = 0;
@@ -283,6 +324,10 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
         }
 #endif
 
+        install_start = chunk_start;
+        install_receive_time = 0_us;
+        install_hash_time = 0_us;
+
         if (!Update.begin(complete_len - FIRMWARE_OFFSET, U_FLASH)) {
             logger.printfln("Failed to begin update: %s", Update.errorString());
             Update.abort();
@@ -300,6 +345,11 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
 
         signature_info.reset();
 #endif
+
+        firmware_writer.begin();
+    }
+    else {
+        install_receive_time += chunk_start - install_last_chunk_end;
     }
 
 #if signature_sodium_public_key_length != 0
@@ -323,9 +373,13 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
         memset(start, 0x55, len);
     }
 
-    if (crypto_sign_update(&signature_state, chunk_data, chunk_len) < 0) {
+    micros_t hash_start = now_us();
+    int hash_result = crypto_sign_update(&signature_state, chunk_data, chunk_len);
+    install_hash_time += now_us() - hash_start;
+
+    if (hash_result < 0) {
         logger.printfln("Failed to update signature verification");
-        Update.abort();
+        abort_update();
         return InstallState::SignatureUpdateFailed;
     }
 #endif
@@ -334,12 +388,13 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
         InstallState result = check_firmware_info(false, true, json_ptr);
 
         if (result != InstallState::InProgress) {
-            Update.abort();
+            abort_update();
             return result;
         }
     }
 
     if (chunk_offset + chunk_len < FIRMWARE_OFFSET) {
+        install_last_chunk_end = now_us();
         return InstallState::InProgress;
     }
 
@@ -352,10 +407,16 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
         len -= to_skip;
     }
 
-    size_t written = Update.write(start, len);
+    // The flash is written on the firmware writer's task while the next chunk is received and hashed.
+    bool write_ok = firmware_writer.write(start, len);
 
-    if (written != len) {
-        logger.printfln("Failed to write update chunk with length %u; written %u, error: %s", len, written, Update.errorString());
+    if (write_ok && is_complete) {
+        write_ok = firmware_writer.finish();
+    }
+
+    if (!write_ok) {
+        firmware_writer.finish();
+        logger.printfln("Failed to write update chunk with length %u; written %u, error: %s", firmware_writer.failed_len, firmware_writer.failed_written, Update.errorString());
         Update.abort();
         return InstallState::FlashShortWrite;
     }
@@ -399,8 +460,13 @@ InstallState FirmwareUpdate::handle_firmware_chunk(size_t chunk_offset, uint8_t
             logger.printfln("Failed to apply update: %s", Update.errorString());
             return InstallState::FlashApplyFailed;
         }
+
+        // Only installs that were verified and applied are timed.
+        publish_install_timing();
     }
 
+    install_last_chunk_end = now_us();
+
     return InstallState::InProgress;
 }
 
@@ -622,7 +688,7 @@ void FirmwareUpdate::register_urls()
     },
     [this](WebServerRequest request, int error_code) {
         logger.printfln("File reception failed: %s (%d)", strerror(error_code), error_code);
-        Update.abort();
+        abort_update();
         task_scheduler.await([this](){flash_firmware_in_progress = false;});
         return request.send(500, "Failed to receive file");
     });
@@ -965,7 +1031,7 @@ void FirmwareUpdate::install_firmware(const char *url)
                 break;
             }
 
-            Update.abort();
+            abort_update();
             install_firmware_in_progress = false;
             break;
 
@@ -999,7 +1065,7 @@ void FirmwareUpdate::install_firmware(const char *url)
                 logger.printfln("Firmware install aborted");
                 state.get("install_state")->updateEnum(InstallState::Aborted);
                 state.get("install_progress")->updateUint(0);
-                Update.abort();
+                abort_update();
             }
 
             install_firmware_in_progress = false;
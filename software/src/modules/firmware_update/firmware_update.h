@@ -30,6 +30,7 @@
 #include "async_https_client.h"
 #include "signature_verify.embedded.h"
 #include "install_state.enum.h"
+#include "firmware_writer.h"
 
 struct TFJsonSerializer;
 
@@ -81,6 +82,8 @@ private:
     bool is_vehicle_blocking_update() const;
     InstallState handle_firmware_chunk(size_t chunk_offset, uint8_t *chunk, size_t chunk_len, size_t complete_len, bool is_complete, TFJsonSerializer *json_ptr);
     InstallState check_firmware_info(bool detect_downgrade, bool log, TFJsonSerializer *json_ptr);
+    void abort_update();
+    void publish_install_timing();
     void check_for_update();
     void install_firmware(const char *url);
 
@@ -102,6 +105,14 @@ private:
 
     BlockReader<firmware_info_t> firmware_info;
 
+    FirmwareWriter firmware_writer;
+
+    // Per-stage timing of the current install. Flash and stall times are tracked by the firmware writer.
+    micros_t install_start;
+    micros_t install_last_chunk_end;
+    micros_t install_receive_time;
+    micros_t install_hash_time;
+
 #if signature_sodium_public_key_length != 0
     struct signature_info_t {
         uint32_t magic[2] = {0};
@@ -0,0 +1,202 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "firmware_writer.h"
+
+#include <algorithm>
+#include <string.h>
+#include <Update.h>
+#include <esp_heap_caps.h>
+
+#include "event_log_prefix.h"
+#include "module_dependencies.h"
+
+void FirmwareWriter::writer_task(void *arg)
+{
+    FirmwareWriter *writer = static_cast<FirmwareWriter *>(arg);
+    Block block;
+
+    while (true) {
+        xQueueReceive(writer->write_queue, &block, portMAX_DELAY);
+
+        if (block.data == nullptr) {
+            break;
+        }
+
+        // Skip the remaining blocks after a failed write. The update will be aborted anyway.
+        if (!writer->failed) {
+            writer->write_block(block.data, block.len);
+        }
+
+        xQueueSend(writer->free_queue, &block.data, portMAX_DELAY);
+    }
+
+    uint8_t *done = nullptr;
+    xQueueSend(writer->free_queue, &done, portMAX_DELAY);
+
+    vTaskDelete(nullptr);
+}
+
+void FirmwareWriter::write_block(uint8_t *data, size_t len)
+{
+    micros_t start = now_us();
+    size_t written = Update.write(data, len);
+    flash_time += now_us() - start;
+
+    if (written != len) {
+        failed_len = len;
+        failed_written = written;
+        failed = true;
+    }
+}
+
+void FirmwareWriter::begin()
+{
+    finish();
+
+    flash_time = 0_us;
+    stall_time = 0_us;
+    failed_len = 0;
+    failed_written = 0;
+    failed = false;
+
+    if (!start_task()) {
+        logger.printfln("Writing firmware without a writer task");
+    }
+}
+
+bool FirmwareWriter::start_task()
+{
+    // Internal RAM only: Every block is copied in and then out into Update's sector buffer.
+    // Both copies would be slower in PSRAM. The blocks are only allocated during an install.
+    for (size_t i = 0; i < FIRMWARE_WRITER_BLOCK_COUNT; ++i) {
+        buffers[i] = static_cast<uint8_t *>(heap_caps_calloc(1, FIRMWARE_WRITER_BLOCK_SIZE, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
+
+        if (buffers[i] == nullptr) {
+            logger.printfln("Failed to allocate firmware write buffer");
+            free_resources();
+            return false;
+        }
+    }
+
+    // One more slot for the nullptr that signals the end of the task.
+    free_queue = xQueueCreate(FIRMWARE_WRITER_BLOCK_COUNT + 1, sizeof(uint8_t *));
+    write_queue = xQueueCreate(FIRMWARE_WRITER_BLOCK_COUNT + 1, sizeof(Block));
+
+    if (free_queue == nullptr || write_queue == nullptr) {
+        logger.printfln("Failed to create firmware write queues");
+        free_resources();
+        return false;
+    }
+
+    for (size_t i = 0; i < FIRMWARE_WRITER_BLOCK_COUNT; ++i) {
+        xQueueSend(free_queue, &buffers[i], 0);
+    }
+
+    // Same priority as the task that receives the firmware, so that neither starves the other.
+    BaseType_t err = xTaskCreate(writer_task, "fw_writer", FIRMWARE_WRITER_STACK_SIZE, this, uxTaskPriorityGet(nullptr), &task);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+    // pdPASS expands to an old-style cast that is also useless
+    if (err != pdPASS) {
+        logger.printfln("Failed to create firmware writer task: %d", err);
+        task = nullptr;
+        free_resources();
+        return false;
+    }
+#pragma GCC diagnostic pop
+
+    return true;
+}
+
+bool FirmwareWriter::write(uint8_t *data, size_t len)
+{
+    if (task == nullptr) {
+        if (!failed) {
+            write_block(data, len);
+        }
+
+        return !failed;
+    }
+
+    while (len > 0) {
+        if (failed) {
+            return false;
+        }
+
+        uint8_t *buf;
+
+        micros_t start = now_us();
+        xQueueReceive(free_queue, &buf, portMAX_DELAY);
+        stall_time += now_us() - start;
+
+        size_t to_write = std::min(len, static_cast<size_t>(FIRMWARE_WRITER_BLOCK_SIZE));
+        memcpy(buf, data, to_write);
+
+        Block block = {buf, to_write};
+        xQueueSend(write_queue, &block, portMAX_DELAY);
+
+        data += to_write;
+        len -= to_write;
+    }
+
+    return !failed;
+}
+
+bool FirmwareWriter::finish()
+{
+    if (task == nullptr) {
+        return !failed;
+    }
+
+    Block stop = {nullptr, 0};
+    xQueueSend(write_queue, &stop, portMAX_DELAY);
+
+    // The task returns all blocks before the nullptr.
+    uint8_t *buf;
+
+    do {
+        xQueueReceive(free_queue, &buf, portMAX_DELAY);
+    } while (buf != nullptr);
+
+    task = nullptr;
+    free_resources();
+
+    return !failed;
+}
+
+void FirmwareWriter::free_resources()
+{
+    if (free_queue != nullptr) {
+        vQueueDelete(free_queue);
+        free_queue = nullptr;
+    }
+
+    if (write_queue != nullptr) {
+        vQueueDelete(write_queue);
+        write_queue = nullptr;
+    }
+
+    for (size_t i = 0; i < FIRMWARE_WRITER_BLOCK_COUNT; ++i) {
+        free(buffers[i]);
+        buffers[i] = nullptr;
+    }
+}
@@ -0,0 +1,86 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "tools.h"
+
+// One flash sector. Update buffers writes in blocks of this size anyway.
+#define FIRMWARE_WRITER_BLOCK_SIZE 4096
+#define FIRMWARE_WRITER_BLOCK_COUNT 2
+#define FIRMWARE_WRITER_STACK_SIZE 4096
+
+// Calls Update.write on a separate task. While one block is written to flash,
+// the next chunk of the firmware can be received and hashed. Flash operations
+// stop both CPUs, but the flash driver yields between the steps of an erase,
+// so the receiving task keeps running for most of a block's write.
+// Falls back to writing on the calling task if the blocks or the task can't be set up.
+// Update must not be used by anyone else between begin() and finish().
+class FirmwareWriter
+{
+public:
+    FirmwareWriter() = default;
+    FirmwareWriter(const FirmwareWriter &other) = delete;
+    FirmwareWriter &operator=(const FirmwareWriter &other) = delete;
+
+    // Resets the timing and starts the writer task.
+    void begin();
+
+    // Copies data into the next free block. Blocks if all blocks are still being written.
+    // Returns false if this or a previous write failed.
+    bool write(uint8_t *data, size_t len);
+
+    // Waits until all blocks are written and stops the task.
+    // Returns false if any write failed. Does nothing if the writer is not running.
+    bool finish();
+
+    // Time spent in Update.write and waiting for a free block.
+    micros_t flash_time;
+    micros_t stall_time;
+
+    // Length and written bytes of the first failed write.
+    size_t failed_len = 0;
+    size_t failed_written = 0;
+
+private:
+    struct Block {
+        uint8_t *data;
+        size_t len;
+    };
+
+    static void writer_task(void *arg);
+    bool start_task();
+    void write_block(uint8_t *data, size_t len);
+    void free_resources();
+
+    uint8_t *buffers[FIRMWARE_WRITER_BLOCK_COUNT] = {};
+    // Holds free buffers. finish() receives a nullptr once the task is done.
+    QueueHandle_t free_queue = nullptr;
+    QueueHandle_t write_queue = nullptr;
+    TaskHandle_t task = nullptr;
+
+    // Written by the writer task while it runs, by write() otherwise. The queues order the accesses.
+    volatile bool failed = false;
+};
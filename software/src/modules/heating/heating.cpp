@@ -41,7 +41,7 @@ static constexpr auto HEATING_UPDATE_INTERVAL = 1_m;
 
 void Heating::pre_setup()
 {
-    this->trace_buffer_index = logger.alloc_trace_buffer("heating", 1 << 20);
+    this->trace_buffer_index = logger.alloc_trace_buffer("heating", 1 << 20, true);
 
     config = ConfigRoot{Config::Object({
         {"sg_ready_blocking_active_type", Config::Uint(0, 0, 1)},
@@ -21,6 +21,7 @@
 
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
+#include "string_builder.h"
 
 class HTTPChunkedResponse : public IBaseChunkedResponse
 {
@@ -98,20 +99,8 @@ bool custom_uri_match(const char *ref_uri, const char *in_uri, size_t len)
     if (strncmp_with_same_len(ref_uri, "/*", 2) != 0 || len < 2)
         return false;
 
-    // Use + 1 to compare: in_uri starts with /; the api paths don't.
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == len - 1 && memcmp(api.commands[i].path, in_uri + 1, len - 1) == 0)
-            return true;
-
-    for (size_t i = 0; i < api.states.size(); i++)
-        if (api.states[i].path_len == len - 1 && memcmp(api.states[i].path, in_uri + 1, len - 1) == 0)
-            return true;
-
-    for (size_t i = 0; i < api.responses.size(); i++)
-        if (api.responses[i].path_len == len - 1 && memcmp(api.responses[i].path, in_uri + 1, len - 1) == 0)
-            return true;
-
-    return false;
+    // Use + 1 to look up: in_uri starts with /; the api paths don't.
+    return api.lookupPath(in_uri + 1, len - 1).kind != APIPathKind::None;
 }
 
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -147,9 +136,12 @@ void Http::setup()
     initialized = true;
 }
 
+#define MSGPACK_CONTENT_TYPE "application/msgpack"
+
 static WebServerRequestReturnProtect run_command(WebServerRequest req, size_t cmdidx)
 {
     CommandRegistration &reg = api.commands[cmdidx];
+    APIPayloadEncoding encoding = req.header("Content-Type").startsWith(MSGPACK_CONTENT_TYPE) ? APIPayloadEncoding::MessagePack : APIPayloadEncoding::JSON;
 
     // Check stack usage after increasing buffer size.
     char recv_buf[4096];
@@ -170,7 +162,7 @@ static WebServerRequestReturnProtect run_command(WebServerRequest req, size_t cm
     if (bytes_written == 0 && reg.config->is_null()) {
         message = api.callCommand(reg, nullptr, 0);
     } else {
-        message = api.callCommand(reg, recv_buf, bytes_written);
+        message = api.callCommand(reg, recv_buf, bytes_written, encoding);
     }
 
     if (message.isEmpty()) {
@@ -217,15 +209,30 @@ WebServerRequestReturnProtect Http::run_response(WebServerRequest req, ResponseR
 // Use + 1 to compare: req.uriCStr() starts with /; the api paths don't.
 WebServerRequestReturnProtect Http::api_handler_get(WebServerRequest req)
 {
-    size_t req_uri_len = strlen(req.uriCStr() + 1);
+    APIPathLookup lookup = api.lookupPath(req.uriCStr() + 1, strlen(req.uriCStr() + 1));
+
+    if (lookup.kind == APIPathKind::State) {
+        size_t i = lookup.idx;
 
-    for (size_t i = 0; i < api.states.size(); i++) {
-        if (api.states[i].path_len != req_uri_len || memcmp(api.states[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
+        if (req.header("Accept").indexOf(MSGPACK_CONTENT_TYPE) >= 0) {
+            StringBuilder sb;
+            auto result = task_scheduler.await([&sb, i]() {
+                const auto &reg = api.states[i];
+                if (sb.setCapacity(reg.msgpack_length()))
+                    reg.to_msgpack_except(reg.keys_to_censor, reg.keys_to_censor_len, &sb);
+            });
+            if (result == TaskScheduler::AwaitResult::Timeout)
+                return req.send(500, "text/plain", "Failed to get config. Task timed out.");
+
+            if (sb.getLength() == 0)
+                return req.send(500, "text/plain", "Failed to get config. Out of memory.");
+
+            return req.send(200, MSGPACK_CONTENT_TYPE, sb.getPtr(), sb.getLength());
+        }
 
         String response;
         auto result = task_scheduler.await([&response, i]() {
-            response = api.states[i].config->to_string_except(api.states[i].keys_to_censor, api.states[i].keys_to_censor_len);
+            response = api.states[i].to_string_except(api.states[i].keys_to_censor, api.states[i].keys_to_censor_len);
         });
         if (result == TaskScheduler::AwaitResult::Timeout)
             return req.send(500, "text/plain", "Failed to get config. Task timed out.");
@@ -233,9 +240,8 @@ WebServerRequestReturnProtect Http::api_handler_get(WebServerRequest req)
         return req.send(200, "application/json; charset=utf-8", response.c_str());
     }
 
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == req_uri_len && memcmp(api.commands[i].path, req.uriCStr() + 1, req_uri_len) == 0 && api.commands[i].config->is_null())
-            return run_command(req, i);
+    if (lookup.kind == APIPathKind::Command && api.commands[lookup.idx].config->is_null())
+        return run_command(req, lookup.idx);
 
     // If we reach this point, the url matcher found an API with the req.uri() as path, but we did not.
     // This was probably a raw command or a command that requires a payload. Return 405 - Method not allowed
@@ -244,32 +250,24 @@ WebServerRequestReturnProtect Http::api_handler_get(WebServerRequest req)
 
 WebServerRequestReturnProtect Http::api_handler_put(WebServerRequest req)
 {
-    size_t req_uri_len = strlen(req.uriCStr() + 1);
+    APIPathLookup lookup = api.lookupPath(req.uriCStr() + 1, strlen(req.uriCStr() + 1));
 
-    for (size_t i = 0; i < api.commands.size(); i++)
-        if (api.commands[i].path_len == req_uri_len && memcmp(api.commands[i].path, req.uriCStr() + 1, req_uri_len) == 0)
-            return run_command(req, i);
+    if (lookup.kind == APIPathKind::Command)
+        return run_command(req, lookup.idx);
 
-    for (size_t i = 0; i < api.responses.size(); i++)
-        if (api.responses[i].path_len == req_uri_len && memcmp(api.responses[i].path, req.uriCStr() + 1, req_uri_len) == 0)
-            return run_response(req, api.responses[i]);
+    if (lookup.kind == APIPathKind::Response)
+        return run_response(req, api.responses[lookup.idx]);
 
     if (req.uri().endsWith("_update")) {
         return req.send(405, "text/plain", "Request method for this URI is not handled by server");
     }
 
-    for (size_t i = 0; i < api.states.size(); i++) {
-        if (api.states[i].path_len != req_uri_len || memcmp(api.states[i].path, req.uriCStr() + 1, req_uri_len) != 0)
-            continue;
-
+    if (lookup.kind == APIPathKind::State) {
         String uri_update = req.uri() + "_update";
-        for (size_t a = 0; a < api.commands.size(); a++)
-            if (api.commands[a].path_len == uri_update.length() - 1 && memcmp(api.commands[a].path, uri_update.c_str() + 1, uri_update.length() - 1) == 0)
-                return run_command(req, a);
+        APIPathLookup update_lookup = api.lookupPath(uri_update.c_str() + 1, uri_update.length() - 1);
 
-        // If we've found the api state that matches req.uriCStr() but did not find a corresponding command with _update,
-        // break here because there can't be two states with the same path. We don't have to check the rest.
-        break;
+        if (update_lookup.kind == APIPathKind::Command)
+            return run_command(req, update_lookup.idx);
     }
 
     // If we reach this point, the url matcher found an API with the req.uri() as path, but we did not.
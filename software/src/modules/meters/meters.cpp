@@ -24,6 +24,7 @@
 #include "meter_class_none.h"
 #include "tools.h"
 #include "string_builder.h"
+#include "config/msgpack_writer.h"
 
 #include "gcc_warnings.h"
 #ifdef __GNUC__
@@ -176,10 +177,10 @@ void Meters::pre_setup()
             Config::get_prototype_uint32_0(),
             0, METERS_MAX_VALUES_PER_METER, Config::type_id<Config::ConfUint>()
         );
-        meter_slot.values = Config::Array({},
-            Config::get_prototype_float_nan(),
-            0, METERS_MAX_VALUES_PER_METER, Config::type_id<Config::ConfFloat>()
-        );
+        meter_slot.values = *Config::Null();
+
+        meter_slot.value_count = 0;
+        meter_slot.values_changed = false;
 
         meter_slot.values_last_updated_at = INT64_MIN;
         meter_slot.values_last_changed_at = INT64_MIN;
@@ -399,7 +400,7 @@ void Meters::register_urls()
         api.addState(get_path(slot, Meters::PathType::State),    &meter_slot.state);
         api.addState(get_path(slot, Meters::PathType::Errors),   &meter_slot.errors);
         api.addState(get_path(slot, Meters::PathType::ValueIDs), &meter_slot.value_ids);
-        api.addState(get_path(slot, Meters::PathType::Values),   &meter_slot.values, {}, {}, METERS_VALUES_LOW_LATENCY);
+        api.addRawState(get_path(slot, Meters::PathType::Values), &meter_slot.values, &meter_slot, METERS_VALUES_LOW_LATENCY);
 
         const String base_path = get_path(slot, Meters::PathType::Base);
 
@@ -600,16 +601,18 @@ bool Meters::meter_has_value_changed(uint32_t slot, micros_t max_age_us)
     return max_age_us == 0_us || !deadline_elapsed(meter_slots[slot].values_last_changed_at + max_age_us);
 }
 
-MeterValueAvailability Meters::get_values(uint32_t slot, const Config **values, micros_t max_age)
+MeterValueAvailability Meters::get_values(uint32_t slot, const float **values, size_t *value_count, micros_t max_age)
 {
     if (slot >= METERS_SLOTS) {
         *values = nullptr;
+        *value_count = 0;
         return MeterValueAvailability::Unavailable;
     }
 
     const MeterSlot &meter_slot = meter_slots[slot];
 
-    *values = &meter_slot.values;
+    *values = meter_slot.values_packed.get();
+    *value_count = meter_slot.value_count;
 
     if (!this->meter_is_fresh(slot, max_age)) {
         return MeterValueAvailability::Stale;
@@ -627,7 +630,7 @@ MeterValueAvailability Meters::get_value_by_index(uint32_t slot, uint32_t index,
 
     const MeterSlot &meter_slot = meter_slots[slot];
 
-    *value_out = meter_slot.values.get(index)->asFloat();
+    *value_out = index < meter_slot.value_count ? meter_slot.values_packed[index] : NAN;
 
     if (!this->meter_is_fresh(slot, max_age)) {
         return MeterValueAvailability::Stale;
@@ -669,7 +672,7 @@ MeterValueAvailability Meters::get_single_value(uint32_t slot, uint32_t kind, fl
         }
     }
 
-    *value_out = meter_slot.values.get(cached_index)->asFloat();
+    *value_out = meter_slot.values_packed[cached_index];
 
     if (!this->meter_is_fresh(slot, max_age)) {
         return MeterValueAvailability::Stale;
@@ -705,7 +708,6 @@ MeterValueAvailability Meters::get_currents(uint32_t slot, float currents[INDEX_
     }
 
     const MeterSlot &meter_slot = meter_slots[slot];
-    const ConfigRoot &values = meter_slot.values;
 
     uint32_t currents_available = 0;
     for (uint32_t i = 0; i < INDEX_CACHE_CURRENT_COUNT; i++) {
@@ -715,7 +717,7 @@ MeterValueAvailability Meters::get_currents(uint32_t slot, float currents[INDEX_
             currents[i] = NAN;
         } else {
             currents_available++;
-            currents[i] = values.get(cached_index)->asFloat();
+            currents[i] = meter_slot.values_packed[cached_index];
         }
     }
 
@@ -737,7 +739,6 @@ MeterValueAvailability Meters::get_currents(uint32_t slot, float currents[INDEX_
 
 void Meters::apply_filters(MeterSlot &meter_slot, size_t base_value_count, const float *base_values)
 {
-    Config &values = meter_slot.values;
     float extra_values[METERS_MAX_VALUES_PER_METER];
     size_t filter_count = 0;
     uint32_t value_combiner_filter_bitmask = meter_slot.value_combiner_filters_bitmask;
@@ -756,15 +757,86 @@ void Meters::apply_filters(MeterSlot &meter_slot, size_t base_value_count, const
         filter_count++;
     } while (value_combiner_filter_bitmask);
 
-    size_t extra_value_count = values.count() - base_value_count;
+    size_t extra_value_count = meter_slot.value_count - base_value_count;
     for (size_t i = 0; i < extra_value_count; i++) {
         float value = extra_values[i];
         if (!isnan(value)) {
-            values.get(base_value_count + i)->updateFloat(value);
+            store_value(meter_slot, base_value_count + i, value);
         }
     }
 }
 
+// Returns true if the value changed.
+bool Meters::store_value(MeterSlot &meter_slot, size_t index, float value)
+{
+    float *values_packed = meter_slot.values_packed.get();
+
+    // Same comparison as Config::updateFloat: A NaN old value always counts as changed.
+#if defined(__GNUC__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wfloat-equal"
+#endif
+    if (values_packed[index] == value) {
+#if defined(__GNUC__)
+    #pragma GCC diagnostic pop
+#endif
+        return false;
+    }
+
+    values_packed[index] = value;
+    meter_slot.values_changed = true;
+
+    return true;
+}
+
+// Lets the API push meters/N/values once per update, not once per changed value.
+void Meters::commit_changed_values(MeterSlot &meter_slot)
+{
+    if (meter_slot.values_changed) {
+        meter_slot.values.set_updated(0xFF);
+        meter_slot.values_changed = false;
+    }
+}
+
+size_t Meters::MeterSlot::string_length() const
+{
+    // Same estimate per float as string_length_visitor, +1 for each ',' and the brackets.
+    return value_count * (16 + 1) + 2;
+}
+
+void Meters::MeterSlot::to_json(StringBuilder *sb) const
+{
+    sb->putc('[');
+
+    for (size_t i = 0; i < value_count; i++) {
+        if (i != 0)
+            sb->putc(',');
+
+        // Same output as the to_json visitor, for example null for NaN.
+        StaticJsonDocument<16> doc;
+        doc.set(values_packed[i]);
+
+        size_t written = serializeJson(doc, sb->getRemainingPtr(), sb->getRemainingLength() + 1); // +1 for NUL-terminator
+        sb->setLength(sb->getLength() + written);
+    }
+
+    sb->putc(']');
+}
+
+size_t Meters::MeterSlot::msgpack_length() const
+{
+    return msgpack_header_length(15, value_count) + value_count * msgpack_float_length();
+}
+
+void Meters::MeterSlot::to_msgpack(StringBuilder *sb) const
+{
+    msgpack_put_header(sb, 0x90, 15, 0xDC, value_count);
+
+    for (size_t i = 0; i < value_count; i++) {
+        msgpack_put_float(sb, values_packed[i]);
+    }
+}
+
 void Meters::update_value(uint32_t slot, uint32_t index, float new_value)
 {
     if (isnan(new_value))
@@ -782,27 +854,25 @@ void Meters::update_value(uint32_t slot, uint32_t index, float new_value)
 
     MeterSlot &meter_slot = meter_slots[slot];
 
-    Config &values = meter_slot.values;
-    Config *conf_val = static_cast<Config *>(values.get(index));
+    if (index >= meter_slot.value_count) {
+        logger.printfln("Tried to update value %u for meter in slot %u that only declared %u values.", index, slot, meter_slot.value_count);
+        return;
+    }
+
     micros_t t_now = now_us();
 
     // Think about ordering and short-circuting issues before changing this!
-    float old_value = conf_val->asFloat();
-    if (conf_val->updateFloat(new_value) && !isnan(old_value))
+    float old_value = meter_slot.values_packed[index];
+    if (store_value(meter_slot, index, new_value) && !isnan(old_value))
         meter_slot.values_last_changed_at = t_now;
 
     meter_slot.values_last_updated_at = t_now;
 
     if (meter_slot.value_combiner_filters_bitmask) {
-        float base_values[METERS_MAX_VALUES_PER_METER];
-        size_t base_value_count = meter_slot.base_value_count;
-
-        for (size_t i = 0; i < base_value_count; i++) {
-            base_values[i] = values.get(i)->asFloat();
-        }
-
-        apply_filters(meter_slot, base_value_count, base_values);
+        apply_filters(meter_slot, meter_slot.base_value_count, meter_slot.values_packed.get());
     }
+
+    commit_changed_values(meter_slot);
 }
 
 void Meters::update_all_values(uint32_t slot, const float new_values[])
@@ -814,7 +884,6 @@ void Meters::update_all_values(uint32_t slot, const float new_values[])
 
     MeterSlot &meter_slot = meter_slots[slot];
 
-    Config &values = meter_slot.values;
     size_t base_value_count = meter_slot.base_value_count;
     bool updated_any_value = false;
     bool changed_any_value = false;
@@ -822,11 +891,9 @@ void Meters::update_all_values(uint32_t slot, const float new_values[])
     for (size_t i = 0; i < base_value_count; i++) {
         float new_value = new_values[i];
         if (!isnan(new_value)) {
-            Config *conf_val = static_cast<Config *>(values.get(i));
-
             // Think about ordering and short-circuting issues before changing this!
-            float old_value = conf_val->asFloat();
-            if (conf_val->updateFloat(new_value) && !isnan(old_value))
+            float old_value = meter_slot.values_packed[i];
+            if (store_value(meter_slot, i, new_value) && !isnan(old_value))
                 changed_any_value = true;
 
             updated_any_value = true;
@@ -837,6 +904,8 @@ void Meters::update_all_values(uint32_t slot, const float new_values[])
         apply_filters(meter_slot, base_value_count, new_values);
     }
 
+    commit_changed_values(meter_slot);
+
     micros_t t_now = now_us();
 
     if (changed_any_value)
@@ -895,7 +964,6 @@ void Meters::declare_value_ids(uint32_t slot, const MeterValueID new_value_ids[]
     MeterSlot &meter_slot = meter_slots[slot];
 
     Config &value_ids = meter_slot.value_ids;
-    Config &values    = meter_slot.values;
 
     if (value_ids.count() != 0) {
         logger.printfln("Meter in slot %u already declared %u values. Refusing to re-declare %u values.", slot, value_ids.count(), value_id_count);
@@ -988,13 +1056,18 @@ void Meters::declare_value_ids(uint32_t slot, const MeterValueID new_value_ids[]
     }
     meter_slot.value_combiner_filters_data = filter_data_compact;
 
+    meter_slot.values_packed = heap_alloc_array<float>(total_value_id_count);
+
     for (uint32_t i = 0; i < total_value_id_count; i++) {
         auto val = value_ids.add();
         val->updateUint(static_cast<uint32_t>(total_value_ids[i]));
 
-        values.add();
+        meter_slot.values_packed[i] = NAN;
     }
 
+    meter_slot.value_count = total_value_id_count;
+    meter_slot.values.set_updated(0xFF);
+
     uint32_t index_power_ac            = meters_find_id_index(total_value_ids, total_value_id_count, MeterValueID::PowerActiveLSumImExDiff);
     uint32_t index_power_dc            = meters_find_id_index(total_value_ids, total_value_id_count, MeterValueID::PowerDCImExDiff);
     uint32_t index_power_dc_battery    = meters_find_id_index(total_value_ids, total_value_id_count, MeterValueID::PowerDCChaDisDiff);
@@ -23,6 +23,7 @@
 
 #include "module.h"
 #include "config.h"
+#include "modules/api/api.h"
 #include "imeter.h"
 #include "meter_generator.h"
 #include "meter_value_availability.h"
@@ -90,7 +91,7 @@ public:
     bool meter_is_fresh(uint32_t slot, micros_t max_age_us);
     bool meter_has_value_changed(uint32_t slot, micros_t max_age_us);
 
-    MeterValueAvailability get_values(uint32_t slot, const Config **values, micros_t max_age = 0_us);
+    MeterValueAvailability get_values(uint32_t slot, const float **values, size_t *value_count, micros_t max_age = 0_us);
     MeterValueAvailability get_value_by_index(uint32_t slot, uint32_t index, float *value, micros_t max_age = 0_us);
     MeterValueAvailability get_power(uint32_t slot, float *power_w, micros_t max_age = 0_us);
     MeterValueAvailability get_energy_import(uint32_t slot, float *total_import_kwh, micros_t max_age = 0_us);
@@ -111,11 +112,21 @@ public:
     String get_path(uint32_t slot, PathType path_type);
 
 private:
-    class MeterSlot final
+    // meters/N/values is serialized straight from values_packed.
+    class MeterSlot final : public IRawState
     {
     public:
+        size_t string_length() const override;
+        void to_json(StringBuilder *sb) const override;
+        size_t msgpack_length() const override;
+        void to_msgpack(StringBuilder *sb) const override;
+
         ConfigRoot value_ids;
-        ConfigRoot values;
+        ConfigRoot values; // Holds no values, only the updated flags of meters/N/values.
+
+        std::unique_ptr<float[]> values_packed;
+        size_t value_count;
+        bool values_changed;
 
         micros_t values_last_updated_at;
         micros_t values_last_changed_at;
@@ -144,6 +155,8 @@ private:
 
     MeterValueAvailability get_single_value(uint32_t slot, uint32_t kind, float *value, micros_t max_age_us);
     void apply_filters(MeterSlot &meter_slot, size_t base_value_count, const float *base_values);
+    bool store_value(MeterSlot &meter_slot, size_t index, float value);
+    void commit_changed_values(MeterSlot &meter_slot);
 
     float live_samples_per_second();
 
@@ -476,13 +476,15 @@ EventResult MetersLegacyAPI::on_value_ids_change(const Config *value_ids)
 
     String values_path = meters.get_path(linked_meter_slot, Meters::PathType::Values);
 
-    const Config *old_values = api.getState(values_path);
-    if (old_values->count() > 0) {
-        on_values_change(old_values);
+    const float *old_values;
+    size_t old_values_count;
+    meters.get_values(linked_meter_slot, &old_values, &old_values_count);
+    if (old_values_count > 0) {
+        on_values_change();
     }
 
-    event.registerEvent(values_path, {}, [this](const Config *event_values) {
-        on_values_change(event_values);
+    event.registerEvent(values_path, {}, [this](const Config */*event_values*/) {
+        on_values_change();
         return EventResult::OK;
     });
 
@@ -524,11 +526,10 @@ EventResult MetersLegacyAPI::on_value_ids_change(const Config *value_ids)
     return EventResult::Deregister;
 }
 
-static void update_config_values(uint16_t *indices, uint16_t index_count, const Config *source_values, Config *target_values)
+static void update_config_values(uint16_t *indices, uint16_t index_count, const float *source_values, size_t source_count, Config *target_values)
 {
     bool needs_values_helper = target_values->is<Config::ConfObject>() && index_count == 3;
 
-    size_t source_count = source_values->count();
     size_t target_count = needs_values_helper ? 3 : target_values->count();
 
     if (target_count != index_count) {
@@ -552,28 +553,33 @@ static void update_config_values(uint16_t *indices, uint16_t index_count, const
             target_config = static_cast<Config *>(target_values->get(target_index));
         }
 
-        float source_value = source_values->get(source_index)->asFloat();
-        target_config->updateFloat(source_value);
+        target_config->updateFloat(source_values[source_index]);
     }
 }
 
-void MetersLegacyAPI::on_values_change(const Config *values)
+void MetersLegacyAPI::on_values_change()
 {
-    update_config_values(value_indices_legacy_values_to_linked_meter, ARRAY_SIZE(value_indices_legacy_values_to_linked_meter), values, &legacy_values);
+    const float *values;
+    size_t values_count;
+    meters.get_values(linked_meter_slot, &values, &values_count);
+
+    update_config_values(value_indices_legacy_values_to_linked_meter, ARRAY_SIZE(value_indices_legacy_values_to_linked_meter), values, values_count, &legacy_values);
 
     if (has_all_values) {
-        update_config_values(value_indices_legacy_all_values_to_linked_meter, ARRAY_SIZE(value_indices_legacy_all_values_to_linked_meter), values, &legacy_all_values);
+        update_config_values(value_indices_legacy_all_values_to_linked_meter, ARRAY_SIZE(value_indices_legacy_all_values_to_linked_meter), values, values_count, &legacy_all_values);
     }
 
     if (has_phases && !phases_overridden) {
         auto *phases_connected = static_cast<Config *>(legacy_phases.get("phases_connected"));
         for (size_t i = 0; i < 3; i++) {
-            float value = values->get(value_indices_legacy_all_values_to_linked_meter[METER_ALL_VALUES_LINE_TO_NEUTRAL_VOLTS_L1 + i])->asFloat();
+            size_t index = value_indices_legacy_all_values_to_linked_meter[METER_ALL_VALUES_LINE_TO_NEUTRAL_VOLTS_L1 + i];
+            float value = index < values_count ? values[index] : NAN;
             phases_connected->get(i)->updateBool(value > PHASE_CONNECTED_VOLTAGE_THRES);
         }
         auto *phases_active = static_cast<Config *>(legacy_phases.get("phases_active"));
         for (size_t i = 0; i < 3; i++) {
-            float value = values->get(value_indices_legacy_all_values_to_linked_meter[METER_ALL_VALUES_CURRENT_L1_A + i])->asFloat();
+            size_t index = value_indices_legacy_all_values_to_linked_meter[METER_ALL_VALUES_CURRENT_L1_A + i];
+            float value = index < values_count ? values[index] : NAN;
             phases_active->get(i)->updateBool(value > PHASE_ACTIVE_CURRENT_THRES);
         }
     }
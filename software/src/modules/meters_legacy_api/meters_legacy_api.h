@@ -42,7 +42,7 @@ public:
 
 private:
     EventResult on_value_ids_change(const Config *value_ids);
-    void on_values_change(const Config *values);
+    void on_values_change();
     void on_last_reset_change(const Config *last_reset);
 
     ConfigRoot state;
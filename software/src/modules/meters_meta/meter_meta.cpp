@@ -220,14 +220,15 @@ EventResult MeterMeta::on_value_ids_change(const Config *value_ids)
     String values_path_a = meters.get_path(source_meter_a, Meters::PathType::Values);
 
     if (source_mode == SourceMode::Single) {
-        event.registerEvent(values_path_a, {}, [this](const Config *event_values) {
-            this->on_values_change_single(event_values);
+        event.registerEvent(values_path_a, {}, [this](const Config */*event_values*/) {
+            this->on_values_change_single();
             return EventResult::OK;
         });
 
-        const Config *values;
-        if (meters.get_values(source_meter_a, &values, 0_us) == MeterValueAvailability::Fresh) {
-            on_values_change_single(values);
+        const float *values;
+        size_t values_count;
+        if (meters.get_values(source_meter_a, &values, &values_count, 0_us) == MeterValueAvailability::Fresh) {
+            on_values_change_single();
         }
     } else if (source_mode == SourceMode::Double) {
         event.registerEvent(values_path_a, {}, [this](const Config */*event_values*/) {
@@ -247,11 +248,19 @@ EventResult MeterMeta::on_value_ids_change(const Config *value_ids)
     return EventResult::Deregister;
 }
 
-void MeterMeta::on_values_change_single(const Config *source_values)
+void MeterMeta::on_values_change_single()
 {
     if (mode == ConfigMode::Pf2Current) {
+        const float *source_values;
+        size_t source_count;
+        meters.get_values(source_meter_a, &source_values, &source_count);
+
+        if (source_count <= 0) {
+            return;
+        }
+
         float values[METER_META_PF_INDEX_COUNT];
-        values[METER_META_PF_INDEX_POWER] = source_values->get((*value_indices)[METER_META_PF_INDEX_POWER][0])->asFloat();
+        values[METER_META_PF_INDEX_POWER] = source_values[(*value_indices)[METER_META_PF_INDEX_POWER][0]];
 
         for (size_t i = 0; i < 3; i++) {
             union {
@@ -259,8 +268,8 @@ void MeterMeta::on_values_change_single(const Config *source_values)
                 uint32_t u32;
             } current, pf;
 
-            current.f = source_values->get((*value_indices)[METER_META_PF_INDEX_CURRENT_L1 + i][0])->asFloat();
-            pf.f      = source_values->get((*value_indices)[METER_META_PF_INDEX_PF_L1      + i][0])->asFloat();
+            current.f = source_values[(*value_indices)[METER_META_PF_INDEX_CURRENT_L1 + i][0]];
+            pf.f      = source_values[(*value_indices)[METER_META_PF_INDEX_PF_L1      + i][0]];
 
             // Replace current value's sign with power factor value's sign.
             current.u32 ^= (current.u32 ^ pf.u32) & 0x80000000u;
@@ -288,13 +297,15 @@ void MeterMeta::on_values_change_double()
 
 void MeterMeta::on_values_change_task_double()
 {
-    const Config *values_a;
-    const Config *values_b;
+    const float *values_a;
+    const float *values_b;
+    size_t count_a;
+    size_t count_b;
 
-    MeterValueAvailability availability_a = meters.get_values(source_meter_a, &values_a, micros_t{2100 * 1000}); // 2.1s
-    MeterValueAvailability availability_b = meters.get_values(source_meter_b, &values_b, micros_t{2100 * 1000}); // 2.1s
+    MeterValueAvailability availability_a = meters.get_values(source_meter_a, &values_a, &count_a, micros_t{2100 * 1000}); // 2.1s
+    MeterValueAvailability availability_b = meters.get_values(source_meter_b, &values_b, &count_b, micros_t{2100 * 1000}); // 2.1s
 
-    if (values_a->count() <= 0 || values_b->count() <= 0) {
+    if (count_a <= 0 || count_b <= 0) {
         return;
     }
 
@@ -311,8 +322,8 @@ void MeterMeta::on_values_change_task_double()
     float values[METERS_MAX_VALUES_PER_METER];
 
     for (size_t i = 0; i < value_count; i++) {
-        float value_a = values_a->get((*value_indices)[i][0])->asFloat();
-        float value_b = values_b->get((*value_indices)[i][1])->asFloat();
+        float value_a = values_a[(*value_indices)[i][0]];
+        float value_b = values_b[(*value_indices)[i][1]];
         float value;
 
         if (mode == ConfigMode::Sum) {
@@ -68,7 +68,7 @@ public:
     bool supports_currents()      override {return true;}
 
     EventResult on_value_ids_change(const Config *value_ids);
-    void on_values_change_single(const Config *source_values);
+    void on_values_change_single();
     void on_values_change_double();
     void on_values_change_task_double();
 
@@ -39,6 +39,11 @@ void GenericModbusTCPClient::connect_callback()
 }
 
 void GenericModbusTCPClient::start_generic_read()
+{
+    start_read(&generic_read_request);
+}
+
+void GenericModbusTCPClient::start_read(ReadRequest *request)
 {
     if (connected_client == nullptr) {
         return;
@@ -51,34 +56,34 @@ void GenericModbusTCPClient::start_generic_read()
         return;
     }
 
-    read_buffer_num = 0;
-    registers_done_count = 0;
+    request->read_buffer_num = 0;
+    request->registers_done_count = 0;
 
-    if (generic_read_request.register_count == 0) {
-        generic_read_request.result = TFModbusTCPClientTransactionResult::InvalidArgument;
-        generic_read_request.done_callback();
+    if (request->register_count == 0) {
+        request->result = TFModbusTCPClientTransactionResult::InvalidArgument;
+        request->done_callback();
         return;
     }
 
-    size_t read_blocks = (generic_read_request.register_count + TF_MODBUS_TCP_MAX_READ_REGISTER_COUNT - 1) / TF_MODBUS_TCP_MAX_READ_REGISTER_COUNT;
-    read_block_size = static_cast<uint16_t>((generic_read_request.register_count + read_blocks - 1) / read_blocks);
+    size_t read_blocks = (request->register_count + TF_MODBUS_TCP_MAX_READ_REGISTER_COUNT - 1) / TF_MODBUS_TCP_MAX_READ_REGISTER_COUNT;
+    request->read_block_size = static_cast<uint16_t>((request->register_count + read_blocks - 1) / read_blocks);
 
-    read_next();
+    read_next(request);
 }
 
-void GenericModbusTCPClient::read_next()
+void GenericModbusTCPClient::read_next(ReadRequest *request)
 {
     if (connected_client == nullptr) {
         esp_system_abort("generic_modbus_tcp_client: Not connected while trying to read");
     }
 
-    uint16_t *target_buffer = generic_read_request.data[read_buffer_num] + registers_done_count;
-    uint16_t read_start_address = static_cast<uint16_t>(generic_read_request.start_address + registers_done_count);
-    uint16_t registers_remaining = static_cast<uint16_t>(generic_read_request.register_count - registers_done_count);
-    uint16_t read_count = registers_remaining < read_block_size ? registers_remaining : read_block_size;
+    uint16_t *target_buffer = request->data[request->read_buffer_num] + request->registers_done_count;
+    uint16_t read_start_address = static_cast<uint16_t>(request->start_address + request->registers_done_count);
+    uint16_t registers_remaining = static_cast<uint16_t>(request->register_count - request->registers_done_count);
+    uint16_t read_count = registers_remaining < request->read_block_size ? registers_remaining : request->read_block_size;
     TFModbusTCPDataType data_type;
 
-    switch (generic_read_request.register_type) {
+    switch (request->register_type) {
     case ModbusRegisterType::HoldingRegister: data_type = TFModbusTCPDataType::HoldingRegister; break;
     case ModbusRegisterType::InputRegister:   data_type = TFModbusTCPDataType::InputRegister;   break;
     default:
@@ -86,7 +91,7 @@ void GenericModbusTCPClient::read_next()
     }
 
     static_cast<TFModbusTCPSharedClient *>(connected_client)->read(data_type, device_address, read_start_address, read_count, target_buffer, 2_s,
-    [this, data_type, read_start_address, read_count](TFModbusTCPClientTransactionResult result) {
+    [this, request, data_type, read_start_address, read_count](TFModbusTCPClientTransactionResult result) {
         if (last_read_result == result) {
             ++last_read_result_burst_length;
         }
@@ -110,29 +115,29 @@ void GenericModbusTCPClient::read_next()
                                          static_cast<int>(result));
             }
 
-            generic_read_request.result = result;
-            generic_read_request.done_callback();
+            request->result = result;
+            request->done_callback();
             return;
         }
 
-        registers_done_count = static_cast<uint16_t>(registers_done_count + read_block_size);
+        request->registers_done_count = static_cast<uint16_t>(request->registers_done_count + request->read_block_size);
 
-        if (registers_done_count >= generic_read_request.register_count) {
+        if (request->registers_done_count >= request->register_count) {
             // buffer done
-            if (generic_read_request.read_twice && read_buffer_num == 0) {
+            if (request->read_twice && request->read_buffer_num == 0) {
                 // Two reads requested and first read is done. -> Next buffer.
-                read_buffer_num = 1;
-                registers_done_count = 0;
+                request->read_buffer_num = 1;
+                request->registers_done_count = 0;
             } else {
                 // Only one read requested or second buffer done. -> All done.
                 last_successful_read = now_us();
-                generic_read_request.result = TFModbusTCPClientTransactionResult::Success;
-                generic_read_request.done_callback();
+                request->result = TFModbusTCPClientTransactionResult::Success;
+                request->done_callback();
                 return;
             }
         }
 
-        read_next();
+        read_next(request);
     });
 
     // Read successfully dispatched, will continue in callback.
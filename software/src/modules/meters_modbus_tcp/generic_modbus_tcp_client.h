@@ -37,6 +37,11 @@ protected:
         bool read_twice;
         TFModbusTCPClientTransactionResult result;
         std::function<void(void)> done_callback;
+
+        // Progress of the read, set by start_read.
+        uint8_t read_buffer_num;
+        uint16_t read_block_size;
+        uint16_t registers_done_count;
     };
 
     GenericModbusTCPClient(const char *event_log_prefix_override_, TFModbusTCPClientPool *pool) :
@@ -45,19 +50,19 @@ protected:
     void connect_callback() override;
     void start_generic_read();
 
+    // Several requests can be read at once: The shared client matches the
+    // responses by transaction ID and applies the timeout per transaction.
+    void start_read(ReadRequest *request);
+
     uint8_t device_address = 0;
     ReadRequest generic_read_request;
 
 private:
-    void read_next();
+    void read_next(ReadRequest *request);
 
     micros_t last_successful_read = 0_us;
     micros_t successful_read_timeout = 1_m;
 
-    uint8_t read_buffer_num;
-    uint16_t read_block_size;
-    uint16_t registers_done_count;
-
     TFModbusTCPClientTransactionResult last_read_result = TFModbusTCPClientTransactionResult::Success;
     size_t last_read_result_burst_length = 0;
 };
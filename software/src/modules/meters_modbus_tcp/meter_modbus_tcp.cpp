@@ -136,6 +136,9 @@ void MeterModbusTCP::setup(const Config &ephemeral_config)
     port           = static_cast<uint16_t>(ephemeral_config.get("port")->asUint());
     table_id       = ephemeral_config.get("table")->getTag<MeterModbusTCPTableID>();
 
+    max_register_gap = ephemeral_config.get("max_register_gap")->asUint();
+    max_transactions_in_flight = static_cast<uint8_t>(ephemeral_config.get("max_transactions_in_flight")->asUint());
+
     switch (table_id) {
     case MeterModbusTCPTableID::None:
         logger.printfln("No table selected");
@@ -909,6 +912,9 @@ void MeterModbusTCP::setup(const Config &ephemeral_config)
         meters.declare_value_ids(slot, table->ids, table->ids_length);
     }
 
+    read_planner.reset(table->specs_length);
+    read_window.setup(max_transactions_in_flight);
+
     task_scheduler.scheduleWithFixedDelay([this]() {
         if (read_allowed) {
             read_allowed = false;
@@ -940,10 +946,8 @@ void MeterModbusTCP::connect_callback()
 {
     GenericModbusTCPClient::connect_callback();
 
-    generic_read_request.data[0] = register_buffer;
-    generic_read_request.data[1] = nullptr;
-    generic_read_request.read_twice = false;
-    generic_read_request.done_callback = [this]{ read_done_callback(); };
+    read_window.reset();
+    current_read = nullptr;
 
     read_index = 0;
     register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
@@ -957,15 +961,20 @@ void MeterModbusTCP::disconnect_callback()
     read_allowed = false;
 }
 
+bool MeterModbusTCP::skip_read(size_t index) const
+{
+    return
+#ifndef DEBUG_LOG_ALL_VALUES
+        table->index[index] == VALUE_INDEX_DEBUG ||
+#endif
+        table->specs[index].start_address == START_ADDRESS_VIRTUAL;
+}
+
 bool MeterModbusTCP::prepare_read()
 {
     bool overflow = false;
 
-    while (
-#ifndef DEBUG_LOG_ALL_VALUES
-        table->index[read_index] == VALUE_INDEX_DEBUG ||
-#endif
-        table->specs[read_index].start_address == START_ADDRESS_VIRTUAL) {
+    while (skip_read(read_index)) {
         read_index = (read_index + 1) % table->specs_length;
 
         if (read_index == 0) {
@@ -978,33 +987,76 @@ bool MeterModbusTCP::prepare_read()
 
 void MeterModbusTCP::read_next()
 {
-    if (register_buffer_index < generic_read_request.register_count
-     && generic_read_request.register_type == table->specs[read_index].register_type
-     && generic_read_request.start_address + register_buffer_index == table->specs[read_index].start_address
-     && register_buffer_index + MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(table->specs[read_index].value_type) <= generic_read_request.register_count) {
+    const ValueSpec *spec = &table->specs[read_index];
+    size_t spec_register_count = MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(spec->value_type);
+
+    // A register buffer index of METER_MODBUS_TCP_REGISTER_BUFFER_SIZE marks the buffer as invalid.
+    // ModbusReadPlanner::next_block has to match this check: It tells the read window where the next block starts.
+    if (register_buffer_index < METER_MODBUS_TCP_REGISTER_BUFFER_SIZE
+     && current_read->request.register_type == spec->register_type
+     && current_read->request.start_address <= spec->start_address
+     && spec->start_address - current_read->request.start_address + spec_register_count <= current_read->request.register_count) {
+        register_buffer_index = spec->start_address - current_read->request.start_address;
+        register_start_address = spec->start_address;
+
         read_done_callback();
     }
     else {
-        generic_read_request.register_type = table->specs[read_index].register_type;
-        generic_read_request.start_address = table->specs[read_index].start_address;
-        generic_read_request.register_count = MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(table->specs[read_index].value_type);
-
-        for (size_t i = read_index + 1; i < table->specs_length; ++i) {
-            if (generic_read_request.register_type == table->specs[i].register_type
-             && generic_read_request.start_address + generic_read_request.register_count == table->specs[i].start_address
-             && generic_read_request.register_count + MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(table->specs[i].value_type) <= max_register_count) {
-                generic_read_request.register_count += MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(table->specs[i].value_type);
-                continue;
-            }
+        if (cycle_request_count == 0) {
+            cycle_start = now_us();
+        }
 
-            break;
+        ++cycle_request_count;
+
+        register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
+
+        // The block might have been read already, while the previous one was processed.
+        read_window.read(read_index);
+        pump_reads();
+    }
+}
+
+void MeterModbusTCP::pump_reads()
+{
+    auto register_count = [](const ValueSpec &s) {
+        return static_cast<size_t>(MODBUS_VALUE_TYPE_TO_REGISTER_COUNT(s.value_type));
+    };
+
+    read_window.pump([this, &register_count](BlockRead &read, size_t first) {
+        const ValueSpec *spec = &table->specs[first];
+
+        read.block = read_planner.plan(table->specs, table->specs_length, first, max_register_count, max_register_gap, START_ADDRESS_VIRTUAL, register_count);
+
+        read.request.register_type = spec->register_type;
+        read.request.start_address = read.block.start_address;
+        read.request.register_count = read.block.register_count;
+        read.request.data[0] = read.buffer;
+        read.request.data[1] = nullptr;
+        read.request.read_twice = false;
+
+        // Planning stops at the end of the table: The next cycle starts after a pause.
+        return ModbusReadPlanner::next_block(table->specs, table->specs_length, first, read.block, register_count, [this](size_t index) {
+            return skip_read(index);
+        });
+    },
+    [this](ModbusReadWindow<BlockRead>::Slot *slot) {
+        if (!slot->read.request.done_callback) {
+            slot->read.request.done_callback = [this, slot]() {
+                read_window.read_returned(slot);
+                pump_reads();
+            };
         }
 
+        start_read(&slot->read.request);
+    },
+    [this](ModbusReadWindow<BlockRead>::Slot *slot) {
+        current_read = &slot->read;
+        register_buffer = current_read->buffer;
         register_buffer_index = 0;
-        register_start_address = generic_read_request.start_address;
+        register_start_address = current_read->request.start_address;
 
-        start_generic_read();
-    }
+        read_done_callback();
+    });
 }
 
 bool MeterModbusTCP::is_sungrow_inverter_meter() const
@@ -1073,19 +1125,30 @@ bool MeterModbusTCP::is_carlo_gavazzi_em510() const
 
 void MeterModbusTCP::read_done_callback()
 {
-    if (generic_read_request.result != TFModbusTCPClientTransactionResult::Success) {
-        if (generic_read_request.result == TFModbusTCPClientTransactionResult::Timeout) {
+    if (current_read->request.result != TFModbusTCPClientTransactionResult::Success) {
+        if (current_read->request.result == TFModbusTCPClientTransactionResult::Timeout) {
             auto timeout = errors->get("timeout");
             timeout->updateUint(timeout->asUint() + 1);
         }
+        else if (current_read->request.result != TFModbusTCPClientTransactionResult::InvalidArgument
+              && read_planner.read_failed(read_index, current_read->block)) {
+            // Probably an exception caused by an unmapped register in a gap.
+            // Retry only this block right away, without bridging gaps from now on.
+            logger.printfln("%s / %s: Read including gaps failed, reading this block without gaps from now on",
+                            get_meter_modbus_tcp_table_id_name(table_id), table->specs[read_index].name);
+            register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
+            read_next();
+            return;
+        }
 
+        // The cycle continues with this value on the next read, keep counting its requests.
         read_allowed = true;
         register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
         return;
     }
 
     if (is_sungrow_inverter_meter()
-     && generic_read_request.start_address == SUNGROW_INVERTER_OUTPUT_TYPE_ADDRESS) {
+     && register_start_address == SUNGROW_INVERTER_OUTPUT_TYPE_ADDRESS) {
         if (sungrow_inverter_output_type < 0) {
             switch (register_buffer[register_buffer_index]) {
             case 0:
@@ -1145,7 +1208,7 @@ void MeterModbusTCP::read_done_callback()
     }
 
     if (is_deye_hybrid_inverter_battery_meter()
-     && generic_read_request.start_address == DEYE_HYBRID_INVERTER_DEVICE_TYPE_ADDRESS) {
+     && register_start_address == DEYE_HYBRID_INVERTER_DEVICE_TYPE_ADDRESS) {
         if (deye_hybrid_inverter_device_type < 0) {
             switch (register_buffer[register_buffer_index]) {
             case 0x0002:
@@ -1570,6 +1633,13 @@ void MeterModbusTCP::read_done_callback()
     }
 
     if (overflow) {
+        state->get("requests_per_cycle")->updateUint(cycle_request_count);
+        state->get("cycle_time")->updateUint(static_cast<uint32_t>(static_cast<int64_t>(now_us() - cycle_start) / 1000));
+        cycle_request_count = 0;
+
+        // Don't reuse the buffer in the next round trip.
+        register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
+
         // make a little pause after each round trip
         meters.finish_update(slot);
         read_allowed = true;
@@ -23,6 +23,8 @@
 #include <stdint.h>
 
 #include "generic_modbus_tcp_client.h"
+#include "modbus_read_planner.h"
+#include "modbus_read_window.h"
 #include "modules/meters/imeter.h"
 #include "modules/meters/meter_value_id.h"
 #include "config.h"
@@ -56,6 +58,18 @@
 
 #define METER_MODBUS_TCP_REGISTER_BUFFER_SIZE 32
 
+// Values separated by up to this many unused registers are read with a single request.
+// Configurable per meter.
+#define METER_MODBUS_TCP_DEFAULT_MAX_REGISTER_GAP 8
+
+// Number of planned blocks whose reads are outstanding at once. Devices that
+// do not accept multiple outstanding transaction IDs per connection require 1.
+// Configurable per meter. Meters with the same host and port share a pooled
+// connection: Their windows add up on that connection, so all of them should
+// use the same value.
+#define METER_MODBUS_TCP_DEFAULT_MAX_TRANSACTIONS_IN_FLIGHT 1
+#define METER_MODBUS_TCP_MAX_TRANSACTIONS_IN_FLIGHT 8
+
 class MeterModbusTCP final : protected GenericModbusTCPClient, public IMeter
 {
 public:
@@ -94,10 +108,18 @@ public:
     void read_done_callback();
 
 private:
+    struct BlockRead {
+        ReadRequest request;
+        ModbusReadBlock block;
+        uint16_t buffer[METER_MODBUS_TCP_REGISTER_BUFFER_SIZE];
+    };
+
     void connect_callback() override;
     void disconnect_callback() override;
+    bool skip_read(size_t index) const;
     bool prepare_read();
     void read_next();
+    void pump_reads();
     bool is_sungrow_inverter_meter() const;
     bool is_sungrow_grid_meter() const;
     bool is_sungrow_battery_meter() const;
@@ -120,8 +142,18 @@ private:
     bool values_declared = false;
     size_t read_index = 0;
     size_t max_register_count = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
+    size_t max_register_gap = METER_MODBUS_TCP_DEFAULT_MAX_REGISTER_GAP;
+
+    uint8_t max_transactions_in_flight = METER_MODBUS_TCP_DEFAULT_MAX_TRANSACTIONS_IN_FLIGHT;
+
+    ModbusReadPlanner read_planner;
+    ModbusReadWindow<BlockRead> read_window;
+    BlockRead *current_read = nullptr;
+
+    uint32_t cycle_request_count = 0;
+    micros_t cycle_start = 0_us;
 
-    uint16_t register_buffer[METER_MODBUS_TCP_REGISTER_BUFFER_SIZE];
+    uint16_t *register_buffer = nullptr;
     size_t register_buffer_index = METER_MODBUS_TCP_REGISTER_BUFFER_SIZE;
     size_t register_start_address;
 
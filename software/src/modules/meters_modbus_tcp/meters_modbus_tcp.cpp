@@ -166,6 +166,8 @@ void MetersModbusTCP::pre_setup()
         {"display_name",   Config::Str("", 0, 32)},
         {"host",           Config::Str("", 0, 64)},
         {"port",           Config::Uint16(502)},
+        {"max_register_gap", Config::Uint(METER_MODBUS_TCP_DEFAULT_MAX_REGISTER_GAP, 0, METER_MODBUS_TCP_REGISTER_BUFFER_SIZE)},
+        {"max_transactions_in_flight", Config::Uint(METER_MODBUS_TCP_DEFAULT_MAX_TRANSACTIONS_IN_FLIGHT, 1, METER_MODBUS_TCP_MAX_TRANSACTIONS_IN_FLIGHT)},
         {"table",          Config::Union<MeterModbusTCPTableID>(
             *Config::Null(),
             MeterModbusTCPTableID::None,
@@ -174,6 +176,11 @@ void MetersModbusTCP::pre_setup()
         )},
     });
 
+    state_prototype = Config::Object({
+        {"requests_per_cycle", Config::Uint32(0)},
+        {"cycle_time", Config::Uint32(0)}, // ms
+    });
+
     errors_prototype = Config::Object({
         {"timeout", Config::Uint32(0)},
     });
@@ -199,7 +206,7 @@ const Config *MetersModbusTCP::get_config_prototype()
 
 const Config *MetersModbusTCP::get_state_prototype()
 {
-    return Config::Null();
+    return &state_prototype;
 }
 
 const Config *MetersModbusTCP::get_errors_prototype()
@@ -0,0 +1,122 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct ModbusReadBlock {
+    size_t start_address;
+    size_t register_count;
+    bool gap_bridged;
+};
+
+// Merges the values of a table into as few reads as possible.
+// Some devices reject reads that include unmapped registers: Blocks that failed
+// while bridging a gap are read without bridging gaps from then on.
+class ModbusReadPlanner
+{
+public:
+    void reset(size_t specs_length)
+    {
+        gap_bridging_disabled.assign(specs_length, false);
+    }
+
+    // Plans the read of the block that starts at specs[first]. Specs are sorted by address within a block.
+    // Extends the read up to the last spec that is at most max_gap unused registers behind the previous one
+    // and still fits into max_register_count registers. Specs at virtual_address are skipped.
+    // Spec needs the members register_type and start_address, register_count(spec) returns its length in registers.
+    template<typename Spec, typename RegisterCount>
+    ModbusReadBlock plan(const Spec *specs, size_t specs_length, size_t first, size_t max_register_count, size_t max_gap, size_t virtual_address, RegisterCount &&register_count) const
+    {
+        if (first < gap_bridging_disabled.size() && gap_bridging_disabled[first]) {
+            max_gap = 0;
+        }
+
+        const Spec &first_spec = specs[first];
+        ModbusReadBlock block = {first_spec.start_address, register_count(first_spec), false};
+
+        for (size_t i = first + 1; i < specs_length; ++i) {
+            const Spec &next_spec = specs[i];
+
+            if (next_spec.start_address == virtual_address) {
+                continue;
+            }
+
+            size_t read_end = block.start_address + block.register_count;
+
+            if (first_spec.register_type != next_spec.register_type
+             || next_spec.start_address < read_end
+             || next_spec.start_address - read_end > max_gap) {
+                break;
+            }
+
+            size_t extended_register_count = next_spec.start_address - block.start_address + register_count(next_spec);
+
+            if (extended_register_count > max_register_count) {
+                break;
+            }
+
+            block.gap_bridged |= next_spec.start_address != read_end;
+            block.register_count = extended_register_count;
+        }
+
+        return block;
+    }
+
+    // Returns the index of the spec that the read after the block starts with: The first spec behind specs[first]
+    // that is not skipped and not inside the block. Returns SIZE_MAX if the table ends before.
+    // skip(index) returns true for specs that are not read, register_count(spec) as for plan.
+    template<typename Spec, typename RegisterCount, typename Skip>
+    static size_t next_block(const Spec *specs, size_t specs_length, size_t first, const ModbusReadBlock &block, RegisterCount &&register_count, Skip &&skip)
+    {
+        for (size_t i = first + 1; i < specs_length; ++i) {
+            if (skip(i)) {
+                continue;
+            }
+
+            const Spec &spec = specs[i];
+
+            if (spec.register_type != specs[first].register_type
+             || spec.start_address < block.start_address
+             || spec.start_address - block.start_address + register_count(spec) > block.register_count) {
+                return i;
+            }
+        }
+
+        return SIZE_MAX;
+    }
+
+    // Returns true if the failed read of the block should be retried without bridging gaps.
+    bool read_failed(size_t first, const ModbusReadBlock &block)
+    {
+        if (!block.gap_bridged || first >= gap_bridging_disabled.size() || gap_bridging_disabled[first]) {
+            return false;
+        }
+
+        gap_bridging_disabled[first] = true;
+        return true;
+    }
+
+private:
+    // Indexed by spec. Set if a read starting at this spec failed while bridging a gap.
+    std::vector<bool> gap_bridging_disabled;
+};
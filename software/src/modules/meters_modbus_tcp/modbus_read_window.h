@@ -0,0 +1,214 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#define MODBUS_READ_WINDOW_NO_BLOCK SIZE_MAX
+
+// Keeps the reads of up to max_in_flight planned blocks of a value table
+// outstanding, so that the device already works on the next blocks while
+// the caller processes the values of the first one. The caller gets the
+// blocks in the order they were planned. Each slot has its own read data,
+// because the reads write into it: A block that is discarded while its read
+// is outstanding keeps its slot until the read returned.
+template<typename Read>
+class ModbusReadWindow
+{
+private:
+    enum : uint8_t {
+        FREE,
+        IN_FLIGHT,
+        RETURNED,
+        CURRENT,
+    };
+
+public:
+    struct Slot {
+        Read read;
+        size_t first = MODBUS_READ_WINDOW_NO_BLOCK; // Index of the spec the block starts with
+        uint32_t seq = 0;                           // Planning order
+        uint8_t state = FREE;
+        bool discarded = false;
+    };
+
+    void setup(uint8_t max_in_flight)
+    {
+        slots_length = max_in_flight > 0 ? max_in_flight : 1;
+        slots.reset(new Slot[slots_length]);
+        reset();
+    }
+
+    // Forgets all blocks, for example after a reconnect.
+    void reset()
+    {
+        for (size_t i = 0; i < slots_length; ++i) {
+            slots[i].state = FREE;
+            slots[i].discarded = false;
+        }
+
+        next_first = MODBUS_READ_WINDOW_NO_BLOCK;
+        current = nullptr;
+        waiting = false;
+    }
+
+    // The caller is done with the current block and needs the one that starts with specs[first].
+    // If the next planned block starts somewhere else, for example because the table changed or
+    // a read failed, the planned blocks are discarded and planning starts again at first.
+    void read(size_t first)
+    {
+        if (current != nullptr) {
+            current->state = FREE;
+            current = nullptr;
+        }
+
+        Slot *next = oldest();
+
+        if (next == nullptr || next->first != first) {
+            for (size_t i = 0; i < slots_length; ++i) {
+                Slot &slot = slots[i];
+
+                if (slot.state == IN_FLIGHT) {
+                    slot.discarded = true;
+                } else {
+                    slot.state = FREE;
+                }
+            }
+
+            next_first = first;
+        }
+
+        waiting = true;
+    }
+
+    // Call when the read of the slot returned.
+    void read_returned(Slot *slot)
+    {
+        // Returned after a reset.
+        if (slot->state != IN_FLIGHT) {
+            return;
+        }
+
+        slot->state = slot->discarded ? FREE : RETURNED;
+        slot->discarded = false;
+    }
+
+    // Plans and dispatches blocks until the window is full and passes the next block to process once its read returned.
+    // plan(read, first) fills the read of the block that starts with specs[first] and returns the first spec of the block
+    // after it or MODBUS_READ_WINDOW_NO_BLOCK at the end of the table. dispatch(slot) starts the read and may call
+    // read_returned and pump before it returns, for example if the connection is gone. process(slot) may call read and pump.
+    // Such nested calls of pump return immediately: The loop below continues.
+    template<typename Plan, typename Dispatch, typename Process>
+    void pump(Plan &&plan, Dispatch &&dispatch, Process &&process)
+    {
+        if (pumping) {
+            return;
+        }
+
+        pumping = true;
+
+        bool progress;
+
+        do {
+            progress = false;
+
+            Slot *slot;
+
+            while (next_first != MODBUS_READ_WINDOW_NO_BLOCK && (slot = free_slot()) != nullptr) {
+                slot->first = next_first;
+                slot->seq = next_seq++;
+                slot->state = IN_FLIGHT;
+                slot->discarded = false;
+
+                next_first = plan(slot->read, slot->first);
+
+                dispatch(slot);
+                progress = true;
+            }
+
+            if (waiting) {
+                slot = oldest();
+
+                if (slot != nullptr && slot->state == RETURNED) {
+                    waiting = false;
+                    current = slot;
+                    slot->state = CURRENT;
+
+                    process(slot);
+                    progress = true;
+                }
+            }
+        } while (progress);
+
+        pumping = false;
+    }
+
+    uint8_t get_in_flight() const
+    {
+        uint8_t in_flight = 0;
+
+        for (size_t i = 0; i < slots_length; ++i) {
+            if (slots[i].state == IN_FLIGHT) {
+                ++in_flight;
+            }
+        }
+
+        return in_flight;
+    }
+
+private:
+    Slot *free_slot()
+    {
+        for (size_t i = 0; i < slots_length; ++i) {
+            if (slots[i].state == FREE) {
+                return &slots[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    // The next block to pass to the caller.
+    Slot *oldest()
+    {
+        Slot *result = nullptr;
+
+        for (size_t i = 0; i < slots_length; ++i) {
+            Slot &slot = slots[i];
+
+            if ((slot.state == IN_FLIGHT || slot.state == RETURNED) && !slot.discarded
+             && (result == nullptr || static_cast<int32_t>(slot.seq - result->seq) < 0)) {
+                result = &slot;
+            }
+        }
+
+        return result;
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t slots_length = 0;
+    size_t next_first = MODBUS_READ_WINDOW_NO_BLOCK;
+    Slot *current = nullptr;
+    uint32_t next_seq = 0;
+    bool waiting = false;
+    bool pumping = false;
+};
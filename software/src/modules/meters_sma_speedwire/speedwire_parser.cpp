@@ -0,0 +1,206 @@
+/* esp32-firmware
+ * Copyright (C) 2023 Thomas Hein
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "speedwire_parser.h"
+
+#define SPEEDWIRE_DATA_LENGTH_OFFSET 12
+#define SPEEDWIRE_PROTOCOL_OFFSET    16
+#define SPEEDWIRE_RECORDS_OFFSET     28
+#define SPEEDWIRE_PROTOCOL_ID_EMETER 0x6069
+#define SPEEDWIRE_CHANNEL_VERSION    0x90
+
+// constexpr to build the lookup table below at compile time. Has external linkage because of the declaration in the header.
+constexpr speedwire_obis_mapping speedwire_obis_mappings[SPEEDWIRE_OBIS_COUNT] {
+    { 1, 4,      1/10.0F},  // PowerActiveLSumImport
+    {21, 4,      1/10.0F},  // PowerActiveL1Import
+    {41, 4,      1/10.0F},  // PowerActiveL2Import
+    {61, 4,      1/10.0F},  // PowerActiveL3Import
+
+    { 1, 8, 1/3600000.0F},  // EnergyActiveLSumImport
+    {21, 8, 1/3600000.0F},  // EnergyActiveL1Import
+    {41, 8, 1/3600000.0F},  // EnergyActiveL2Import
+    {61, 8, 1/3600000.0F},  // EnergyActiveL3Import
+
+    { 2, 4,      1/10.0F},  // PowerActiveLSumExport
+    {22, 4,      1/10.0F},  // PowerActiveL1Export
+    {42, 4,      1/10.0F},  // PowerActiveL2Export
+    {62, 4,      1/10.0F},  // PowerActiveL3Export
+
+    { 2, 8, 1/3600000.0F},  // EnergyActiveLSumExport
+    {22, 8, 1/3600000.0F},  // EnergyActiveL1Export
+    {42, 8, 1/3600000.0F},  // EnergyActiveL2Export
+    {62, 8, 1/3600000.0F},  // EnergyActiveL3Export
+
+    { 3, 4,      1/10.0F},  // PowerReactiveLSumInductive
+    {23, 4,      1/10.0F},  // PowerReactiveL1Inductive
+    {43, 4,      1/10.0F},  // PowerReactiveL2Inductive
+    {63, 4,      1/10.0F},  // PowerReactiveL3Inductive
+
+    { 3, 8, 1/3600000.0F},  // EnergyReactiveLSumInductive
+    {23, 8, 1/3600000.0F},  // EnergyReactiveL1Inductive
+    {43, 8, 1/3600000.0F},  // EnergyReactiveL2Inductive
+    {63, 8, 1/3600000.0F},  // EnergyReactiveL3Inductive
+
+    { 4, 4,      1/10.0F},  // PowerReactiveLSumCapacitive
+    {24, 4,      1/10.0F},  // PowerReactiveL1Capacitive
+    {44, 4,      1/10.0F},  // PowerReactiveL2Capacitive
+    {64, 4,      1/10.0F},  // PowerReactiveL3Capacitive
+
+    { 4, 8, 1/3600000.0F},  // EnergyReactiveLSumCapacitive
+    {24, 8, 1/3600000.0F},  // EnergyReactiveL1Capacitive
+    {44, 8, 1/3600000.0F},  // EnergyReactiveL2Capacitive
+    {64, 8, 1/3600000.0F},  // EnergyReactiveL3Capacitive
+
+    { 9, 4,      1/10.0F},  // PowerApparentLSumImport
+    {29, 4,      1/10.0F},  // PowerApparentL1Import
+    {49, 4,      1/10.0F},  // PowerApparentL2Import
+    {69, 4,      1/10.0F},  // PowerApparentL3Import
+
+    { 9, 8, 1/3600000.0F},  // EnergyApparentLSumImport
+    {29, 8, 1/3600000.0F},  // EnergyApparentL1Import
+    {49, 8, 1/3600000.0F},  // EnergyApparentL2Import
+    {69, 8, 1/3600000.0F},  // EnergyApparentL3Import
+
+    {10, 4,      1/10.0F},  // PowerApparentLSumExport
+    {30, 4,      1/10.0F},  // PowerApparentL1Export
+    {50, 4,      1/10.0F},  // PowerApparentL2Export
+    {70, 4,      1/10.0F},  // PowerApparentL3Export
+
+    {10, 8, 1/3600000.0F},  // EnergyApparentLSumExport
+    {30, 8, 1/3600000.0F},  // EnergyApparentL1Export
+    {50, 8, 1/3600000.0F},  // EnergyApparentL2Export
+    {70, 8, 1/3600000.0F},  // EnergyApparentL3Export
+
+    // Power factors are always positive, for both import and export
+    {13, 4,    1/1000.0F},  // PowerFactorLSum
+    {33, 4,    1/1000.0F},  // PowerFactorL1
+    {53, 4,    1/1000.0F},  // PowerFactorL2
+    {73, 4,    1/1000.0F},  // PowerFactorL3
+
+    {32, 4,    1/1000.0F},  // VoltageL1N
+    {52, 4,    1/1000.0F},  // VoltageL2N
+    {72, 4,    1/1000.0F},  // VoltageL3N
+
+    // Currents are always positive, for both import and export
+    {31, 4,    1/1000.0F},  // CurrentL1ImExSum
+    {51, 4,    1/1000.0F},  // CurrentL2ImExSum
+    {71, 4,    1/1000.0F},  // CurrentL3ImExSum
+
+    {14, 4,    1/1000.0F},  // FrequencyLAvg
+
+};
+
+// Maps [type == 8][index] to the position in speedwire_obis_mappings + 1. 0 means not mapped.
+struct speedwire_obis_lookup {
+    uint8_t pos[2][SPEEDWIRE_OBIS_INDEX_LIMIT];
+};
+
+static constexpr speedwire_obis_lookup make_obis_lookup()
+{
+    speedwire_obis_lookup lookup{};
+
+    for (size_t i = 0; i < SPEEDWIRE_OBIS_COUNT; i++) {
+        const speedwire_obis_mapping &mapping = speedwire_obis_mappings[i];
+        lookup.pos[mapping.type == 8 ? 1 : 0][mapping.index] = static_cast<uint8_t>(i + 1);
+    }
+
+    return lookup;
+}
+
+static constexpr speedwire_obis_lookup obis_lookup = make_obis_lookup();
+
+static uint16_t read_uint16(const uint8_t *buf)
+{
+    return static_cast<uint16_t>(buf[0] << 8 | buf[1]);
+}
+
+static uint32_t read_uint32(const uint8_t *buf)
+{
+    return static_cast<uint32_t>(buf[0]) << 24 |
+           static_cast<uint32_t>(buf[1]) << 16 |
+           static_cast<uint32_t>(buf[2]) <<  8 |
+           static_cast<uint32_t>(buf[3]) <<  0;
+}
+
+static uint64_t read_uint64(const uint8_t *buf)
+{
+    return static_cast<uint64_t>(read_uint32(buf)) << 32 | read_uint32(buf + 4);
+}
+
+int speedwire_parse_values(const uint8_t *buf, size_t buflen, float values[SPEEDWIRE_OBIS_COUNT])
+{
+    // "SMA\0", tag 0x02A0 with group 1, data length, tag 0x0010, protocol ID, SUSy ID, serial number, ticker
+    if (buflen < SPEEDWIRE_RECORDS_OFFSET || buf[0] != 'S' || buf[1] != 'M' || buf[2] != 'A' || buf[3] != 0) {
+        return -1;
+    }
+
+    if (read_uint16(buf + SPEEDWIRE_PROTOCOL_OFFSET) != SPEEDWIRE_PROTOCOL_ID_EMETER) {
+        return -1;
+    }
+
+    // The data length counts from the protocol ID up to the end tag.
+    size_t end = SPEEDWIRE_PROTOCOL_OFFSET + read_uint16(buf + SPEEDWIRE_DATA_LENGTH_OFFSET);
+
+    if (end > buflen || end < SPEEDWIRE_RECORDS_OFFSET) {
+        return -1;
+    }
+
+    int found = 0;
+    size_t pos = SPEEDWIRE_RECORDS_OFFSET;
+
+    while (pos + 4 <= end) {
+        uint8_t channel = buf[pos + 0];
+        uint8_t index   = buf[pos + 1];
+        uint8_t type    = buf[pos + 2];
+        uint8_t tariff  = buf[pos + 3];
+
+        // The software version record has type 0 but a 4 byte value.
+        size_t value_len = channel == SPEEDWIRE_CHANNEL_VERSION ? 4 : type;
+
+        if (value_len != 4 && value_len != 8) {
+            return -1;
+        }
+
+        const uint8_t *value = buf + pos + 4;
+        pos += 4 + value_len;
+
+        if (pos > end) {
+            return -1;
+        }
+
+        if (channel != 0 || tariff != 0 || index >= SPEEDWIRE_OBIS_INDEX_LIMIT) {
+            continue;
+        }
+
+        uint8_t mapping_pos = obis_lookup.pos[type == 8 ? 1 : 0][index];
+
+        if (mapping_pos == 0) {
+            continue;
+        }
+
+        const speedwire_obis_mapping &mapping = speedwire_obis_mappings[mapping_pos - 1];
+        float raw = type == 8 ? static_cast<float>(read_uint64(value)) : static_cast<float>(read_uint32(value));
+
+        values[mapping_pos - 1] = raw * mapping.scaling_factor;
+        ++found;
+    }
+
+    return found;
+}
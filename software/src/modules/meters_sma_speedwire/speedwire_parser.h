@@ -0,0 +1,46 @@
+/* esp32-firmware
+ * Copyright (C) 2023 Thomas Hein
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPEEDWIRE_OBIS_COUNT 59
+
+// OBIS indices of the energy meter protocol are below this limit.
+#define SPEEDWIRE_OBIS_INDEX_LIMIT 80
+
+// Measurement of channel 0 and tariff 0. The type is the length of the value in bytes:
+// 4 for momentary values, 8 for counters.
+struct speedwire_obis_mapping {
+    uint8_t index;
+    uint8_t type;
+    float scaling_factor;
+};
+
+extern const speedwire_obis_mapping speedwire_obis_mappings[SPEEDWIRE_OBIS_COUNT];
+
+// Walks the OBIS records of an energy meter datagram (protocol ID 0x6069) once and
+// stores each known measurement at the position of its speedwire_obis_mappings entry.
+// Entries that are not present in the datagram are not touched.
+// Returns the number of stored values or -1 if the datagram is not an energy meter datagram
+// or a record exceeds the datagram.
+int speedwire_parse_values(const uint8_t *buf, size_t buflen, float values[SPEEDWIRE_OBIS_COUNT]);
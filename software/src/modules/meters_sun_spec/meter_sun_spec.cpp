@@ -30,12 +30,20 @@
 #define COMMON_MODEL_ID 1
 #define NON_IMPLEMENTED_UINT16 0xFFFF
 
+// SunSpec ID and the Common model up to DA, read in one request to verify a stored discovery.
+#define VERIFY_REGCOUNT (2 + 67)
+
 static const uint16_t scan_base_addresses[] {
     40000,
     50000,
     0
 };
 
+String MeterSunSpec::get_discovery_path(uint32_t slot)
+{
+    return "meters_sun_spec/" + String(slot) + "/discovery";
+}
+
 MeterClassID MeterSunSpec::get_class() const
 {
     return MeterClassID::SunSpec;
@@ -55,9 +63,31 @@ void MeterSunSpec::setup(const Config &ephemeral_config)
     model_parser = MetersSunSpecParser::new_parser(slot, model_id);
     if (!model_parser) {
         logger.printfln("No parser available for model %u", model_id);
+        API::removeConfig(get_discovery_path(slot));
         return;
     }
 
+    discovery = ConfigRoot{Config::Object({
+        {"host", Config::Str("", 0, 64)},
+        {"port", Config::Uint16(0)},
+        {"device_address", Config::Uint8(0)},
+        {"model_id", Config::Uint16(0)},
+        {"model_instance", Config::Uint16(0)},
+        {"base_address", Config::Uint16(0)},
+        {"model_start_address", Config::Uint16(0)},
+        {"manufacturer_name", Config::Str("", 0, 32)},
+        {"model_name", Config::Str("", 0, 32)},
+        {"serial_number", Config::Str("", 0, 32)},
+    })};
+
+    discovery_stored = api.restorePersistentConfig(get_discovery_path(slot), &discovery);
+    discovery_valid = discovery_stored && discovery_matches_config();
+
+    // Stored for a different configuration of this slot.
+    if (discovery_stored && !discovery_valid) {
+        discovery_remove();
+    }
+
     task_scheduler.scheduleWithFixedDelay([this]() {
         if (read_allowed) {
             read_allowed = false;
@@ -89,7 +119,16 @@ void MeterSunSpec::connect_callback()
 {
     GenericModbusTCPClient::connect_callback();
 
-    scan_start();
+    connected_at = now_us();
+    first_value_pending = true;
+    state->get("time_to_first_value")->updateUint(0);
+
+    if (discovery_valid) {
+        verify_start();
+    }
+    else {
+        scan_start();
+    }
 }
 
 void MeterSunSpec::disconnect_callback()
@@ -154,6 +193,128 @@ void MeterSunSpec::read_done_callback()
         inconsistency->updateUint(inconsistency->asUint() + 1);
         // TODO: Read again if parsing failed?
     }
+    else if (first_value_pending) {
+        first_value_pending = false;
+        state->get("time_to_first_value")->updateUint(static_cast<uint32_t>(static_cast<int64_t>(now_us() - connected_at) / 1000));
+    }
+}
+
+bool MeterSunSpec::discovery_matches_config()
+{
+    if (discovery.get("host")->asString() != host_name ||
+        discovery.get("port")->asUint() != port ||
+        discovery.get("device_address")->asUint() != device_address ||
+        discovery.get("model_id")->asUint() != model_id ||
+        discovery.get("model_instance")->asUint() != model_instance) {
+        return false;
+    }
+
+    // The configured device was found by the scan that stored the discovery, unless the configuration changed since then.
+    if (manufacturer_name.length() == 0 && model_name.length() == 0 && serial_number.length() == 0) {
+        return true;
+    }
+
+    return discovery.get("manufacturer_name")->asString() == manufacturer_name &&
+           discovery.get("model_name")->asString() == model_name &&
+           discovery.get("serial_number")->asString() == serial_number;
+}
+
+// Remembers the device of the last matching Common model during a scan.
+void MeterSunSpec::discovery_update(const char *device_manufacturer_name, const char *device_model_name, const char *device_serial_number)
+{
+    bool changed = false;
+
+    changed |= discovery.get("manufacturer_name")->updateString(String(device_manufacturer_name, strnlen(device_manufacturer_name, 32)));
+    changed |= discovery.get("model_name")->updateString(String(device_model_name, strnlen(device_model_name, 32)));
+    changed |= discovery.get("serial_number")->updateString(String(device_serial_number, strnlen(device_serial_number, 32)));
+
+    // Don't verify against a half-updated discovery and make discovery_store write it.
+    if (changed) {
+        discovery_valid = false;
+    }
+}
+
+void MeterSunSpec::discovery_store(size_t base_address, size_t model_start_address)
+{
+    bool changed = !discovery_valid;
+
+    changed |= discovery.get("host")->updateString(host_name);
+    changed |= discovery.get("port")->updateUint(port);
+    changed |= discovery.get("device_address")->updateUint(device_address);
+    changed |= discovery.get("model_id")->updateUint(model_id);
+    changed |= discovery.get("model_instance")->updateUint(model_instance);
+    changed |= discovery.get("base_address")->updateUint(static_cast<uint32_t>(base_address));
+    changed |= discovery.get("model_start_address")->updateUint(static_cast<uint32_t>(model_start_address));
+
+    discovery_valid = true;
+
+    // Only write if the scan found something else, e.g. after a firmware update of the device.
+    if (changed) {
+        API::writeConfig(get_discovery_path(slot), &discovery);
+        discovery_stored = true;
+    }
+}
+
+// Called if the configuration changed or a scan didn't find the configured model anymore.
+void MeterSunSpec::discovery_remove()
+{
+    discovery_valid = false;
+
+    if (discovery_stored) {
+        API::removeConfig(get_discovery_path(slot));
+        discovery_stored = false;
+    }
+}
+
+void MeterSunSpec::verify_start()
+{
+    free(generic_read_request.data[0]);
+
+    generic_read_request.data[0] = nullptr;
+    generic_read_request.data[1] = nullptr;
+
+    uint16_t *buffer = static_cast<uint16_t *>(malloc(sizeof(uint16_t) * VERIFY_REGCOUNT));
+    if (!buffer) {
+        logger.printfln("Cannot alloc read buffer.");
+        return;
+    }
+
+    scan_state = ScanState::Idle;
+    scan_state_next = ScanState::VerifyCommonModel;
+    scan_deserializer.buf = buffer;
+    scan_base_address = discovery.get("base_address")->asUint();
+
+    generic_read_request.register_type = ModbusRegisterType::HoldingRegister;
+    generic_read_request.start_address = scan_base_address;
+    generic_read_request.register_count = VERIFY_REGCOUNT;
+    generic_read_request.data[0] = buffer;
+    generic_read_request.read_twice = false;
+    generic_read_request.done_callback = [this]{ scan_next(); };
+
+    start_generic_read();
+}
+
+void MeterSunSpec::detect_quirks(const char *device_manufacturer_name)
+{
+    quirks = 0;
+
+    if (strncmp(device_manufacturer_name, "KOSTAL", 32) == 0) {
+        quirks |= SUN_SPEC_QUIRKS_ACC32_IS_INT32;
+        quirks |= SUN_SPEC_QUIRKS_INTEGER_METER_POWER_FACTOR_IS_UNITY;
+    } else if (strncmp(device_manufacturer_name, "SMA", 32) == 0) {
+        if (model_id >= 100 && model_id < 200) {
+            quirks |= SUN_SPEC_QUIRKS_INVERTER_CURRENT_IS_INT16;
+        }
+    } else if (strncmp(device_manufacturer_name, "SolarEdge", 9) == 0) {
+        // Compare only 9 characters. The manufacturer name for SolarEdge devices sometimes has a trailing space.
+        quirks |= SUN_SPEC_QUIRKS_ACTIVE_POWER_IS_INVERTED;
+    } else if (strncmp(device_manufacturer_name, "SUNGROW", 32) == 0) {
+        quirks |= SUN_SPEC_QUIRKS_INTEGER_INVERTER_POWER_FACTOR_IS_UNITY;
+    }
+
+    if (quirks) {
+        logger.printfln("Enabling quirks mode 0x%02x for %.32s device.", quirks, device_manufacturer_name);
+    }
 }
 
 void MeterSunSpec::scan_start_delay()
@@ -178,6 +339,7 @@ void MeterSunSpec::scan_start()
     }
 
     scan_base_address_index = 0;
+    scan_base_address = scan_base_addresses[scan_base_address_index];
     scan_state = ScanState::Idle;
     scan_state_next = ScanState::ReadSunSpecID;
     scan_deserializer.buf = buffer;
@@ -185,7 +347,7 @@ void MeterSunSpec::scan_start()
     scan_model_counter = model_instance;
 
     generic_read_request.register_type = ModbusRegisterType::HoldingRegister;
-    generic_read_request.start_address = scan_base_addresses[scan_base_address_index];
+    generic_read_request.start_address = scan_base_address;
     generic_read_request.register_count = 2;
     generic_read_request.data[0] = buffer;
     generic_read_request.read_twice = false;
@@ -209,7 +371,14 @@ void MeterSunSpec::scan_next()
             timeout->updateUint(timeout->asUint() + 1);
         }
 
-        scan_read_delay();
+        if (scan_state_next == ScanState::VerifyCommonModel || scan_state_next == ScanState::VerifyModelHeader) {
+            logger.printfln("Verifying stored SunSpec discovery failed, scanning for device at %s:%u:%u", host_name.c_str(), port, device_address);
+            scan_start();
+        }
+        else {
+            scan_read_delay();
+        }
+
         return;
     }
 
@@ -235,10 +404,12 @@ void MeterSunSpec::scan_next()
 
                     if (scan_base_address_index >= ARRAY_SIZE(scan_base_addresses)) {
                         logger.printfln("No SunSpec device found at %s:%u:%u", host_name.c_str(), port, device_address);
+                        discovery_remove();
                         scan_start_delay();
                     }
                     else {
-                        generic_read_request.start_address = scan_base_addresses[scan_base_address_index];
+                        scan_base_address = scan_base_addresses[scan_base_address_index];
+                        generic_read_request.start_address = scan_base_address;
                         generic_read_request.register_count = 2;
                         scan_state_next = ScanState::ReadSunSpecID;
 
@@ -256,6 +427,7 @@ void MeterSunSpec::scan_next()
                 if (scan_model_id == NON_IMPLEMENTED_UINT16) { // End model found
                     logger.printfln("Configured SunSpec model %u/%u not found at %s:%u:%u",
                                     model_id, model_instance, host_name.c_str(), port, device_address);
+                    discovery_remove();
                     scan_start_delay();
                 }
                 else if (scan_device_found && scan_model_id == model_id) {
@@ -270,6 +442,7 @@ void MeterSunSpec::scan_next()
                     else {
                         if (block_length != model_parser->get_model_length()) {
                             logger.printfln("Configured SunSpec model found but has incorrect length. Expected %u, got %u.", model_parser->get_model_length(), block_length);
+                            discovery_remove();
                             scan_start_delay();
                         }
                         else {
@@ -277,6 +450,8 @@ void MeterSunSpec::scan_next()
 
                             logger.printfln("Configured SunSpec model %u/%u found at %s:%u:%u:%u",
                                             model_id, model_instance, host_name.c_str(), port, device_address, generic_read_request.start_address);
+                            discovery_store(scan_base_address, generic_read_request.start_address);
+                            state->get("scan_skipped")->updateBool(false);
                             read_start(generic_read_request.start_address, model_parser->get_interesting_registers_count());
                         }
                     }
@@ -326,23 +501,8 @@ void MeterSunSpec::scan_next()
                                     !scan_device_found ? "not " :"");
 
                     if (scan_device_found) {
-                        if (strncmp(m->Mn, "KOSTAL", 32) == 0) {
-                            quirks |= SUN_SPEC_QUIRKS_ACC32_IS_INT32;
-                            quirks |= SUN_SPEC_QUIRKS_INTEGER_METER_POWER_FACTOR_IS_UNITY;
-                        } else if (strncmp(m->Mn, "SMA", 32) == 0) {
-                            if (model_id >= 100 && model_id < 200) {
-                                quirks |= SUN_SPEC_QUIRKS_INVERTER_CURRENT_IS_INT16;
-                            }
-                        } else if (strncmp(m->Mn, "SolarEdge", 9) == 0) {
-                            // Compare only 9 characters. The manufacturer name for SolarEdge devices sometimes has a trailing space.
-                            quirks |= SUN_SPEC_QUIRKS_ACTIVE_POWER_IS_INVERTED;
-                        } else if (strncmp(m->Mn, "SUNGROW", 32) == 0) {
-                            quirks |= SUN_SPEC_QUIRKS_INTEGER_INVERTER_POWER_FACTOR_IS_UNITY;
-                        }
-
-                        if (quirks) {
-                            logger.printfln("Enabling quirks mode 0x%02x for %.32s device.", quirks, m->Mn);
-                        }
+                        discovery_update(m->Mn, m->Md, m->SN);
+                        detect_quirks(m->Mn);
                     }
                 }
                 else {
@@ -358,6 +518,52 @@ void MeterSunSpec::scan_next()
 
             break;
 
+        case ScanState::VerifyCommonModel: {
+                uint32_t sun_spec_id = scan_deserializer.read_uint32();
+                uint16_t scan_model_id = scan_deserializer.read_uint16();
+
+                SunSpecCommonModel001_u *common_model = reinterpret_cast<SunSpecCommonModel001_u *>(generic_read_request.data[0] + 2);
+                modbus_bswap_registers(common_model->registers + 2, 64);
+                const SunSpecCommonModel001_s *m = &common_model->model;
+
+                if (sun_spec_id != SUN_SPEC_ID || scan_model_id != COMMON_MODEL_ID ||
+                    strncmp(m->Mn, discovery.get("manufacturer_name")->asEphemeralCStr(), 32) != 0 ||
+                    strncmp(m->Md, discovery.get("model_name")->asEphemeralCStr(), 32) != 0 ||
+                    strncmp(m->SN, discovery.get("serial_number")->asEphemeralCStr(), 32) != 0) {
+                    logger.printfln("Device at %s:%u:%u:%u changed, scanning again", host_name.c_str(), port, device_address, scan_base_address);
+                    scan_start();
+                    break;
+                }
+
+                detect_quirks(m->Mn);
+
+                generic_read_request.start_address = discovery.get("model_start_address")->asUint();
+                generic_read_request.register_count = 2;
+                scan_state_next = ScanState::VerifyModelHeader;
+
+                start_generic_read();
+            }
+
+            break;
+
+        case ScanState::VerifyModelHeader: {
+                uint16_t scan_model_id = scan_deserializer.read_uint16();
+                size_t block_length = scan_deserializer.read_uint16();
+
+                if (scan_model_id != model_id || block_length != model_parser->get_model_length()) {
+                    logger.printfln("Stored SunSpec model %u/%u not found at %s:%u:%u:%u anymore, scanning again",
+                                    model_id, model_instance, host_name.c_str(), port, device_address, generic_read_request.start_address);
+                    scan_start();
+                    break;
+                }
+
+                scan_state_next = ScanState::Idle;
+                state->get("scan_skipped")->updateBool(true);
+                read_start(generic_read_request.start_address, model_parser->get_interesting_registers_count());
+            }
+
+            break;
+
         default:
             esp_system_abort("meter_sun_spec: Invalid state during scan");
     }
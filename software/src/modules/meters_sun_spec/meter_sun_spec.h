@@ -52,12 +52,16 @@ public:
 
     void read_done_callback();
 
+    static String get_discovery_path(uint32_t slot);
+
 private:
     enum class ScanState {
         Idle,
         ReadSunSpecID,
         ReadModelHeader,
         ReadModel,
+        VerifyCommonModel,
+        VerifyModelHeader,
     };
 
     void connect_callback() override;
@@ -70,6 +74,13 @@ private:
     void scan_read_delay();
     void scan_next();
 
+    bool discovery_matches_config();
+    void discovery_update(const char *device_manufacturer_name, const char *device_model_name, const char *device_serial_number);
+    void discovery_store(size_t base_address, size_t model_start_address);
+    void discovery_remove();
+    void verify_start();
+    void detect_quirks(const char *device_manufacturer_name);
+
     uint32_t slot;
     Config *state;
     Config *errors;
@@ -88,6 +99,16 @@ private:
     ModbusDeserializer scan_deserializer;
     bool scan_device_found;
     uint16_t scan_model_counter;
+    size_t scan_base_address;
+
+    // Result of the last successful scan: Where the configured model was found and which device
+    // was there. Checked against the device at boot and reconnect instead of scanning again.
+    ConfigRoot discovery;
+    bool discovery_valid = false;
+    bool discovery_stored = false;
+
+    micros_t connected_at = 0_us;
+    bool first_value_pending = false;
 
     uint32_t quirks = 0;
     MetersSunSpecParser *model_parser;
@@ -61,6 +61,11 @@ void MetersSunSpec::pre_setup()
         {"model_instance", Config::Uint16(0)},
     });
 
+    state_prototype = Config::Object({
+        {"scan_skipped", Config::Bool(false)}, // Stored discovery was still valid
+        {"time_to_first_value", Config::Uint32(0)}, // ms since connect, 0 until the first values are read
+    });
+
     errors_prototype = Config::Object({
         {"timeout", Config::Uint32(0)},
         {"inconsistency", Config::Uint32(0)},
@@ -85,6 +90,13 @@ void MetersSunSpec::pre_setup()
 
 void MetersSunSpec::register_urls()
 {
+    // The slot's class changed since a SunSpec meter stored its discovery. All meters are set up at this point.
+    for (uint32_t slot = 0; slot < METERS_SLOTS; slot++) {
+        if (meters.get_meter_class(slot) != MeterClassID::SunSpec) {
+            API::removeConfig(MeterSunSpec::get_discovery_path(slot));
+        }
+    }
+
     api.addCommand("meters_sun_spec/scan", &scan_config, {}, [this](String &error) {
         if (scan_state != ScanState::Idle) {
             error = "Another scan is already in progress, please try again later!";
@@ -651,7 +663,7 @@ const Config *MetersSunSpec::get_config_prototype()
 [[gnu::const]]
 const Config *MetersSunSpec::get_state_prototype()
 {
-    return Config::Null();
+    return &state_prototype;
 }
 
 [[gnu::const]]
@@ -0,0 +1,73 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include "modbus_register_image.h"
+
+// The includer provides MODULE_CHARGE_TRACKER_AVAILABLE() and CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE.
+// tools/modbus_tcp/register_blocks_test checks that the register functions in modbus_tcp.cpp
+// only handle registers of these blocks: Other registers would never be read.
+
+// Registers of each table, in pairs. Reads of other registers are illegal or return 0.
+static const ModbusRegisterBlock warp_input_register_blocks[] = {
+    {0, 14},
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+    {1000, 12 + 2 * CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE},
+    {2000, 10},
+#else
+    {1000, 4},
+    {1010, 2 + 2 * CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE},
+    {2000, 8},
+#endif
+    {2100, 2 * 85},
+    {3100, 4},
+    {4000, 14},
+};
+
+static const ModbusRegisterBlock warp_holding_register_blocks[] = {
+    {0, 2},
+    {1000, 8},
+    {2000, 2},
+    {3100, 2},
+    {4000, 14},
+};
+
+// All other Bender registers read as 0.
+static const ModbusRegisterBlock bender_holding_register_blocks[] = {
+    {100, 42},
+    {200, 28},
+    {706, 14},
+};
+
+static const ModbusRegisterBlock keba_holding_register_blocks[] = {
+    {1000, 2},
+    {1004, 18},
+    {1036, 2},
+    {1040, 8},
+    {1100, 2},
+    {1110, 2},
+#if MODULE_CHARGE_TRACKER_AVAILABLE()
+    {1500, 4},
+#else
+    {1500, 2},
+#endif
+    {1550, 4},
+    {1600, 4},
+};
@@ -0,0 +1,103 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "modbus_register_image.h"
+
+#include <string.h>
+
+void ModbusRegisterImage::init(const ModbusRegisterBlock *new_blocks, size_t block_count)
+{
+    blocks.clear();
+    register_count = 0;
+
+    for (size_t i = 0; i < block_count; ++i) {
+        const ModbusRegisterBlock &b = new_blocks[i];
+
+        if (!blocks.empty() && blocks.back().start + blocks.back().count == b.start)
+            blocks.back().count = static_cast<uint16_t>(blocks.back().count + b.count);
+        else
+            blocks.push_back({b.start, b.count, static_cast<uint16_t>(register_count)});
+
+        register_count += b.count;
+    }
+
+    blocks.shrink_to_fit();
+    regs = std::unique_ptr<uint16_t[]>(new uint16_t[register_count]());
+}
+
+void ModbusRegisterImage::store_u32(size_t offset, uint32_t value)
+{
+    uint8_t *p = reinterpret_cast<uint8_t *>(regs.get() + offset);
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+}
+
+bool ModbusRegisterImage::contains(uint16_t reg) const
+{
+    for (const Block &block : blocks) {
+        if (reg >= block.start && reg < block.start + block.count)
+            return true;
+    }
+
+    return false;
+}
+
+bool ModbusRegisterImage::read(uint16_t start_address, uint16_t data_count, uint16_t *data_values, bool gaps_are_illegal) const
+{
+    uint32_t reg = start_address;
+    uint32_t end = reg + data_count;
+    size_t b = 0;
+
+    while (reg < end) {
+        // Blocks are sorted: Skip those that end before the register.
+        while (b < blocks.size() && static_cast<uint32_t>(blocks[b].start + blocks[b].count) <= reg)
+            ++b;
+
+        uint32_t chunk_end = end;
+        bool in_block = b < blocks.size() && blocks[b].start <= reg;
+
+        if (in_block) {
+            chunk_end = blocks[b].start + blocks[b].count;
+        } else if (b < blocks.size()) {
+            chunk_end = blocks[b].start;
+        }
+
+        if (chunk_end > end)
+            chunk_end = end;
+
+        size_t n = chunk_end - reg;
+
+        if (in_block) {
+            memcpy(data_values, regs.get() + blocks[b].offset + (reg - blocks[b].start), n * sizeof(uint16_t));
+        } else {
+            if (gaps_are_illegal)
+                return false;
+
+            memset(data_values, 0, n * sizeof(uint16_t));
+        }
+
+        data_values += n;
+        reg = chunk_end;
+    }
+
+    return true;
+}
@@ -0,0 +1,71 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct ModbusRegisterBlock {
+    uint16_t start;
+    uint16_t count;
+};
+
+// Register values of a table, encoded in network byte order as they are sent.
+// Reads only copy from the image. The image is filled by the table's register functions.
+class ModbusRegisterImage
+{
+public:
+    // Blocks must be sorted and must not overlap. Adjacent blocks are merged.
+    // Each block must start at an even register and cover register pairs.
+    void init(const ModbusRegisterBlock *blocks, size_t block_count);
+
+    // Calls get_value for the first register of every pair and stores the value in both registers.
+    template<typename F>
+    void fill(F &&get_value)
+    {
+        for (const Block &block : blocks) {
+            for (uint32_t i = 0; i < block.count; i += 2)
+                store_u32(block.offset + i, get_value(static_cast<uint16_t>(block.start + i)));
+        }
+    }
+
+    // Registers outside of the blocks read as 0, unless gaps_are_illegal is set: Then the read fails.
+    bool read(uint16_t start_address, uint16_t data_count, uint16_t *data_values, bool gaps_are_illegal) const;
+
+    bool contains(uint16_t reg) const;
+
+    size_t get_register_count() const { return register_count; }
+
+private:
+    struct Block {
+        uint16_t start;
+        uint16_t count;
+        uint16_t offset; // Of the first register of the block in regs.
+    };
+
+    void store_u32(size_t offset, uint32_t value);
+
+    std::vector<Block> blocks;
+    std::unique_ptr<uint16_t[]> regs;
+    size_t register_count = 0;
+};
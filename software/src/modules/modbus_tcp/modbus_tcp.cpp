@@ -30,6 +30,7 @@
 #include "string_builder.h"
 
 #include "module_dependencies.h"
+#include "modbus_register_blocks.h"
 
 extern uint32_t local_uid_num;
 
@@ -39,6 +40,9 @@ extern uint32_t local_uid_num;
 // 3 - Add phase switch, EVSE LED color, EVSE GPIOs, NFC tag injection
 #define MODBUS_TABLE_VERSION 3
 
+// Reads are served from the register images. Rebuild them if they are older than this.
+#define REGISTER_IMAGE_MAX_AGE 100_ms
+
 static uint8_t hextouint(const char c)
 {
     uint8_t i = 0;
@@ -296,49 +300,18 @@ Option<ModbusTcp::TwoRegs> ModbusTcp::getWarpInputRegister(uint16_t reg, void *c
         }
     }
 
-    if (this->send_illegal_data_address && report_illegal_data_address)
+    // Unknown registers read as 0 or are illegal, depending on send_illegal_data_address. See ModbusRegisterImage::read.
+    if (report_illegal_data_address)
         return {};
 
     return {val};
 }
 
 TFModbusTCPExceptionCode ModbusTcp::getWarpInputRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
-    struct {
-        Option<float> energy_abs = {};
-        Option<NFC::tag_info_t> tag = {};
-    } ctx;
-
-    FILL_FEATURE_CACHE(evse)
-    FILL_FEATURE_CACHE(meter)
-    FILL_FEATURE_CACHE(meter_all_values)
-    FILL_FEATURE_CACHE(nfc)
-    FILL_FEATURE_CACHE(phase_switch)
-
-    int i = 0;
-    while (i < data_count) {
-        uint16_t reg = (i + start_address) & (~1);
-
-        Option<TwoRegs> opt = this->getWarpInputRegister(reg, &ctx);
-        if (opt.is_none())
-            return TFModbusTCPExceptionCode::IllegalDataAddress;
+    update_register_images();
 
-        TwoRegs val = opt.unwrap();
-
-        val.u = swapBytes(val.u);
-
-        // TODO: comment
-        if (i == 0 && (start_address % 2) == 1) {
-            data_values[i] = val.regs.lower;
-            ++i;
-        } else if (i == data_count - 1) {
-            data_values[i] = val.regs.upper;
-            ++i;
-        } else {
-            data_values[i] = val.regs.upper;
-            data_values[i + 1] = val.regs.lower;
-            i += 2;
-        }
-    }
+    if (!input_registers.read(start_address, data_count, data_values, this->send_illegal_data_address))
+        return TFModbusTCPExceptionCode::IllegalDataAddress;
 
     return TFModbusTCPExceptionCode::Success;
 }
@@ -381,45 +354,20 @@ Option<ModbusTcp::TwoRegs> ModbusTcp::getWarpHoldingRegister(uint16_t reg) {
             }
             val.u = swapBytes(val.u);
         }
-        logger.printfln_debug("READ %u %.*s", reg, 4, val.chars);
     }
 
-    if (this->send_illegal_data_address && report_illegal_data_address)
+    // Unknown registers read as 0 or are illegal, depending on send_illegal_data_address. See ModbusRegisterImage::read.
+    if (report_illegal_data_address)
         return {};
 
     return {val};
 }
 
 TFModbusTCPExceptionCode ModbusTcp::getWarpHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
-    FILL_FEATURE_CACHE(evse)
-    FILL_FEATURE_CACHE(meter)
-    FILL_FEATURE_CACHE(nfc)
+    update_register_images();
 
-    int i = 0;
-    while (i < data_count) {
-        uint16_t reg = (i + start_address) & (~1);
-
-        Option<ModbusTcp::TwoRegs> opt = this->getWarpHoldingRegister(reg);
-        if (opt.is_none())
-            return TFModbusTCPExceptionCode::IllegalDataAddress;
-
-        auto val = opt.unwrap();
-
-        val.u = swapBytes(val.u);
-
-        // TODO: comment
-        if (i == 0 && (start_address % 2) == 1) {
-            data_values[i] = val.regs.lower;
-            ++i;
-        } else if (i == data_count - 1) {
-            data_values[i] = val.regs.upper;
-            ++i;
-        } else {
-            data_values[i] = val.regs.upper;
-            data_values[i + 1] = val.regs.lower;
-            i += 2;
-        }
-    }
+    if (!holding_registers.read(start_address, data_count, data_values, this->send_illegal_data_address))
+        return TFModbusTCPExceptionCode::IllegalDataAddress;
 
     return TFModbusTCPExceptionCode::Success;
 }
@@ -526,6 +474,9 @@ TFModbusTCPExceptionCode ModbusTcp::getWarpCoils(uint16_t start_address, uint16_
 }
 
 TFModbusTCPExceptionCode ModbusTcp::setWarpCoils(uint16_t start_address, uint16_t data_count, uint8_t *data_values) {
+    // Let the next read see the written values.
+    register_images_valid = false;
+
     FILL_FEATURE_CACHE(evse)
 
     if (!cache->has_feature_evse || !cache->evse_slots->get(CHARGING_SLOT_MODBUS_TCP)->get("active")->asBool())
@@ -566,6 +517,9 @@ TFModbusTCPExceptionCode ModbusTcp::setWarpCoils(uint16_t start_address, uint16_
 }
 
 TFModbusTCPExceptionCode ModbusTcp::setWarpHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
+    // Let the next read see the written values.
+    register_images_valid = false;
+
     FILL_FEATURE_CACHE(evse)
     FILL_FEATURE_CACHE(meter)
     FILL_FEATURE_CACHE(phase_switch)
@@ -585,20 +539,24 @@ TFModbusTCPExceptionCode ModbusTcp::setWarpHoldingRegisters(uint16_t start_addre
         if (i == 0 && (start_address % 2) == 1) {
             val.regs.lower = data_values[i];
             Option<TwoRegs> opt = this->getWarpHoldingRegister(reg);
-            if (opt.is_none())
+            if (opt.is_none() && this->send_illegal_data_address)
                 return TFModbusTCPExceptionCode::IllegalDataAddress;
 
-            auto old_val = opt.unwrap();
+            TwoRegs old_val{0};
+            if (opt.is_some())
+                old_val = opt.unwrap();
             old_val.u = swapBytes(old_val.u);
             val.regs.upper = old_val.regs.upper;
             ++i;
         } else if (i == data_count - 1) {
             val.regs.upper = data_values[i];
             Option<TwoRegs> opt = this->getWarpHoldingRegister(reg);
-            if (opt.is_none())
+            if (opt.is_none() && this->send_illegal_data_address)
                 return TFModbusTCPExceptionCode::IllegalDataAddress;
 
-            auto old_val = opt.unwrap();
+            TwoRegs old_val{0};
+            if (opt.is_some())
+                old_val = opt.unwrap();
             old_val.u = swapBytes(old_val.u);
             val.regs.lower = old_val.regs.lower;
             ++i;
@@ -720,6 +678,9 @@ TFModbusTCPExceptionCode ModbusTcp::setWarpHoldingRegisters(uint16_t start_addre
 }
 
 TFModbusTCPExceptionCode ModbusTcp::setKebaHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
+    // Let the next read see the written values.
+    register_images_valid = false;
+
     FILL_FEATURE_CACHE(evse)
     FILL_FEATURE_CACHE(phase_switch)
 
@@ -769,6 +730,9 @@ TFModbusTCPExceptionCode ModbusTcp::setKebaHoldingRegisters(uint16_t start_addre
 }
 
 TFModbusTCPExceptionCode ModbusTcp::setBenderHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
+    // Let the next read see the written values.
+    register_images_valid = false;
+
     FILL_FEATURE_CACHE(evse)
     FILL_FEATURE_CACHE(phase_switch)
 
@@ -792,36 +756,10 @@ TFModbusTCPExceptionCode ModbusTcp::setBenderHoldingRegisters(uint16_t start_add
 }
 
 TFModbusTCPExceptionCode ModbusTcp::getKebaHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
-    FILL_FEATURE_CACHE(evse)
-    FILL_FEATURE_CACHE(meter)
-    FILL_FEATURE_CACHE(meter_all_values)
-    FILL_FEATURE_CACHE(nfc)
-
-    int i = 0;
-    while (i < data_count) {
-        uint16_t reg = (i + start_address) & (~1);
+    update_register_images();
 
-        Option<ModbusTcp::TwoRegs> opt = this->getKebaHoldingRegister(reg);
-        if (opt.is_none())
-            return TFModbusTCPExceptionCode::IllegalDataAddress;
-
-        auto val = opt.unwrap();
-
-        val.u = swapBytes(val.u);
-
-        // TODO: comment
-        if (i == 0 && (start_address % 2) == 1) {
-            data_values[i] = val.regs.lower;
-            ++i;
-        } else if (i == data_count - 1) {
-            data_values[i] = val.regs.upper;
-            ++i;
-        } else {
-            data_values[i] = val.regs.upper;
-            data_values[i + 1] = val.regs.lower;
-            i += 2;
-        }
-    }
+    if (!holding_registers.read(start_address, data_count, data_values, this->send_illegal_data_address))
+        return TFModbusTCPExceptionCode::IllegalDataAddress;
 
     return TFModbusTCPExceptionCode::Success;
 }
@@ -862,7 +800,14 @@ Option<ModbusTcp::TwoRegs> ModbusTcp::getKebaHoldingRegister(uint16_t reg) {
         case 1010: REQUIRE(meter_all_values); val.u = (uint32_t)(cache->meter_all_values->get(METER_ALL_VALUES_CURRENT_L2_A)->asFloat() * 1000); break;
         case 1012: REQUIRE(meter_all_values); val.u = (uint32_t)(cache->meter_all_values->get(METER_ALL_VALUES_CURRENT_L3_A)->asFloat() * 1000); break;
         case 1014: val.u = local_uid_num; break;
-        case 1016: val.u = keba_get_features(); break;
+        case 1016: {
+                // Logs if the configuration doesn't match: Only do this once and not on every image update.
+                if (!cache->keba_features_valid) {
+                    cache->keba_features = keba_get_features();
+                    cache->keba_features_valid = true;
+                }
+                val.u = cache->keba_features;
+            } break;
         case 1018: val.u = 0x30A1B00; break;  //3.10.27 is the last firmware version without support for the failsafe registers. We don't implement those, so report .27.
         case 1020: REQUIRE(meter); val.u = (uint32_t)(cache->meter_values->get("power")->asFloat() * 1000); break;
         case 1036: REQUIRE(meter); val.u = (uint32_t)(cache->meter_values->get("energy_abs")->asFloat() * 1000 * 10); break; // 0.1 Wh
@@ -901,37 +846,17 @@ Option<ModbusTcp::TwoRegs> ModbusTcp::getKebaHoldingRegister(uint16_t reg) {
         case 1600: break; // failsafe
         case 1602: break; // failsafe
 
-        default: if (this->send_illegal_data_address) {logger.printfln_debug("%d", this->send_illegal_data_address); return {};}
+        default: return {};
     }
 
     return {val};
 }
 
 TFModbusTCPExceptionCode ModbusTcp::getBenderHoldingRegisters(uint16_t start_address, uint16_t data_count, uint16_t *data_values) {
-    FILL_FEATURE_CACHE(evse)
-    FILL_FEATURE_CACHE(meter_all_values)
-
-    int i = 0;
-    while (i < data_count) {
-        uint16_t reg = (i + start_address) & (~1);
-
-        ModbusTcp::TwoRegs val = this->getBenderHoldingRegister(reg);
+    update_register_images();
 
-        val.u = swapBytes(val.u);
-
-        // TODO: comment
-        if (i == 0 && (start_address % 2) == 1) {
-            data_values[i] = val.regs.lower;
-            ++i;
-        } else if (i == data_count - 1) {
-            data_values[i] = val.regs.upper;
-            ++i;
-        } else {
-            data_values[i] = val.regs.upper;
-            data_values[i + 1] = val.regs.lower;
-            i += 2;
-        }
-    }
+    // Bender registers without a value read as 0.
+    holding_registers.read(start_address, data_count, data_values, false);
 
     return TFModbusTCPExceptionCode::Success;
 }
@@ -939,7 +864,7 @@ TFModbusTCPExceptionCode ModbusTcp::getBenderHoldingRegisters(uint16_t start_add
 /* Bender docs:
    If there are gaps with undefined register numbers in this range, value '0' will be returned.
 */
-ModbusTcp::TwoRegs ModbusTcp::getBenderHoldingRegister(uint16_t reg) {
+Option<ModbusTcp::TwoRegs> ModbusTcp::getBenderHoldingRegister(uint16_t reg) {
     ModbusTcp::TwoRegs val{0};
 
     switch (reg) {
@@ -1018,17 +943,34 @@ ModbusTcp::TwoRegs ModbusTcp::getBenderHoldingRegister(uint16_t reg) {
             }
             break;
 #endif
-        default: break;
+        default: return {};
     }
 
-    return val;
+    return {val};
 }
 
 void ModbusTcp::start_server() {
     cache = std::unique_ptr<Cache>(new Cache());
     fillCache();
 
-    auto table = config.get("table")->asEnum<RegisterTable>();
+    table = config.get("table")->asEnum<RegisterTable>();
+
+    switch (table) {
+        case RegisterTable::WARP:
+            input_registers.init(warp_input_register_blocks, ARRAY_SIZE(warp_input_register_blocks));
+            holding_registers.init(warp_holding_register_blocks, ARRAY_SIZE(warp_holding_register_blocks));
+            break;
+        case RegisterTable::BENDER:
+            input_registers.init(nullptr, 0);
+            holding_registers.init(bender_holding_register_blocks, ARRAY_SIZE(bender_holding_register_blocks));
+            break;
+        case RegisterTable::KEBA:
+            input_registers.init(nullptr, 0);
+            holding_registers.init(keba_holding_register_blocks, ARRAY_SIZE(keba_holding_register_blocks));
+            break;
+    }
+
+    register_images_valid = false;
 
     this->send_illegal_data_address = config.get("send_illegal_data_address")->asBool();
 
@@ -1040,7 +982,7 @@ void ModbusTcp::start_server() {
         [](uint32_t peer_address, uint16_t port, TFModbusTCPServerDisconnectReason reason, int error_number) {
             logger.printfln("client disconnected: peer_address=%u port=%u reason=%s error_number=%d", peer_address, port, get_tf_modbus_tcp_server_client_disconnect_reason_name(reason), error_number);
         },
-        [this, table](uint8_t unit_id, TFModbusTCPFunctionCode function_code, uint16_t start_address, uint16_t data_count, void *data_values) {
+        [this](uint8_t unit_id, TFModbusTCPFunctionCode function_code, uint16_t start_address, uint16_t data_count, void *data_values) {
             switch(function_code) {
                 case TFModbusTCPFunctionCode::ReadCoils:
                     switch (table) {
@@ -1113,6 +1055,56 @@ void ModbusTcp::start_server() {
     }, 10_ms);
 }
 
+// The images are only built while clients read, at most once per REGISTER_IMAGE_MAX_AGE.
+// A poll that reads several blocks of a table is then served from the same image.
+void ModbusTcp::update_register_images() {
+    if (register_images_valid && !deadline_elapsed(register_images_updated + REGISTER_IMAGE_MAX_AGE))
+        return;
+
+    FILL_FEATURE_CACHE(evse)
+    FILL_FEATURE_CACHE(meter)
+    FILL_FEATURE_CACHE(meter_all_values)
+    FILL_FEATURE_CACHE(nfc)
+    FILL_FEATURE_CACHE(phase_switch)
+
+    switch (table) {
+        case RegisterTable::WARP: {
+                // Shared by all input registers, as it was by the registers of one request.
+                struct {
+                    Option<float> energy_abs = {};
+                    Option<NFC::tag_info_t> tag = {};
+                } ctx;
+
+                input_registers.fill([this, &ctx](uint16_t reg) {
+                    Option<TwoRegs> opt = this->getWarpInputRegister(reg, &ctx);
+                    return opt.is_none() ? 0 : opt.unwrap().u;
+                });
+
+                holding_registers.fill([this](uint16_t reg) {
+                    Option<TwoRegs> opt = this->getWarpHoldingRegister(reg);
+                    return opt.is_none() ? 0 : opt.unwrap().u;
+                });
+            } break;
+
+        case RegisterTable::BENDER:
+            holding_registers.fill([this](uint16_t reg) {
+                Option<TwoRegs> opt = this->getBenderHoldingRegister(reg);
+                return opt.is_none() ? 0 : opt.unwrap().u;
+            });
+            break;
+
+        case RegisterTable::KEBA:
+            holding_registers.fill([this](uint16_t reg) {
+                Option<TwoRegs> opt = this->getKebaHoldingRegister(reg);
+                return opt.is_none() ? 0 : opt.unwrap().u;
+            });
+            break;
+    }
+
+    register_images_updated = now_us();
+    register_images_valid = true;
+}
+
 void ModbusTcp::stop_server() {
     // We are running in the main task -> cancel can't return WillBeCancelled
     task_scheduler.cancel(this->tick_task);
@@ -26,6 +26,8 @@
 
 #include <TFTools/Option.h>
 
+#include "modbus_register_image.h"
+
 class ModbusTcp final : public IModule
 {
 public:
@@ -44,6 +46,7 @@ private:
     void start_server();
     void stop_server();
     void fillCache();
+    void update_register_images();
 
     TFModbusTCPExceptionCode getWarpCoils(uint16_t start_address, uint16_t data_count, uint8_t *data_values);
     TFModbusTCPExceptionCode getWarpDiscreteInputs(uint16_t start_address, uint16_t data_count, uint8_t *data_values);
@@ -82,6 +85,9 @@ private:
 
         char nfc_tag_injection_buffer[28];
 
+        uint32_t keba_features;
+        bool keba_features_valid; // Set on first read.
+
         bool has_feature_evse;
         bool has_feature_meter;
         bool has_feature_meter_phases;
@@ -107,10 +113,16 @@ private:
     Option<TwoRegs> getWarpHoldingRegister(uint16_t address);
 
     Option<TwoRegs> getKebaHoldingRegister(uint16_t reg);
-    TwoRegs getBenderHoldingRegister(uint16_t reg);
+    Option<TwoRegs> getBenderHoldingRegister(uint16_t reg);
 
     std::unique_ptr<Cache> cache;
     uint64_t tick_task;
 
+    RegisterTable table = RegisterTable::WARP;
+    ModbusRegisterImage input_registers; // Only the WARP table has input registers.
+    ModbusRegisterImage holding_registers;
+    micros_t register_images_updated = 0_us;
+    bool register_images_valid = false;
+
     bool send_illegal_data_address = true;
 };
@@ -46,6 +46,20 @@ extern char local_uid_str[32];
 
 #define MQTT_RECV_BUFFER_HEADROOM (MQTT_RECV_BUFFER_SIZE / 6)
 
+// Publishes over TLS run on this task's stack, as they do on the esp-mqtt task.
+#define MQTT_SENDER_STACK_SIZE CONFIG_MQTT_TASK_STACK_SIZE
+
+// Messages are queued per topic, so the count only limits the number of different topics.
+#define MQTT_PUBLISH_QUEUE_MAX_MESSAGES 256U
+#if defined(BOARD_HAS_PSRAM)
+#define MQTT_PUBLISH_QUEUE_MAX_BYTES 32768U
+#else
+#define MQTT_PUBLISH_QUEUE_MAX_BYTES 8192U
+#endif
+
+// Messages taken from the queue per lock. Sent back to back while the main thread keeps queueing.
+#define MQTT_PUBLISH_BATCH_SIZE 8U
+
 extern "C" esp_err_t esp_crt_bundle_attach(void *conf);
 
 #if !MODULE_CERTS_AVAILABLE()
@@ -85,7 +99,9 @@ void Mqtt::pre_setup()
         {"connection_state", Config::Enum(MqttConnectionState::NotConfigured, MqttConnectionState::NotConfigured, MqttConnectionState::Error)},
         {"connection_start", Config::Uint(0)},
         {"connection_end", Config::Uint(0)},
-        {"last_error", Config::Int(0)}
+        {"last_error", Config::Int(0)},
+        {"publish_coalesced", Config::Uint32(0)}, // Queued payloads replaced by a newer one before they were sent
+        {"publish_dropped", Config::Uint32(0)}, // Publishes rejected because the queue was full
     });
 
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -205,13 +221,13 @@ void Mqtt::addResponse(size_t responseIdx, const ResponseRegistration &reg)
 {
 }
 
-bool Mqtt::publish_with_prefix(const String &path, const String &payload, bool retain)
+bool Mqtt::publish_with_prefix(const String &path, const String &payload, bool retain, bool coalesce)
 {
     String topic = global_topic_prefix + "/" + path;
-    return publish(topic, payload, retain);
+    return publish(topic, payload, retain, coalesce);
 }
 
-bool Mqtt::publish(const String &topic, const String &payload, bool retain)
+bool Mqtt::publish(const String &topic, const String &payload, bool retain, bool coalesce)
 {
     // ESP-MQTT does this check but we only want to allow publishing after
     // onMqttConnect was called (in the main thread!)
@@ -219,12 +235,78 @@ bool Mqtt::publish(const String &topic, const String &payload, bool retain)
     if (client == nullptr || this->state.get("connection_state")->asEnum<MqttConnectionState>() != MqttConnectionState::Connected)
         return false;
 
-// enqueue uses an unbounded queue! IDF 5.3 adds a limit for the queue. Until then use publish even though it blocks the main thread.
-//#if defined(BOARD_HAS_PSRAM)
-//    return esp_mqtt_client_enqueue(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain, true) >= 0;
-//#else
-    return esp_mqtt_client_publish(this->client, topic.c_str(), payload.c_str(), payload.length(), 0, retain) >= 0;
-//#endif
+    MqttPublishQueue::PushResult result;
+
+    {
+        std::lock_guard<std::mutex> lock{publish_queue_mutex};
+        result = publish_queue.push(topic.c_str(), topic.length(), payload.c_str(), payload.length(), retain, coalesce);
+    }
+
+    // A state that is not queued stays updated and is pushed again later.
+    if (result == MqttPublishQueue::PushResult::Full)
+        return false;
+
+    xTaskNotifyGive(sender_task_handle);
+    return true;
+}
+
+void Mqtt::sender_task(void *arg)
+{
+    Mqtt *mqtt = static_cast<Mqtt *>(arg);
+    MqttPublishMessage batch[MQTT_PUBLISH_BATCH_SIZE];
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (true) {
+            size_t count;
+
+            {
+                std::lock_guard<std::mutex> lock{mqtt->publish_queue_mutex};
+                count = mqtt->publish_queue.pop(batch, MQTT_PUBLISH_BATCH_SIZE);
+            }
+
+            if (count == 0)
+                break;
+
+            size_t sent = 0;
+
+            while (sent < count && mqtt->sender_connected) {
+                MqttPublishMessage &msg = batch[sent];
+
+                if (esp_mqtt_client_publish(mqtt->client, msg.topic, msg.payload, static_cast<int>(msg.payload_len), 0, msg.retain) < 0)
+                    break;
+
+                MqttPublishQueue::free_message(&msg);
+                ++sent;
+            }
+
+            if (sent == count)
+                continue;
+
+            if (!mqtt->sender_connected) {
+                // All states are pushed again after reconnecting.
+                for (size_t i = sent; i < count; ++i)
+                    MqttPublishQueue::free_message(&batch[i]);
+
+                continue;
+            }
+
+            // Try again later, unless a newer value arrives in the meantime.
+            {
+                std::lock_guard<std::mutex> lock{mqtt->publish_queue_mutex};
+                mqtt->publish_queue.requeue(batch + sent, count - sent);
+            }
+
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
+}
+
+void Mqtt::clear_publish_queue()
+{
+    std::lock_guard<std::mutex> lock{publish_queue_mutex};
+    publish_queue.clear();
 }
 
 bool Mqtt::pushStateUpdate(size_t stateIdx, const String &payload, const String &path)
@@ -234,7 +316,7 @@ bool Mqtt::pushStateUpdate(size_t stateIdx, const String &payload, const String
     if (!deadline_elapsed(state.last_send_ms + this->send_interval_ms))
         return false;
 
-    bool success = this->publish_with_prefix(path, payload);
+    bool success = this->publish_with_prefix(path, payload, true, true);
 
     if (success) {
         state.last_send_ms = millis();
@@ -245,7 +327,7 @@ bool Mqtt::pushStateUpdate(size_t stateIdx, const String &payload, const String
 
 bool Mqtt::pushRawStateUpdate(const String &payload, const String &path)
 {
-    return this->publish_with_prefix(path, payload);
+    return this->publish_with_prefix(path, payload, true, true);
 }
 
 IAPIBackend::WantsStateUpdate Mqtt::wantsStateUpdate(size_t stateIdx) {
@@ -303,6 +385,7 @@ void Mqtt::onMqttConnect()
     logger.printfln("Connected to broker at %s%s:%u%s.", schema, this->config.get("broker_host")->asEphemeralCStr(), this->config.get("broker_port")->asUint(), print_path ? this->config.get("broker_path")->asEphemeralCStr() : "");
 
     this->state.get("connection_state")->updateEnum(MqttConnectionState::Connected);
+    sender_connected = true;
 
     for (size_t i = 0; i < api.commands.size(); ++i) {
         auto &reg = api.commands[i];
@@ -331,6 +414,9 @@ void Mqtt::onMqttDisconnect()
         logger.printfln("Disconnected from broker.");
 
     this->state.get("connection_state")->updateEnum(MqttConnectionState::NotConnected);
+    sender_connected = false;
+    clear_publish_queue();
+
     if (was_connected) {
         was_connected = false;
         uint32_t now = millis();
@@ -403,9 +489,10 @@ void Mqtt::onMqttMessage(char *topic, size_t topic_len, char *data, size_t data_
     topic += global_topic_prefix.length() + 1;
     topic_len -= global_topic_prefix.length() + 1;
 
-    for (auto &reg : api.commands) {
-        if (topic_len != reg.path_len || memcmp(topic, reg.path, topic_len) != 0)
-            continue;
+    APIPathLookup lookup = api.lookupPath(topic, topic_len);
+
+    if (lookup.kind == APIPathKind::Command) {
+        auto &reg = api.commands[lookup.idx];
 
         if (retain && reg.is_action) {
             logger.printfln("Topic %s is an action. Ignoring retained message (data_len=%u).", reg.path, data_len);
@@ -428,11 +515,8 @@ void Mqtt::onMqttMessage(char *topic, size_t topic_len, char *data, size_t data_
     }
 
     // Don't print error message on state topics, this could be one of our own messages.
-    for (auto &reg : api.states) {
-        if (topic_len != reg.path_len || memcmp(topic, reg.path, topic_len) != 0)
-            continue;
+    if (lookup.kind == APIPathKind::State)
         return;
-    }
 
     // Don't print error message if this packet was received because it was retained (as opposed to a newly published message)
     // The spec says:
@@ -678,8 +762,41 @@ void Mqtt::setup()
 
     esp_mqtt_client_register_event(client, (esp_mqtt_event_id_t)ESP_EVENT_ANY_ID, mqtt_event_handler, this);
 
+    publish_queue.set_limits(MQTT_PUBLISH_QUEUE_MAX_MESSAGES, MQTT_PUBLISH_QUEUE_MAX_BYTES);
+
+    // Same priority as the main thread, so that neither starves the other.
+    BaseType_t err = xTaskCreate(sender_task, "mqtt_sender", MQTT_SENDER_STACK_SIZE, this, uxTaskPriorityGet(nullptr), &sender_task_handle);
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wuseless-cast"
+    // pdPASS expands to an old-style cast that is also useless
+    if (err != pdPASS) {
+        logger.printfln("Failed to create MQTT sender task: %d", err);
+        esp_mqtt_client_destroy(client);
+        client = nullptr;
+        return;
+    }
+#pragma GCC diagnostic pop
+
+#if MODULE_DEBUG_AVAILABLE()
+    debug.register_task(sender_task_handle, MQTT_SENDER_STACK_SIZE);
+#endif
+
     task_scheduler.scheduleWithFixedDelay([this](){
         this->resubscribe();
+
+        uint32_t coalesced;
+        uint32_t dropped;
+
+        {
+            std::lock_guard<std::mutex> lock{publish_queue_mutex};
+            coalesced = publish_queue.get_coalesced();
+            dropped = publish_queue.get_dropped();
+        }
+
+        state.get("publish_coalesced")->updateUint(coalesced);
+        state.get("publish_dropped")->updateUint(dropped);
     }, 1_s, 1_s);
 }
 
@@ -691,28 +808,36 @@ void Mqtt::register_urls()
 #if MODULE_AUTOMATION_AVAILABLE()
     if (automation.has_task_with_trigger(AutomationTriggerID::MQTT) && config.get("enable_mqtt")->asBool()) {
         Automation::ConfigVec trigger_config = automation.get_configured_triggers(AutomationTriggerID::MQTT);
-        std::vector<String> subscribed_topics;
-        for (auto &conf : trigger_config) {
+        automation_topic_filters.reserve(trigger_config.size());
+
+        for (size_t rule_idx = 0; rule_idx < trigger_config.size(); rule_idx++) {
+            const Config *conf = trigger_config[rule_idx].second;
+            String topic;
+            if (conf->get("use_prefix")->asBool()) {
+                topic = global_topic_prefix + "/automation_trigger/" + conf->get("topic_filter")->asString();
+            } else {
+                topic = conf->get("topic_filter")->asString();
+            }
+
             bool already_subscribed = false;
-            for (auto &new_topic : subscribed_topics) {
-                if (conf.second->get("topic_filter")->asString() == new_topic)
+            for (size_t i = 0; i < rule_idx; i++) {
+                if (automation_topic_filters[i].topic == topic) {
                     already_subscribed = true;
+                    break;
+                }
             }
-            const size_t idx = conf.first;
+
+            automation_topic_filters.push_back({topic, conf->get("payload")->asString()});
+
             if (!already_subscribed) {
-                String topic = conf.second->get("topic_filter")->asString();
-                if (conf.second->get("use_prefix")->asBool()) {
-                    topic = config.get("global_topic_prefix")->asString() + "/automation_trigger/" + topic;
-                }
-                subscribe(topic, [this, idx](const char *tpic, size_t tpic_len, char * data, size_t data_len) {
+                subscribe(topic, [this](const char *tpic, size_t tpic_len, char * data, size_t data_len) {
                     MqttMessage msg;
                     msg.topic = String(tpic).substring(0, tpic_len);
                     msg.payload = String(data).substring(0, data_len);
                     msg.retained = false;
                     if (automation.trigger(AutomationTriggerID::MQTT, &msg, this))
                         return;
-                }, conf.second->get("retain")->asBool() ? Retained::Accept : Retained::IgnoreWarn);
-                subscribed_topics.push_back(topic);
+                }, conf->get("retain")->asBool() ? Retained::Accept : Retained::IgnoreWarn);
             }
         }
     }
@@ -753,6 +878,8 @@ void Mqtt::register_events()
 
 void Mqtt::pre_reboot()
 {
+    sender_connected = false;
+
     if (client != nullptr) {
 #if MODULE_DEBUG_AVAILABLE()
         debug.deregister_task("mqtt_task");
@@ -788,4 +915,15 @@ bool Mqtt::has_triggered(const Config *conf, void *data)
     }
     return false;
 }
+
+bool Mqtt::has_rule_triggered(size_t rule_idx, const Config *conf, void *data)
+{
+    if (conf->getTag<AutomationTriggerID>() != AutomationTriggerID::MQTT || rule_idx >= automation_topic_filters.size()) {
+        return has_triggered(conf, data);
+    }
+
+    const AutomationTopicFilter &filter = automation_topic_filters[rule_idx];
+    const MqttMessage *msg = static_cast<const MqttMessage *>(data);
+    return msg->topic == filter.topic && (filter.payload.length() == 0 || msg->payload == filter.payload);
+}
 #endif
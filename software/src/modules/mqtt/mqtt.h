@@ -19,12 +19,17 @@
 
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <mqtt_client.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #include "module.h"
 #include "config.h"
 #include "modules/api/api.h"
 #include "mqtt_connection_state.enum.h"
+#include "mqtt_publish_queue.h"
 #include "module_available.h"
 
 #if MODULE_AUTOMATION_AVAILABLE()
@@ -64,8 +69,9 @@ public:
     void pre_reboot() override;
 
     // Retain messages by default because we only send on change.
-    bool publish_with_prefix(const String &path, const String &payload, bool retain = true);
-    bool publish(const String &topic, const String &payload, bool retain);
+    bool publish_with_prefix(const String &path, const String &payload, bool retain = true, bool coalesce = false);
+    // coalesce: A newer payload may replace this one before it is sent. Only for states.
+    bool publish(const String &topic, const String &payload, bool retain, bool coalesce = false);
 
     void subscribe(const String &path, SubscribeCallback &&callback, Retained retained, CallbackInThread callback_in_thread = CallbackInThread::Main, AddPrefix add_prefix = AddPrefix::No);
 
@@ -85,6 +91,7 @@ public:
 
 #if MODULE_AUTOMATION_AVAILABLE()
     bool has_triggered(const Config *conf, void *data) override;
+    bool has_rule_triggered(size_t rule_idx, const Config *conf, void *data) override;
 #endif
 
     ConfigRoot config;
@@ -115,7 +122,17 @@ private:
         bool retained;
     };
 
+    // Full topic and payload of the configured MQTT automation triggers, in rule order.
+    struct AutomationTopicFilter {
+        String topic;
+        String payload;
+    };
+
+    static void sender_task(void *arg);
+    void clear_publish_queue();
+
     std::vector<MqttCommand> commands;
+    std::vector<AutomationTopicFilter> automation_topic_filters;
     std::vector<MqttState, IRAMAlloc<MqttState>> states;
 
     size_t backend_idx;
@@ -123,6 +140,14 @@ private:
     esp_mqtt_client_handle_t client = nullptr;
     uint32_t send_interval_ms;
 
+    // publish only queues the message. The sender task calls esp_mqtt_client_publish,
+    // which blocks if the broker or the uplink is slow.
+    MqttPublishQueue publish_queue;
+    std::mutex publish_queue_mutex;
+    TaskHandle_t sender_task_handle = nullptr;
+    // Copy of the connection state for the sender task.
+    std::atomic<bool> sender_connected{false};
+
     uint32_t last_connected_ms = 0;
     bool was_connected = false;
     bool global_topic_prefix_subscribed = false;
@@ -0,0 +1,168 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "mqtt_publish_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t hash_topic(const char *topic, size_t topic_len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < topic_len; ++i) {
+        hash ^= static_cast<uint8_t>(topic[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool same_topic(const MqttPublishMessage &message, const char *topic, size_t topic_len, uint32_t topic_hash)
+{
+    return message.topic_hash == topic_hash && message.topic_len == topic_len && memcmp(message.topic, topic, topic_len) == 0;
+}
+
+static bool make_message(MqttPublishMessage *message, const char *topic, size_t topic_len, const char *payload, size_t payload_len, uint32_t topic_hash, bool retain, bool coalesce)
+{
+    char *buf = static_cast<char *>(malloc(topic_len + payload_len + 2));
+    if (buf == nullptr)
+        return false;
+
+    memcpy(buf, topic, topic_len);
+    buf[topic_len] = '\0';
+    memcpy(buf + topic_len + 1, payload, payload_len);
+    buf[topic_len + 1 + payload_len] = '\0';
+
+    *message = {buf, topic_len, buf + topic_len + 1, payload_len, topic_hash, retain, coalesce};
+    return true;
+}
+
+MqttPublishQueue::~MqttPublishQueue()
+{
+    clear();
+}
+
+void MqttPublishQueue::set_limits(size_t max_messages_, size_t max_bytes_)
+{
+    max_messages = max_messages_;
+    max_bytes = max_bytes_;
+    messages.reserve(max_messages);
+}
+
+MqttPublishQueue::PushResult MqttPublishQueue::push(const char *topic, size_t topic_len, const char *payload, size_t payload_len, bool retain, bool coalesce)
+{
+    uint32_t topic_hash = hash_topic(topic, topic_len);
+    size_t new_bytes = message_bytes(topic_len, payload_len);
+
+    // Only the last message of the topic can be replaced. Replacing an earlier one would send the new payload before a later message.
+    for (auto it = messages.rbegin(); coalesce && it != messages.rend(); ++it) {
+        MqttPublishMessage &queued = *it;
+
+        if (!same_topic(queued, topic, topic_len, topic_hash))
+            continue;
+
+        if (!queued.coalesce)
+            break;
+
+        size_t old_bytes = message_bytes(queued.topic_len, queued.payload_len);
+        MqttPublishMessage replacement;
+
+        if ((messages.size() > 1 && bytes - old_bytes + new_bytes > max_bytes) || !make_message(&replacement, topic, topic_len, payload, payload_len, topic_hash, retain, coalesce)) {
+            ++dropped;
+            return PushResult::Full;
+        }
+
+        free_message(&queued);
+        queued = replacement;
+        bytes = bytes - old_bytes + new_bytes;
+        ++coalesced;
+        return PushResult::Coalesced;
+    }
+
+    MqttPublishMessage message;
+
+    if (messages.size() >= max_messages || (!messages.empty() && bytes + new_bytes > max_bytes) || !make_message(&message, topic, topic_len, payload, payload_len, topic_hash, retain, coalesce)) {
+        ++dropped;
+        return PushResult::Full;
+    }
+
+    messages.push_back(message);
+    bytes += new_bytes;
+    return PushResult::Queued;
+}
+
+size_t MqttPublishQueue::pop(MqttPublishMessage *batch, size_t max_count)
+{
+    size_t count = messages.size() < max_count ? messages.size() : max_count;
+
+    for (size_t i = 0; i < count; ++i) {
+        batch[i] = messages[i];
+        bytes -= message_bytes(batch[i].topic_len, batch[i].payload_len);
+    }
+
+    messages.erase(messages.begin(), messages.begin() + static_cast<ptrdiff_t>(count));
+    return count;
+}
+
+void MqttPublishQueue::requeue(MqttPublishMessage *requeued, size_t count)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        bool newer_queued = false;
+
+        for (const MqttPublishMessage &queued : messages) {
+            if (requeued[i].coalesce && queued.coalesce && same_topic(queued, requeued[i].topic, requeued[i].topic_len, requeued[i].topic_hash)) {
+                newer_queued = true;
+                break;
+            }
+        }
+
+        if (newer_queued) {
+            free_message(&requeued[i]);
+        } else {
+            requeued[kept++] = requeued[i];
+        }
+    }
+
+    // Not checked against the limits: Pushes while the messages were popped could have
+    // taken their space. Rejecting them now would lose the older values of their topics.
+    messages.insert(messages.begin(), requeued, requeued + kept);
+
+    for (size_t i = 0; i < kept; ++i)
+        bytes += message_bytes(requeued[i].topic_len, requeued[i].payload_len);
+}
+
+void MqttPublishQueue::clear()
+{
+    for (MqttPublishMessage &message : messages)
+        free_message(&message);
+
+    messages.clear();
+    bytes = 0;
+}
+
+void MqttPublishQueue::free_message(MqttPublishMessage *message)
+{
+    free(message->topic);
+    message->topic = nullptr;
+    message->payload = nullptr;
+}
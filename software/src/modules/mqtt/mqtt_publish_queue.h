@@ -0,0 +1,88 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct MqttPublishMessage {
+    char *topic;        // Topic and payload share one allocation and are null-terminated.
+    size_t topic_len;
+    char *payload;
+    size_t payload_len;
+    uint32_t topic_hash;
+    bool retain;
+    bool coalesce;
+};
+
+// Messages waiting for the MQTT sender task. A coalescing message, i.e. a state,
+// replaces the last queued message of its topic if that one is coalescing too and
+// keeps its position. Other messages, e.g. those of automation actions, are all sent.
+// Not thread-safe, the caller has to lock.
+class MqttPublishQueue
+{
+public:
+    enum class PushResult {
+        Queued,
+        Coalesced,
+        Full,
+    };
+
+    MqttPublishQueue() = default;
+    MqttPublishQueue(const MqttPublishQueue &other) = delete;
+    MqttPublishQueue &operator=(const MqttPublishQueue &other) = delete;
+    ~MqttPublishQueue();
+
+    void set_limits(size_t max_messages, size_t max_bytes);
+
+    // Full if the message doesn't fit into the limits. Then the queue is unchanged.
+    // A message larger than max_bytes is only accepted if it is the only one.
+    PushResult push(const char *topic, size_t topic_len, const char *payload, size_t payload_len, bool retain, bool coalesce);
+
+    // Moves up to max_count of the oldest messages into batch and returns their count.
+    // Pass each one to free_message or back to requeue.
+    size_t pop(MqttPublishMessage *batch, size_t max_count);
+
+    // Puts messages that could not be sent back in front of the queue, in the given order.
+    // A coalescing message is freed instead if a newer one for its topic was queued in the meantime.
+    void requeue(MqttPublishMessage *messages, size_t count);
+
+    void clear();
+
+    size_t get_count() const { return messages.size(); }
+    size_t get_bytes() const { return bytes; }
+
+    // Pushes that replaced a queued payload and pushes that were rejected because the queue was full.
+    uint32_t get_coalesced() const { return coalesced; }
+    uint32_t get_dropped() const { return dropped; }
+
+    static void free_message(MqttPublishMessage *message);
+
+private:
+    static size_t message_bytes(size_t topic_len, size_t payload_len) { return topic_len + payload_len + 2; }
+
+    std::vector<MqttPublishMessage> messages; // Oldest first.
+    size_t bytes = 0;
+    size_t max_messages = 0;
+    size_t max_bytes = 0;
+    uint32_t coalesced = 0;
+    uint32_t dropped = 0;
+};
@@ -30,7 +30,7 @@ extern char local_uid_str[32];
 
 void Ocpp::pre_setup()
 {
-    trace_buf_idx = logger.alloc_trace_buffer("ocpp", 1 << 17);
+    trace_buf_idx = logger.alloc_trace_buffer("ocpp", 1 << 17, true);
 
     config = Config::Object({
         {"enable", Config::Bool(false)},
@@ -769,7 +769,10 @@ void PhaseSwitcher::update_all_data()
     // chart
     int16_t actual_charging_power = 0;
     if (api.hasFeature("meters")){
-        actual_charging_power = api.getState("meters/0/values", false)->get(0)->asFloat();
+        float power;
+        meters.get_value_by_index(0, 0, &power);
+        if (!isnan(power))
+            actual_charging_power = power;
     }
     float samples[3] = {(float)available_charging_power, (float)actual_charging_power, (float)requested_phases_pending};
     power_history.add_sample(samples);
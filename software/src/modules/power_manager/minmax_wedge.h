@@ -0,0 +1,85 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Positions in history_values whose values are strictly ascending (min)
+// or descending (max) from oldest to newest. The oldest entry holds the
+// current extremum.
+struct minmax_wedge {
+    uint16_t *positions = nullptr;
+    int32_t   head      = 0;
+    int32_t   count     = 0;
+};
+
+// Starts with the first value at position 0.
+static inline void init_minmax_wedge(minmax_wedge *wedge)
+{
+    wedge->positions[0] = 0;
+    wedge->head  = 0;
+    wedge->count = 1;
+}
+
+// Adds the value at history_pos to the wedge and returns the extremum of the window.
+// Must be called after the value was written and before history_pos advances.
+template<bool is_min>
+static inline int32_t update_minmax_wedge(minmax_wedge *wedge, const int32_t *values, int32_t history_length, int32_t history_pos)
+{
+    uint16_t *positions = wedge->positions;
+    int32_t head  = wedge->head;
+    int32_t count = wedge->count;
+
+    // Drop the oldest entry if its value was just overwritten.
+    if (count > 0 && positions[head] == history_pos) {
+        head++;
+        if (head >= history_length) {
+            head = 0;
+        }
+        count--;
+    }
+
+    // Drop newer entries that can't become the extremum anymore because the new value is at least as extreme and lives longer.
+    int32_t new_value = values[history_pos];
+    while (count > 0) {
+        int32_t back = head + count - 1;
+        if (back >= history_length) {
+            back -= history_length;
+        }
+
+        int32_t back_value = values[positions[back]];
+        if (is_min ? back_value < new_value : back_value > new_value) {
+            break;
+        }
+        count--;
+    }
+
+    int32_t tail = head + count;
+    if (tail >= history_length) {
+        tail -= history_length;
+    }
+    positions[tail] = static_cast<uint16_t>(history_pos);
+    count++;
+
+    wedge->head  = head;
+    wedge->count = count;
+
+    return values[positions[head]];
+}
@@ -258,9 +258,21 @@ static void init_minmax_filter(PowerManager::minmax_filter *filter, size_t value
         values_count = 1;
     }
 
+    if (values_count > UINT16_MAX + 1u) {
+        logger.printfln("Cannot create minmax filter with %zu values, limiting to %u.", values_count, UINT16_MAX + 1u);
+        values_count = UINT16_MAX + 1u;
+    }
+
     filter->history_length = static_cast<decltype(filter->history_length)>(values_count);
     filter->history_values = static_cast<decltype(filter->history_values)>(heap_caps_malloc_prefer(values_count * sizeof(filter->history_values[0]), 2, MALLOC_CAP_32BIT, MALLOC_CAP_SPIRAM)); // Prefer IRAM
     filter->type = filter_type;
+
+    if (filter_type != PowerManager::FilterType::MaxOnly) {
+        filter->min_wedge.positions = static_cast<uint16_t *>(heap_caps_malloc_prefer(values_count * sizeof(uint16_t), 2, MALLOC_CAP_32BIT, MALLOC_CAP_SPIRAM)); // Prefer IRAM
+    }
+    if (filter_type != PowerManager::FilterType::MinOnly) {
+        filter->max_wedge.positions = static_cast<uint16_t *>(heap_caps_malloc_prefer(values_count * sizeof(uint16_t), 2, MALLOC_CAP_32BIT, MALLOC_CAP_SPIRAM)); // Prefer IRAM
+    }
 }
 
 static void init_mavg_filter(PowerManager::mavg_filter *filter, size_t values_count)
@@ -623,13 +635,18 @@ static void update_minmax_filter(int32_t new_value, PowerManager::minmax_filter
         } else {
             filter->history_pos = 1; // Position for next value
         }
-        filter->history_min_pos = 0;
-        filter->history_max_pos = 0;
 
         filter->history_values[0] = new_value;
         // Other values don't need to be initialized because they won't be read before the first value is removed,
         // at which point all values must have been written.
 
+        if (filter->type != PowerManager::FilterType::MaxOnly) {
+            init_minmax_wedge(&filter->min_wedge);
+        }
+        if (filter->type != PowerManager::FilterType::MinOnly) {
+            init_minmax_wedge(&filter->max_wedge);
+        }
+
         return;
     }
 
@@ -638,67 +655,11 @@ static void update_minmax_filter(int32_t new_value, PowerManager::minmax_filter
     filter->history_values[history_pos] = new_value;
 
     if (filter->type != PowerManager::FilterType::MaxOnly) {
-        if (new_value <= filter->min) {
-            filter->min = new_value;
-            filter->history_min_pos = history_pos;
-        } else {
-            if (filter->history_min_pos == history_pos) {
-                // Current minimum was just replaced, need to find new minimum.
-                int32_t *values = filter->history_values;
-                int32_t min = INT32_MAX;
-                int32_t min_pos = 0;
-
-                // Search older data after current position in history
-                for (int32_t i = history_pos + 1; i < filter->history_length; i++) {
-                    if (values[i] <= min) {
-                        min = values[i];
-                        min_pos = i;
-                    }
-                }
-                // Search newer data before current position in history
-                for (int32_t i = 0; i <= history_pos; i++) {
-                    if (values[i] <= min) {
-                        min = values[i];
-                        min_pos = i;
-                    }
-                }
-
-                filter->min = min;
-                filter->history_min_pos = min_pos;
-            }
-        }
+        filter->min = update_minmax_wedge<true>(&filter->min_wedge, filter->history_values, filter->history_length, history_pos);
     }
 
     if (filter->type != PowerManager::FilterType::MinOnly) {
-        if (new_value >= filter->max) {
-            filter->max = new_value;
-            filter->history_max_pos = history_pos;
-        } else {
-            if (filter->history_max_pos == history_pos) {
-                // Current maximum was just replaced, need to find new maximum.
-                int32_t *values = filter->history_values;
-                int32_t max = INT32_MIN;
-                int32_t max_pos = 0;
-
-                // Search older data after current position in history
-                for (int32_t i = history_pos + 1; i < filter->history_length; i++) {
-                    if (values[i] >= max) {
-                        max = values[i];
-                        max_pos = i;
-                    }
-                }
-                // Search newer data before current position in history
-                for (int32_t i = 0; i <= history_pos; i++) {
-                    if (values[i] >= max) {
-                        max = values[i];
-                        max_pos = i;
-                    }
-                }
-
-                filter->max = max;
-                filter->history_max_pos = max_pos;
-            }
-        }
+        filter->max = update_minmax_wedge<false>(&filter->max_wedge, filter->history_values, filter->history_length, history_pos);
     }
 
     history_pos++;
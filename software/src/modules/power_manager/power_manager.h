@@ -22,6 +22,7 @@
 
 #include "module.h"
 #include "config.h"
+#include "minmax_wedge.h"
 #include "phase_switcher_back-end.h"
 #include "modules/debug_protocol/debug_protocol_backend.h"
 #include "modules/charge_manager/current_limits.h"
@@ -99,8 +100,8 @@ public:
         int32_t *history_values  = nullptr;
         int32_t  history_length  = 0;
         int32_t  history_pos     = 0;
-        int32_t  history_min_pos = 0;
-        int32_t  history_max_pos = 0;
+        minmax_wedge min_wedge;
+        minmax_wedge max_wedge;
         FilterType type          = FilterType::MinOnly;
     };
 
@@ -0,0 +1,124 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include "username_index.h"
+
+#include <string.h>
+
+UsernameIndex::UsernameIndex()
+{
+    clear();
+}
+
+void UsernameIndex::clear()
+{
+    memset(username_hashes, 0, sizeof(username_hashes));
+    memset(buckets, 0, sizeof(buckets));
+    memset(display_name_offsets, 0, sizeof(display_name_offsets));
+    display_names.clear();
+    display_names.shrink_to_fit();
+}
+
+uint32_t UsernameIndex::hash_username(const char *username, size_t username_len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < username_len; ++i) {
+        hash ^= static_cast<uint8_t>(username[i]);
+        hash *= 16777619u;
+    }
+
+    // 0 marks a free user ID.
+    return hash != 0 ? hash : 1;
+}
+
+void UsernameIndex::insert_bucket(uint8_t user_id)
+{
+    uint32_t bucket = username_hashes[user_id] & (USERNAME_INDEX_BUCKETS - 1);
+    while (buckets[bucket] != 0)
+        bucket = (bucket + 1) & (USERNAME_INDEX_BUCKETS - 1);
+
+    buckets[bucket] = static_cast<uint16_t>(user_id + 1);
+}
+
+void UsernameIndex::remove_bucket(uint8_t user_id)
+{
+    uint32_t bucket = username_hashes[user_id] & (USERNAME_INDEX_BUCKETS - 1);
+    while (buckets[bucket] != user_id + 1)
+        bucket = (bucket + 1) & (USERNAME_INDEX_BUCKETS - 1);
+
+    // Backward shift: Move following entries of the probe sequence into the gap,
+    // so that lookups don't stop early at an empty bucket.
+    uint32_t gap = bucket;
+    for (uint32_t next = (gap + 1) & (USERNAME_INDEX_BUCKETS - 1); buckets[next] != 0; next = (next + 1) & (USERNAME_INDEX_BUCKETS - 1)) {
+        uint32_t home = username_hashes[buckets[next] - 1] & (USERNAME_INDEX_BUCKETS - 1);
+
+        // The entry can move into the gap if its home bucket is not between the gap and its bucket.
+        if (((next - home) & (USERNAME_INDEX_BUCKETS - 1)) >= ((next - gap) & (USERNAME_INDEX_BUCKETS - 1))) {
+            buckets[gap] = buckets[next];
+            gap = next;
+        }
+    }
+
+    buckets[gap] = 0;
+}
+
+void UsernameIndex::set(uint8_t user_id, const char *username, size_t username_len, const char *display_name, size_t display_name_len)
+{
+    if (username_hashes[user_id] != 0)
+        remove_bucket(user_id);
+
+    username_hashes[user_id] = username_len == 0 ? 0 : hash_username(username, username_len);
+
+    if (username_hashes[user_id] != 0)
+        insert_bucket(user_id);
+
+    size_t start = display_name_offsets[user_id];
+    size_t old_len = display_name_offsets[user_id + 1] - start;
+
+    if (display_name_len > old_len)
+        display_names.insert(display_names.begin() + static_cast<ptrdiff_t>(start + old_len), display_name_len - old_len, '\0');
+    else if (display_name_len < old_len)
+        display_names.erase(display_names.begin() + static_cast<ptrdiff_t>(start + display_name_len), display_names.begin() + static_cast<ptrdiff_t>(start + old_len));
+
+    if (display_name_len > 0)
+        memcpy(display_names.data() + start, display_name, display_name_len);
+
+    if (display_name_len != old_len) {
+        for (size_t i = static_cast<size_t>(user_id) + 1; i <= USERNAME_INDEX_USERS; ++i)
+            display_name_offsets[i] = static_cast<uint16_t>(display_name_offsets[i] + display_name_len - old_len);
+    }
+}
+
+size_t UsernameIndex::get_display_name(uint8_t user_id, char *ret_buf) const
+{
+    size_t start = display_name_offsets[user_id];
+    size_t len = display_name_offsets[user_id + 1] - start;
+
+    if (len > 0)
+        memcpy(ret_buf, display_names.data() + start, len);
+
+    return len;
+}
+
+size_t UsernameIndex::get_memory_usage() const
+{
+    return sizeof(*this) + display_names.capacity();
+}
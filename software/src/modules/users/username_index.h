@@ -0,0 +1,81 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define USERNAME_INDEX_USERS 256
+#define USERNAME_INDEX_BUCKETS 512 // Power of two, at most half full.
+
+// In-RAM copy of the username file: The hash of each username and the display names.
+// Finding a username or a display name doesn't have to read the file anymore.
+class UsernameIndex
+{
+public:
+    UsernameIndex();
+
+    void clear();
+
+    // An empty username marks the user ID as free.
+    void set(uint8_t user_id, const char *username, size_t username_len, const char *display_name, size_t display_name_len);
+
+    bool is_free(uint8_t user_id) const { return username_hashes[user_id] == 0; }
+
+    // Calls is_match for each user with the same username hash, because hashes can collide.
+    // Returns the first user ID for which is_match returns true or -1.
+    template<typename F>
+    int find(const char *username, size_t username_len, F &&is_match) const
+    {
+        if (username_len == 0)
+            return -1;
+
+        uint32_t hash = hash_username(username, username_len);
+
+        for (uint32_t bucket = hash & (USERNAME_INDEX_BUCKETS - 1); buckets[bucket] != 0; bucket = (bucket + 1) & (USERNAME_INDEX_BUCKETS - 1)) {
+            uint8_t user_id = static_cast<uint8_t>(buckets[bucket] - 1);
+            if (username_hashes[user_id] == hash && is_match(user_id))
+                return user_id;
+        }
+
+        return -1;
+    }
+
+    // Copies the display name into ret_buf without a null terminator. Returns its length.
+    size_t get_display_name(uint8_t user_id, char *ret_buf) const;
+
+    size_t get_memory_usage() const;
+
+    static uint32_t hash_username(const char *username, size_t username_len);
+
+private:
+    void insert_bucket(uint8_t user_id);
+    void remove_bucket(uint8_t user_id);
+
+    uint32_t username_hashes[USERNAME_INDEX_USERS]; // 0 if the user ID is free.
+    uint16_t buckets[USERNAME_INDEX_BUCKETS];       // User ID + 1 or 0 if empty. Linear probing.
+
+    // Display names are packed in the order of the user IDs. The name of user i is at
+    // display_name_offsets[i] and ends where the name of user i + 1 starts.
+    uint16_t display_name_offsets[USERNAME_INDEX_USERS + 1];
+    std::vector<char> display_names;
+};
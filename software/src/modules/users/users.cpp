@@ -29,6 +29,8 @@
 
 #define USERNAME_FILE "/users/all_usernames"
 
+static_assert(MAX_PASSIVE_USERS == USERNAME_INDEX_USERS, "Username index doesn't cover all user IDs");
+
 // We have to do access the evse/evse_v2 configs manually
 // because a lot of the code runs in setup(), i.e. before APIs
 // are registered.
@@ -181,16 +183,9 @@ void Users::pre_setup()
             if (config.get("users")->get(i)->get("username")->asString() == add.get("username")->asString())
                 return "Can't add user. A user with this username already exists.";
 
-        {
-            char username[33] = {0};
-            File f = LittleFS.open(USERNAME_FILE, "r");
-            for (size_t i = 0; i < f.size(); i += USERNAME_ENTRY_LENGTH) {
-                f.seek(i);
-                f.read((uint8_t *) username, USERNAME_LENGTH);
-                if (add.get("username")->asString() == username)
-                    return "Can't add user. A user with this username already has tracked charges.";
-            }
-        }
+        const String &username = add.get("username")->asString();
+        if (username_index.find(username.c_str(), username.length(), [this, &username](uint8_t user_id) {return username_matches(user_id, username);}) >= 0)
+            return "Can't add user. A user with this username already has tracked charges.";
 
         return "";
     }};
@@ -262,19 +257,8 @@ void Users::pre_setup()
             }
         }
 
-        {
-            char other_name[33] = {0};
-            File f = LittleFS.open(USERNAME_FILE, "r");
-            for(size_t i = 0; i < f.size(); i += USERNAME_ENTRY_LENGTH) {
-                if ((i / USERNAME_ENTRY_LENGTH) == id)
-                    continue;
-
-                f.seek(i);
-                f.read((uint8_t *) other_name, USERNAME_LENGTH);
-                if (username == other_name)
-                    return "Can't modify user. A user with this username already has tracked charges.";
-            }
-        }
+        if (username_index.find(username.c_str(), username.length(), [this, id, &username](uint8_t user_id) {return user_id != id && username_matches(user_id, username);}) >= 0)
+            return "Can't modify user. A user with this username already has tracked charges.";
 
         if (!roles_passed)
             modify.get("roles")->updateUint(user->get("roles")->asUint());
@@ -330,6 +314,49 @@ void create_username_file()
         f.write(buf, sizeof(buf));
 }
 
+void Users::load_username_index()
+{
+    char buf[8 * USERNAME_ENTRY_LENGTH];
+    File f = LittleFS.open(USERNAME_FILE, "r");
+
+    std::lock_guard<std::mutex> lock{username_index_mutex};
+    username_index.clear();
+
+    for (size_t user_id = 0; user_id < MAX_PASSIVE_USERS;) {
+        size_t read = f.read((uint8_t *)buf, sizeof(buf));
+        if (read < USERNAME_ENTRY_LENGTH)
+            break;
+
+        for (size_t i = 0; i + USERNAME_ENTRY_LENGTH <= read && user_id < MAX_PASSIVE_USERS; i += USERNAME_ENTRY_LENGTH, ++user_id) {
+            const char *username = buf + i;
+            const char *display_name = username + USERNAME_LENGTH;
+            username_index.set((uint8_t)user_id, username, strnlen(username, USERNAME_LENGTH), display_name, strnlen(display_name, DISPLAY_NAME_LENGTH));
+        }
+    }
+}
+
+// The file keeps only USERNAME_LENGTH - 1 characters of the username. Index what will be found in the file.
+// The display name is kept in full, as get_display_name always returned it from the config for configured users.
+void Users::update_username_index(uint8_t user_id, const String &username, const String &display_name)
+{
+    std::lock_guard<std::mutex> lock{username_index_mutex};
+    username_index.set(user_id,
+                       username.c_str(), std::min(username.length(), (unsigned int)(USERNAME_LENGTH - 1)),
+                       display_name.c_str(), std::min(display_name.length(), (unsigned int)DISPLAY_NAME_LENGTH));
+}
+
+// Hashes can collide, so compare the username in the file before reporting a match.
+bool Users::username_matches(uint8_t user_id, const String &username)
+{
+    char file_username[USERNAME_LENGTH + 1] = {0};
+
+    File f = LittleFS.open(USERNAME_FILE, "r");
+    f.seek(user_id * USERNAME_ENTRY_LENGTH, SeekMode::SeekSet);
+    f.read((uint8_t *)file_username, USERNAME_LENGTH);
+
+    return username == file_username;
+}
+
 void Users::setup()
 {
     api.restorePersistentConfig("users/config", &config);
@@ -343,6 +370,12 @@ void Users::setup()
         }
     }
 
+    load_username_index();
+    for (size_t i = 0; i < config.get("users")->count(); ++i) {
+        Config *user = (Config *)config.get("users")->get(i);
+        update_username_index(user->get("id")->asUint(), user->get("username")->asString(), user->get("display_name")->asString());
+    }
+
     // Next user id is 0 if there is no free user left.
     // After a reboot maybe tracked charges were removed.
     if (config.get("next_user_id")->asUint() == 0)
@@ -462,19 +495,13 @@ void Users::search_next_free_user()
     uint8_t user_id = config.get("next_user_id")->asUint();
     uint8_t start_uid = user_id;
     user_id++;
-    {
-        File f = LittleFS.open(USERNAME_FILE, "r+");
-        while (start_uid != user_id) {
-            if (user_id == 0)
-                user_id++;
-            f.seek(user_id * USERNAME_ENTRY_LENGTH, SeekMode::SeekSet);
-            char user_name_byte = 0;
-            f.readBytes(&user_name_byte, 1);
-            if (user_name_byte == '\0')
-                break;
+    while (start_uid != user_id) {
+        if (user_id == 0)
             user_id++;
-        };
-    }
+        if (username_index.is_free(user_id))
+            break;
+        user_id++;
+    };
     if (user_id == start_uid)
         user_id = 0;
 
@@ -483,17 +510,10 @@ void Users::search_next_free_user()
 
 size_t Users::get_display_name(uint8_t user_id, char *ret_buf)
 {
-    for (auto &cfg : config.get("users")) {
-        if (cfg.get("id")->asUint() == user_id) {
-            const String &s = cfg.get("display_name")->asString();
-            strncpy(ret_buf, s.c_str(), 32);
-            return min(s.length(), 32u);
-        }
-    }
-    File f = LittleFS.open(USERNAME_FILE, "r");
-    f.seek(user_id * USERNAME_ENTRY_LENGTH + USERNAME_LENGTH, SeekMode::SeekSet);
-    f.read((uint8_t *)ret_buf, DISPLAY_NAME_LENGTH);
-    return strnlen(ret_buf, 32);
+    std::lock_guard<std::mutex> lock{username_index_mutex};
+    size_t length = username_index.get_display_name(user_id, ret_buf);
+    ret_buf[length] = '\0';
+    return length;
 }
 
 bool Users::is_user_configured(uint8_t user_id)
@@ -675,9 +695,13 @@ void Users::rename_user(uint8_t user_id, const String &username, const String &d
     username.toCharArray(buf, USERNAME_LENGTH);
     display_name.toCharArray(buf + USERNAME_LENGTH, DISPLAY_NAME_LENGTH);
 
-    File f = LittleFS.open(USERNAME_FILE, "r+");
-    f.seek(user_id * USERNAME_ENTRY_LENGTH, SeekMode::SeekSet);
-    f.write((const uint8_t *)buf, USERNAME_ENTRY_LENGTH);
+    {
+        File f = LittleFS.open(USERNAME_FILE, "r+");
+        f.seek(user_id * USERNAME_ENTRY_LENGTH, SeekMode::SeekSet);
+        f.write((const uint8_t *)buf, USERNAME_ENTRY_LENGTH);
+    }
+
+    update_username_index(user_id, username, display_name);
 }
 
 void Users::remove_from_username_file(uint8_t user_id)
@@ -747,6 +771,9 @@ void Users::remove_username_file()
 {
     if (LittleFS.exists(USERNAME_FILE))
         LittleFS.remove(USERNAME_FILE);
+
+    std::lock_guard<std::mutex> lock{username_index_mutex};
+    username_index.clear();
 }
 
 bool Users::start_charging(uint8_t user_id, uint16_t current_limit, uint8_t auth_type, Config::ConfVariant auth_info)
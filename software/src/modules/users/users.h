@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "module.h"
 #include "config.h"
+#include "username_index.h"
 
 #define USERS_AUTH_TYPE_NONE 0
 #define USERS_AUTH_TYPE_LOST 1
@@ -54,6 +57,8 @@ public:
     void rename_user(uint8_t user_id, const String &username, const String &display_name);
     void remove_from_username_file(uint8_t user_id);
     void search_next_free_user();
+    // ret_buf needs DISPLAY_NAME_LENGTH + 1 bytes. Returns the length without the null terminator.
+    // Can be called from any thread.
     size_t get_display_name(uint8_t user_id, char *ret_buf);
     bool is_user_configured(uint8_t user_id);
 
@@ -76,6 +81,15 @@ public:
     bool stop_charging(uint8_t user_id, bool force, float meter_abs = 0);
 
     micros_t last_charge_action_triggered = 0_us;
+
+private:
+    void load_username_index();
+    void update_username_index(uint8_t user_id, const String &username, const String &display_name);
+    bool username_matches(uint8_t user_id, const String &username);
+
+    // Written only by the main thread, which can read it without the lock.
+    UsernameIndex username_index;
+    std::mutex username_index_mutex;
 };
 
 void set_led(int16_t mode);
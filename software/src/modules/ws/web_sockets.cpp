@@ -19,6 +19,8 @@
 
 #include "web_sockets.h"
 
+#include <lwip/sockets.h>
+
 #include "event_log_prefix.h"
 #include "main_dependencies.h"
 #include "tools.h"
@@ -31,85 +33,108 @@
 static int watchdog_handle = -1;
 #endif
 
-void clear_ws_work_item(ws_work_item *wi)
+bool WebSockets::beginWork(uint32_t after_seq, ws_work_item *item)
+{
+    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
+    return work_queue.begin_next(after_seq, item);
+}
+
+void WebSockets::finishWork(uint32_t seq, uint32_t done_slots)
 {
-    free(wi->payload);
-    wi->payload = nullptr;
+    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
+    work_queue.finish(seq, done_slots);
 }
 
-bool WebSockets::haveWork(ws_work_item *item)
+bool WebSockets::enqueue(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, httpd_ws_type_t ws_type, const WebSocketsWorkKey *key, bool replace_queued)
 {
     std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
 
-    if (work_queue.empty())
+    if (work_queue.push(fds, payload, payload_len, static_cast<uint8_t>(ws_type), key, replace_queued) == WebSocketsWorkQueue::PushResult::Full) {
+        free(payload);
         return false;
+    }
 
-    *item = work_queue.front();
-    work_queue.pop_front();
     return true;
 }
 
-void WebSockets::cleanUpQueue()
+bool WebSockets::canReplaceQueued(const WebSocketsWorkKey *key)
 {
     std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    while (!work_queue.empty()) {
-        ws_work_item *wi = &work_queue.front();
-        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-            if (wi->fds[i] != -1) {
-                return;
-            }
-        }
-        clear_ws_work_item(wi);
-        // Every fd was -1.
-        work_queue.pop_front();
-    }
+    return work_queue.can_replace(key);
 }
 
-bool WebSockets::queueFull()
+// Checks without blocking whether the socket can take more data.
+static bool fd_writable(int fd)
 {
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (work_queue.size() < MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
-        return false;
-    }
+    fd_set write_fds;
+    FD_ZERO(&write_fds);
+    FD_SET(fd, &write_fds);
 
-    cleanUpQueue();
-
-    if (work_queue.size() >= MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
-        return true;
-    }
-    // Print only to the console because printing to the event log
-    // would generate more websocket messages to fill up the queue.
-    printf("web_sockets: Work queue was full but %u items were cleaned.\n", MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE - work_queue.size());
-
-    return false;
+    struct timeval timeout = {0, 0};
+    return select(fd + 1, nullptr, &write_fds, nullptr, &timeout) > 0;
 }
 
-static bool send_ws_work_item(WebSockets *ws, ws_work_item wi)
+// Sets one bit in done_slots per index into wi.fds for each client that doesn't need the payload anymore.
+// If blocked_fds is not nullptr, clients whose socket is full are skipped and added to blocked_fds,
+// so that they don't hold back the others. Their later items are skipped too, to keep the order.
+static bool send_ws_work_item(WebSockets *ws, const ws_work_item &wi, uint32_t *done_slots = nullptr, int *blocked_fds = nullptr)
 {
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
 
     ws_pkt.payload = (uint8_t *)wi.payload;
     ws_pkt.len = wi.payload_len;
-    ws_pkt.type = wi.payload_len == 0 ? HTTPD_WS_TYPE_PING : wi.ws_type;
+    ws_pkt.type = wi.payload_len == 0 ? HTTPD_WS_TYPE_PING : static_cast<httpd_ws_type_t>(wi.ws_type);
 
     bool result = true;
+    uint32_t done = 0;
 
     struct httpd_data *hd = (struct httpd_data *)ws->httpd;
 
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-        if (wi.fds[i] == -1) {
+        int fd = wi.fds[i];
+
+        if (fd == -1) {
             continue;
         }
 
-        if (httpd_ws_get_fd_info(hd, wi.fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) {
+        if (httpd_ws_get_fd_info(hd, fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+            done |= 1u << i;
             continue;
         }
 
-        if (httpd_ws_send_frame_async(hd, wi.fds[i], &ws_pkt) != ESP_OK) {
-            ws->keepAliveCloseDead(wi.fds[i]);
+        if (blocked_fds != nullptr) {
+            bool blocked = false;
+            int free_slot = -1;
+
+            for (int j = 0; j < MAX_WEB_SOCKET_CLIENTS; ++j) {
+                if (blocked_fds[j] == fd)
+                    blocked = true;
+                else if (blocked_fds[j] == -1 && free_slot == -1)
+                    free_slot = j;
+            }
+
+            if (blocked) {
+                continue;
+            }
+
+            if (!fd_writable(fd)) {
+                if (free_slot != -1)
+                    blocked_fds[free_slot] = fd;
+                continue;
+            }
+        }
+
+        if (httpd_ws_send_frame_async(hd, fd, &ws_pkt) != ESP_OK) {
+            ws->keepAliveCloseDead(fd);
             result = false;
         }
+
+        done |= 1u << i;
+    }
+
+    if (done_slots != nullptr) {
+        *done_slots = done;
     }
 
     return result;
@@ -120,10 +145,16 @@ static void work(void *arg)
     WebSockets *ws = (WebSockets *)arg;
     ws->worker_active = WEBSOCKET_WORKER_RUNNING;
 
+    int blocked_fds[MAX_WEB_SOCKET_CLIENTS] = {-1, -1, -1, -1, -1};
+    uint32_t seq = 0;
     ws_work_item wi;
-    while (ws->haveWork(&wi)) {
-        send_ws_work_item(ws, wi);
-        clear_ws_work_item(&wi);
+
+    while (ws->beginWork(seq, &wi)) {
+        uint32_t done_slots;
+        send_ws_work_item(ws, wi, &done_slots, blocked_fds);
+
+        seq = wi.seq;
+        ws->finishWork(seq, done_slots);
     }
 
     ws->worker_active = WEBSOCKET_WORKER_DONE;
@@ -132,6 +163,34 @@ static void work(void *arg)
 #endif
 }
 
+// Checks whether the comma separated header value contains the token.
+static bool header_contains_token(httpd_req_t *req, const char *header, const char *token)
+{
+    char value[128];
+    if (httpd_req_get_hdr_value_str(req, header, value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+
+    size_t token_len = strlen(token);
+    const char *pos = value;
+
+    while (*pos != '\0') {
+        while (*pos == ' ' || *pos == ',')
+            ++pos;
+
+        const char *end = pos;
+        while (*end != '\0' && *end != ',' && *end != ' ')
+            ++end;
+
+        if (static_cast<size_t>(end - pos) == token_len && memcmp(pos, token, token_len) == 0)
+            return true;
+
+        pos = end;
+    }
+
+    return false;
+}
+
 static esp_err_t ws_handler(httpd_req_t *req)
 {
     if (req->method == HTTP_GET) {
@@ -153,8 +212,15 @@ static esp_err_t ws_handler(httpd_req_t *req)
                 return ESP_FAIL;
             }
 
+            // Only confirm the subprotocol if the client asked for it.
+            // Clients without subprotocol get the plain protocol.
+            const char *subprotocol = nullptr;
+            if (ws->supported_subprotocol != nullptr && header_contains_token(req, "Sec-WebSocket-Protocol", ws->supported_subprotocol)) {
+                subprotocol = ws->supported_subprotocol;
+            }
+
             struct httpd_data *hd = (struct httpd_data *)ws->httpd;
-            esp_err_t ret = httpd_ws_respond_server_handshake(&hd->hd_req, nullptr);
+            esp_err_t ret = httpd_ws_respond_server_handshake(&hd->hd_req, subprotocol);
             if (ret != ESP_OK) {
                 return ret;
             }
@@ -174,7 +240,7 @@ static esp_err_t ws_handler(httpd_req_t *req)
                 ws->on_client_connect_fn(WebSocketsClient{sock, ws});
             }
 
-            ws->keepAliveAdd(sock);
+            ws->keepAliveAdd(sock, subprotocol != nullptr);
         } else {
             request.send(200);
         }
@@ -236,7 +302,7 @@ static esp_err_t ws_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-void WebSockets::keepAliveAdd(int fd)
+void WebSockets::keepAliveAdd(int fd, bool uses_subprotocol)
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
@@ -244,6 +310,7 @@ void WebSockets::keepAliveAdd(int fd)
             // fd is alreaedy in the keep alive array. Only update last_pong to prevent instantly closing the new connection.
             // This can happen if web sockets are opened and closed rapidly (so that LWIP "reuses" the fd) and we miss a close frame.
             keep_alive_last_pong[i] = millis();
+            keep_alive_uses_subprotocol[i] = uses_subprotocol;
             return;
         }
     }
@@ -253,6 +320,7 @@ void WebSockets::keepAliveAdd(int fd)
             continue;
         keep_alive_fds[i] = fd;
         keep_alive_last_pong[i] = millis();
+        keep_alive_uses_subprotocol[i] = uses_subprotocol;
         return;
     }
 }
@@ -266,16 +334,14 @@ void WebSockets::keepAliveRemove(int fd)
                 continue;
             keep_alive_fds[i] = -1;
             keep_alive_last_pong[i] = 0;
+            keep_alive_uses_subprotocol[i] = false;
             break;
         }
     }
 
     {
         std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-        for (int i = 0; i < work_queue.size(); ++i)
-            for (int j = 0; j < MAX_WEB_SOCKET_CLIENTS; ++j)
-                if (work_queue[i].fds[j] == fd)
-                    work_queue[i].fds[j] = -1;
+        work_queue.remove_fd(fd);
     }
 }
 
@@ -329,13 +395,7 @@ void WebSockets::pingActiveClients()
         memcpy(fds, keep_alive_fds, sizeof(fds));
     }
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        return;
-    }
-
-    work_queue.push_back({{}, nullptr, 0, HTTPD_WS_TYPE_PING});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
+    enqueue(fds, nullptr, 0, HTTPD_WS_TYPE_PING);
 }
 
 void WebSockets::checkActiveClients()
@@ -364,7 +424,7 @@ void WebSockets::receivedPong(int fd)
 
 bool WebSocketsClient::sendOwnedNoFreeBlocking_HTTPThread(char *payload, size_t payload_len, httpd_ws_type_t ws_type)
 {
-    ws_work_item wi{{this->fd, -1, -1, -1, -1}, payload, payload_len, ws_type};
+    ws_work_item wi{{this->fd, -1, -1, -1, -1}, payload, payload_len, static_cast<uint8_t>(ws_type), nullptr, 0, 0, 0, 0, false};
     bool result = send_ws_work_item(ws, wi);
     return result;
 }
@@ -387,14 +447,8 @@ bool WebSockets::sendToClient(const char *payload, size_t payload_len, int fd, h
 
     memcpy(payload_copy, payload, payload_len);
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload_copy);
-        return false;
-    }
-
-    work_queue.push_back({{fd, -1, -1, -1, -1}, payload_copy, payload_len, ws_type});
-    return true;
+    int fds[MAX_WEB_SOCKET_CLIENTS] = {fd, -1, -1, -1, -1};
+    return enqueue(fds, payload_copy, payload_len, ws_type);
 }
 
 bool WebSockets::sendToClientOwned(char *payload, size_t payload_len, int fd, httpd_ws_type_t ws_type)
@@ -404,26 +458,42 @@ bool WebSockets::sendToClientOwned(char *payload, size_t payload_len, int fd, ht
         return true;
     }
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload);
-        return false;
+    int fds[MAX_WEB_SOCKET_CLIENTS] = {fd, -1, -1, -1, -1};
+    return enqueue(fds, payload, payload_len, ws_type);
+}
+
+static bool client_matches_filter(bool uses_subprotocol, WebSocketsClientFilter filter)
+{
+    switch (filter) {
+        case WebSocketsClientFilter::All:
+            return true;
+        case WebSocketsClientFilter::WithSubprotocol:
+            return uses_subprotocol;
+        case WebSocketsClientFilter::WithoutSubprotocol:
+            return !uses_subprotocol;
     }
 
-    work_queue.push_back({{fd, -1, -1, -1, -1}, payload, payload_len, ws_type});
     return true;
 }
 
-bool WebSockets::haveActiveClient()
+bool WebSockets::haveActiveClient(WebSocketsClientFilter filter)
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
     for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
-        if (keep_alive_fds[i] != -1)
+        if (keep_alive_fds[i] != -1 && client_matches_filter(keep_alive_uses_subprotocol[i], filter))
             return true;
     }
     return false;
 }
 
+void WebSockets::copyClientFds(int fds[MAX_WEB_SOCKET_CLIENTS], WebSocketsClientFilter filter)
+{
+    std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
+    for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+        fds[i] = client_matches_filter(keep_alive_uses_subprotocol[i], filter) ? keep_alive_fds[i] : -1;
+    }
+}
+
 bool WebSockets::haveFreeSlot()
 {
     std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
@@ -434,28 +504,18 @@ bool WebSockets::haveFreeSlot()
     return false;
 }
 
-bool WebSockets::sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type)
+bool WebSockets::sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type, WebSocketsClientFilter filter, const WebSocketsWorkKey *key, bool replace_queued)
 {
-    if (!this->haveActiveClient()) {
+    if (!this->haveActiveClient(filter)) {
         free(payload);
         return true;
     }
 
     // Copy over to not hold both mutexes at the same time.
     int fds[MAX_WEB_SOCKET_CLIENTS];
-    {
-        std::lock_guard<std::recursive_mutex> lock{keep_alive_mutex};
-        memcpy(fds, keep_alive_fds, sizeof(fds));
-    }
+    copyClientFds(fds, filter);
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload);
-        return false;
-    }
-    work_queue.push_back({{}, payload, payload_len, ws_type});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
-    return true;
+    return enqueue(fds, payload, payload_len, ws_type, key, replace_queued);
 }
 
 bool WebSockets::sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type)
@@ -476,15 +536,7 @@ bool WebSockets::sendToAll(const char *payload, size_t payload_len, httpd_ws_typ
         memcpy(fds, keep_alive_fds, sizeof(fds));
     }
 
-    std::lock_guard<std::recursive_mutex> lock{work_queue_mutex};
-    if (queueFull()) {
-        free(payload_copy);
-        return false;
-    }
-
-    work_queue.push_back({{}, payload_copy, payload_len, ws_type});
-    memcpy(work_queue.back().fds, fds, sizeof(fds));
-    return true;
+    return enqueue(fds, payload_copy, payload_len, ws_type);
 }
 
 void WebSockets::triggerHttpThread()
@@ -540,7 +592,9 @@ void WebSockets::pre_setup() {
         {"keep_alive_pongs", Config::Array({},Config::get_prototype_uint32_0(), MAX_WEB_SOCKET_CLIENTS, MAX_WEB_SOCKET_CLIENTS, Config::type_id<Config::ConfUint>())},
         {"worker_active", Config::Uint8(WEBSOCKET_WORKER_DONE)},
         {"last_worker_run", Config::Uint32(0)},
-        {"queue_len", Config::Uint32(0)}
+        {"queue_len", Config::Uint32(0)},
+        {"queue_replaced", Config::Uint32(0)}, // Queued payloads replaced by a newer one before they were sent to every client
+        {"queue_dropped", Config::Uint32(0)}, // Payloads not queued because the queue was full
     });
 
     Config *state_keep_alive_fds = static_cast<Config *>(state.get("keep_alive_fds"));
@@ -551,6 +605,7 @@ void WebSockets::pre_setup() {
         state_keep_alive_pongs->add();
         keep_alive_fds[i] = -1;
         keep_alive_last_pong[i] = 0;
+        keep_alive_uses_subprotocol[i] = false;
     }
 }
 
@@ -562,6 +617,8 @@ void WebSockets::updateDebugState()
         state.get("worker_active"  )->updateUint(worker_active);
         state.get("last_worker_run")->updateUint(last_worker_run);
         state.get("queue_len"      )->updateUint(work_queue.size());
+        state.get("queue_replaced" )->updateUint(work_queue.get_replaced());
+        state.get("queue_dropped"  )->updateUint(work_queue.get_dropped());
     }
 
     {
@@ -580,6 +637,7 @@ void WebSockets::updateDebugState()
 void WebSockets::start(const char *uri, const char *state_path, httpd_handle_t httpd, const char *supported_subprotocol)
 {
     this->httpd = httpd;
+    this->supported_subprotocol = supported_subprotocol;
 
     httpd_uri_t ws = {};
     ws.uri = uri;
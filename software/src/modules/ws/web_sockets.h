@@ -24,15 +24,18 @@
 #include <functional>
 #include <atomic>
 #include <mutex>
-#include <deque>
 
 #include "config.h"
-
-#define MAX_WEB_SOCKET_CLIENTS 5
-#define MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE 32
+#include "web_sockets_work_queue.h"
 
 class WebSockets;
 
+enum class WebSocketsClientFilter {
+    All,
+    WithSubprotocol,
+    WithoutSubprotocol
+};
+
 struct WebSocketsClient {
     int fd;
     WebSockets *ws;
@@ -41,15 +44,6 @@ struct WebSocketsClient {
     void close_HTTPThread();
 };
 
-struct ws_work_item {
-    int fds[MAX_WEB_SOCKET_CLIENTS];
-    char *payload;
-    size_t payload_len;
-    httpd_ws_type_t ws_type;
-};
-
-void clear_ws_work_item(ws_work_item *wi);
-
 #define WEBSOCKET_WORKER_ENQUEUED 0
 #define WEBSOCKET_WORKER_RUNNING 1
 #define WEBSOCKET_WORKER_DONE 2
@@ -65,44 +59,53 @@ public:
     bool sendToClient(const char *payload, size_t payload_len, int sock, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
     bool sendToClientOwned(char *payload, size_t payload_len, int sock, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
     bool sendToAll(const char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
-    bool sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT);
+    // A payload with a key replaces a queued payload with the same key that was not sent yet, unless replace_queued is false. See WebSocketsWorkQueue::push.
+    bool sendToAllOwned(char *payload, size_t payload_len, httpd_ws_type_t ws_type = HTTPD_WS_TYPE_TEXT, WebSocketsClientFilter filter = WebSocketsClientFilter::All, const WebSocketsWorkKey *key = nullptr, bool replace_queued = true);
 
     bool haveFreeSlot();
-    bool haveActiveClient();
+    bool haveActiveClient(WebSocketsClientFilter filter = WebSocketsClientFilter::All);
     void pingActiveClients();
     void checkActiveClients();
     void receivedPong(int fd);
 
-    void cleanUpQueue();
-    bool queueFull();
+    bool enqueue(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, httpd_ws_type_t ws_type, const WebSocketsWorkKey *key = nullptr, bool replace_queued = true);
+    bool canReplaceQueued(const WebSocketsWorkKey *key);
 
     void onConnect_HTTPThread(std::function<void(WebSocketsClient)> &&fn);
     void onBinaryDataReceived_HTTPThread(std::function<void(const int fd, httpd_ws_frame_t *ws_pkt)> &&fn);
 
     void triggerHttpThread();
-    bool haveWork(ws_work_item *item);
+    bool beginWork(uint32_t after_seq, ws_work_item *item);
+    void finishWork(uint32_t seq, uint32_t done_slots);
 
-    void keepAliveAdd(int fd);
+    void keepAliveAdd(int fd, bool uses_subprotocol);
     void keepAliveRemove(int fd);
     void keepAliveCloseDead(int fd);
 
     void updateDebugState();
 
+private:
+    void copyClientFds(int fds[MAX_WEB_SOCKET_CLIENTS], WebSocketsClientFilter filter);
+
+public:
+
     // Using a recursive mutex simplifies the method implementations,
     // as every method can lock the mutex without considering that
     // it could be called by another method that locked the mutex.
     std::recursive_mutex keep_alive_mutex;
     int keep_alive_fds[MAX_WEB_SOCKET_CLIENTS];
     uint32_t keep_alive_last_pong[MAX_WEB_SOCKET_CLIENTS];
+    bool keep_alive_uses_subprotocol[MAX_WEB_SOCKET_CLIENTS];
 
     std::recursive_mutex work_queue_mutex;
-    std::deque<ws_work_item> work_queue;
+    WebSocketsWorkQueue work_queue;
 
     std::atomic<uint8_t> worker_active;
     uint32_t last_worker_run = 0;
     uint32_t worker_poll_count = 0;
 
     httpd_handle_t httpd;
+    const char *supported_subprotocol = nullptr;
 
     std::function<void(WebSocketsClient)> on_client_connect_fn;
     std::function<void(const int fd, httpd_ws_frame_t *ws_pkt)> on_binary_data_received_fn;
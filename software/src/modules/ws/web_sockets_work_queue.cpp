@@ -0,0 +1,215 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "web_sockets_work_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void clear_ws_work_item(ws_work_item *wi)
+{
+    free(wi->payload);
+    wi->payload = nullptr;
+
+    free(wi->key_path);
+    wi->key_path = nullptr;
+}
+
+static bool has_client(const ws_work_item &wi)
+{
+    for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+        if (wi.fds[i] != -1)
+            return true;
+    }
+
+    return false;
+}
+
+// Compares the path and the variant: Different paths can have the same hash.
+static bool has_key(const ws_work_item &wi, const WebSocketsWorkKey *key)
+{
+    return wi.key_path != nullptr
+        && wi.key_hash == key->hash
+        && wi.key_variant == key->variant
+        && wi.key_path_len == key->path_len
+        && memcmp(wi.key_path, key->path, key->path_len) == 0;
+}
+
+WebSocketsWorkQueue::~WebSocketsWorkQueue()
+{
+    clear();
+}
+
+WebSocketsWorkQueue::PushResult WebSocketsWorkQueue::push(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, uint8_t ws_type, const WebSocketsWorkKey *key, bool replace_queued)
+{
+    PushResult result = PushResult::Queued;
+
+    if (key != nullptr && replace_queued) {
+        for (auto it = items.begin(); it != items.end(); ++it) {
+            if (it->in_flight || !has_key(*it, key))
+                continue;
+
+            clear_ws_work_item(&*it);
+            items.erase(it);
+            ++replaced;
+            result = PushResult::Replaced;
+            break;
+        }
+    }
+
+    if (items.size() >= MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
+        clean_up();
+
+        if (items.size() >= MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
+            ++dropped;
+            return PushResult::Full;
+        }
+    }
+
+    ws_work_item wi;
+    memcpy(wi.fds, fds, sizeof(wi.fds));
+    wi.payload = payload;
+    wi.payload_len = payload_len;
+    wi.ws_type = ws_type;
+    wi.key_path = nullptr;
+    wi.key_path_len = 0;
+    wi.key_variant = 0;
+    wi.key_hash = 0;
+    wi.seq = next_seq++;
+    wi.in_flight = false;
+
+    // Without the copy, the item can't be replaced. That only costs bandwidth:
+    // A later patch is then queued behind it, as for an item in flight.
+    if (key != nullptr) {
+        wi.key_path = static_cast<char *>(malloc(key->path_len > 0 ? key->path_len : 1));
+
+        if (wi.key_path != nullptr) {
+            memcpy(wi.key_path, key->path, key->path_len);
+            wi.key_path_len = key->path_len;
+            wi.key_variant = key->variant;
+            wi.key_hash = key->hash;
+        }
+    }
+
+    // 0 is the start value of begin_next.
+    if (next_seq == 0)
+        next_seq = 1;
+
+    items.push_back(wi);
+    return result;
+}
+
+bool WebSocketsWorkQueue::can_replace(const WebSocketsWorkKey *key) const
+{
+    if (key == nullptr)
+        return false;
+
+    for (const ws_work_item &wi : items) {
+        if (!wi.in_flight && has_key(wi, key))
+            return true;
+    }
+
+    return false;
+}
+
+bool WebSocketsWorkQueue::begin_next(uint32_t after_seq, ws_work_item *item)
+{
+    for (ws_work_item &wi : items) {
+        if (wi.seq <= after_seq || !has_client(wi))
+            continue;
+
+        wi.in_flight = true;
+        *item = wi;
+        return true;
+    }
+
+    return false;
+}
+
+void WebSocketsWorkQueue::finish(uint32_t seq, uint32_t done_slots)
+{
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        if (it->seq != seq)
+            continue;
+
+        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+            if ((done_slots & (1u << i)) != 0)
+                it->fds[i] = -1;
+        }
+
+        it->in_flight = false;
+
+        if (!has_client(*it)) {
+            clear_ws_work_item(&*it);
+            items.erase(it);
+        }
+
+        return;
+    }
+}
+
+void WebSocketsWorkQueue::remove_fd(int fd)
+{
+    for (ws_work_item &wi : items) {
+        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+            if (wi.fds[i] == fd)
+                wi.fds[i] = -1;
+        }
+    }
+
+    clean_up();
+}
+
+void WebSocketsWorkQueue::clear()
+{
+    for (ws_work_item &wi : items)
+        clear_ws_work_item(&wi);
+
+    items.clear();
+}
+
+// Removes the items that no client needs anymore.
+void WebSocketsWorkQueue::clean_up()
+{
+    for (auto it = items.begin(); it != items.end();) {
+        if (it->in_flight || has_client(*it)) {
+            ++it;
+            continue;
+        }
+
+        clear_ws_work_item(&*it);
+        it = items.erase(it);
+    }
+}
+
+WebSocketsWorkKey WebSocketsWorkKey::for_path(const char *path, size_t path_len, uint8_t variant)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < path_len; ++i) {
+        hash ^= static_cast<uint8_t>(path[i]);
+        hash *= 16777619u;
+    }
+
+    hash ^= variant;
+    hash *= 16777619u;
+
+    return {path, path_len, variant, hash};
+}
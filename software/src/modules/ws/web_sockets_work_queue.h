@@ -0,0 +1,114 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+#define MAX_WEB_SOCKET_CLIENTS 5
+#define MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE 32
+
+// Items with the same key replace each other. Different variants of the same path,
+// for example for clients with and without a subprotocol, have different keys.
+// The hash only speeds up the comparison.
+struct WebSocketsWorkKey {
+    const char *path;
+    size_t path_len;
+    uint8_t variant;
+    uint32_t hash;
+
+    static WebSocketsWorkKey for_path(const char *path, size_t path_len, uint8_t variant);
+};
+
+struct ws_work_item {
+    int fds[MAX_WEB_SOCKET_CLIENTS]; // -1 if the payload was sent to the client or doesn't have to be.
+    char *payload;
+    size_t payload_len;
+    uint8_t ws_type;                 // httpd_ws_type_t
+    char *key_path;                  // Copy of the key's path. nullptr if the item must not be replaced.
+    size_t key_path_len;
+    uint8_t key_variant;
+    uint32_t key_hash;
+    uint32_t seq;
+    bool in_flight;
+};
+
+void clear_ws_work_item(ws_work_item *wi);
+
+// Payloads waiting to be sent to the web socket clients. Each item remembers which
+// clients still need it, so that a slow client only holds back its own items.
+// A newer item with the same key replaces a queued one that is not being sent,
+// so a client that falls behind gets the latest value of a state instead of every
+// value in between. Not thread-safe, the caller has to lock.
+class WebSocketsWorkQueue
+{
+public:
+    enum class PushResult {
+        Queued,
+        Replaced,
+        Full,
+    };
+
+    WebSocketsWorkQueue() = default;
+    WebSocketsWorkQueue(const WebSocketsWorkQueue &other) = delete;
+    WebSocketsWorkQueue &operator=(const WebSocketsWorkQueue &other) = delete;
+    ~WebSocketsWorkQueue();
+
+    // Takes ownership of the payload unless the queue is full. The item keeps a copy of the key's path.
+    // A replaced item is moved to the end of the queue: Items queued after the old
+    // one, for example patches of the same state, must not overtake the new one.
+    // If replace_queued is not set, the item only gets the key, so that a later item can replace it. Used for patches.
+    // Items without a key (nullptr) are never replaced.
+    PushResult push(const int fds[MAX_WEB_SOCKET_CLIENTS], char *payload, size_t payload_len, uint8_t ws_type, const WebSocketsWorkKey *key = nullptr, bool replace_queued = true);
+
+    // True if push would replace a queued item with this key. A patch can't replace
+    // another item, because it only holds the changes since the previous one: Then the
+    // full state, which holds both, has to be pushed instead. The worker can finish
+    // an item in flight after this returned false, so patches are pushed without
+    // replace_queued.
+    bool can_replace(const WebSocketsWorkKey *key) const;
+
+    // Copies the oldest item queued after the item with sequence number after_seq
+    // and marks it as in flight: It won't be replaced or freed until finish is called.
+    // Pass 0 to start at the front of the queue.
+    bool begin_next(uint32_t after_seq, ws_work_item *item);
+
+    // done_slots has one bit per index into the item's fds that is done.
+    // Frees the item if no client needs it anymore.
+    void finish(uint32_t seq, uint32_t done_slots);
+
+    void remove_fd(int fd);
+    void clear();
+
+    size_t size() const { return items.size(); }
+    bool empty() const { return items.empty(); }
+
+    uint32_t get_replaced() const { return replaced; }
+    uint32_t get_dropped() const { return dropped; }
+
+private:
+    void clean_up();
+
+    std::deque<ws_work_item> items; // Sorted by seq.
+    uint32_t next_seq = 1;
+    uint32_t replaced = 0;
+    uint32_t dropped = 0;
+};
@@ -24,6 +24,7 @@
 #include "event_log_prefix.h"
 #include "module_dependencies.h"
 #include "cool_string.h"
+#include "config/json_cache.h"
 
 static const char *prefix = "{\"topic\":\"";
 static const char *infix = "\",\"payload\":";
@@ -32,6 +33,12 @@ static size_t prefix_len = strlen(prefix);
 static size_t infix_len = strlen(infix);
 static size_t suffix_len = strlen(suffix);
 
+// Clients that negotiate this subprotocol receive state updates as
+// {"topic":"...","patch":[["/json/pointer",value],...]} if that is shorter.
+#define WS_PATCH_SUBPROTOCOL "state-patch"
+static const char *patch_infix = "\",\"patch\":";
+static size_t patch_infix_len = strlen(patch_infix);
+
 // Also change mqtt.cpp MQTT_RECV_BUFFER_SIZE when changing WS_SEND_BUFFER_SIZE here!
 #if defined(BOARD_HAS_PSRAM)
 #define WS_SEND_BUFFER_SIZE 10240U
@@ -41,7 +48,7 @@ static size_t suffix_len = strlen(suffix);
 
 void WS::pre_setup()
 {
-    api.registerBackend(this);
+    backend_idx = api.registerBackend(this);
     web_sockets.pre_setup();
 }
 
@@ -78,7 +85,7 @@ void WS::register_urls()
                     auto &reg = api.states[i];
                     auto path = reg.path;
                     auto path_len = reg.path_len;
-                    auto config_len = reg.config->string_length();
+                    auto config_len = reg.string_length();
                     int req = prefix_len + path_len + infix_len + config_len + suffix_len + 1; // +1 for the second \n
 
                     if (sb.getRemainingLength() < req) {
@@ -95,7 +102,7 @@ void WS::register_urls()
                     sb.puts(path, path_len);
                     sb.puts(infix, infix_len);
 
-                    reg.config->to_string_except(reg.keys_to_censor, reg.keys_to_censor_len, &sb);
+                    reg.to_string_except(reg.keys_to_censor, reg.keys_to_censor_len, &sb);
 
                     sb.puts(suffix, suffix_len);
                 }
@@ -122,13 +129,15 @@ void WS::register_urls()
         }
     });
 
-    web_sockets.start("/ws", "info/ws", server.httpd);
+    web_sockets.start("/ws", "info/ws", server.httpd, WS_PATCH_SUBPROTOCOL);
 
     task_scheduler.scheduleWithFixedDelay([this](){
+        static const WebSocketsWorkKey key = WebSocketsWorkKey::for_path("info/keep_alive", strlen("info/keep_alive"), 0);
+
         char *payload;
         int len = asprintf(&payload, "{\"topic\":\"info/keep_alive\",\"payload\":{\"uptime\":%lu}}\n", millis());
         if (len > 0)
-            web_sockets.sendToAllOwned(payload, len);
+            web_sockets.sendToAllOwned(payload, len, HTTPD_WS_TYPE_TEXT, WebSocketsClientFilter::All, &key);
     }, 1_s, 1_s);
 }
 
@@ -151,22 +160,99 @@ bool WS::pushStateUpdate(size_t stateIdx, const String &payload, const String &p
         return true;
     }
 
+    if (web_sockets.haveActiveClient(WebSocketsClientFilter::WithSubprotocol)) {
+        StringBuilder sb;
+
+        if (buildStatePatch(&sb, stateIdx, payload.length(), path)) {
+            bool success = true;
+
+            if (web_sockets.haveActiveClient(WebSocketsClientFilter::WithoutSubprotocol)) {
+                success = pushFullStateUpdate(payload, path, WebSocketsClientFilter::WithoutSubprotocol, true);
+            }
+
+            // Patches and full states for clients with the subprotocol share one key per path.
+            // A patch can't replace a queued patch or full state, so the full state replaces it instead.
+            WebSocketsWorkKey key = WebSocketsWorkKey::for_path(path.c_str(), path.length(), static_cast<uint8_t>(WebSocketsClientFilter::WithSubprotocol));
+
+            if (web_sockets.canReplaceQueued(&key)) {
+                return pushFullStateUpdate(payload, path, WebSocketsClientFilter::WithSubprotocol, true) && success;
+            }
+
+            size_t len = sb.getLength();
+            char *buf = sb.take().release();
+
+            // If any send fails, the updated flags are kept and the patch is sent again.
+            // This is fine because patches only replace values.
+            return web_sockets.sendToAllOwned(buf, len, HTTPD_WS_TYPE_TEXT, WebSocketsClientFilter::WithSubprotocol, &key, false) && success;
+        }
+    }
+
+    return pushFullStateUpdate(payload, path, WebSocketsClientFilter::All, true);
+}
+
+// returns true on success
+bool WS::pushRawStateUpdate(const String &payload, const String &path)
+{
+    if (!web_sockets.haveActiveClient()) {
+        return true;
+    }
+
+    // Raw state updates have no updated flags to build a patch from.
+    // They can't replace each other either: Some, like event log messages, are a stream.
+    return pushFullStateUpdate(payload, path, WebSocketsClientFilter::All, false);
+}
+
+// returns true on success
+bool WS::pushFullStateUpdate(const String &payload, const String &path, WebSocketsClientFilter filter, bool replace_queued)
+{
     StringBuilder sb;
     size_t payload_len = payload.length();
 
-    if (!pushStateUpdateBegin(&sb, stateIdx, payload_len, path.c_str(), path.length())) {
+    if (!pushStateUpdateBegin(&sb, 0, payload_len, path.c_str(), path.length())) {
         return false;
     }
 
     sb.puts(payload.c_str(), payload_len);
+    sb.puts(suffix, suffix_len);
+
+    size_t len = sb.getLength();
+    char *buf = sb.take().release();
+
+    // A full state update makes a queued one of the same path obsolete. For clients with the subprotocol,
+    // it also makes queued patches obsolete: They share the key. See pushStateUpdate.
+    WebSocketsWorkKey key = WebSocketsWorkKey::for_path(path.c_str(), path.length(), static_cast<uint8_t>(filter));
 
-    return pushStateUpdateEnd(&sb);
+    return web_sockets.sendToAllOwned(buf, len, HTTPD_WS_TYPE_TEXT, filter, replace_queued ? &key : nullptr);
 }
 
-// returns true on success
-bool WS::pushRawStateUpdate(const String &payload, const String &path)
+// returns true if the patch is shorter than the full state update
+bool WS::buildStatePatch(StringBuilder *sb, size_t stateIdx, size_t payload_len, const String &path)
 {
-    return pushStateUpdate(0, payload, path);
+    const auto &reg = api.states[stateIdx];
+    size_t path_len = path.length();
+
+    // Raw states have no Config tree to diff: Send them as a whole.
+    if (reg.raw_state != nullptr) {
+        return false;
+    }
+
+    // A patch that is not shorter than the payload is of no use.
+    if (!sb->setCapacity(prefix_len + path_len + infix_len + payload_len + suffix_len)) {
+        return false;
+    }
+
+    sb->puts(prefix, prefix_len);
+    sb->puts(path.c_str(), path_len);
+    sb->puts(patch_infix, patch_infix_len);
+
+    // Our updated flag covers all changes since the last successful push to the web sockets.
+    if (!config_to_json_patch(reg.config, 1 << backend_idx, reg.keys_to_censor, reg.keys_to_censor_len, sb)) {
+        return false;
+    }
+
+    sb->puts(suffix, suffix_len);
+
+    return sb->getRemainingLength() > 0;
 }
 
 // returns true if it is okay to call pushStateUpdateEnd
@@ -49,4 +49,10 @@ public:
     bool pushRawStateUpdateEnd(StringBuilder *sb);
 
     WebSockets web_sockets;
+
+private:
+    bool pushFullStateUpdate(const String &payload, const String &path, WebSocketsClientFilter filter, bool replace_queued);
+    bool buildStatePatch(StringBuilder *sb, size_t stateIdx, size_t payload_len, const String &path);
+
+    size_t backend_idx = 0;
 };
@@ -0,0 +1,104 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "web_assets.h"
+
+#include <string.h>
+#include <strings.h>
+
+const WebAsset *find_web_asset(const WebAsset *assets, size_t count, const char *uri)
+{
+    const char *query = strchr(uri, '?');
+    size_t uri_len = query == nullptr ? strlen(uri) : static_cast<size_t>(query - uri);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (strlen(assets[i].path) == uri_len && memcmp(assets[i].path, uri, uri_len) == 0)
+            return &assets[i];
+    }
+
+    return nullptr;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Parses the q parameter in "gzip;q=0.5". Only has to tell if it is zero.
+static bool q_is_zero(const char *params, const char *end)
+{
+    while (params < end) {
+        const char *param_end = static_cast<const char *>(memchr(params, ';', static_cast<size_t>(end - params)));
+        if (param_end == nullptr)
+            param_end = end;
+
+        while (params < param_end && is_space(*params))
+            ++params;
+
+        if (param_end - params >= 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=') {
+            for (const char *c = params + 2; c < param_end && !is_space(*c); ++c) {
+                if (*c != '0' && *c != '.')
+                    return false;
+            }
+
+            return true;
+        }
+
+        params = param_end + 1;
+    }
+
+    return false;
+}
+
+// An explicitly listed coding wins over "*". Codings that are not listed are not acceptable.
+bool accepts_content_coding(const char *accept_encoding, const char *coding)
+{
+    size_t coding_len = strlen(coding);
+    int wildcard = -1;
+
+    const char *element = accept_encoding;
+    const char *header_end = accept_encoding + strlen(accept_encoding);
+
+    while (element < header_end) {
+        const char *element_end = strchr(element, ',');
+        if (element_end == nullptr)
+            element_end = header_end;
+
+        while (element < element_end && is_space(*element))
+            ++element;
+
+        const char *token_end = element;
+        while (token_end < element_end && *token_end != ';' && !is_space(*token_end))
+            ++token_end;
+
+        size_t token_len = static_cast<size_t>(token_end - element);
+        const char *params = static_cast<const char *>(memchr(token_end, ';', static_cast<size_t>(element_end - token_end)));
+        bool acceptable = params == nullptr || !q_is_zero(params + 1, element_end);
+
+        if (token_len == coding_len && strncasecmp(element, coding, coding_len) == 0)
+            return acceptable;
+
+        if (token_len == 1 && *element == '*')
+            wildcard = acceptable ? 1 : 0;
+
+        element = element_end + 1;
+    }
+
+    return wildcard == 1;
+}
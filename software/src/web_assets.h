@@ -0,0 +1,39 @@
+/* esp32-firmware
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// One file of the web interface, embedded by pio_hooks.py into web_assets.embedded.cpp.
+struct WebAsset {
+    const char *path;
+    const char *content_type;
+    const char *gzip_data;
+    size_t gzip_length;
+    const char *brotli_data; // nullptr if no Brotli compressor was available when building.
+    size_t brotli_length;
+    bool immutable;          // The path contains a hash of the content.
+};
+
+// Ignores a query string in uri. Returns nullptr if there is no asset with that path.
+const WebAsset *find_web_asset(const WebAsset *assets, size_t count, const char *uri);
+
+// Whether an Accept-Encoding header value allows the content coding, for example "br".
+bool accepts_content_coding(const char *accept_encoding, const char *coding);
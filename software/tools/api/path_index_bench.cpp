@@ -0,0 +1,181 @@
+// Registers the states, commands and responses of a firmware with seven
+// meters, checks that the path index finds every registered path with its
+// kind and index and rejects unknown paths, then measures the lookup that
+// custom_uri_match, getState and callCommand do for each request:
+// Scanning the three registration vectors as before against the index.
+//
+// Usage: path_index_bench [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "api_path_index.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct Registration {
+    std::string path;
+    APIPathKind kind;
+    size_t idx;
+};
+
+struct Registrations {
+    std::vector<std::string> states;
+    std::vector<std::string> commands;
+    std::vector<std::string> responses;
+    std::vector<Registration> all;
+
+    void add(const std::string &path, APIPathKind kind)
+    {
+        std::vector<std::string> &v = kind == APIPathKind::State ? states : kind == APIPathKind::Command ? commands : responses;
+        v.push_back(path);
+        all.push_back({path, kind, v.size() - 1});
+    }
+
+    // Same as API::addPersistentConfig
+    void add_persistent_config(const std::string &path)
+    {
+        add(path + "_modified", APIPathKind::State);
+        add(path, APIPathKind::State);
+        add(path + "_update", APIPathKind::Command);
+        add(path + "_reset", APIPathKind::Command);
+    }
+};
+
+static Registrations make_registrations()
+{
+    static const char *const modules[] = {
+        "ethernet", "wifi", "network", "mqtt", "ntp", "time", "rtc", "users", "info", "event_log",
+        "firmware_update", "system", "remote_access", "automation", "charge_manager", "charge_limits",
+        "charge_tracker", "cron", "debug", "evse", "front_panel", "modbus_tcp", "nfc", "ocpp",
+        "power_manager", "proxy", "require_meter", "solar_forecast", "day_ahead_prices", "heating",
+        "em_common", "em_v2", "energy_manager", "meters_legacy_api", "meters_sun_spec", "coredump",
+    };
+
+    Registrations r;
+
+    for (const char *module : modules) {
+        std::string m = module;
+        r.add_persistent_config(m + "/config");
+        r.add(m + "/state", APIPathKind::State);
+        r.add(m + "/low_level_state", APIPathKind::State);
+        r.add(m + "/reset", APIPathKind::Command);
+    }
+
+    for (int meter = 0; meter < 7; ++meter) {
+        std::string m = "meters/" + std::to_string(meter);
+        r.add_persistent_config(m + "/config");
+        r.add(m + "/state", APIPathKind::State);
+        r.add(m + "/value_ids", APIPathKind::State);
+        r.add(m + "/values", APIPathKind::State);
+        r.add(m + "/errors", APIPathKind::State);
+        r.add(m + "/reset", APIPathKind::Command);
+        r.add(m + "/last_reset", APIPathKind::State);
+    }
+
+    for (int charger = 0; charger < 32; ++charger)
+        r.add("charge_manager/chargers/" + std::to_string(charger) + "/state", APIPathKind::State);
+
+    r.add("charge_tracker/pdf", APIPathKind::Response);
+    r.add("charge_tracker/charge_log", APIPathKind::Response);
+    r.add("event_log/log", APIPathKind::Response);
+    r.add("debug/report", APIPathKind::Response);
+
+    return r;
+}
+
+// custom_uri_match before the index: Commands, then states, then responses.
+static APIPathLookup scan(const Registrations &r, const char *path, size_t path_len)
+{
+    for (size_t i = 0; i < r.commands.size(); i++)
+        if (r.commands[i].size() == path_len && memcmp(r.commands[i].data(), path, path_len) == 0)
+            return {APIPathKind::Command, i};
+
+    for (size_t i = 0; i < r.states.size(); i++)
+        if (r.states[i].size() == path_len && memcmp(r.states[i].data(), path, path_len) == 0)
+            return {APIPathKind::State, i};
+
+    for (size_t i = 0; i < r.responses.size(); i++)
+        if (r.responses[i].size() == path_len && memcmp(r.responses[i].data(), path, path_len) == 0)
+            return {APIPathKind::Response, i};
+
+    return {APIPathKind::None, 0};
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    Registrations r = make_registrations();
+    APIPathIndex<> index;
+
+    for (const Registration &reg : r.all)
+        index.add(reg.path.data(), reg.path.size(), reg.kind, reg.idx);
+
+    // Same as API::pathMatches
+    auto find = [&r, &index](const std::string &path) {
+        return index.find(path.data(), path.size(), [&r, &path](APIPathKind kind, size_t idx) {
+            const std::string &reg_path = kind == APIPathKind::State ? r.states[idx] : kind == APIPathKind::Command ? r.commands[idx] : r.responses[idx];
+            return reg_path == path;
+        });
+    };
+
+    CHECK(index.size() == r.all.size(), "Index has %zu entries, expected %zu", index.size(), r.all.size());
+
+    for (const Registration &reg : r.all) {
+        APIPathLookup lookup = find(reg.path);
+        CHECK(lookup.kind == reg.kind && lookup.idx == reg.idx, "%s: Found kind %u index %zu, expected kind %u index %zu",
+              reg.path.c_str(), static_cast<unsigned>(lookup.kind), lookup.idx, static_cast<unsigned>(reg.kind), reg.idx);
+
+        // Prefixes and extensions of registered paths are not registered unless they are in the list themselves.
+        for (const std::string &other : {reg.path.substr(0, reg.path.size() - 1), reg.path + "x", reg.path + "/"}) {
+            APIPathLookup expected = scan(r, other.data(), other.size());
+            APIPathLookup other_lookup = find(other);
+            CHECK(other_lookup.kind == expected.kind && other_lookup.idx == expected.idx, "%s: Found kind %u, expected kind %u",
+                  other.c_str(), static_cast<unsigned>(other_lookup.kind), static_cast<unsigned>(expected.kind));
+        }
+    }
+
+    CHECK(find("").kind == APIPathKind::None, "Empty path found");
+    CHECK(index.find(nullptr, 0, [](APIPathKind, size_t) {return true;}).kind == APIPathKind::None, "Null path found");
+
+    // A forced hash match must not be reported if the path differs.
+    CHECK(index.find("meters/0/values", 15, [](APIPathKind, size_t) {return false;}).kind == APIPathKind::None, "Hash match without path match reported");
+
+    // Every registered path once as in a web interface reload, and as many URIs that are not API paths.
+    std::vector<std::string> requests;
+    for (const Registration &reg : r.all) {
+        requests.push_back(reg.path);
+        requests.push_back("assets/" + reg.path + ".js");
+    }
+
+    volatile size_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        for (const std::string &path : requests)
+            sink = sink + static_cast<size_t>(scan(r, path.data(), path.size()).kind);
+    auto scan_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        for (const std::string &path : requests)
+            sink = sink + static_cast<size_t>(find(path).kind);
+    auto index_time = std::chrono::steady_clock::now() - start;
+
+    auto ns = [iterations, &requests](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::nano>(d).count() / iterations / static_cast<double>(requests.size());
+    };
+
+    printf("%zu states, %zu commands, %zu responses; half of the lookups are not API paths\n", r.states.size(), r.commands.size(), r.responses.size());
+    printf("scan:  %8.1f ns per lookup\n", ns(scan_time));
+    printf("index: %8.1f ns per lookup\n", ns(index_time));
+
+    return host_test_result();
+}
@@ -0,0 +1,107 @@
+// Stands in for config.h, which needs ArduinoJson: Just enough of Config
+// to build automation_rules.cpp on the host. Objects look up their members
+// by name, like ConfObject does without resolved keys, unions hold a tag
+// and one value, and arrays hold their items.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct String : public std::string {
+    using std::string::string;
+
+    bool isEmpty() const {return empty();}
+};
+
+class Config
+{
+public:
+    static Config Int(int32_t value)
+    {
+        Config conf;
+        conf.type = Type::Int;
+        conf.value = value;
+        return conf;
+    }
+
+    static Config Object(std::vector<std::pair<const char *, Config>> members)
+    {
+        Config conf;
+        conf.type = Type::Object;
+        for (auto &member : members) {
+            conf.keys.push_back(member.first);
+            conf.children.push_back(std::move(member.second));
+        }
+        return conf;
+    }
+
+    static Config Array(std::vector<Config> items)
+    {
+        Config conf;
+        conf.type = Type::Array;
+        conf.children = std::move(items);
+        return conf;
+    }
+
+    template<typename T>
+    static Config Union(T tag, Config value)
+    {
+        Config conf;
+        conf.type = Type::Union;
+        conf.value = static_cast<int32_t>(tag);
+        conf.children.push_back(std::move(value));
+        return conf;
+    }
+
+    // for ConfUnion
+    Config *get() {return &children[0];}
+    const Config *get() const {return &children[0];}
+
+    // for ConfObject
+    Config *get(const char *key) {return const_cast<Config *>(static_cast<const Config *>(this)->get(key));}
+    const Config *get(const char *key) const
+    {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (strcmp(keys[i], key) == 0)
+                return &children[i];
+        }
+        return nullptr;
+    }
+
+    // for ConfArray
+    Config *get(size_t idx) {return &children[idx];}
+    const Config *get(size_t idx) const {return &children[idx];}
+    size_t count() const {return children.size();}
+
+    template<typename T>
+    T getTag() const {return static_cast<T>(value);}
+
+    int32_t asInt() const {return value;}
+    bool is_null() const {return type == Type::Null;}
+
+private:
+    enum class Type {Null, Int, Object, Array, Union};
+
+    Type type = Type::Null;
+    int32_t value = 0;
+    std::vector<const char *> keys;
+    std::vector<Config> children;
+};
+
+class ConfigRoot : public Config
+{
+public:
+    ConfigRoot() = default;
+    ConfigRoot(Config conf) : Config(std::move(conf)) {}
+};
+
+template<typename T>
+struct ConfUnionPrototype {
+    T tag;
+    Config config;
+};
@@ -0,0 +1,264 @@
+// Checks CronMatcher against the cron logic that Automation::has_triggered
+// used before, for every trigger setting on every day of 2024 and 2025.
+// Then loads random tasks into Automation and checks that
+// Automation::trigger runs the same actions in the same order as the
+// previous scan over all tasks, for every trigger at every minute of a day.
+// Reports the time per trigger for both.
+//
+// automation_rules.cpp and cron_matcher.cpp are the firmware's. Config is
+// a stand-in that looks up object members by name like ConfObject does,
+// because the real one needs ArduinoJson.
+//
+// Usage: dispatch_test [--iterations N] [--rules N]
+// Exits with 1 if a check fails.
+
+#include "automation.h"
+#include "cron_matcher.h"
+#include "fake_automation.h"
+#include "module_dependencies.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static bool legacy_is_last_day(struct tm time)
+{
+    const int mon = time.tm_mon;
+    time_t next_day = mktime(&time) + 86400;
+    time = *localtime(&next_day);
+    return time.tm_mon != mon;
+}
+
+static bool legacy_cron(int32_t mday, int32_t wday, int32_t hour, int32_t minute, tm *time_struct)
+{
+    bool triggered = false;
+
+    if (wday == -1) {
+        triggered |= mday == time_struct->tm_mday || mday == -1 || mday == 0;
+        triggered |= mday == 32 && legacy_is_last_day(*time_struct);
+    } else if (wday > 7) {
+        triggered |= wday == 8 && time_struct->tm_wday > 0 && time_struct->tm_wday < 6;
+        triggered |= wday == 9 && (time_struct->tm_wday == 0 || time_struct->tm_wday >= 6);
+    } else {
+        triggered |= (wday % 7) == time_struct->tm_wday;
+    }
+
+    triggered = (hour == time_struct->tm_hour || hour == -1) && triggered;
+    triggered = (minute == time_struct->tm_min || minute == -1) && triggered;
+    return triggered;
+}
+
+static void check_cron()
+{
+    static const int32_t hours[] = {-1, 0, 13, 23};
+    static const int32_t minutes[] = {-1, 0, 30, 59};
+    static const int times[][2] = {{0, 0}, {13, 30}, {23, 59}, {7, 1}};
+
+    tm start = {};
+    start.tm_year = 124;
+    start.tm_mday = 1;
+    start.tm_hour = 12;
+    time_t day = mktime(&start);
+    size_t checked = 0;
+
+    for (int d = 0; d < 731; ++d, day += 86400) {
+        tm date;
+        localtime_r(&day, &date);
+
+        for (const auto &t : times) {
+            tm time_struct = date;
+            time_struct.tm_hour = t[0];
+            time_struct.tm_min = t[1];
+
+            for (int32_t mday = -1; mday <= 32; ++mday) {
+                for (int32_t wday = -1; wday <= 9; ++wday) {
+                    for (int32_t hour : hours) {
+                        for (int32_t minute : minutes) {
+                            bool expected = legacy_cron(mday, wday, hour, minute, &time_struct);
+                            bool actual = CronMatcher::compile(mday, wday, hour, minute).matches(&time_struct);
+                            CHECK(expected == actual, "mday %d wday %d hour %d minute %d at %04d-%02d-%02d %02d:%02d: expected %d, got %d",
+                                  mday, wday, hour, minute, time_struct.tm_year + 1900, time_struct.tm_mon + 1, time_struct.tm_mday,
+                                  time_struct.tm_hour, time_struct.tm_min, expected, actual);
+                            ++checked;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("checked %zu cron settings and times\n", checked);
+}
+
+// The previous Automation::has_triggered for cron triggers.
+class LegacyCronBackend : public IAutomationBackend
+{
+public:
+    bool has_triggered(const Config *conf, void *data) override
+    {
+        if (conf->getTag<AutomationTriggerID>() != AutomationTriggerID::Cron)
+            return false;
+
+        const Config *cfg = static_cast<const Config *>(conf->get());
+        return legacy_cron(cfg->get("mday")->asInt(), cfg->get("wday")->asInt(), cfg->get("hour")->asInt(), cfg->get("minute")->asInt(), static_cast<tm *>(data));
+    }
+};
+
+// Stands in for backends that compare against live state: Every rule of the trigger fires.
+class AnyBackend : public IAutomationBackend
+{
+public:
+    bool has_triggered(const Config *conf, void *data) override
+    {
+        (void)conf;
+        (void)data;
+        return true;
+    }
+};
+
+// The previous Automation::trigger: Scans all tasks and looks up the trigger and action of each.
+static bool legacy_trigger(Config *tasks, std::map<AutomationActionID, Automation::ActionCb> &action_map, AutomationTriggerID number, void *data, IAutomationBackend *backend)
+{
+    bool triggered = false;
+    int current_rule = 1;
+    size_t task_count = tasks->count();
+    for (size_t i = 0; i < task_count; ++i) {
+        Config *conf = tasks->get(i);
+        Config *trigger = static_cast<Config *>(conf->get("trigger"));
+        if (trigger->getTag<AutomationTriggerID>() == number && backend->has_triggered(trigger, data)) {
+            triggered = true;
+            logger.printfln("Running rule #%d", current_rule);
+            const Config *action = static_cast<const Config *>(conf->get("action"));
+            AutomationActionID action_ident = action->getTag<AutomationActionID>();
+            if (action_ident != AutomationActionID::None && action_map.find(action_ident) != action_map.end()) {
+                action_map[action_ident](static_cast<const Config *>(action->get()));
+            } else {
+                logger.printfln("There is no action with ID %u!", (uint8_t)action_ident);
+            }
+        }
+        current_rule++;
+    }
+    return triggered;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100000;
+    int rule_count = AUTOMATION_MAX_TASKS;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}, {"rules", &rule_count}}))
+        return 2;
+
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+
+    check_cron();
+
+    // Rules spread over all triggers, with mostly cron rules like a typical config.
+    // Each action config holds the task index, so that the checks see which tasks ran.
+    std::mt19937 rng{1};
+    std::vector<Config> tasks;
+
+    for (size_t i = 0; i < static_cast<size_t>(rule_count); ++i) {
+        AutomationTriggerID trigger_id = i % 4 == 0 ? static_cast<AutomationTriggerID>(2 + rng() % (AUTOMATION_TRIGGER_ID_COUNT - 2)) : AutomationTriggerID::Cron;
+        AutomationActionID action_id = static_cast<AutomationActionID>(1 + rng() % (AUTOMATION_ACTION_ID_COUNT - 1));
+        int32_t mday = rng() % 2 == 0 ? -1 : static_cast<int32_t>(rng() % 33);
+        int32_t wday = mday != -1 ? -1 : static_cast<int32_t>(rng() % 11) - 1;
+        int32_t hour = rng() % 4 == 0 ? -1 : static_cast<int32_t>(rng() % 24);
+        int32_t minute = static_cast<int32_t>(rng() % 60);
+
+        Config trigger = trigger_id == AutomationTriggerID::Cron
+            ? Config::Union(trigger_id, Config::Object({{"mday", Config::Int(mday)}, {"wday", Config::Int(wday)}, {"hour", Config::Int(hour)}, {"minute", Config::Int(minute)}}))
+            : Config::Union(trigger_id, Config::Object({}));
+
+        tasks.push_back(Config::Object({
+            {"trigger", trigger},
+            {"action", Config::Union(action_id, Config::Object({{"task", Config::Int(static_cast<int32_t>(i))}}))},
+        }));
+    }
+
+    Config legacy_tasks = Config::Array(tasks);
+    host_automation_tasks = Config::Array(tasks);
+
+    // One action ID is not registered, like an action of a module that is not compiled in.
+    std::vector<int32_t> ran;
+    std::map<AutomationActionID, Automation::ActionCb> legacy_action_map;
+    Automation automation;
+
+    for (uint8_t id = 1; id < AUTOMATION_ACTION_ID_COUNT - 1; ++id) {
+        legacy_action_map[static_cast<AutomationActionID>(id)] = [&ran](const Config *cfg) { ran.push_back(cfg->get("task")->asInt()); };
+        automation.register_action(static_cast<AutomationActionID>(id), Config::Object({}), [&ran](const Config *cfg) { ran.push_back(cfg->get("task")->asInt()); });
+    }
+
+    automation.setup();
+
+    LegacyCronBackend legacy_cron_backend;
+    AnyBackend any_backend;
+
+    // Every minute of June 2025 for every trigger. The benchmark uses the minutes of the last day.
+    std::vector<tm> minutes;
+    for (int mday = 1; mday <= 30; ++mday) {
+        tm day = {};
+        day.tm_year = 125;
+        day.tm_mon = 5;
+        day.tm_mday = mday;
+        mktime(&day);
+
+        minutes.clear();
+        for (int m = 0; m < 24 * 60; ++m) {
+            tm time_struct = day;
+            time_struct.tm_hour = m / 60;
+            time_struct.tm_min = m % 60;
+            minutes.push_back(time_struct);
+        }
+
+        for (tm &time_struct : minutes) {
+            for (uint8_t id = 1; id < AUTOMATION_TRIGGER_ID_COUNT; ++id) {
+                AutomationTriggerID trigger_id = static_cast<AutomationTriggerID>(id);
+                bool is_cron = trigger_id == AutomationTriggerID::Cron;
+
+                ran.clear();
+                bool expected = legacy_trigger(&legacy_tasks, legacy_action_map, trigger_id, &time_struct, is_cron ? static_cast<IAutomationBackend *>(&legacy_cron_backend) : &any_backend);
+                std::vector<int32_t> expected_ran = ran;
+
+                ran.clear();
+                bool actual = automation.trigger(trigger_id, &time_struct, is_cron ? static_cast<IAutomationBackend *>(&automation) : &any_backend);
+
+                CHECK(expected == actual && expected_ran == ran, "trigger %u on %02d-%02d %02d:%02d: scan ran %zu actions (%d), Automation::trigger ran %zu (%d)",
+                      id, time_struct.tm_mon + 1, time_struct.tm_mday, time_struct.tm_hour, time_struct.tm_min, expected_ran.size(), expected, ran.size(), actual);
+            }
+        }
+    }
+
+    size_t cron_rules = automation.get_configured_triggers(AutomationTriggerID::Cron).size();
+
+    size_t dispatches = static_cast<size_t>(iterations) * 2;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        tm *time_struct = &minutes[static_cast<size_t>(i) % minutes.size()];
+        ran.clear();
+        legacy_trigger(&legacy_tasks, legacy_action_map, AutomationTriggerID::Cron, time_struct, &legacy_cron_backend);
+        legacy_trigger(&legacy_tasks, legacy_action_map, static_cast<AutomationTriggerID>(2 + i % (AUTOMATION_TRIGGER_ID_COUNT - 2)), time_struct, &any_backend);
+    }
+    auto scan_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        tm *time_struct = &minutes[static_cast<size_t>(i) % minutes.size()];
+        ran.clear();
+        automation.trigger(AutomationTriggerID::Cron, time_struct, &automation);
+        automation.trigger(static_cast<AutomationTriggerID>(2 + i % (AUTOMATION_TRIGGER_ID_COUNT - 2)), time_struct, &any_backend);
+    }
+    auto index_time = std::chrono::steady_clock::now() - start;
+
+    printf("%zu rules, %zu cron rules\n", tasks.size(), cron_rules);
+    printf("scan over all tasks: %8.3f us per trigger\n", std::chrono::duration<double, std::micro>(scan_time).count() / static_cast<double>(dispatches));
+    printf("Automation::trigger: %8.3f us per trigger\n", std::chrono::duration<double, std::micro>(index_time).count() / static_cast<double>(dispatches));
+
+    return host_test_result();
+}
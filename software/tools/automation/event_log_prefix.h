@@ -0,0 +1,3 @@
+// Stands in for event_log_prefix.h: The host logger has no module prefix.
+
+#pragma once
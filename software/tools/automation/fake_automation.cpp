@@ -0,0 +1,34 @@
+// Stands in for automation.cpp, which needs the API, the task scheduler and
+// the RTC. Only the parts that dispatch_test needs to set up the rules.
+
+#include "automation.h"
+#include "fake_automation.h"
+
+Config host_automation_tasks;
+
+Automation::Automation() {}
+
+void Automation::pre_setup() {}
+
+void Automation::setup()
+{
+    config = ConfigRoot{Config::Object({{"tasks", host_automation_tasks}})};
+    config_in_use = config;
+    build_rule_index();
+
+    initialized = true;
+}
+
+void Automation::register_urls() {}
+
+void Automation::register_action(AutomationActionID id, Config cfg, ActionCb &&callback, ValidatorCb &&validator, bool enable)
+{
+    (void)cfg;
+    action_map[id] = ActionValue{std::move(callback), std::move(validator), enable};
+}
+
+void Automation::register_trigger(AutomationTriggerID id, Config cfg, ValidatorCb &&validator, bool enable)
+{
+    (void)cfg;
+    trigger_map[id] = TriggerValue{std::move(validator), enable};
+}
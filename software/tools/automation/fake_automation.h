@@ -0,0 +1,7 @@
+// Host-only: Automation::setup() loads these tasks instead of the persistent config.
+
+#pragma once
+
+#include "config.h"
+
+extern Config host_automation_tasks;
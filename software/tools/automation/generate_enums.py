@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+# Writes the .enum.h and .enum.cpp files of a module into a build directory,
+# like pio_hooks.py does before a firmware build.
+#
+# Usage: generate_enums.py MODULE_DIR OUTPUT_DIR
+
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..'))
+
+import util
+
+
+def main():
+    mod_path, out_path = sys.argv[1:3]
+    os.makedirs(out_path, exist_ok=True)
+
+    for name in sorted(os.listdir(mod_path)):
+        if not name.endswith('.enum'):
+            continue
+
+        name_parts = name.split('.')
+        enum_name = util.FlavoredName(name_parts[0]).get()
+        enum_values = []
+        enum_cases = []
+        value_number = -1
+        value_count = 0
+
+        with open(os.path.join(mod_path, name), 'r', encoding='utf-8') as f:
+            for line in f.readlines():
+                line = line.strip()
+
+                if len(line) == 0 or line.startswith('#'):
+                    continue
+
+                line_parts = line.split('=', 1)
+                value_name = util.FlavoredName(line_parts[0].strip()).get()
+
+                if len(line_parts) > 1:
+                    value_number = int(line_parts[1].strip())
+                else:
+                    value_number += 1
+
+                value_count += 1
+
+                enum_values.append('    {0} = {1},\n'.format(value_name.camel, value_number))
+                enum_cases.append('    case {0}::{1}: return "{2}";\n'.format(enum_name.camel, value_name.camel, value_name.space))
+
+        with open(os.path.join(out_path, enum_name.under + '.enum.h'), 'w', encoding='utf-8') as f:
+            f.write('#include <stdint.h>\n\n')
+            f.write('#pragma once\n\n')
+            f.write(f'enum class {enum_name.camel} : {name_parts[1]}_t {{\n')
+            f.write(''.join(enum_values))
+            f.write('};\n\n')
+            f.write(f'#define {enum_name.upper}_COUNT {value_count}\n\n')
+            f.write(f'const char *get_{enum_name.under}_name({enum_name.camel} value);\n')
+
+        with open(os.path.join(out_path, enum_name.under + '.enum.cpp'), 'w', encoding='utf-8') as f:
+            f.write(f'#include "{enum_name.under}.enum.h"\n\n')
+            f.write(f'const char *get_{enum_name.under}_name({enum_name.camel} value)\n')
+            f.write('{\n')
+            f.write('    switch (value) {\n')
+            f.write(''.join(enum_cases))
+            f.write('    default: return "Unknown";\n')
+            f.write('    }\n')
+            f.write('}\n')
+
+
+if __name__ == '__main__':
+    main()
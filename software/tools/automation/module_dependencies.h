@@ -0,0 +1,14 @@
+// Stands in for the generated module_dependencies.h of the automation module.
+
+#pragma once
+
+#include <stddef.h>
+
+// Counts the messages instead of printing them, so that the benchmark measures the dispatch.
+struct EventLog {
+    size_t messages = 0;
+
+    void printfln(const char *fmt, ...) {(void)fmt; ++messages;}
+};
+
+inline EventLog logger;
@@ -0,0 +1,5 @@
+#pragma once
+
+// Host-only stand-in for the parts of Arduino.h used by the shared sources.
+
+[[noreturn]] void esp_system_abort(const char *details);
@@ -0,0 +1,459 @@
+// Drives allocate_current with scripted scenarios in simulated time,
+// checks invariants after every allocation and prints latency percentiles
+// of the allocator and of each of its stages.
+//
+// Usage: allocator_sim [--scenario NAME] [--seed N] [--chargers N] [--max-p99-us N] [--digest]
+// Exits with 1 if an invariant is violated or the p99 latency of a whole
+// allocation exceeds --max-p99-us.
+// --chargers overrides the charger count of every scenario.
+// --digest only prints a hash of all allocations of each scenario.
+// Builds of different allocator implementations can be compared with it.
+
+#include "current_allocator_private.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "event_log_prefix.h"
+#include "modules/cm_networking/cm_networking_defs.h"
+#include "tools.h"
+
+#define STAGE_COUNT 9
+
+static std::chrono::steady_clock::time_point stage_start;
+static std::vector<int64_t> stage_ns[STAGE_COUNT];
+
+static size_t charger_count_override = 0;
+static bool print_digest = false;
+
+void current_allocator_stage_hook(int stage)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (stage > 0)
+        stage_ns[stage - 1].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - stage_start).count());
+
+    // Don't count the bookkeeping above.
+    stage_start = std::chrono::steady_clock::now();
+}
+
+struct SimCharger {
+    micros_t plug_in_at;
+    micros_t unplug_at;
+    // Energy the car accepts before it stops charging, in mA * s.
+    float capacity;
+    float charged;
+
+    uint8_t car_phases;
+    bool phase_switch_supported;
+    uint16_t supported_current;
+    PhaseRotation rotation;
+
+    uint8_t charger_state;
+    micros_t state_changed;
+    uint8_t phases_connected;
+    uint32_t uptime;
+    bool stopped_charging;
+};
+
+struct Scenario {
+    const char *name;
+    size_t charger_count;
+    micros_t duration;
+
+    // Phase current limit of the grid connection.
+    int32_t phase_limit;
+    // Peak PV excess current summed over all phases. 0 means no PV excess charging.
+    int32_t pv_peak;
+
+    // Time span in which all vehicles are plugged in.
+    micros_t plug_in_span;
+    // Share of phase-switchable chargers, one-phase cars and chargers with unknown rotation.
+    float phase_switch_share;
+    float one_phase_car_share;
+    float unknown_rotation_share;
+};
+
+static const Scenario scenarios[] = {
+    // name              chargers                 duration  phase    PV      plug-in  switch 1p    unknown rot
+    {"grid_static",      MAX_CONTROLLED_CHARGERS, 4_h,      125000,  0,      1_h,     0.0f,  0.0f, 0.0f},
+    {"plug_in_storm",    MAX_CONTROLLED_CHARGERS, 1_h,       63000,  0,      5_s,     0.0f,  0.3f, 0.1f},
+    {"pv_excess",        8,                       6_h,       63000,  96000,  30_m,    0.75f, 0.2f, 0.0f},
+    {"phase_rotations",  MAX_CONTROLLED_CHARGERS, 3_h,       80000,  0,      20_m,    0.5f,  0.4f, 0.25f},
+};
+
+static const PhaseRotation known_rotations[] = {
+    PhaseRotation::L123,
+    PhaseRotation::L132,
+    PhaseRotation::L231,
+    PhaseRotation::L213,
+    PhaseRotation::L321,
+    PhaseRotation::L312,
+};
+
+static const char *get_charger_name(uint8_t idx)
+{
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "sim%u", idx);
+    return buf;
+}
+
+// Emulates an EVSE and its vehicle for one second and returns the state packet the EVSE would send.
+static void step_charger(SimCharger *sim, const ChargerAllocationState *alloc, micros_t now, cm_state_v1 *v1, cm_state_v2 *v2, cm_state_v3 *v3)
+{
+    bool plugged = now >= sim->plug_in_at && now < sim->unplug_at;
+    uint8_t new_state;
+
+    if (!plugged) {
+        new_state = 0;
+        sim->charged = 0;
+        sim->stopped_charging = false;
+    } else if (alloc->allocated_current == 0 || alloc->allocated_phases == 0 || sim->stopped_charging) {
+        new_state = 1;
+    } else if (sim->charger_state == 1 || sim->charger_state == 0) {
+        // Cars take a moment before they start charging.
+        new_state = 2;
+    } else {
+        new_state = 3;
+    }
+
+    if (new_state != sim->charger_state) {
+        sim->charger_state = new_state;
+        sim->state_changed = now;
+    }
+
+    if (sim->phase_switch_supported && alloc->allocated_phases > 0)
+        sim->phases_connected = std::min(static_cast<uint8_t>(alloc->allocated_phases), sim->car_phases);
+
+    float line_current = 0;
+    if (sim->charger_state == 3) {
+        line_current = alloc->allocated_current / 1000.0f;
+        sim->charged += alloc->allocated_current * sim->phases_connected;
+
+        if (sim->charged >= sim->capacity)
+            sim->stopped_charging = true;
+    }
+
+    ++sim->uptime;
+
+    memset(v1, 0, sizeof(*v1));
+    v1->feature_flags = CM_FEATURE_FLAGS_METER_MASK | (sim->phase_switch_supported ? CM_FEATURE_FLAGS_PHASE_SWITCH_MASK : 0);
+    v1->evse_uptime = sim->uptime;
+    v1->car_stopped_charging = sim->stopped_charging ? 1 : 0;
+    v1->allowed_charging_current = sim->charger_state == 0 ? 0 : alloc->allocated_current;
+    v1->supported_current = plugged ? sim->supported_current : 0;
+    v1->charger_state = sim->charger_state;
+    v1->state_flags = CM_STATE_FLAGS_MANAGED_MASK;
+    for (int i = 0; i < 3; ++i)
+        v1->line_currents[i] = i < sim->phases_connected ? line_current : 0;
+    v1->power_total = line_current * sim->phases_connected * 230;
+    v1->energy_abs = sim->charged / 1000.0f / 3600.0f * 230.0f / 1000.0f;
+
+    v2->time_since_state_change = static_cast<uint32_t>((now - sim->state_changed).millis());
+
+    memset(v3, 0, sizeof(*v3));
+    v3->phases = sim->phases_connected | (sim->phase_switch_supported && sim->charger_state != 3 ? CM_STATE_V3_CAN_PHASE_SWITCH_MASK : 0);
+}
+
+static CurrentLimits get_limits(const Scenario *scenario, micros_t elapsed, std::mt19937 &rng)
+{
+    CurrentLimits limits;
+    int32_t phase = scenario->phase_limit;
+
+    limits.raw = Cost{3 * phase, phase, phase, phase};
+    limits.min = limits.raw;
+    limits.spread = limits.raw;
+    limits.max_pv = limits.raw.pv;
+
+    if (scenario->pv_peak == 0)
+        return limits;
+
+    // Half a sine wave over the scenario with passing clouds.
+    float day = static_cast<float>(static_cast<double>(elapsed) / static_cast<double>(scenario->duration));
+    float clouds = std::uniform_real_distribution<float>{0.4f, 1.0f}(rng);
+    int32_t pv = static_cast<int32_t>(scenario->pv_peak * sinf(day * static_cast<float>(M_PI)) * clouds);
+
+    limits.raw.pv = pv;
+    limits.min.pv = pv * 9 / 10;
+    limits.spread.pv = pv * 4 / 5;
+    limits.max_pv = pv * 11 / 10;
+
+    return limits;
+}
+
+static Cost get_allocation_cost(const ChargerState *charger_state, const ChargerAllocationState *charger_allocation_state, size_t charger_count)
+{
+    Cost cost;
+
+    for (size_t i = 0; i < charger_count; ++i) {
+        auto &alloc = charger_allocation_state[i];
+        if (alloc.allocated_phases == 0)
+            continue;
+
+        cost += get_cost(alloc.allocated_current, static_cast<ChargerPhase>(alloc.allocated_phases), charger_state[i].phase_rotation, 0, static_cast<ChargerPhase>(0));
+    }
+
+    return cost;
+}
+
+// FNV-1a
+static void update_digest(uint64_t *digest, const void *data, size_t len)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < len; ++i) {
+        *digest ^= bytes[i];
+        *digest *= 1099511628211ull;
+    }
+}
+
+static int64_t percentile(std::vector<int64_t> &values, int pct)
+{
+    if (values.empty())
+        return 0;
+
+    size_t idx = (values.size() - 1) * pct / 100;
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+static void print_percentiles(const char *name, std::vector<int64_t> &ns)
+{
+    printf("  %-8s p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f us\n",
+           name,
+           percentile(ns, 50) / 1000.0,
+           percentile(ns, 90) / 1000.0,
+           percentile(ns, 99) / 1000.0,
+           percentile(ns, 100) / 1000.0);
+}
+
+// Returns the number of invariant violations. Stores the p99 latency of whole allocations in p99_ns.
+static size_t run_scenario(const Scenario *scenario, uint32_t seed, int64_t *p99_ns)
+{
+    std::mt19937 rng{seed};
+    std::uniform_real_distribution<float> chance{0.0f, 1.0f};
+
+    const size_t charger_count = charger_count_override != 0 ? charger_count_override : scenario->charger_count;
+    const micros_t start = 1_h;
+
+    CurrentAllocatorConfig cfg {
+        .allocation_interval = 10_s,
+        .global_hysteresis = 3_m,
+        .wakeup_time = 3_m,
+        .plug_in_time = 3_m,
+        .minimum_active_time = 15_m,
+        .allocated_energy_rotation_threshold = 5,
+
+        .minimum_current_3p = 6000,
+        .minimum_current_1p = 6000,
+        .enable_current_factor = 1.5f,
+        .distribution_log = std::unique_ptr<char[]>(new char[DISTRIBUTION_LOG_LEN]()),
+        .distribution_log_len = DISTRIBUTION_LOG_LEN,
+        .charger_count = charger_count,
+        .requested_current_margin = 3000,
+        .requested_current_threshold = 60,
+    };
+
+    std::vector<SimCharger> sims(charger_count);
+    std::vector<ChargerState> charger_state(charger_count);
+    std::vector<ChargerAllocationState> charger_allocation_state(charger_count);
+    std::vector<const char *> hosts(charger_count, "sim");
+    CurrentAllocatorState ca_state;
+
+    for (size_t i = 0; i < charger_count; ++i) {
+        auto &sim = sims[i];
+
+        sim.plug_in_at = start + micros_t{static_cast<int64_t>(chance(rng) * static_cast<double>(scenario->plug_in_span))};
+        sim.unplug_at = sim.plug_in_at + micros_t{static_cast<int64_t>((0.5f + chance(rng)) * static_cast<double>(scenario->duration))};
+        sim.capacity = (0.3f + chance(rng)) * 16000.0f * 3 * 3600.0f;
+        sim.car_phases = chance(rng) < scenario->one_phase_car_share ? 1 : 3;
+        sim.phase_switch_supported = chance(rng) < scenario->phase_switch_share;
+        sim.supported_current = chance(rng) < 0.5f ? 16000 : 32000;
+        sim.phases_connected = sim.car_phases;
+        sim.uptime = static_cast<uint32_t>(i) * 1000;
+
+        if (chance(rng) < scenario->unknown_rotation_share)
+            sim.rotation = PhaseRotation::Unknown;
+        else
+            sim.rotation = known_rotations[rng() % ARRAY_SIZE(known_rotations)];
+
+        charger_state[i].phase_rotation = sim.rotation;
+        charger_state[i].last_phase_switch = -cfg.global_hysteresis;
+    }
+
+    for (auto &ns : stage_ns)
+        ns.clear();
+
+    std::vector<int64_t> total_ns;
+    size_t violations = 0;
+    uint64_t allocated_current_sum = 0;
+    uint64_t digest = 14695981039346656037ull;
+    micros_t next_allocation = start + cfg.allocation_interval;
+
+    for (micros_t now = start; now < start + scenario->duration; now += 1_s) {
+        set_simulated_time(now);
+
+        for (size_t i = 0; i < charger_count; ++i) {
+            cm_state_v1 v1;
+            cm_state_v2 v2;
+            cm_state_v3 v3;
+
+            step_charger(&sims[i], &charger_allocation_state[i], now, &v1, &v2, &v3);
+            update_from_client_packet(static_cast<uint8_t>(i), &v1, &v2, &v3, &cfg, charger_state.data(), charger_allocation_state.data(), hosts.data(), get_charger_name);
+        }
+
+        if (now < next_allocation)
+            continue;
+
+        next_allocation = now + cfg.allocation_interval;
+
+        CurrentLimits limits = get_limits(scenario, now - start, rng);
+        CurrentLimits limits_post_allocation = limits;
+
+        std::vector<int8_t> phases_before(charger_count);
+        std::vector<bool> may_skip_hysteresis(charger_count);
+        for (size_t i = 0; i < charger_count; ++i) {
+            auto &state = charger_state[i];
+
+            phases_before[i] = charger_allocation_state[i].allocated_phases;
+            // Stage 2 activates just plugged in vehicles immediately, stage 9 keeps waking up vehicles that still have current allowed.
+            may_skip_hysteresis[i] = (state.last_plug_in != 0_us && state.wants_to_charge) || state.allowed_current != 0;
+        }
+
+        uint32_t allocated_current = 0;
+
+        auto alloc_start = std::chrono::steady_clock::now();
+        allocate_current(&cfg,
+                         &limits_post_allocation,
+                         false,
+                         charger_state.data(),
+                         hosts.data(),
+                         get_charger_name,
+                         [](uint8_t) {},
+                         &ca_state,
+                         charger_allocation_state.data(),
+                         &allocated_current);
+        total_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - alloc_start).count());
+        allocated_current_sum += allocated_current;
+
+        for (size_t i = 0; i < charger_count; ++i) {
+            const auto &alloc = charger_allocation_state[i];
+
+            update_digest(&digest, &alloc.allocated_current, sizeof(alloc.allocated_current));
+            update_digest(&digest, &alloc.allocated_phases, sizeof(alloc.allocated_phases));
+            update_digest(&digest, &alloc.cp_disconnect, sizeof(alloc.cp_disconnect));
+        }
+
+        int64_t t = static_cast<int64_t>((now - start).millis() / 1000);
+
+        // No phase limit must be exceeded.
+        Cost cost = get_allocation_cost(charger_state.data(), charger_allocation_state.data(), charger_count);
+        for (size_t p = 1; p < 4; ++p) {
+            if (cost[p] > limits.raw[p]) {
+                fprintf(stderr, "%s t=%llds: L%zu allocated %d mA > limit %d mA\n", scenario->name, (long long)t, p, cost[p], limits.raw[p]);
+                ++violations;
+            }
+        }
+
+        for (size_t i = 0; i < charger_count; ++i) {
+            auto &alloc = charger_allocation_state[i];
+
+            // Other chargers must only be switched on if the global hysteresis elapsed.
+            if (phases_before[i] == 0 && alloc.allocated_phases != 0 && !ca_state.global_hysteresis_elapsed && !may_skip_hysteresis[i]) {
+                fprintf(stderr, "%s t=%llds: charger %zu activated before global hysteresis elapsed\n", scenario->name, (long long)t, i);
+                ++violations;
+            }
+
+            if (alloc.allocated_current > charger_state[i].supported_current) {
+                fprintf(stderr, "%s t=%llds: charger %zu allocated %u mA > supported %u mA\n", scenario->name, (long long)t, i, alloc.allocated_current, charger_state[i].supported_current);
+                ++violations;
+            }
+        }
+    }
+
+    *p99_ns = percentile(total_ns, 99);
+
+    if (print_digest) {
+        printf("%s: %zu chargers, %zu allocations, digest %016llx\n", scenario->name, charger_count, total_ns.size(), (unsigned long long)digest);
+        return violations;
+    }
+
+    printf("%s: %zu chargers, %zu allocations, %.1f A allocated on average, %zu invariant violations\n",
+           scenario->name,
+           charger_count,
+           total_ns.size(),
+           total_ns.empty() ? 0.0 : allocated_current_sum / 1000.0 / total_ns.size(),
+           violations);
+    print_percentiles("total", total_ns);
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "stage_%zu", i + 1);
+        print_percentiles(name, stage_ns[i]);
+    }
+
+    return violations;
+}
+
+int main(int argc, char **argv)
+{
+    const char *scenario_name = nullptr;
+    uint32_t seed = 1;
+    int64_t max_p99_us = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+            scenario_name = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--chargers") == 0 && i + 1 < argc) {
+            charger_count_override = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--max-p99-us") == 0 && i + 1 < argc) {
+            max_p99_us = strtoll(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--digest") == 0) {
+            print_digest = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--scenario NAME] [--seed N] [--chargers N] [--max-p99-us N] [--digest]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (charger_count_override > MAX_CONTROLLED_CHARGERS) {
+        fprintf(stderr, "At most %d chargers are supported\n", MAX_CONTROLLED_CHARGERS);
+        return 2;
+    }
+
+    // The allocator logs every decision. Only the results are of interest here.
+    logger.enabled = false;
+
+    bool failed = false;
+    bool found = false;
+
+    for (const auto &scenario : scenarios) {
+        if (scenario_name != nullptr && strcmp(scenario_name, scenario.name) != 0)
+            continue;
+
+        found = true;
+
+        int64_t p99_ns;
+        if (run_scenario(&scenario, seed, &p99_ns) != 0)
+            failed = true;
+
+        if (max_p99_us >= 0 && p99_ns > max_p99_us * 1000) {
+            printf("%s: p99 latency %.2f us exceeds %lld us\n", scenario.name, p99_ns / 1000.0, (long long)max_p99_us);
+            failed = true;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "Unknown scenario %s\n", scenario_name);
+        return 2;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1 @@
+../../src/modules/charge_manager/command_fan_out.h
\ No newline at end of file
@@ -0,0 +1,347 @@
+// Measures how long a new allocation takes to reach the chargers. Sends the
+// commands over UDP loopback sockets, one per charger, like main.cpp sends
+// them to real chargers, in simulated time with a keep-alive tick every
+// 1000 ms / charger count. Compares CommandFanOut with the round-robin it
+// replaced, which sent one command per tick and only advanced on success.
+// Some chargers can't be sent to for a while, like a socket that reports
+// EAGAIN. They are the ones the round-robin reaches first after the
+// allocation. Otherwise a share of the sends fails.
+// Checks that CommandFanOut delivers every new command to chargers that can
+// be reached right after the allocation, retries the others on the next tick
+// and still sends each reachable charger a command at least once per rotation.
+// Reports the worst-case latency in simulated time, separately for blocked
+// chargers, and the wall time of sending one allocation round to all
+// chargers through the loopback.
+//
+// Usage: command_latency [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "current_allocator_private.h"
+#include "command_fan_out.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "modules/cm_networking/cm_networking_defs.h"
+#include "tools.h"
+
+#define SIM_DURATION_US 10000000
+
+static int create_socket()
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0 || bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        perror("socket");
+        exit(2);
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    return sock;
+}
+
+struct Loopback {
+    int manager_sock;
+    std::vector<int> charger_socks;
+    std::vector<sockaddr_in> dest_addrs;
+    uint16_t next_seq_num = 1;
+
+    explicit Loopback(size_t charger_count)
+    {
+        manager_sock = create_socket();
+
+        for (size_t i = 0; i < charger_count; ++i) {
+            int sock = create_socket();
+            sockaddr_in addr;
+            socklen_t addr_len = sizeof(addr);
+            getsockname(sock, reinterpret_cast<sockaddr *>(&addr), &addr_len);
+
+            charger_socks.push_back(sock);
+            dest_addrs.push_back(addr);
+        }
+    }
+
+    ~Loopback()
+    {
+        close(manager_sock);
+        for (int sock : charger_socks)
+            close(sock);
+    }
+
+    // Same as send_manager_update in main.cpp.
+    bool send(size_t idx, const ChargerAllocationState &allocation)
+    {
+        cm_command_packet command_pkt;
+        memset(&command_pkt, 0, sizeof(command_pkt));
+        command_pkt.header.magic = CM_PACKET_MAGIC;
+        command_pkt.header.length = CM_COMMAND_PACKET_LENGTH;
+        command_pkt.header.seq_num = next_seq_num++;
+        command_pkt.header.version = CM_COMMAND_VERSION;
+        command_pkt.v1.allocated_current = allocation.allocated_current;
+        command_pkt.v1.command_flags = static_cast<uint8_t>(allocation.cp_disconnect << CM_COMMAND_FLAGS_CPDISC_BIT_POS);
+        command_pkt.v2.allocated_phases = allocation.allocated_phases;
+
+        ssize_t err = sendto(manager_sock, &command_pkt, sizeof(command_pkt), MSG_DONTWAIT, reinterpret_cast<const sockaddr *>(&dest_addrs[idx]), sizeof(dest_addrs[idx]));
+
+        if (err < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+
+        return true;
+    }
+
+    // Returns the allocated current of the last command the charger received or -1.
+    int32_t receive(size_t idx, int timeout_ms)
+    {
+        int32_t current = -1;
+        pollfd pfd = {charger_socks[idx], POLLIN, 0};
+
+        while (poll(&pfd, 1, current < 0 ? timeout_ms : 0) > 0) {
+            cm_command_packet command_pkt;
+            if (recv(charger_socks[idx], &command_pkt, sizeof(command_pkt), 0) != sizeof(command_pkt))
+                break;
+
+            current = command_pkt.v1.allocated_current;
+        }
+
+        return current;
+    }
+};
+
+struct Scenario {
+    const char *name;
+    size_t charger_count;
+    // Chargers 1..blocked_count report EAGAIN for blocked_for_us after the allocation.
+    size_t blocked_count;
+    int64_t blocked_for_us;
+    // Share of the sends to the other chargers that report EAGAIN.
+    uint32_t drop_percent;
+
+    bool is_blocked(size_t idx) const { return idx >= 1 && idx <= blocked_count; }
+};
+
+struct Result {
+    // Simulated time in us from the allocation until the new command arrived, -1 if it never did.
+    std::vector<int64_t> latency_us;
+    // Longest simulated time in us a charger that isn't blocked didn't receive a command after the allocation.
+    int64_t max_silence_us = 0;
+};
+
+enum class Strategy {RoundRobin, FanOut};
+
+static Result run(const Scenario &scenario, Strategy strategy, uint32_t seed)
+{
+    const size_t charger_count = scenario.charger_count;
+    const int64_t tick_us = 1000000 / static_cast<int64_t>(charger_count);
+    // Between two ticks, like the allocation task that runs independently of the send task.
+    const int64_t allocated_at = 2000000 + tick_us / 2;
+
+    Loopback loopback(charger_count);
+    std::mt19937 rng(seed);
+    int64_t now = 0;
+
+    std::vector<ChargerAllocationState> allocations(charger_count);
+    for (auto &allocation : allocations) {
+        allocation.allocated_current = 6000;
+        allocation.allocated_phases = 3;
+    }
+
+    std::vector<CommandFanOut::SentCommand> sent_commands(charger_count);
+    CommandFanOut fan_out;
+    fan_out.setup(charger_count, sent_commands.data());
+    size_t round_robin_idx = 0;
+
+    auto send = [&](size_t idx, const ChargerAllocationState &allocation) {
+        if (now >= allocated_at) {
+            if (scenario.is_blocked(idx) && now < allocated_at + scenario.blocked_for_us)
+                return false;
+            if (!scenario.is_blocked(idx) && rng() % 100 < scenario.drop_percent)
+                return false;
+        }
+
+        return loopback.send(idx, allocation);
+    };
+
+    Result result;
+    result.latency_us.assign(charger_count, -1);
+    std::vector<int64_t> last_received(charger_count, allocated_at);
+
+    auto receive_all = [&]() {
+        for (size_t i = 0; i < charger_count; ++i) {
+            int32_t current = loopback.receive(i, 0);
+            if (current < 0 || now < allocated_at)
+                continue;
+
+            if (!scenario.is_blocked(i))
+                result.max_silence_us = std::max(result.max_silence_us, now - last_received[i]);
+            last_received[i] = now;
+
+            if (current == 16000 && result.latency_us[i] < 0)
+                result.latency_us[i] = now - allocated_at;
+        }
+    };
+
+    int64_t next_tick = 0;
+    bool allocated = false;
+
+    while (now < allocated_at + SIM_DURATION_US) {
+        if (!allocated && allocated_at <= next_tick) {
+            now = allocated_at;
+            allocated = true;
+
+            for (auto &allocation : allocations)
+                allocation.allocated_current = 16000;
+
+            if (strategy == Strategy::FanOut) {
+                fan_out.queue_changed(allocations.data());
+                fan_out.send_pending(allocations.data(), send);
+            }
+        } else {
+            now = next_tick;
+            next_tick += tick_us;
+
+            if (strategy == Strategy::FanOut) {
+                fan_out.keep_alive(allocations.data(), send);
+            } else {
+                if (round_robin_idx >= charger_count)
+                    round_robin_idx = 0;
+                if (send(round_robin_idx, allocations[round_robin_idx]))
+                    ++round_robin_idx;
+            }
+        }
+
+        receive_all();
+    }
+
+    for (size_t i = 0; i < charger_count; ++i) {
+        if (!scenario.is_blocked(i))
+            result.max_silence_us = std::max(result.max_silence_us, now - last_received[i]);
+    }
+
+    return result;
+}
+
+// Sends one allocation round to every charger and waits until all of them received it, in wall time.
+static double batch_wall_us(size_t charger_count)
+{
+    Loopback loopback(charger_count);
+    std::vector<ChargerAllocationState> allocations(charger_count);
+    std::vector<CommandFanOut::SentCommand> sent_commands(charger_count);
+    CommandFanOut fan_out;
+    fan_out.setup(charger_count, sent_commands.data());
+
+    for (auto &allocation : allocations)
+        allocation.allocated_current = 16000;
+
+    auto start = std::chrono::steady_clock::now();
+
+    fan_out.send_pending(allocations.data(), [&loopback](size_t idx, const ChargerAllocationState &allocation) {return loopback.send(idx, allocation);});
+
+    for (size_t i = 0; i < charger_count; ++i)
+        CHECK(loopback.receive(i, 1000) == 16000, "Loopback: Charger %zu didn't receive the command", i);
+
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double ms(int64_t t_us)
+{
+    return static_cast<double>(t_us) / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 10;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    const Scenario scenarios[] = {
+        {"64 chargers, all reachable",          64, 0, 0,       0},
+        {"64 chargers, one blocked for 3 s",    64, 1, 3000000, 0},
+        {"64 chargers, 10 % of the sends fail", 64, 0, 0,       10},
+        {"32 chargers, 4 blocked for 500 ms",   32, 4, 500000,  0},
+        {"10 chargers, all reachable",          10, 0, 0,       0},
+    };
+
+    printf("Worst-case latency of a new allocation in simulated time, %d runs each\n", iterations);
+
+    for (const Scenario &scenario : scenarios) {
+        const int64_t tick_us = 1000000 / static_cast<int64_t>(scenario.charger_count);
+        // Indexed by strategy and whether the charger is blocked.
+        int64_t worst_us[2][2] = {{0, 0}, {0, 0}};
+        size_t never[2] = {0, 0};
+        int64_t max_silence_us = 0;
+
+        for (int iter = 0; iter < iterations; ++iter) {
+            for (Strategy strategy : {Strategy::RoundRobin, Strategy::FanOut}) {
+                Result result = run(scenario, strategy, static_cast<uint32_t>(iter + 1));
+                size_t s = static_cast<size_t>(strategy);
+
+                for (size_t i = 0; i < scenario.charger_count; ++i) {
+                    int64_t latency_us = result.latency_us[i];
+
+                    if (latency_us < 0) {
+                        ++never[s];
+                        continue;
+                    }
+
+                    size_t blocked = scenario.is_blocked(i) ? 1 : 0;
+                    worst_us[s][blocked] = std::max(worst_us[s][blocked], latency_us);
+
+                    if (strategy != Strategy::FanOut)
+                        continue;
+
+                    if (blocked) {
+                        // Retried on every tick after the block ends.
+                        CHECK(latency_us <= scenario.blocked_for_us + tick_us, "%s: Blocked charger %zu got its command after %.1f ms", scenario.name, i, ms(latency_us));
+                    } else if (scenario.drop_percent == 0) {
+                        CHECK(latency_us == 0, "%s: Charger %zu got its command after %.1f ms", scenario.name, i, ms(latency_us));
+                    }
+                }
+
+                if (strategy == Strategy::FanOut) {
+                    CHECK(never[s] == 0, "%s: %zu chargers never got their command", scenario.name, never[s]);
+                    max_silence_us = std::max(max_silence_us, result.max_silence_us);
+                }
+            }
+        }
+
+        // Chargers that can be reached get a command at least once per rotation, even if another charger is blocked.
+        if (scenario.drop_percent == 0) {
+            CHECK(max_silence_us <= 1000000 + 2 * tick_us, "%s: A charger didn't receive a command for %.1f ms", scenario.name, ms(max_silence_us));
+        }
+
+        printf("  %-36s round-robin %7.1f ms, fan-out %7.1f ms\n", scenario.name, ms(worst_us[0][0]), ms(worst_us[1][0]));
+
+        if (scenario.blocked_count > 0)
+            printf("  %-36s round-robin %7.1f ms, fan-out %7.1f ms\n", "  blocked chargers", ms(worst_us[0][1]), ms(worst_us[1][1]));
+
+        if (never[0] > 0)
+            printf("  %-36s round-robin: %zu commands not delivered within 10 s\n", "", never[0]);
+    }
+
+    printf("Wall time to send one allocation round through the loopback until every charger received it\n");
+    for (size_t charger_count : {size_t{10}, size_t{32}, size_t{64}}) {
+        double best = 1e9;
+        for (int iter = 0; iter < iterations; ++iter)
+            best = std::min(best, batch_wall_us(charger_count));
+
+        printf("  %2zu chargers: %7.1f us\n", charger_count, best);
+    }
+
+    return host_test_result();
+}
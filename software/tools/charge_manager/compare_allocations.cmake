@@ -0,0 +1,22 @@
+# Runs allocator_sim and allocator_sim_reference with several seeds and charger counts
+# and fails if any scenario results in different allocations.
+#
+# Usage: cmake -DSIM=<allocator_sim> -DREFERENCE=<allocator_sim_reference> -P compare_allocations.cmake
+
+foreach(seed 1 2 3)
+    foreach(chargers 0 10 32)
+        set(args --digest --seed ${seed})
+        if(NOT chargers EQUAL 0)
+            list(APPEND args --chargers ${chargers})
+        endif()
+
+        execute_process(COMMAND ${SIM} ${args} OUTPUT_VARIABLE sim_out RESULT_VARIABLE sim_result)
+        execute_process(COMMAND ${REFERENCE} ${args} OUTPUT_VARIABLE reference_out RESULT_VARIABLE reference_result)
+
+        if(NOT sim_result EQUAL reference_result OR NOT sim_out STREQUAL reference_out)
+            message(FATAL_ERROR "Allocations differ for ${args}\nallocator_sim (${sim_result}):\n${sim_out}\nreference (${reference_result}):\n${reference_out}")
+        endif()
+
+        message(STATUS "${args}: identical\n${sim_out}")
+    endforeach()
+endforeach()
@@ -3,11 +3,15 @@
 #include <stddef.h>
 
 struct EventLog {
+    bool enabled = true;
+
     void trace_timestamp();
     void write(const char *buf, size_t len);
     void printfln(const char *fmt, ...);
     void trace_write(const char *buf);
     void tracefln(const char *fmt, ...);
+    void trace_timestamp(size_t trace_buf_idx);
+    size_t tracefln_plain(size_t trace_buf_idx, const char *fmt, ...);
 };
 
 extern EventLog logger;
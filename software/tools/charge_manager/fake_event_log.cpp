@@ -7,14 +7,23 @@
 EventLog logger;
 
 void EventLog::trace_timestamp() {
+    if (!enabled)
+        return;
+
     printf("timestamp\n");
 }
 
 void EventLog::write(const char *buf, size_t len) {
+    if (!enabled)
+        return;
+
     printf("%.*s\n", (int)len, buf);
 }
 
 void EventLog::printfln(const char *fmt, ...) {
+    if (!enabled)
+        return;
+
     va_list args;
     va_start(args, fmt);
     int res = vprintf(fmt, args);
@@ -25,10 +34,16 @@ void EventLog::printfln(const char *fmt, ...) {
 }
 
 void EventLog::trace_write(const char *buf) {
+    if (!enabled)
+        return;
+
     printf("%s\n", buf);
 }
 
 void EventLog::tracefln(const char *fmt, ...) {
+    if (!enabled)
+        return;
+
     va_list args;
     va_start(args, fmt);
     int res = vprintf(fmt, args);
@@ -37,3 +52,20 @@ void EventLog::tracefln(const char *fmt, ...) {
     if (fmt[strlen(fmt) - 1] != '\n')
         putchar('\n');
 }
+
+void EventLog::trace_timestamp(size_t trace_buf_idx) {
+    trace_timestamp();
+}
+
+size_t EventLog::tracefln_plain(size_t trace_buf_idx, const char *fmt, ...) {
+    if (!enabled)
+        return 0;
+
+    va_list args;
+    va_start(args, fmt);
+    int res = vprintf(fmt, args);
+    va_end(args);
+
+    putchar('\n');
+    return res < 0 ? 0 : static_cast<size_t>(res) + 1;
+}
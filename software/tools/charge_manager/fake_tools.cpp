@@ -3,8 +3,11 @@
 #include "stdarg.h"
 #include "stdint.h"
 #include "stdio.h"
+#include "stdlib.h"
 #include "time.h"
 
+#include "Arduino.h"
+
 size_t snprintf_u(char *buf, size_t len, const char *format, ...)
 {
     va_list args;
@@ -25,7 +28,19 @@ bool deadline_elapsed(uint32_t deadline_ms)
     return a_after_b(millis(), deadline_ms);
 }
 
+static bool use_simulated_time = false;
+static micros_t simulated_time = 0_us;
+
+void set_simulated_time(micros_t now)
+{
+    use_simulated_time = true;
+    simulated_time = now;
+}
+
 uint32_t millis() {
+    if (use_simulated_time)
+        return simulated_time.millis();
+
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts );
     return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000L);
@@ -33,6 +48,9 @@ uint32_t millis() {
 
 micros_t now_us()
 {
+    if (use_simulated_time)
+        return simulated_time;
+
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts );
     return (micros_t)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000L);
@@ -42,3 +60,9 @@ bool deadline_elapsed(micros_t deadline_us)
 {
     return deadline_us < now_us();
 }
+
+void esp_system_abort(const char *details)
+{
+    fprintf(stderr, "esp_system_abort: %s\n", details);
+    abort();
+}
@@ -1,4 +1,5 @@
 #include "current_allocator.h"
+#include "command_fan_out.h"
 #include <memory>
 
 #include "tools.h"
@@ -72,21 +73,12 @@ static bool seq_num_invalid(uint16_t received_sn, uint16_t last_seen_sn)
 
 #pragma endregion
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wc99-designator"
-static struct sockaddr_in dest_addrs[] = {
-    {
-        .sin_family = AF_INET,
-        .sin_port = htons(CHARGE_MANAGEMENT_PORT),
-        .sin_addr.s_addr = inet_addr("192.168.1.115")
-    },
-    {
-        .sin_family = AF_INET,
-        .sin_port = htons(CHARGE_MANAGEMENT_PORT),
-        .sin_addr.s_addr = inet_addr("192.168.1.129")
-    }
+static const char *const dest_ips[] = {
+    "192.168.1.115",
+    "192.168.1.129",
 };
-#pragma clang diagnostic pop
+
+static struct sockaddr_in dest_addrs[ARRAY_SIZE(dest_ips)];
 
 static int manager_sock;
 
@@ -95,6 +87,12 @@ static const char *get_charger_name(uint8_t idx) {
 };
 
 static void start_manager() {
+    for (size_t i = 0; i < ARRAY_SIZE(dest_addrs); ++i) {
+        dest_addrs[i].sin_family = AF_INET;
+        dest_addrs[i].sin_port = htons(CHARGE_MANAGEMENT_PORT);
+        dest_addrs[i].sin_addr.s_addr = inet_addr(dest_ips[i]);
+    }
+
     manager_sock = create_socket(CHARGE_MANAGER_PORT, true);
 }
 
@@ -222,15 +220,9 @@ bool send_manager_update(uint8_t client_id, uint16_t allocated_current, bool cp_
 }
 
 
-void send_to_clients(size_t charger_count, ChargerAllocationState *charger_allocation_state) {
-    static int i = 0;
-
-    if (i >= charger_count)
-        i = 0;
-
-    auto &charger_alloc = charger_allocation_state[i];
-    if(send_manager_update(i, charger_alloc.allocated_current, charger_alloc.cp_disconnect, charger_alloc.allocated_phases))
-        ++i;
+static bool send_command(size_t idx, const ChargerAllocationState &allocation)
+{
+    return send_manager_update(static_cast<uint8_t>(idx), allocation.allocated_current, allocation.cp_disconnect, allocation.allocated_phases);
 }
 
 #define CHARGER_COUNT (sizeof(dest_addrs)/sizeof(dest_addrs[0]))
@@ -263,7 +255,6 @@ int main(int argc, char **argv) {
 
     };
 
-    bool seen_all_chargers = true;
     CurrentLimits limits {
         .raw = {96000, 32000, 32000, 32000},
         .min = {96000, 32000, 32000, 32000},
@@ -287,6 +278,10 @@ int main(int argc, char **argv) {
 
     ChargerAllocationState charger_allocation_state[CHARGER_COUNT]{};
 
+    CommandFanOut::SentCommand sent_commands[CHARGER_COUNT]{};
+    CommandFanOut command_fan_out;
+    command_fan_out.setup(CHARGER_COUNT, sent_commands);
+
     uint32_t allocated_current = 0;
 
     uint32_t last_alloc = millis();
@@ -317,7 +312,6 @@ int main(int argc, char **argv) {
         if (deadline_elapsed(last_alloc + 5000)) {
             CurrentLimits limits_post_alloc = limits;
             allocate_current(&cfg,
-                            seen_all_chargers,
                             &limits_post_alloc,
                             cp_disconnect_requested,
                             charger_state,
@@ -328,10 +322,13 @@ int main(int argc, char **argv) {
                             charger_allocation_state,
                             &allocated_current);
             last_alloc = millis();
+
+            command_fan_out.queue_changed(charger_allocation_state);
+            command_fan_out.send_pending(charger_allocation_state, send_command);
         }
 
         if (deadline_elapsed(last_send + 1000 / cfg.charger_count)) {
-            send_to_clients(cfg.charger_count, charger_allocation_state);
+            command_fan_out.keep_alive(charger_allocation_state, send_command);
             last_send = millis();
         }
 
@@ -1,2 +1,2 @@
 #!/bin/sh
-clang++ -g -ldw -- *.cpp
+cmake -S . -B build && cmake --build build -j
@@ -7,3 +7,12 @@
 #define MODULE_EVSE_COMMON_AVAILABLE() 0
 #define MODULE_AUTOMATION_AVAILABLE() 0
 #define MODULE_FIRMWARE_UPDATE_AVAILABLE() 0
+#define MODULE_EM_V1_AVAILABLE() 0
+
+#include <stddef.h>
+
+struct ChargeManager {
+    size_t trace_buffer_index = 0;
+};
+
+inline ChargeManager charge_manager;
@@ -0,0 +1 @@
+../../src/string_builder.cpp
\ No newline at end of file
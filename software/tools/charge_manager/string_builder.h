@@ -0,0 +1 @@
+../../src/string_builder.h
\ No newline at end of file
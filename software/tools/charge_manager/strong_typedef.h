@@ -1 +0,0 @@
-../../src/strong_typedef.h
\ No newline at end of file
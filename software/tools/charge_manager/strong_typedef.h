@@ -0,0 +1,23 @@
+#pragma once
+
+// Host-only stand-in for the strong typedef helper that the firmware gets from tftools.
+
+#define STRONG_INTEGER_TYPEDEF(T, D, ...) \
+    struct D { \
+        T t; \
+        constexpr D() : t(0) {} \
+        constexpr explicit D(T t_) : t(t_) {} \
+        constexpr explicit operator T() const { return t; } \
+        constexpr bool operator==(const D &other) const { return t == other.t; } \
+        constexpr bool operator!=(const D &other) const { return t != other.t; } \
+        constexpr bool operator< (const D &other) const { return t <  other.t; } \
+        constexpr bool operator<=(const D &other) const { return t <= other.t; } \
+        constexpr bool operator> (const D &other) const { return t >  other.t; } \
+        constexpr bool operator>=(const D &other) const { return t >= other.t; } \
+        constexpr D operator+(const D &other) const { return D{static_cast<T>(t + other.t)}; } \
+        constexpr D operator-(const D &other) const { return D{static_cast<T>(t - other.t)}; } \
+        constexpr D operator-() const { return D{static_cast<T>(-t)}; } \
+        D &operator+=(const D &other) { t += other.t; return *this; } \
+        D &operator-=(const D &other) { t -= other.t; return *this; } \
+        __VA_ARGS__ \
+    };
@@ -20,6 +20,14 @@ STRONG_INTEGER_TYPEDEF(int64_t, micros_t,
     explicit operator double () const { return (double)t; }
 )
 
+STRONG_INTEGER_TYPEDEF(int64_t, millis_t,
+    constexpr operator micros_t() const { return micros_t{t * 1000}; }
+)
+
+STRONG_INTEGER_TYPEDEF(int64_t, seconds_t,
+    constexpr operator micros_t() const { return micros_t{t * 1000 * 1000}; }
+)
+
 constexpr micros_t operator""_us  (unsigned long long int i) { return micros_t{(int64_t)i}; }
 constexpr micros_t operator""_ms  (unsigned long long int i) { return micros_t{(int64_t)i * 1000}; }
 constexpr micros_t operator""_s   (unsigned long long int i) { return micros_t{(int64_t)i * 1000 * 1000}; }
@@ -29,4 +37,7 @@ constexpr micros_t operator""_h   (unsigned long long int i) { return micros_t{(
 micros_t now_us();
 bool deadline_elapsed(micros_t deadline_us);
 
+// Host-only: Makes now_us and millis return the given time instead of reading CLOCK_MONOTONIC.
+void set_simulated_time(micros_t now);
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
@@ -0,0 +1,549 @@
+// Writes a full charge record history (30 files with 256 records each,
+// the last one with a started charge) in the on-flash record format,
+// builds a ChargeTrackerIndex from it like ChargeTracker::repair_charges
+// and checks the index against reading the records:
+// - get_totals against summing up every record, also after dropping
+//   the first file, and that dropping files after a time zone change
+//   leaves no totals of months before the remaining files,
+// - the PDF export's search and table with and without skipping files
+//   by the index, for random time ranges and user filters,
+// - is_user_tracked against scanning the user IDs.
+// Then measures both approaches.
+//
+// LittleFS is not available on the host, so the files are written to a
+// temporary directory. The host's page cache makes reading them much
+// cheaper than reading LittleFS on the ESP32; the number of records read
+// per query is the more meaningful measure.
+//
+// Usage: index_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "charge_tracker_index.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <map>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+struct [[gnu::packed]] ChargeStart {
+    uint32_t timestamp_minutes = 0;
+    float meter_start = 0.0f;
+    uint8_t user_id = 0;
+};
+
+struct [[gnu::packed]] ChargeEnd {
+    uint32_t charge_duration : 24;
+    float meter_end = 0.0f;
+};
+
+struct [[gnu::packed]] Charge {
+    ChargeStart cs;
+    ChargeEnd ce;
+};
+
+static_assert(sizeof(Charge) == 16, "Unexpected size of Charge");
+
+#define CHARGE_RECORD_SIZE sizeof(Charge)
+#define CHARGE_RECORD_FILE_COUNT 30
+#define CHARGE_RECORD_MAX_FILE_SIZE 4096
+#define RECORDS_PER_FILE (CHARGE_RECORD_MAX_FILE_SIZE / CHARGE_RECORD_SIZE)
+#define MAX_ACTIVE_USERS 16
+#define USER_FILTER_ALL_USERS -2
+#define USER_FILTER_DELETED_USERS -1
+
+// Files don't start at 1 after old ones were dropped.
+#define FIRST_FILE 12u
+#define LAST_FILE (FIRST_FILE + CHARGE_RECORD_FILE_COUNT - 1)
+
+static std::string record_dir;
+
+static std::string record_filename(uint32_t file)
+{
+    return record_dir + "/charge-record-" + std::to_string(file) + ".bin";
+}
+
+static bool charged_invalid(const ChargeStart &cs, const ChargeEnd &ce)
+{
+    return isnan(cs.meter_start) || isnan(ce.meter_end) || ce.meter_end < cs.meter_start;
+}
+
+static float charged_energy(const ChargeStart &cs, const ChargeEnd &ce)
+{
+    return charged_invalid(cs, ce) ? NAN : ce.meter_end - cs.meter_start;
+}
+
+// About 10 charges per day by 40 users, with some unknown start times, clock jumps and broken meter values.
+static void write_history(std::mt19937 &rng)
+{
+    uint32_t timestamp_min = 27900000; // 2023-01-16
+    float meter = 1000.0f;
+
+    std::uniform_int_distribution<uint32_t> gap(10, 280);
+    std::uniform_int_distribution<uint32_t> duration(600, 6 * 3600);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::geometric_distribution<int> user(0.1);
+
+    for (uint32_t file = FIRST_FILE; file <= LAST_FILE; ++file) {
+        FILE *f = fopen(record_filename(file).c_str(), "wb");
+        size_t records = file == LAST_FILE ? 200 : RECORDS_PER_FILE;
+
+        for (size_t i = 0; i <= records; ++i) {
+            timestamp_min += gap(rng);
+
+            Charge c = {};
+            c.cs.timestamp_minutes = timestamp_min;
+            c.cs.user_id = static_cast<uint8_t>(std::min(user(rng), 39));
+            c.cs.meter_start = meter;
+            meter += static_cast<float>(percent(rng)) / 5.0f;
+            c.ce.meter_end = meter;
+            c.ce.charge_duration = duration(rng) & 0xFFFFFF;
+
+            int p = percent(rng);
+            if (p == 0)
+                c.cs.timestamp_minutes = 0; // Charge started before the clock was set.
+            else if (p == 1)
+                c.cs.timestamp_minutes -= 3 * 24 * 60; // Wrong clock.
+            else if (p < 5)
+                c.ce.meter_end = NAN;
+
+            if (i == records) {
+                // A started charge at the end of the last file.
+                if (file == LAST_FILE)
+                    fwrite(&c.cs, sizeof(c.cs), 1, f);
+                break;
+            }
+
+            fwrite(&c, sizeof(c), 1, f);
+        }
+
+        fclose(f);
+    }
+}
+
+static std::vector<Charge> read_file(uint32_t file)
+{
+    std::vector<Charge> charges(RECORDS_PER_FILE + 1);
+
+    FILE *f = fopen(record_filename(file).c_str(), "rb");
+    size_t read = fread(charges.data(), 1, sizeof(Charge) * charges.size(), f);
+    fclose(f);
+
+    charges.resize(read / sizeof(Charge) + (read % sizeof(Charge) >= sizeof(ChargeStart) ? 1 : 0));
+    return charges;
+}
+
+static size_t complete_records(uint32_t file)
+{
+    FILE *f = fopen(record_filename(file).c_str(), "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+
+    return static_cast<size_t>(size) / CHARGE_RECORD_SIZE;
+}
+
+static void build_index(ChargeTrackerIndex *index)
+{
+    index->clear();
+
+    for (uint32_t file = FIRST_FILE; file <= LAST_FILE; ++file) {
+        index->add_file(file);
+
+        std::vector<Charge> charges = read_file(file);
+        size_t complete = complete_records(file);
+
+        for (size_t i = 0; i < charges.size(); ++i) {
+            const Charge &c = charges[i];
+
+            if (i < complete)
+                index->add_record(file, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+            else
+                index->add_start(file, c.cs.timestamp_minutes, c.cs.user_id);
+        }
+    }
+}
+
+// Sums up all records like the index does, but from the files.
+static std::vector<ChargeTrackerAggregate> scan_totals(uint32_t first_file)
+{
+    std::map<std::pair<uint16_t, uint8_t>, ChargeTrackerAggregate> totals;
+
+    for (uint32_t file = first_file; file <= LAST_FILE; ++file) {
+        FILE *f = fopen(record_filename(file).c_str(), "rb");
+        Charge c;
+
+        while (fread(&c, sizeof(c), 1, f) == 1) {
+            uint16_t month = ChargeTrackerIndex::month_of(c.cs.timestamp_minutes);
+            ChargeTrackerAggregate &total = totals[{month, c.cs.user_id}];
+            total.month = month;
+            total.user_id = c.cs.user_id;
+            ++total.charges;
+            total.duration_s += c.ce.charge_duration;
+
+            float energy = charged_energy(c.cs, c.ce);
+            if (isnan(energy))
+                ++total.charges_without_meter;
+            else
+                total.energy_kwh += energy;
+        }
+
+        fclose(f);
+    }
+
+    std::vector<ChargeTrackerAggregate> result;
+    for (const auto &total : totals)
+        result.push_back(total.second);
+
+    return result;
+}
+
+static bool scan_user_tracked(uint8_t user_id)
+{
+    for (uint32_t file = FIRST_FILE; file <= LAST_FILE; ++file) {
+        for (const Charge &c : read_file(file)) {
+            if (c.cs.user_id == user_id)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+struct Query {
+    uint32_t start_timestamp_min;
+    uint32_t end_timestamp_min;
+    int user_filter;
+    uint8_t configured_users[MAX_ACTIVE_USERS];
+};
+
+struct QueryResult {
+    int charge_records = 0;
+    int first_file = -1;
+    int first_charge = -1;
+    int last_file = -1;
+    int last_charge = -1;
+    double charged_sum = 0;
+    bool seen_charges_without_meter = false;
+    std::vector<std::pair<uint32_t, int>> lines;
+    size_t records_read = 0;
+};
+
+static bool include_user(const Query &q, uint8_t user_id)
+{
+    if (q.user_filter == USER_FILTER_ALL_USERS)
+        return true;
+
+    if (q.user_filter == USER_FILTER_DELETED_USERS) {
+        for (uint8_t configured : q.configured_users) {
+            if (configured == user_id)
+                return false;
+        }
+
+        return true;
+    }
+
+    return user_id == q.user_filter;
+}
+
+// The search and table generation of the PDF export. Without an index, every file is read.
+static QueryResult run_query(const Query &q, const ChargeTrackerIndex *index)
+{
+    QueryResult r;
+
+    uint32_t user_mask[8] = {};
+    if (q.user_filter == USER_FILTER_ALL_USERS) {
+        memset(user_mask, 0xFF, sizeof(user_mask));
+    } else if (q.user_filter == USER_FILTER_DELETED_USERS) {
+        memset(user_mask, 0xFF, sizeof(user_mask));
+        for (uint8_t configured : q.configured_users)
+            user_mask[configured / 32] &= ~(1u << (configured % 32));
+    } else {
+        user_mask[q.user_filter / 32] = 1u << (q.user_filter % 32);
+    }
+
+    uint32_t search_first_file = FIRST_FILE;
+    uint32_t search_last_file = LAST_FILE;
+    if (index != nullptr)
+        index->get_file_range(q.start_timestamp_min, q.end_timestamp_min, &search_first_file, &search_last_file);
+
+    for (uint32_t file = search_first_file; file <= search_last_file; ++file) {
+        if (index != nullptr && file != search_first_file && file != search_last_file && !index->get_file(file)->has_any_user(user_mask))
+            continue;
+
+        FILE *f = fopen(record_filename(file).c_str(), "rb");
+        Charge c;
+
+        for (int j = 0; j < static_cast<int>(RECORDS_PER_FILE); ++j) {
+            if (fread(&c, sizeof(c), 1, f) != 1) {
+                fclose(f);
+                goto search_done;
+            }
+            ++r.records_read;
+
+            if (c.cs.timestamp_minutes != 0 && q.start_timestamp_min != 0 && c.cs.timestamp_minutes < q.start_timestamp_min) {
+                r.charge_records = 0;
+                r.first_file = -1;
+                r.first_charge = -1;
+                r.charged_sum = 0;
+                continue;
+            }
+
+            if (c.cs.timestamp_minutes != 0 && q.end_timestamp_min != 0 && c.cs.timestamp_minutes > q.end_timestamp_min) {
+                r.last_file = static_cast<int>(file);
+                r.last_charge = j;
+                fclose(f);
+                goto search_done;
+            }
+
+            if (!include_user(q, c.cs.user_id))
+                continue;
+
+            if (r.first_file == -1)
+                r.first_file = static_cast<int>(file);
+
+            if (r.first_charge == -1)
+                r.first_charge = j;
+
+            r.last_file = static_cast<int>(file);
+            r.last_charge = j;
+            ++r.charge_records;
+
+            if (charged_invalid(c.cs, c.ce))
+                r.seen_charges_without_meter = true;
+            else
+                r.charged_sum += c.ce.meter_end - c.cs.meter_start;
+        }
+
+        fclose(f);
+    }
+search_done:
+
+    if (r.charge_records == 0)
+        return r;
+
+    int last_file = r.last_file >= 0 ? r.last_file : static_cast<int>(LAST_FILE);
+
+    for (int file = r.first_file; file <= last_file; ++file) {
+        if (index != nullptr && !index->get_file(static_cast<uint32_t>(file))->has_any_user(user_mask))
+            continue;
+
+        FILE *f = fopen(record_filename(static_cast<uint32_t>(file)).c_str(), "rb");
+        int j = file == r.first_file ? r.first_charge : 0;
+        fseek(f, static_cast<long>(CHARGE_RECORD_SIZE) * j, SEEK_SET);
+
+        Charge c;
+        for (; j < static_cast<int>(RECORDS_PER_FILE); ++j) {
+            if (file == last_file && j > r.last_charge)
+                break;
+            if (fread(&c, sizeof(c), 1, f) != 1)
+                break;
+            ++r.records_read;
+
+            if (include_user(q, c.cs.user_id))
+                r.lines.emplace_back(file, j);
+        }
+
+        fclose(f);
+    }
+
+    return r;
+}
+
+static void check_query(const Query &q, const QueryResult &scan, const QueryResult &indexed)
+{
+    // The search doesn't reset the last charge when it drops the charges found so far.
+    // Without included charges, the PDF export doesn't use the positions.
+    if (scan.charge_records == 0) {
+        CHECK(indexed.charge_records == 0 && indexed.lines.empty(), "Query %u-%u user %d: No charges, but %d charges with index",
+              q.start_timestamp_min, q.end_timestamp_min, q.user_filter, indexed.charge_records);
+        return;
+    }
+
+    CHECK(scan.charge_records == indexed.charge_records && scan.first_file == indexed.first_file && scan.first_charge == indexed.first_charge
+          && scan.last_file == indexed.last_file && scan.last_charge == indexed.last_charge && scan.charged_sum == indexed.charged_sum
+          && scan.seen_charges_without_meter == indexed.seen_charges_without_meter && scan.lines == indexed.lines,
+          "Query %u-%u user %d: %d charges from %d/%d to %d/%d, %zu lines, but %d charges from %d/%d to %d/%d, %zu lines with index",
+          q.start_timestamp_min, q.end_timestamp_min, q.user_filter,
+          scan.charge_records, scan.first_file, scan.first_charge, scan.last_file, scan.last_charge, scan.lines.size(),
+          indexed.charge_records, indexed.first_file, indexed.first_charge, indexed.last_file, indexed.last_charge, indexed.lines.size());
+}
+
+static void check_totals(const char *name, const std::vector<ChargeTrackerAggregate> &totals, const std::vector<ChargeTrackerAggregate> &scanned_totals)
+{
+    CHECK(totals.size() == scanned_totals.size(), "%s: Index has %zu totals, scan has %zu", name, totals.size(), scanned_totals.size());
+
+    for (size_t i = 0; i < std::min(totals.size(), scanned_totals.size()); ++i) {
+        const ChargeTrackerAggregate &a = totals[i];
+        const ChargeTrackerAggregate &b = scanned_totals[i];
+        CHECK(a.month == b.month && a.user_id == b.user_id && a.charges == b.charges && a.charges_without_meter == b.charges_without_meter
+              && a.duration_s == b.duration_s && fabs(a.energy_kwh - b.energy_kwh) <= 1e-9 * fabs(b.energy_kwh),
+              "%s: Total %zu differs: month %u user %u charges %u/%u duration %u energy %f, scanned month %u user %u charges %u/%u duration %u energy %f", name, i,
+              a.month, a.user_id, a.charges, a.charges_without_meter, a.duration_s, a.energy_kwh,
+              b.month, b.user_id, b.charges, b.charges_without_meter, b.duration_s, b.energy_kwh);
+    }
+}
+
+template<typename F>
+static double time_us(int iterations, F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        f();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+
+    char dir_template[] = "/tmp/charge_tracker_index_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp");
+        return 2;
+    }
+    record_dir = dir_template;
+
+    std::mt19937 rng{1};
+    write_history(rng);
+
+    ChargeTrackerIndex index;
+    build_index(&index);
+
+    CHECK(index.get_files().size() == CHARGE_RECORD_FILE_COUNT, "Index has %zu files", index.get_files().size());
+
+    // Totals
+    check_totals("all files", index.get_totals(), scan_totals(FIRST_FILE));
+
+    // Repairing a record replaces it in the totals.
+    {
+        ChargeTrackerIndex repaired = index;
+        Charge c = read_file(LAST_FILE)[10];
+        repaired.remove_record(LAST_FILE, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+        repaired.add_record(LAST_FILE, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+        check_totals("repaired", repaired.get_totals(), scan_totals(FIRST_FILE));
+    }
+
+    // Dropping the oldest file like ChargeTracker::removeOldRecords.
+    {
+        ChargeTrackerIndex dropped = index;
+        for (const Charge &c : read_file(FIRST_FILE))
+            dropped.remove_record(FIRST_FILE, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+        dropped.remove_first_file();
+
+        CHECK(dropped.get_files().front().file == FIRST_FILE + 1, "First file after dropping is %u", dropped.get_files().front().file);
+        check_totals("dropped first file", dropped.get_totals(), scan_totals(FIRST_FILE + 1));
+    }
+
+    // Dropping files after a time zone change: remove_record misses the aggregates of charges near
+    // the end of a month. Once no remaining file can contain their month, they must be gone.
+    {
+        ChargeTrackerIndex dropped = index;
+
+        setenv("TZ", "UTC-14", 1);
+        tzset();
+
+        for (uint32_t file = FIRST_FILE; file < LAST_FILE; ++file) {
+            for (const Charge &c : read_file(file))
+                dropped.remove_record(file, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+            dropped.remove_first_file();
+        }
+
+        uint16_t oldest_month = ChargeTrackerIndex::month_of(dropped.get_files().front().min_timestamp_min);
+
+        setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+        tzset();
+
+        for (const ChargeTrackerAggregate &total : dropped.get_totals())
+            CHECK(total.month == 0 || total.month + 1 >= oldest_month, "Time zone change: Total of %u/%u for user %u left after dropping its files, oldest record is from %u/%u",
+                  total.month % 12 + 1, total.month / 12, total.user_id, oldest_month % 12 + 1, oldest_month / 12);
+
+        // Without a time zone change nothing is missed, so nothing but stale totals may be pruned.
+        ChargeTrackerIndex same_zone = index;
+        for (uint32_t file = FIRST_FILE; file < LAST_FILE; ++file) {
+            for (const Charge &c : read_file(file))
+                same_zone.remove_record(file, c.cs.timestamp_minutes, c.cs.user_id, c.ce.charge_duration, charged_energy(c.cs, c.ce));
+            same_zone.remove_first_file();
+        }
+        check_totals("dropped all but the last file", same_zone.get_totals(), scan_totals(LAST_FILE));
+    }
+
+    // Users
+    for (int user_id = 0; user_id < 256; ++user_id)
+        CHECK(index.is_user_tracked(static_cast<uint8_t>(user_id)) == scan_user_tracked(static_cast<uint8_t>(user_id)), "is_user_tracked(%d) differs", user_id);
+
+    // Queries: Months, weeks and open ranges, for all, deleted and single users.
+    std::vector<Query> queries;
+    uint32_t first_ts = index.get_files().front().first_timestamp_min;
+    uint32_t last_ts = index.get_files().back().max_timestamp_min;
+    std::uniform_int_distribution<uint32_t> ts(first_ts - 10000, last_ts + 10000);
+    std::uniform_int_distribution<uint32_t> length(0, 3);
+    std::uniform_int_distribution<int> filter(-2, 45);
+
+    for (int i = 0; i < 400; ++i) {
+        Query q = {};
+        uint32_t start = ts(rng);
+        uint32_t lengths[] = {0, 7 * 24 * 60, 31 * 24 * 60, 365 * 24 * 60};
+        uint32_t len = lengths[length(rng)];
+
+        q.start_timestamp_min = i % 7 == 0 ? 0 : start;
+        q.end_timestamp_min = len == 0 ? 0 : start + len;
+        q.user_filter = filter(rng);
+
+        for (size_t u = 0; u < MAX_ACTIVE_USERS; ++u)
+            q.configured_users[u] = static_cast<uint8_t>(u < 10 ? u * 2 : 0);
+
+        queries.push_back(q);
+    }
+
+    size_t scan_records = 0;
+    size_t indexed_records = 0;
+
+    for (const Query &q : queries) {
+        QueryResult scan = run_query(q, nullptr);
+        QueryResult indexed = run_query(q, &index);
+        check_query(q, scan, indexed);
+
+        scan_records += scan.records_read;
+        indexed_records += indexed.records_read;
+    }
+
+    // Throughput
+    volatile size_t sink = 0;
+    int query_iterations = std::max(1, iterations / 10);
+
+    double build_us = time_us(std::max(1, iterations / 10), [&]() { ChargeTrackerIndex i; build_index(&i); sink = sink + i.get_files().size(); });
+    std::vector<ChargeTrackerAggregate> totals;
+    double index_totals_us = time_us(iterations, [&]() { totals = index.get_totals(); sink = sink + totals.size(); });
+    double scan_totals_us = time_us(std::max(1, iterations / 10), [&]() { sink = sink + scan_totals(FIRST_FILE).size(); });
+    double index_queries_us = time_us(query_iterations, [&]() { for (const Query &q : queries) sink = sink + run_query(q, &index).lines.size(); });
+    double scan_queries_us = time_us(query_iterations, [&]() { for (const Query &q : queries) sink = sink + run_query(q, nullptr).lines.size(); });
+
+    size_t index_bytes = sizeof(index) + index.get_files().size() * sizeof(ChargeTrackerFileIndex) + totals.size() * sizeof(ChargeTrackerAggregate);
+
+    printf("index: %zu bytes for %zu files and %zu totals, built in %.1f us\n", index_bytes, index.get_files().size(), totals.size(), build_us);
+    printf("totals from index:   %10.1f us\n", index_totals_us);
+    printf("totals from records: %10.1f us\n", scan_totals_us);
+    printf("queries with index:    %8.1f us per query, %6.1f records read\n", index_queries_us / static_cast<double>(queries.size()), static_cast<double>(indexed_records) / static_cast<double>(queries.size()));
+    printf("queries without index: %8.1f us per query, %6.1f records read\n", scan_queries_us / static_cast<double>(queries.size()), static_cast<double>(scan_records) / static_cast<double>(queries.size()));
+
+    for (uint32_t file = FIRST_FILE; file <= LAST_FILE; ++file)
+        unlink(record_filename(file).c_str());
+    rmdir(record_dir.c_str());
+
+    return host_test_result();
+}
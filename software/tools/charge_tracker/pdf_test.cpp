@@ -0,0 +1,216 @@
+// Generates the charge log PDF for an export of 2000 charges with
+// compressed and with uncompressed content streams and reports
+// output size, peak heap use, time to the first byte and total time.
+// Checks that both PDFs have a valid cross-reference table and that
+// every compressed stream inflates (with zlib) to the uncompressed one.
+//
+// Usage: pdf_test [--records N]
+// Exits with 1 if a check fails.
+
+#include "pdf_charge_log.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+// Heap accounting: Every allocation of the process goes through these.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+// Relative to the start of a measurement, so this goes negative if older allocations are freed.
+static ptrdiff_t heap_used = 0;
+static ptrdiff_t heap_peak = 0;
+
+static void *account(void *ptr)
+{
+    if (ptr != nullptr) {
+        heap_used += static_cast<ptrdiff_t>(malloc_usable_size(ptr));
+        if (heap_used > heap_peak)
+            heap_peak = heap_used;
+    }
+    return ptr;
+}
+
+extern "C" void *malloc(size_t size)
+{
+    return account(__libc_malloc(size));
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    return account(__libc_calloc(count, size));
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (ptr != nullptr)
+        heap_used -= static_cast<ptrdiff_t>(malloc_usable_size(ptr));
+    return account(__libc_realloc(ptr, size));
+}
+
+extern "C" void free(void *ptr)
+{
+    if (ptr != nullptr)
+        heap_used -= static_cast<ptrdiff_t>(malloc_usable_size(ptr));
+    __libc_free(ptr);
+}
+
+struct Result {
+    std::string pdf;
+    size_t writes = 0;
+    size_t peak_heap = 0;
+    double first_byte_ms = 0;
+    double total_ms = 0;
+};
+
+// Table lines as built by tracked_charge_to_string: start time, user, energy, duration, meter start, cost.
+static size_t build_line(char *buf, int i)
+{
+    int day = i / 3;
+    return static_cast<size_t>(snprintf(buf, 128, "%02d.%02d.%04d %02d:%02d%cUser %d%c%d,%03d%c%d:%02d:%02d%c%d,%03d%c%d,%02d",
+                                        day % 28 + 1, day / 28 % 12 + 1, 2023 + day / 336, 7 + i % 3 * 5, i * 7 % 60, '\0',
+                                        i % 7, '\0',
+                                        i % 23, i * 37 % 1000, '\0',
+                                        i % 5, i * 13 % 60, i * 29 % 60, '\0',
+                                        10000 + i * 11, i * 7 % 1000, '\0',
+                                        i % 9, i * 3 % 100)) + 1;
+}
+
+static Result generate(int records, bool compress)
+{
+    Result r;
+
+    std::vector<char> lines(8 * 128);
+    int next_line = 0;
+
+    static const char stats[] = "Wallbox: Test (warp3-AbCd)\0Exportiert am 01.01.2025 12:00\0Exportierte Benutzer: Alle Benutzer\0"
+                                "Exportierter Zeitraum: Aufzeichnungsbeginn bis -ende\0Gesamtenergie exportierter Ladevorgänge:  1234,567 kWh";
+    static const char letterhead[] = "Firma\0Straße 1\012345 Stadt";
+    static const char header[] = "Startzeit\0Benutzer\0geladen (kWh)\0Ladedauer\0Zählerstand Start\0Kosten (€)";
+
+    // Collect the PDF outside of the measurement.
+    r.pdf.reserve(4 * 1024 * 1024);
+
+    heap_used = 0;
+    heap_peak = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    init_pdf_generator([&r, start](const void *buf, size_t len) -> ssize_t {
+                           if (r.writes++ == 0)
+                               r.first_byte_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                           r.pdf.append(static_cast<const char *>(buf), len);
+                           return static_cast<ssize_t>(len);
+                       },
+                       "WARP Ladelog", stats, 5, letterhead, 3, header, static_cast<uint16_t>(records),
+                       [&lines, &next_line, records](const char **table_lines) {
+                           char *head = lines.data();
+                           int generated = 0;
+
+                           for (; generated < 8 && next_line < records; ++generated, ++next_line)
+                               head += build_line(head, next_line);
+
+                           *table_lines = lines.data();
+                           return generated;
+                       },
+                       compress);
+
+    r.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    r.peak_heap = static_cast<size_t>(heap_peak);
+
+    return r;
+}
+
+// Checks that each entry of the cross-reference table points to its object.
+static void check_xref(const char *name, const std::string &pdf)
+{
+    size_t startxref = pdf.rfind("startxref\r\n");
+    CHECK(startxref != std::string::npos, "%s: No startxref", name);
+    if (startxref == std::string::npos)
+        return;
+
+    size_t xref = strtoul(pdf.c_str() + startxref + 11, nullptr, 10);
+    CHECK(pdf.compare(xref, 6, "xref\r\n") == 0, "%s: startxref doesn't point to the xref table", name);
+
+    size_t pos = pdf.find("\r\n", xref + 6) + 2;
+    int count = atoi(pdf.c_str() + xref + 8);
+    pos += 20; // Object 0
+
+    for (int i = 1; i < count; ++i, pos += 20) {
+        size_t offset = strtoul(pdf.c_str() + pos, nullptr, 10);
+        std::string expected = std::to_string(i) + " 0 obj";
+        CHECK(pdf.compare(offset, expected.size(), expected) == 0, "%s: xref entry %d doesn't point to its object", name, i);
+    }
+}
+
+// Returns the content streams, inflated if compressed. Image streams are skipped.
+static std::vector<std::string> content_streams(const char *name, const std::string &pdf)
+{
+    std::vector<std::string> streams;
+    size_t pos = 0;
+
+    while ((pos = pdf.find(">>stream\r\n", pos)) != std::string::npos) {
+        size_t dict = pdf.rfind("<<", pos);
+        std::string dict_str = pdf.substr(dict, pos - dict);
+        size_t length = strtoul(pdf.c_str() + pdf.find("/Length ", dict) + 8, nullptr, 10);
+        pos += 10;
+
+        if (dict_str.find("/XObject") != std::string::npos) {
+            pos += length;
+            continue;
+        }
+
+        std::string data = pdf.substr(pos, length);
+        CHECK(pdf.compare(pos + length, 11, "\r\nendstream") == 0, "%s: Stream length is wrong", name);
+        pos += length;
+
+        if (dict_str.find("/FlateDecode") != std::string::npos) {
+            std::vector<uint8_t> inflated(64 * 1024);
+            uLongf inflated_len = inflated.size();
+            int rc = uncompress(inflated.data(), &inflated_len, reinterpret_cast<const uint8_t *>(data.data()), data.size());
+            CHECK(rc == Z_OK, "%s: Stream doesn't inflate: %d", name, rc);
+            data.assign(reinterpret_cast<const char *>(inflated.data()), inflated_len);
+        }
+
+        streams.push_back(data);
+    }
+
+    return streams;
+}
+
+int main(int argc, char **argv)
+{
+    int records = 2000;
+
+    if (!parse_host_test_args(argc, argv, {{"records", &records}}))
+        return 2;
+
+    Result plain = generate(records, false);
+    Result compressed = generate(records, true);
+
+    check_xref("uncompressed", plain.pdf);
+    check_xref("compressed", compressed.pdf);
+
+    std::vector<std::string> plain_streams = content_streams("uncompressed", plain.pdf);
+    std::vector<std::string> compressed_streams = content_streams("compressed", compressed.pdf);
+    CHECK(plain_streams.size() == compressed_streams.size() && plain_streams == compressed_streams,
+          "Content streams differ: %zu uncompressed, %zu compressed", plain_streams.size(), compressed_streams.size());
+    CHECK(compressed.pdf.size() < plain.pdf.size(), "Compressed PDF isn't smaller");
+
+    printf("%d records, %zu content streams\n", records, plain_streams.size());
+    printf("uncompressed: %8zu bytes, peak heap %6zu bytes, first byte after %6.2f ms, done after %6.2f ms, %zu writes\n",
+           plain.pdf.size(), plain.peak_heap, plain.first_byte_ms, plain.total_ms, plain.writes);
+    printf("compressed:   %8zu bytes, peak heap %6zu bytes, first byte after %6.2f ms, done after %6.2f ms, %zu writes\n",
+           compressed.pdf.size(), compressed.peak_heap, compressed.first_byte_ms, compressed.total_ms, compressed.writes);
+
+    return host_test_result();
+}
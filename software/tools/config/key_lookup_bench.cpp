@@ -0,0 +1,148 @@
+// Times the member lookups of ChargeManager::update_charger_state_config for
+// 64 chargers: With string keys through the address scan that literals hit,
+// through the strlen/memcmp scan that other strings fall back to, and with
+// resolved Config::Keys that only compare the schema and index the values.
+// The schemas have the members of the charger state and low-level state in
+// the same order. Checks that all three find the same members.
+// Only the lookup is timed, not updateUint.
+//
+// Usage: key_lookup_bench [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "config/conf_object_schema.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define CHARGERS 64
+
+struct Slot {
+    const ConfObjectSchema *schema;
+    uint32_t *values;
+};
+
+struct Key {
+    const ConfObjectSchema *schema;
+    uint16_t idx;
+};
+
+static ConfObjectSchema *make_schema(std::initializer_list<const char *> keys)
+{
+    auto schema = static_cast<ConfObjectSchema *>(malloc(sizeof(ConfObjectSchema) + keys.size() * sizeof(ConfObjectSchema::Key)));
+    schema->length = 0;
+
+    for (const char *key : keys)
+        schema->keys[schema->length++] = {strlen(key), key};
+
+    return schema;
+}
+
+static uint32_t *get_by_address(const Slot &slot, const char *needle)
+{
+    size_t i = conf_object_schema_find_address(slot.schema, needle);
+    if (i >= slot.schema->length)
+        abort();
+    return &slot.values[i];
+}
+
+static uint32_t *get_by_name(const Slot &slot, const char *needle)
+{
+    size_t i = conf_object_schema_find_name(slot.schema, needle, strlen(needle));
+    if (i >= slot.schema->length)
+        abort();
+    return &slot.values[i];
+}
+
+static uint32_t *get_by_key(const Slot &slot, const Key &key)
+{
+    if (slot.schema != key.schema)
+        abort();
+    return &slot.values[key.idx];
+}
+
+// The literals are merged with the ones the schemas were built from, like keys in rodata.
+static const char *const state_names[] = {"s", "e", "ac", "ap", "sc", "sp", "lu", "u"};
+static const char *const low_level_state_names[] = {"b", "rc", "ae", "ar", "ls", "lp", "lw", "ip"};
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    const ConfObjectSchema *state_schema = make_schema({"s", "e", "ac", "ap", "sc", "sp", "lu", "n", "u"});
+    const ConfObjectSchema *low_level_state_schema = make_schema({"b", "rc", "ae", "ar", "ls", "lp", "lw", "ip"});
+
+    std::vector<uint32_t> values(CHARGERS * (state_schema->length + low_level_state_schema->length));
+    Slot state[CHARGERS];
+    Slot low_level_state[CHARGERS];
+
+    for (size_t i = 0; i < CHARGERS; ++i) {
+        state[i] = {state_schema, &values[i * (state_schema->length + low_level_state_schema->length)]};
+        low_level_state[i] = {low_level_state_schema, state[i].values + state_schema->length};
+    }
+
+    // Copies that aren't in the schemas, like keys built at runtime.
+    char state_copies[8][4];
+    char low_level_state_copies[8][4];
+    Key state_keys[8];
+    Key low_level_state_keys[8];
+
+    for (size_t k = 0; k < 8; ++k) {
+        strcpy(state_copies[k], state_names[k]);
+        strcpy(low_level_state_copies[k], low_level_state_names[k]);
+        state_keys[k] = {state_schema, static_cast<uint16_t>(conf_object_schema_find_name(state_schema, state_names[k], strlen(state_names[k])))};
+        low_level_state_keys[k] = {low_level_state_schema, static_cast<uint16_t>(conf_object_schema_find_name(low_level_state_schema, low_level_state_names[k], strlen(low_level_state_names[k])))};
+
+        for (size_t i = 0; i < CHARGERS; ++i) {
+            CHECK(get_by_address(state[i], state_names[k]) == get_by_key(state[i], state_keys[k])
+               && get_by_name(state[i], state_copies[k]) == get_by_key(state[i], state_keys[k]),
+                  "Charger %zu: State member %s differs", i, state_names[k]);
+            CHECK(get_by_address(low_level_state[i], low_level_state_names[k]) == get_by_key(low_level_state[i], low_level_state_keys[k])
+               && get_by_name(low_level_state[i], low_level_state_copies[k]) == get_by_key(low_level_state[i], low_level_state_keys[k]),
+                  "Charger %zu: Low-level state member %s differs", i, low_level_state_names[k]);
+        }
+    }
+
+    auto time = [&](auto &&update) {
+        auto start = std::chrono::steady_clock::now();
+        for (int iter = 0; iter < iterations; ++iter) {
+            for (size_t i = 0; i < CHARGERS; ++i) {
+                for (size_t k = 0; k < 8; ++k) {
+                    update(i, k, static_cast<uint32_t>(iter));
+                }
+            }
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+    };
+
+    double address_us = time([&](size_t i, size_t k, uint32_t v) {
+        *get_by_address(state[i], state_names[k]) = v;
+        *get_by_address(low_level_state[i], low_level_state_names[k]) = v;
+    });
+    double name_us = time([&](size_t i, size_t k, uint32_t v) {
+        *get_by_name(state[i], state_copies[k]) = v;
+        *get_by_name(low_level_state[i], low_level_state_copies[k]) = v;
+    });
+    double key_us = time([&](size_t i, size_t k, uint32_t v) {
+        *get_by_key(state[i], state_keys[k]) = v;
+        *get_by_key(low_level_state[i], low_level_state_keys[k]) = v;
+    });
+
+    uint32_t checksum = 0;
+    for (uint32_t v : values)
+        checksum += v;
+    CHECK(iterations == 0 || checksum == static_cast<uint32_t>(iterations - 1) * CHARGERS * 16, "Values not written");
+
+    printf("16 member lookups for each of %d chargers\n", CHARGERS);
+    printf("  literal keys (address scan):   %7.2f us\n", address_us);
+    printf("  other strings (strlen/memcmp): %7.2f us\n", name_us);
+    printf("  resolved keys:                 %7.2f us\n", key_us);
+
+    return host_test_result();
+}
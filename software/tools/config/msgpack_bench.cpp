@@ -0,0 +1,359 @@
+// Encodes the values of seven meters and the charge manager state with 32
+// chargers with the MessagePack writer of the to_msgpack visitor and as
+// compact JSON. Checks that the *_length functions return the number of
+// bytes written and that the output decodes back to the same values, then
+// reports the sizes and encoding times.
+//
+// JSON numbers are printed with printf: Floats with 9 significant digits,
+// like ArduinoJson prints a float widened to double. The JSON times are only
+// a rough stand-in for ArduinoJson's; the sizes are what the API sends.
+//
+// Usage: msgpack_bench [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "config/msgpack_writer.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+[[noreturn]] void esp_system_abort(const char *details)
+{
+    fprintf(stderr, "%s\n", details);
+    abort();
+}
+
+// Just enough of Config to describe the two states.
+struct Value {
+    enum class Type {Uint, Int, Float, Str, Array, Object};
+
+    explicit Value(Type type_) : type(type_) {}
+
+    Type type;
+    uint32_t u = 0;
+    int32_t i = 0;
+    float f = 0;
+    std::string s;
+    std::vector<std::string> keys;
+    std::vector<Value> children;
+};
+
+static Value make_uint(uint32_t u) { Value v(Value::Type::Uint); v.u = u; return v; }
+static Value make_int(int32_t i) { Value v(Value::Type::Int); v.i = i; return v; }
+static Value make_float(float f) { Value v(Value::Type::Float); v.f = f; return v; }
+static Value make_str(const std::string &s) { Value v(Value::Type::Str); v.s = s; return v; }
+
+static Value make_object(std::initializer_list<std::pair<const char *, Value>> members)
+{
+    Value v(Value::Type::Object);
+    for (const auto &m : members) {
+        v.keys.push_back(m.first);
+        v.children.push_back(m.second);
+    }
+    return v;
+}
+
+// meters/N/values: Voltages, currents, powers, energies and a few factors.
+static Value make_meter_values(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    Value v(Value::Type::Array);
+
+    for (size_t i = 0; i < 80; ++i) {
+        float base = i < 6 ? 230.0f : i < 12 ? 16.0f : i < 30 ? 3700.0f : i < 60 ? 123456.789f : 0.95f;
+        v.children.push_back(make_float(base * (1.0f + noise(rng) * 0.05f)));
+    }
+
+    return v;
+}
+
+// Same layout as charge_manager/state.
+static Value make_charge_manager_state(std::mt19937 &rng)
+{
+    Value chargers(Value::Type::Array);
+
+    for (uint32_t i = 0; i < 32; ++i) {
+        chargers.children.push_back(make_object({
+            {"s",  make_uint(static_cast<uint32_t>(rng() % 7))},
+            {"e",  make_uint(0)},
+            {"ac", make_uint(static_cast<uint32_t>(6000 + rng() % 26000))},
+            {"ap", make_uint(static_cast<uint32_t>(1 + rng() % 3))},
+            {"sc", make_uint(32000)},
+            {"sp", make_uint(7)},
+            {"lu", make_uint(static_cast<uint32_t>(rng()))},
+            {"n",  make_str("Wallbox garage " + std::to_string(i))},
+            {"u",  make_uint(static_cast<uint32_t>(rng()))},
+        }));
+    }
+
+    Value l_raw(Value::Type::Array);
+    Value alloc(Value::Type::Array);
+    for (int i = 0; i < 4; ++i) {
+        l_raw.children.push_back(make_int(static_cast<int32_t>(rng() % 64000) - 32000));
+        alloc.children.push_back(make_int(static_cast<int32_t>(rng() % 64000)));
+    }
+
+    return make_object({
+        {"state", make_uint(1)},
+        {"l_raw", l_raw},
+        {"l_max_pv", make_int(-12000)},
+        {"alloc", alloc},
+        {"chargers", chargers},
+    });
+}
+
+// Same branches as to_msgpack.
+static void put_msgpack(const Value &v, StringBuilder *sb)
+{
+    switch (v.type) {
+        case Value::Type::Uint:  msgpack_put_uint(sb, v.u); break;
+        case Value::Type::Int:   msgpack_put_int(sb, v.i); break;
+        case Value::Type::Float: msgpack_put_float(sb, v.f); break;
+        case Value::Type::Str:   msgpack_put_str(sb, v.s.data(), v.s.size()); break;
+        case Value::Type::Array:
+            msgpack_put_header(sb, 0x90, 15, 0xDC, v.children.size());
+            for (const Value &child : v.children)
+                put_msgpack(child, sb);
+            break;
+        case Value::Type::Object:
+            msgpack_put_header(sb, 0x80, 15, 0xDE, v.children.size());
+            for (size_t i = 0; i < v.children.size(); ++i) {
+                msgpack_put_str(sb, v.keys[i].data(), v.keys[i].size());
+                put_msgpack(v.children[i], sb);
+            }
+            break;
+    }
+}
+
+// Same branches as msgpack_length_visitor.
+static size_t msgpack_length(const Value &v)
+{
+    size_t sum = 0;
+
+    switch (v.type) {
+        case Value::Type::Uint:  return msgpack_uint_length(v.u);
+        case Value::Type::Int:   return msgpack_int_length(v.i);
+        case Value::Type::Float: return msgpack_float_length();
+        case Value::Type::Str:   return msgpack_str_length(v.s.size());
+        case Value::Type::Array:
+            sum = msgpack_header_length(15, v.children.size());
+            for (const Value &child : v.children)
+                sum += msgpack_length(child);
+            return sum;
+        case Value::Type::Object:
+            sum = msgpack_header_length(15, v.children.size());
+            for (size_t i = 0; i < v.children.size(); ++i)
+                sum += msgpack_str_length(v.keys[i].size()) + msgpack_length(v.children[i]);
+            return sum;
+    }
+
+    return sum;
+}
+
+static void put_json(const Value &v, StringBuilder *sb)
+{
+    switch (v.type) {
+        case Value::Type::Uint:  sb->printf("%u", v.u); break;
+        case Value::Type::Int:   sb->printf("%d", v.i); break;
+        case Value::Type::Float: sb->printf("%.9g", static_cast<double>(v.f)); break;
+        case Value::Type::Str:   sb->printf("\"%s\"", v.s.c_str()); break;
+        case Value::Type::Array:
+            sb->putc('[');
+            for (size_t i = 0; i < v.children.size(); ++i) {
+                if (i != 0)
+                    sb->putc(',');
+                put_json(v.children[i], sb);
+            }
+            sb->putc(']');
+            break;
+        case Value::Type::Object:
+            sb->putc('{');
+            for (size_t i = 0; i < v.children.size(); ++i) {
+                if (i != 0)
+                    sb->putc(',');
+                sb->printf("\"%s\":", v.keys[i].c_str());
+                put_json(v.children[i], sb);
+            }
+            sb->putc('}');
+            break;
+    }
+}
+
+// Minimal decoder for the types the writer produces.
+struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+
+    uint32_t be(size_t bytes)
+    {
+        uint32_t v = 0;
+        for (size_t i = 0; i < bytes && p < end; ++i)
+            v = (v << 8) | *p++;
+        return v;
+    }
+
+    size_t header(uint8_t fix_type, uint8_t fix_mask, uint8_t type_8, uint8_t type_16)
+    {
+        uint8_t b = *p++;
+        if ((b & ~fix_mask) == fix_type)
+            return b & fix_mask;
+        if (type_8 != 0 && b == type_8)
+            return be(1);
+        if (b == type_16)
+            return be(2);
+        return be(4);
+    }
+
+    bool matches(const Value &v)
+    {
+        if (p >= end)
+            return false;
+
+        uint8_t b = *p;
+
+        switch (v.type) {
+            case Value::Type::Uint:
+            case Value::Type::Int: {
+                ++p;
+                int64_t expected = v.type == Value::Type::Uint ? static_cast<int64_t>(v.u) : v.i;
+                if (b <= 0x7F) return expected == b;
+                if (b >= 0xE0) return expected == static_cast<int8_t>(b);
+                if (b == 0xCC) return expected == be(1);
+                if (b == 0xCD) return expected == be(2);
+                if (b == 0xCE) return expected == be(4);
+                if (b == 0xD0) return expected == static_cast<int8_t>(be(1));
+                if (b == 0xD1) return expected == static_cast<int16_t>(be(2));
+                if (b == 0xD2) return expected == static_cast<int32_t>(be(4));
+                return false;
+            }
+            case Value::Type::Float: {
+                ++p;
+                uint32_t bits = be(4);
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                return b == 0xCA && memcmp(&f, &v.f, sizeof(f)) == 0;
+            }
+            case Value::Type::Str: {
+                size_t len = header(0xA0, 0x1F, 0xD9, 0xDA);
+                bool ok = len == v.s.size() && p + len <= end && memcmp(p, v.s.data(), len) == 0;
+                p += len;
+                return ok;
+            }
+            case Value::Type::Array:
+                if (header(0x90, 0x0F, 0, 0xDC) != v.children.size())
+                    return false;
+                for (const Value &child : v.children)
+                    if (!matches(child))
+                        return false;
+                return true;
+            case Value::Type::Object:
+                if (header(0x80, 0x0F, 0, 0xDE) != v.children.size())
+                    return false;
+                for (size_t i = 0; i < v.children.size(); ++i)
+                    if (!matches(make_str(v.keys[i])) || !matches(v.children[i]))
+                        return false;
+                return true;
+        }
+
+        return false;
+    }
+};
+
+static void check_edge_cases()
+{
+    // Every header size and the boundaries between them.
+    const uint32_t uints[] = {0, 0x7F, 0x80, 0xFF, 0x100, 0xFFFF, 0x10000, 0xFFFFFFFF};
+    const int32_t ints[] = {-1, -32, -33, INT8_MIN, INT8_MIN - 1, INT16_MIN, INT16_MIN - 1, INT32_MIN, INT32_MAX};
+    const size_t str_lengths[] = {0, 31, 32, 0xFF, 0x100, 0xFFFF, 0x10000};
+
+    std::vector<Value> values;
+    for (uint32_t u : uints)
+        values.push_back(make_uint(u));
+    for (int32_t i : ints)
+        values.push_back(make_int(i));
+    for (size_t len : str_lengths)
+        values.push_back(make_str(std::string(len, 'x')));
+
+    Value arr_16(Value::Type::Array);
+    arr_16.children.assign(16, make_uint(1));
+    values.push_back(arr_16);
+
+    Value arr_32(Value::Type::Array);
+    arr_32.children.assign(0x10000, make_uint(1));
+    values.push_back(arr_32);
+
+    for (const Value &v : values) {
+        StringBuilder sb;
+        sb.setCapacity(msgpack_length(v));
+        put_msgpack(v, &sb);
+
+        CHECK(sb.getLength() == msgpack_length(v), "Type %d: Wrote %zu bytes, length function says %zu", static_cast<int>(v.type), sb.getLength(), msgpack_length(v));
+
+        Reader r{reinterpret_cast<const uint8_t *>(sb.getPtr()), reinterpret_cast<const uint8_t *>(sb.getPtr()) + sb.getLength()};
+        CHECK(r.matches(v) && r.p == r.end, "Type %d (u %u, i %d, length %zu): Decoded differently", static_cast<int>(v.type), v.u, v.i, v.s.size() + v.children.size());
+    }
+}
+
+template<typename F>
+static double us_per_encoding(int iterations, F &&encode)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        encode();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 10000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    check_edge_cases();
+
+    std::mt19937 rng(1);
+    const std::pair<const char *, Value> states[] = {
+        {"meters/N/values (80 values)", make_meter_values(rng)},
+        {"charge_manager/state (32 chargers)", make_charge_manager_state(rng)},
+    };
+
+    for (const auto &state : states) {
+        const Value &v = state.second;
+        size_t length = msgpack_length(v);
+
+        StringBuilder msgpack;
+        msgpack.setCapacity(length);
+        put_msgpack(v, &msgpack);
+
+        CHECK(msgpack.getLength() == length, "%s: Wrote %zu bytes, length function says %zu", state.first, msgpack.getLength(), length);
+
+        Reader r{reinterpret_cast<const uint8_t *>(msgpack.getPtr()), reinterpret_cast<const uint8_t *>(msgpack.getPtr()) + msgpack.getLength()};
+        CHECK(r.matches(v) && r.p == r.end, "%s: Decoded differently", state.first);
+
+        StringBuilder json;
+        json.setCapacity(16384);
+        put_json(v, &json);
+
+        double msgpack_us = us_per_encoding(iterations, [&v, length]() {
+            StringBuilder sb;
+            sb.setCapacity(length);
+            put_msgpack(v, &sb);
+        });
+
+        double json_us = us_per_encoding(iterations, [&v]() {
+            StringBuilder sb;
+            sb.setCapacity(16384);
+            put_json(v, &sb);
+        });
+
+        printf("%-36s JSON %5zu bytes %7.2f us, MessagePack %5zu bytes (%3zu %%) %7.2f us\n",
+               state.first, json.getLength(), json_us, msgpack.getLength(), msgpack.getLength() * 100 / json.getLength(), msgpack_us);
+    }
+
+    return host_test_result();
+}
@@ -0,0 +1,273 @@
+// Fills a slot buffer of 60000 slots up to a few free ones and then releases
+// and allocates random slots in turn, like configs that are replaced while
+// the buffer is nearly full. Allocations go through a copy of nextSlot with
+// the free list and with the first-free hint it replaced. Checks that every
+// allocation gets a slot that is empty, that a slot is never handed out twice
+// (also for nested allocations before the outer slot is filled), that the
+// buffer only grows when it is full and that allocations after shrinkToFit
+// reuse the empty slots before the last used one. Counts the slots the hint
+// scans per allocation and reports the time per allocation of both.
+//
+// Usage: slot_free_list_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "config/slot_free_list.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define SLOT_HEADROOM 20
+#define SLOTS 60000
+#define FREE_SLOTS 16
+
+// A slot buffer like uint_buf: A slot is empty if its value is 0.
+struct Buffer {
+    std::vector<uint32_t> slots;
+    uint32_t reallocations = 0;
+    uint64_t scanned = 0;
+
+    bool slot_empty(size_t i) const { return slots[i] == 0; }
+
+    size_t grow()
+    {
+        size_t result = slots.size();
+        slots.resize(slots.size() + std::max(static_cast<size_t>(SLOT_HEADROOM), slots.size() / 4), 0);
+        ++reallocations;
+        return result;
+    }
+};
+
+// nextSlot and releaseSlot with the free list.
+struct FreeListAllocator {
+    Buffer buf;
+    SlotFreeList free_list;
+
+    size_t next_slot()
+    {
+        size_t result = free_list.take(buf.slots.size());
+        if (result < buf.slots.size())
+            return result;
+
+        return buf.grow();
+    }
+
+    void release_slot(size_t idx)
+    {
+        free_list.release(idx);
+    }
+
+    // The end of shrinkToFit.
+    void shrink()
+    {
+        size_t last_used_slot = buf.slots.size() - 1;
+        while (last_used_slot > 0 && buf.slot_empty(last_used_slot))
+            --last_used_slot;
+
+        size_t empty_slots = 0;
+        for (size_t i = 0; i < last_used_slot; ++i) {
+            if (buf.slot_empty(i))
+                ++empty_slots;
+        }
+
+        size_t new_size = last_used_slot + 1 + (empty_slots < SLOT_HEADROOM ? SLOT_HEADROOM - empty_slots : 0);
+        if (new_size >= buf.slots.size())
+            return;
+
+        buf.slots.resize(new_size);
+        free_list.reset(last_used_slot + 1);
+
+        for (size_t i = last_used_slot + 1; i > 0; --i) {
+            if (buf.slot_empty(i - 1))
+                free_list.release(i - 1);
+        }
+    }
+};
+
+// nextSlot and releaseSlot with the first-free hint.
+struct HintAllocator {
+    Buffer buf;
+    size_t first_free = 0;
+
+    size_t next_slot()
+    {
+        for (size_t i = first_free; i < buf.slots.size(); i++) {
+            ++buf.scanned;
+
+            if (!buf.slot_empty(i))
+                continue;
+
+            first_free = i + 1;
+            return i;
+        }
+
+        size_t result = buf.grow();
+        first_free = result + 1;
+        return result;
+    }
+
+    void release_slot(size_t idx)
+    {
+        if (idx < first_free)
+            first_free = idx;
+    }
+};
+
+template<typename Allocator>
+static void fill(Allocator &a, uint32_t &next_value)
+{
+    a.buf.slots.assign(SLOTS, 0);
+
+    for (size_t i = 0; i < SLOTS - FREE_SLOTS; ++i) {
+        size_t idx = a.next_slot();
+        CHECK(a.buf.slot_empty(idx), "Fill: Slot %zu taken twice", idx);
+        a.buf.slots[idx] = next_value++;
+    }
+}
+
+// Releases a random used slot and allocates one, as the destructor and constructor of a replaced config do.
+// A nested config allocates its slot before the outer one is filled.
+template<typename Allocator>
+static void replace(Allocator &a, std::mt19937 &rng, std::vector<size_t> &used, uint32_t &next_value)
+{
+    size_t pos = rng() % used.size();
+    size_t released = used[pos];
+    a.buf.slots[released] = 0;
+    a.release_slot(released);
+
+    size_t outer = a.next_slot();
+    CHECK(outer < a.buf.slots.size() && a.buf.slot_empty(outer), "Slot %zu is not free", outer);
+
+    size_t inner = a.next_slot();
+    CHECK(inner != outer, "Nested allocation got the outer slot %zu", outer);
+    CHECK(inner < a.buf.slots.size() && a.buf.slot_empty(inner), "Slot %zu is not free", inner);
+
+    a.buf.slots[inner] = next_value++;
+    a.buf.slots[outer] = next_value++;
+
+    // The nested config goes away again, the outer one stays.
+    a.buf.slots[inner] = 0;
+    a.release_slot(inner);
+
+    used[pos] = outer;
+}
+
+template<typename Allocator>
+static double run(Allocator &a, int rounds, std::vector<size_t> &used)
+{
+    uint32_t next_value = 1;
+    fill(a, next_value);
+
+    used.clear();
+    for (size_t i = 0; i < a.buf.slots.size(); ++i) {
+        if (!a.buf.slot_empty(i))
+            used.push_back(i);
+    }
+
+    std::mt19937 rng(1234);
+    uint32_t reallocations = a.buf.reallocations;
+    a.buf.scanned = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < rounds; ++round)
+        replace(a, rng, used, next_value);
+
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (2.0 * rounds);
+
+    CHECK(a.buf.reallocations == reallocations, "The buffer grew with free slots left");
+
+    size_t count = 0;
+    for (size_t i = 0; i < a.buf.slots.size(); ++i) {
+        if (!a.buf.slot_empty(i))
+            ++count;
+    }
+    CHECK(count == used.size(), "%zu slots in use, expected %zu", count, used.size());
+
+    return ns;
+}
+
+static void check_full_buffer()
+{
+    FreeListAllocator a;
+    uint32_t next_value = 1;
+    fill(a, next_value);
+
+    for (int i = 0; i < FREE_SLOTS; ++i) {
+        size_t idx = a.next_slot();
+        CHECK(a.buf.slot_empty(idx), "Slot %zu taken twice", idx);
+        a.buf.slots[idx] = next_value++;
+    }
+
+    CHECK(a.buf.reallocations == 0, "The buffer grew before it was full");
+
+    size_t idx = a.next_slot();
+    CHECK(idx == SLOTS && a.buf.reallocations == 1, "Got slot %zu of a full buffer", idx);
+    a.buf.slots[idx] = next_value++;
+
+    idx = a.next_slot();
+    CHECK(idx == SLOTS + 1 && a.buf.reallocations == 1, "Got slot %zu after growing", idx);
+    a.buf.slots[idx] = next_value++;
+}
+
+static void check_shrink()
+{
+    FreeListAllocator a;
+    a.buf.slots.assign(200, 0);
+
+    std::vector<size_t> slots;
+    for (uint32_t i = 1; i <= 90; ++i) {
+        size_t idx = a.next_slot();
+        a.buf.slots[idx] = i;
+        slots.push_back(idx);
+    }
+
+    // Slots 10, 20 and 89 are released, 89 is cut off by the shrink.
+    for (size_t idx : std::vector<size_t>({10, 20, 89})) {
+        a.buf.slots[idx] = 0;
+        a.release_slot(idx);
+    }
+
+    a.shrink();
+    CHECK(a.buf.slots.size() == 89 + SLOT_HEADROOM - 2, "Shrunk to %zu slots", a.buf.slots.size());
+
+    std::vector<size_t> taken;
+    for (int i = 0; i < 3; ++i) {
+        size_t idx = a.next_slot();
+        CHECK(a.buf.slot_empty(idx), "Slot %zu taken twice after shrinking", idx);
+        a.buf.slots[idx] = 1000;
+        taken.push_back(idx);
+    }
+
+    std::sort(taken.begin(), taken.end());
+    CHECK(taken == std::vector<size_t>({10, 20, 89}), "Took slots %zu, %zu and %zu after shrinking", taken[0], taken[1], taken[2]);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 2000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 1;
+
+    check_full_buffer();
+    check_shrink();
+
+    std::vector<size_t> used_free_list;
+    std::vector<size_t> used_hint;
+    FreeListAllocator free_list;
+    HintAllocator hint;
+
+    double free_list_ns = run(free_list, iterations, used_free_list);
+    double hint_ns = run(hint, iterations, used_hint);
+
+    printf("%d releases and allocations with %d of %d slots free\n", iterations, FREE_SLOTS, SLOTS);
+    printf("free list: %8.1f ns per allocation\n", free_list_ns);
+    printf("hint:      %8.1f ns per allocation, %.0f slots scanned per allocation\n", hint_ns, iterations == 0 ? 0.0 : static_cast<double>(hint.buf.scanned) / (2.0 * iterations));
+
+    return host_test_result();
+}
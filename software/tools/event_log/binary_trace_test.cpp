@@ -0,0 +1,436 @@
+// Checks that BinaryTraceBuffer formats records like snprintf would have,
+// including '*' widths, inline and static strings and truncated arguments.
+// Checks that records with a slot that is being rewritten or with a format
+// string outside static memory are skipped. Then writes from several
+// threads while a reader formats the records, and checks that every
+// record read is complete.
+// Finally compares the cost per call and the number of retained messages
+// in the same RAM with a model of the text trace buffer: Timestamp and
+// message are formatted under a mutex and pushed into a byte ring buffer.
+//
+// Usage: binary_trace_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "binary_trace_buffer.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <inttypes.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+extern char __executable_start;
+extern char edata;
+
+// Same idea as string_is_in_rodata: String literals are part of the executable image.
+static bool is_static(const char *str)
+{
+    return str >= &__executable_start && str < &edata;
+}
+
+static uint32_t millis()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint32_t>(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+struct BinaryBuffer {
+    std::vector<uint8_t> memory;
+    BinaryTraceBuffer buf;
+
+    explicit BinaryBuffer(size_t size) : memory(size, 0)
+    {
+        buf.setup(memory.data(), memory.size(), is_static);
+    }
+};
+
+[[gnu::format(__printf__, 1, 2)]]
+static void check_format(const char *fmt, ...)
+{
+    char expected[512];
+    char actual[512];
+    va_list args;
+    va_list args_copy;
+
+    va_start(args, fmt);
+    va_copy(args_copy, args);
+    vsnprintf(expected, sizeof(expected), fmt, args_copy);
+    va_end(args_copy);
+
+    BinaryBuffer b(4096);
+    b.buf.vrecord(0, 0, nullptr, 0, fmt, args);
+    va_end(args);
+
+    uint32_t cursor = b.buf.first_slot();
+    BinaryTraceBuffer::Record record;
+
+    if (!b.buf.read(&cursor, b.buf.end_slot(), &record)) {
+        CHECK(false, "'%s': record not readable", fmt);
+        return;
+    }
+
+    BinaryTraceBuffer::format_message(record, actual, sizeof(actual));
+
+    if ((record.flags & BINARY_TRACE_FLAG_TRUNCATED) != 0) {
+        size_t len = strlen(actual);
+        CHECK(len > 3 && strcmp(actual + len - 3, "...") == 0 && strncmp(expected, actual, len - 3) == 0,
+              "'%s': truncated message\n  '%s' is not a prefix of\n  '%s'", fmt, actual, expected);
+    } else {
+        CHECK(strcmp(expected, actual) == 0, "'%s':\n  expected '%s'\n  got      '%s'", fmt, expected, actual);
+    }
+}
+
+static void check_formats()
+{
+    char dynamic[300];
+    snprintf(dynamic, sizeof(dynamic), "[ 0 16000@3p; 123Wh][ 1 %5d@1p;   0Wh]", 6000);
+
+    int raw[4] = {32000, 16000, 15000, 17000};
+
+    check_format("plain text");
+    check_format("100%% done");
+    check_format("%d: raw(%d %d %d %d) min(%d %d %d %d) spread(%d %d %d %d) max_pv %d",
+                 0, raw[0], raw[1], raw[2], raw[3], 6000, 6000, 6000, 6000, 0, 0, 0, 0, -2147483647 - 1);
+    check_format("7: %d: %s%d@%dp", 3, "!chrg ", 16000, 3);
+    check_format("%s", dynamic);
+    check_format("[%2zu %5d@%dp;%4dWh] %lu %llu %lld %jd %td", static_cast<size_t>(7), 16000, 1, 42, 12345678ul, 0xFFFFFFFFFFFFull, -5ll, static_cast<intmax_t>(-9), static_cast<ptrdiff_t>(-3));
+    check_format("%u %x %X %o %#x %c %hhu %hd", 4000000000u, 0xBEEFu, 0xCAFEu, 8u, 255u, 'Z', 300, 70000);
+    check_format("%f %.3f %e %g %10.2f %-8.1f| %Lf", 1.5, 3.14159, 1e-7, 123456789.0, -2.5, 0.25, static_cast<long double>(2.75));
+    check_format("%*d|%-*d|%.*s|%*.*f", 6, 42, 5, 7, 3, "abcdef", 9, 2, 1.234);
+    check_format("%10s|%-10s|%.2s", "right", dynamic + 30, dynamic);
+    check_format("%p", static_cast<void *>(dynamic));
+    check_format("%d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d %d",
+                 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+                 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70);
+
+    std::string long_string(400, 'x');
+    check_format("long %s tail %d", long_string.c_str(), 5);
+
+    // Format strings outside of static memory are formatted immediately.
+    char runtime_fmt[32];
+    snprintf(runtime_fmt, sizeof(runtime_fmt), "runtime %%d %%s");
+    check_format(runtime_fmt, 5, dynamic);
+}
+
+// Slot layout of BinaryTraceBuffer: Sequence number, span and data. The record header starts with the timestamp and the format string.
+#define SLOT_SEQ_OFFSET  0
+#define SLOT_SPAN_OFFSET 4
+#define SLOT_FMT_OFFSET  (SLOT_SPAN_OFFSET + 1 + sizeof(uint32_t))
+
+// Records with a slot that is being rewritten or that doesn't hold a static format string must be skipped.
+static void check_corrupted()
+{
+    static const char *const corruptions[] = {"continuation slot being written", "continuation slot starts a record", "format string outside static memory"};
+    char heap_fmt[] = "heap %d";
+    char inline_arg[] = "copied into the record, so that it spans several slots";
+
+    for (size_t c = 0; c < sizeof(corruptions) / sizeof(corruptions[0]); ++c) {
+        BinaryBuffer b(4096);
+        b.buf.record(1, 0, nullptr, 0, "%s", inline_arg);
+        b.buf.record(2, 0, nullptr, 0, "next");
+
+        uint8_t *slot0 = b.memory.data();
+        uint8_t *slot1 = slot0 + BINARY_TRACE_SLOT_SIZE;
+
+        if (c == 0) {
+            uint32_t zero = 0;
+            memcpy(slot1 + SLOT_SEQ_OFFSET, &zero, sizeof(zero));
+        } else if (c == 1) {
+            slot1[SLOT_SPAN_OFFSET] = 1;
+        } else {
+            const char *fmt = heap_fmt;
+            memcpy(slot0 + SLOT_FMT_OFFSET, &fmt, sizeof(fmt));
+        }
+
+        uint32_t cursor = b.buf.first_slot();
+        BinaryTraceBuffer::Record record;
+        bool read = b.buf.read(&cursor, b.buf.end_slot(), &record);
+
+        CHECK(read && record.timestamp_ms == 2, "%s: expected only the next record, read %d with timestamp %u", corruptions[c], read, read ? record.timestamp_ms : 0);
+    }
+}
+
+static void check_concurrent(int iterations)
+{
+    constexpr int writer_count = 4;
+    // Small enough that writers overwrite records while they are being read.
+    BinaryBuffer b(1024);
+    std::atomic<bool> done{false};
+    size_t records_read = 0;
+
+    std::thread reader([&]() {
+        char msg[512];
+        BinaryTraceBuffer::Record record;
+
+        // One more pass after the writers are done, in case they finished before the reader started.
+        bool last_pass;
+
+        do {
+            last_pass = done.load();
+            uint32_t cursor = b.buf.first_slot();
+
+            while (b.buf.read(&cursor, b.buf.end_slot(), &record)) {
+                BinaryTraceBuffer::format_message(record, msg, sizeof(msg));
+
+                unsigned writer, n, len, check;
+                char fill[300];
+                int matched = sscanf(msg, "w%u n%u len%u %299s chk%u", &writer, &n, &len, fill, &check);
+
+                bool fill_ok = matched == 5 && strlen(fill) == len && strspn(fill, std::string(1, static_cast<char>('a' + writer)).c_str()) == len;
+
+                CHECK(fill_ok && check == writer * 1000003u + n && (record.flags & BINARY_TRACE_FLAG_TRUNCATED) == 0,
+                      "torn record: '%s'", msg);
+                ++records_read;
+            }
+        } while (!last_pass);
+    });
+
+    std::vector<std::thread> writers;
+    for (unsigned w = 0; w < writer_count; ++w) {
+        writers.emplace_back([&b, w, iterations]() {
+            char fill[200];
+
+            for (unsigned n = 0; n < static_cast<unsigned>(iterations) * 20; ++n) {
+                unsigned len = 1 + (n * 7 + w) % 150; // spans 2 to 7 slots
+                memset(fill, 'a' + static_cast<int>(w), len);
+                fill[len] = '\0';
+                b.buf.record(millis(), 0, nullptr, 0, "w%u n%u len%u %s chk%u", w, n, len, fill, w * 1000003u + n);
+            }
+        });
+    }
+
+    for (auto &writer : writers) {
+        writer.join();
+    }
+
+    done = true;
+    reader.join();
+
+    CHECK(records_read > 0, "reader saw no records");
+    printf("concurrent: %zu records read while %d threads wrote %d each\n", records_read, writer_count, iterations * 20);
+}
+
+// Model of the text trace buffer: EventLog::vtracefln_prefixed and trace_plain.
+class TextTraceBuffer
+{
+public:
+    explicit TextTraceBuffer(size_t size) : buf(size) {}
+
+    void vtrace(const char *prefix, size_t prefix_len, const char *fmt, va_list args)
+    {
+        char line[23 + 256];
+        size_t written = format_timestamp(line);
+
+        memcpy(line + written, " | ", 3);
+        written += 3;
+        memcpy(line + written, prefix, prefix_len);
+        written += prefix_len;
+        while (written < 23 + 3 + 16) {
+            line[written++] = ' ';
+        }
+        memcpy(line + written, " | ", 3);
+        written += 3;
+
+        int res = vsnprintf(line + written, sizeof(line) - written, fmt, args);
+        written += res < 0 ? 0 : static_cast<size_t>(res);
+        if (written >= sizeof(line)) {
+            written = sizeof(line) - 1;
+        }
+        line[written++] = '\n';
+
+        std::lock_guard<std::mutex> lock{mutex};
+        push(line, written);
+    }
+
+    void trace(const char *prefix, size_t prefix_len, const char *fmt, ...)
+    {
+        va_list args;
+        va_start(args, fmt);
+        vtrace(prefix, prefix_len, fmt, args);
+        va_end(args);
+    }
+
+    size_t lines()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        size_t count = 0;
+        for (size_t i = 0; i < used; ++i) {
+            count += buf[(start + i) % buf.size()] == '\n';
+        }
+        return count;
+    }
+
+private:
+    static size_t format_timestamp(char *out)
+    {
+        timeval tv;
+        tm timeinfo;
+
+        gettimeofday(&tv, nullptr);
+        localtime_r(&tv.tv_sec, &timeinfo);
+
+        size_t written = strftime(out, 24, "%F %T", &timeinfo);
+        snprintf(out + written, 24 - written, ",%03ld", static_cast<long>(tv.tv_usec / 1000));
+        return 23;
+    }
+
+    void push(const char *line, size_t len)
+    {
+        if (buf.size() - used < len) {
+            // Drop whole lines at the start, like TF_Ringbuffer::pop_until('\n').
+            size_t to_drop = len - (buf.size() - used);
+            while (used > 0 && (to_drop > 0 || buf[(start + buf.size() - 1) % buf.size()] != '\n')) {
+                start = (start + 1) % buf.size();
+                --used;
+                if (to_drop > 0) {
+                    --to_drop;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+            buf[(start + used) % buf.size()] = line[i];
+            ++used;
+        }
+    }
+
+    std::mutex mutex;
+    std::vector<char> buf;
+    size_t start = 0;
+    size_t used = 0;
+};
+
+static const char prefix[] = "charge_manager";
+static const size_t prefix_len = sizeof(prefix) - 1;
+
+// A mix of the current allocator's and the RTC's trace messages.
+template<typename F>
+static void typical_messages(unsigned n, const char *dynamic, F &&emit)
+{
+    int i = static_cast<int>(n);
+
+    switch (n % 6) {
+        case 0: emit("%d: raw(%d %d %d %d) min(%d %d %d %d) spread(%d %d %d %d) max_pv %d", 0, 32000 + i, 16000, 15000, 17000, 6000, 6000, 6000, 6000, 0, 0, 0, 0, 11000); break;
+        case 1: emit("2: %d: plugged in. alloc %dp", i % 32, 3); break;
+        case 2: emit("       %d wnd_min (%d %d %d %d)", i % 32, 6000, 6000, 0, 0); break;
+        case 3: emit("3: wnd_min %d <= p%d raw %d", 6000 + i, 1, 16000); break;
+        case 4: emit("7: %d: %s%d@%dp", i % 32, i % 2 == 0 ? "!chrg " : "", 16000, 3); break;
+        case 5: emit("%s", dynamic); break;
+    }
+}
+
+template<typename F>
+static double measure(int calls, F &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto duration = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(duration).count() / calls;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    check_formats();
+    check_corrupted();
+    check_concurrent(iterations);
+
+    const char *dynamic_fmt = "3: filtered %d to %d, sorted to 4 7 1 0 12 9 3 |...";
+    char dynamic[128];
+    snprintf(dynamic, sizeof(dynamic), dynamic_fmt, 32, 8);
+
+    // Retained messages in the same RAM, after the buffers wrapped several times.
+    constexpr size_t ram = 1 << 17;
+    TextTraceBuffer text_ret(ram);
+    BinaryBuffer binary_ret(ram);
+
+    for (unsigned n = 0; n < 20000; ++n) {
+        typical_messages(n, dynamic, [&](const char *fmt, auto... args) {
+            text_ret.trace(prefix, prefix_len, fmt, args...);
+            binary_ret.buf.record(millis(), BINARY_TRACE_FLAG_PREFIXED, prefix, prefix_len, fmt, args...);
+        });
+    }
+
+    size_t binary_lines = 0;
+    {
+        uint32_t cursor = binary_ret.buf.first_slot();
+        uint32_t end = binary_ret.buf.end_slot();
+        BinaryTraceBuffer::Record record;
+        while (binary_ret.buf.read(&cursor, end, &record)) {
+            ++binary_lines;
+        }
+    }
+
+    // Cost per call from one thread.
+    TextTraceBuffer text(ram);
+    BinaryBuffer binary(ram);
+
+    double text_ns = measure(iterations, [&]() {
+        for (unsigned n = 0; n < static_cast<unsigned>(iterations); ++n) {
+            typical_messages(n, dynamic, [&](const char *fmt, auto... args) { text.trace(prefix, prefix_len, fmt, args...); });
+        }
+    });
+
+    double binary_ns = measure(iterations, [&]() {
+        for (unsigned n = 0; n < static_cast<unsigned>(iterations); ++n) {
+            typical_messages(n, dynamic, [&](const char *fmt, auto... args) { binary.buf.record(millis(), BINARY_TRACE_FLAG_PREFIXED, prefix, prefix_len, fmt, args...); });
+        }
+    });
+
+    // Cost per call with four threads writing at the same time.
+    constexpr unsigned thread_count = 4;
+    auto parallel = [&](auto &&emit) {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                for (unsigned n = t; n < static_cast<unsigned>(iterations) * thread_count; n += thread_count) {
+                    typical_messages(n, dynamic, emit);
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+
+    double text_parallel_ns = measure(iterations * static_cast<int>(thread_count), [&]() {
+        parallel([&](const char *fmt, auto... args) { text.trace(prefix, prefix_len, fmt, args...); });
+    }) * thread_count;
+
+    double binary_parallel_ns = measure(iterations * static_cast<int>(thread_count), [&]() {
+        parallel([&](const char *fmt, auto... args) { binary.buf.record(millis(), BINARY_TRACE_FLAG_PREFIXED, prefix, prefix_len, fmt, args...); });
+    }) * thread_count;
+
+    // Formatting moved to the reader.
+    char msg[512];
+    uint32_t cursor = binary.buf.first_slot();
+    uint32_t end = binary.buf.end_slot();
+    BinaryTraceBuffer::Record record;
+    int formatted = 0;
+    double format_ns = measure(1, [&]() {
+        while (binary.buf.read(&cursor, end, &record)) {
+            BinaryTraceBuffer::format_message(record, msg, sizeof(msg));
+            ++formatted;
+        }
+    });
+    format_ns /= formatted > 0 ? formatted : 1;
+
+    printf("retained in %zu KiB: text %zu messages, binary %zu messages\n", ram / 1024, text_ret.lines(), binary_lines);
+    printf("one thread:   text %8.1f ns per call, binary %8.1f ns per call\n", text_ns, binary_ns);
+    printf("%u threads:    text %8.1f ns per call, binary %8.1f ns per call\n", thread_count, text_parallel_ns, binary_parallel_ns);
+    printf("deferred formatting when read: %8.1f ns per message\n", format_ns);
+
+    return host_test_result();
+}
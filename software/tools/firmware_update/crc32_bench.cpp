@@ -0,0 +1,115 @@
+// Checks crc32_ieee_802_3_recalculate against a bit-by-bit reference
+// for all alignments and lengths up to 64 bytes and for chunked input,
+// then prints the throughput of both.
+//
+// Usage: crc32_bench [--iterations N]
+// Exits with 1 if the checksums differ.
+
+#include "crc32.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// The implementation that was used before the table-driven one.
+static uint32_t crc32_reference(const uint8_t *data, size_t length, uint32_t crc)
+{
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+    }
+
+    return ~crc;
+}
+
+static double mib_per_s(size_t bytes, std::chrono::steady_clock::duration d)
+{
+    return bytes / (1024.0 * 1024.0) / std::chrono::duration<double>(d).count();
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 64;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::mt19937 rng{1};
+    // A merged firmware image is about 2 MiB.
+    std::vector<uint8_t> buf(2 * 1024 * 1024 + 64);
+
+    for (auto &b : buf)
+        b = static_cast<uint8_t>(rng());
+
+    size_t mismatches = 0;
+
+    // "123456789" is the standard check input.
+    if (crc32_ieee_802_3("123456789", 9) != 0xCBF43926) {
+        fprintf(stderr, "check value mismatch: %08x\n", crc32_ieee_802_3("123456789", 9));
+        ++mismatches;
+    }
+
+    for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t len = 0; len <= 64; ++len) {
+            uint32_t expected = crc32_reference(buf.data() + offset, len, 0);
+            uint32_t actual = crc32_ieee_802_3(buf.data() + offset, len);
+
+            if (expected != actual) {
+                fprintf(stderr, "offset %zu length %zu: expected %08x, got %08x\n", offset, len, expected, actual);
+                ++mismatches;
+            }
+        }
+    }
+
+    // Upload chunks have arbitrary lengths.
+    {
+        size_t len = 256 * 1024;
+        uint32_t crc = 0;
+
+        for (size_t pos = 0; pos < len;) {
+            size_t chunk = std::min<size_t>(1 + rng() % 1500, len - pos);
+            crc32_ieee_802_3_recalculate(buf.data() + pos, chunk, &crc);
+            pos += chunk;
+        }
+
+        uint32_t expected = crc32_reference(buf.data(), len, 0);
+
+        if (crc != expected) {
+            fprintf(stderr, "chunked: expected %08x, got %08x\n", expected, crc);
+            ++mismatches;
+        }
+    }
+
+    size_t bytes = buf.size() - 64;
+    volatile uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        sink = sink + crc32_ieee_802_3(buf.data(), bytes);
+    auto table_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        sink = sink + crc32_reference(buf.data(), bytes, 0);
+    auto reference_time = std::chrono::steady_clock::now() - start;
+
+    printf("slice-by-8: %8.1f MiB/s\n", mib_per_s(bytes * iterations, table_time));
+    printf("bitwise:    %8.1f MiB/s\n", mib_per_s(bytes * iterations, reference_time));
+    printf("%zu mismatches\n", mismatches);
+
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// Shared by the host tests and benchmarks under software/tools.
+//
+// CHECK counts a failed check and prints the message, host_test_result
+// prints the number of failures and returns the exit code: 1 if a check
+// failed. parse_host_test_args parses options like "--iterations N".
+
+#pragma once
+
+#include <initializer_list>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+inline size_t failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            ++failures; \
+        } \
+    } while (0)
+
+struct HostTestArg {
+    const char *name; // Without the leading "--"
+    int *value;       // Keeps its default if the option is not given
+};
+
+// Prints the usage and returns false on an unknown option or a missing value.
+inline bool parse_host_test_args(int argc, char **argv, std::initializer_list<HostTestArg> args)
+{
+    for (int i = 1; i < argc; ++i) {
+        const HostTestArg *match = nullptr;
+
+        for (const HostTestArg &arg : args) {
+            if (strncmp(argv[i], "--", 2) == 0 && strcmp(argv[i] + 2, arg.name) == 0)
+                match = &arg;
+        }
+
+        if (match == nullptr || i + 1 >= argc) {
+            fprintf(stderr, "Usage: %s", argv[0]);
+            for (const HostTestArg &arg : args)
+                fprintf(stderr, " [--%s N]", arg.name);
+            fputc('\n', stderr);
+            return false;
+        }
+
+        *match->value = atoi(argv[++i]);
+    }
+
+    return true;
+}
+
+inline int host_test_result()
+{
+    printf("%zu failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
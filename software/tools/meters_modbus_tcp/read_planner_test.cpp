@@ -0,0 +1,309 @@
+// Plans the reads of random value tables with ModbusReadPlanner and checks
+// the blocks: Without gap bridging they must be the same as the contiguous
+// merging as it was before. With gap bridging every block must contain only
+// values of one register type, fit into max_register_count, bridge gaps of
+// at most max_gap registers and stop only where the next value can't be
+// merged. Virtual values are skipped.
+// Then polls the tables like MeterModbusTCP::read_next from a stand-in
+// device that rejects reads of some unmapped registers with an exception.
+// Checks that every value is read in every cycle, that only the failed block
+// is retried without gaps and that later cycles don't fail anymore.
+// Reports the requests per cycle.
+//
+// Usage: read_planner_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "modbus_read_planner.h"
+#include "host_test.h"
+
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define VIRTUAL_ADDRESS 0xFFFFFFFEu
+#define REGISTER_TYPES 2
+
+struct Spec {
+    uint32_t register_type;
+    size_t start_address;
+    size_t register_count;
+};
+
+static size_t spec_register_count(const Spec &spec)
+{
+    return spec.register_count;
+}
+
+// Sorted by address within blocks of the same register type, with gaps of 0 to 20 registers.
+static std::vector<Spec> make_table(std::mt19937 &rng, size_t spec_count, bool with_virtual)
+{
+    static const size_t register_counts[] = {1, 2, 2, 4};
+    std::vector<Spec> specs;
+    uint32_t register_type = 0;
+    size_t address = rng() % 1000;
+
+    while (specs.size() < spec_count) {
+        if (with_virtual && rng() % 10 == 0) {
+            specs.push_back({register_type, VIRTUAL_ADDRESS, 2});
+            continue;
+        }
+
+        if (rng() % 15 == 0) {
+            // A new block, possibly at a lower address.
+            register_type = static_cast<uint32_t>(rng() % REGISTER_TYPES);
+            address = rng() % 1000;
+        }
+
+        size_t register_count = register_counts[rng() % 4];
+        specs.push_back({register_type, address, register_count});
+
+        size_t gap = rng() % 3 == 0 ? 0 : rng() % 21;
+        address += register_count + gap;
+    }
+
+    return specs;
+}
+
+// read_next as it was before: Merges only strictly contiguous values.
+static ModbusReadBlock plan_contiguous(const std::vector<Spec> &specs, size_t first, size_t max_register_count)
+{
+    ModbusReadBlock block = {specs[first].start_address, specs[first].register_count, false};
+
+    for (size_t i = first + 1; i < specs.size(); ++i) {
+        if (specs[first].register_type == specs[i].register_type
+         && block.start_address + block.register_count == specs[i].start_address
+         && block.register_count + specs[i].register_count <= max_register_count) {
+            block.register_count += specs[i].register_count;
+            continue;
+        }
+
+        break;
+    }
+
+    return block;
+}
+
+static bool in_block(const Spec &spec, uint32_t register_type, const ModbusReadBlock &block)
+{
+    return spec.register_type == register_type
+        && spec.start_address != VIRTUAL_ADDRESS
+        && spec.start_address >= block.start_address
+        && spec.start_address + spec.register_count <= block.start_address + block.register_count;
+}
+
+static void check_block(const std::vector<Spec> &specs, size_t first, const ModbusReadBlock &block, size_t max_register_count, size_t max_gap)
+{
+    const Spec &first_spec = specs[first];
+
+    CHECK(block.start_address == first_spec.start_address, "Block at spec %zu starts at %zu instead of %zu", first, block.start_address, first_spec.start_address);
+    CHECK(block.register_count <= max_register_count || block.register_count == first_spec.register_count, "Block at spec %zu has %zu registers, max is %zu", first, block.register_count, max_register_count);
+
+    size_t read_end = first_spec.start_address + first_spec.register_count;
+    bool gap_bridged = false;
+    size_t i = first + 1;
+
+    for (; i < specs.size(); ++i) {
+        if (specs[i].start_address == VIRTUAL_ADDRESS)
+            continue;
+
+        if (!in_block(specs[i], first_spec.register_type, block) || specs[i].start_address < read_end)
+            break;
+
+        CHECK(specs[i].start_address - read_end <= max_gap, "Block at spec %zu bridges a gap of %zu registers, max is %zu", first, specs[i].start_address - read_end, max_gap);
+        gap_bridged |= specs[i].start_address != read_end;
+        read_end = specs[i].start_address + specs[i].register_count;
+    }
+
+    CHECK(read_end == block.start_address + block.register_count, "Block at spec %zu ends at %zu, its last value at %zu", first, block.start_address + block.register_count, read_end);
+    CHECK(gap_bridged == block.gap_bridged, "Block at spec %zu: gap_bridged is %d, expected %d", first, block.gap_bridged, gap_bridged);
+
+    if (i < specs.size()) {
+        const Spec &next = specs[i];
+        bool mergeable = next.register_type == first_spec.register_type
+                      && next.start_address >= read_end
+                      && next.start_address - read_end <= max_gap
+                      && next.start_address - block.start_address + next.register_count <= max_register_count;
+
+        CHECK(!mergeable, "Block at spec %zu stops before spec %zu, which could be merged", first, i);
+    }
+}
+
+struct Device {
+    // Unmapped registers that cause an exception if a read includes them.
+    std::vector<std::pair<size_t, size_t>> rejected; // register type, address
+
+    bool read(uint32_t register_type, const ModbusReadBlock &block) const
+    {
+        for (const auto &r : rejected) {
+            if (r.first == register_type && r.second >= block.start_address && r.second < block.start_address + block.register_count)
+                return false;
+        }
+
+        return true;
+    }
+};
+
+static bool is_mapped(const std::vector<Spec> &specs, uint32_t register_type, size_t address)
+{
+    for (const Spec &spec : specs) {
+        if (spec.register_type == register_type && spec.start_address != VIRTUAL_ADDRESS
+         && address >= spec.start_address && address < spec.start_address + spec.register_count)
+            return true;
+    }
+
+    return false;
+}
+
+// Marks every fifth unmapped register in the gaps of the table as rejected.
+static Device make_device(const std::vector<Spec> &specs)
+{
+    Device device;
+
+    for (size_t i = 1; i < specs.size(); ++i) {
+        const Spec &prev = specs[i - 1];
+        const Spec &spec = specs[i];
+
+        if (prev.start_address == VIRTUAL_ADDRESS || spec.start_address == VIRTUAL_ADDRESS || prev.register_type != spec.register_type)
+            continue;
+
+        for (size_t address = prev.start_address + prev.register_count; address < spec.start_address; ++address) {
+            if (address % 5 == 0 && !is_mapped(specs, spec.register_type, address))
+                device.rejected.push_back({spec.register_type, address});
+        }
+    }
+
+    return device;
+}
+
+struct PollResult {
+    size_t requests = 0;
+    size_t failed = 0;
+    size_t values = 0;
+};
+
+// Same as MeterModbusTCP::read_next and read_done_callback: A value is taken from the last read
+// if it is inside the block, otherwise a new block is planned. A failed read that bridged a gap
+// is retried right away without gaps.
+static PollResult poll_cycle(const std::vector<Spec> &specs, ModbusReadPlanner &planner, const Device &device, size_t max_register_count, size_t max_gap)
+{
+    PollResult result;
+    ModbusReadBlock block = {0, 0, false};
+    uint32_t block_register_type = 0;
+    bool block_valid = false;
+
+    for (size_t i = 0; i < specs.size(); ++i) {
+        const Spec &spec = specs[i];
+
+        if (spec.start_address == VIRTUAL_ADDRESS)
+            continue;
+
+        if (!block_valid || !in_block(spec, block_register_type, block)) {
+            for (;;) {
+                block = planner.plan(specs.data(), specs.size(), i, max_register_count, max_gap, VIRTUAL_ADDRESS, spec_register_count);
+                block_register_type = spec.register_type;
+                ++result.requests;
+
+                if (device.read(spec.register_type, block))
+                    break;
+
+                ++result.failed;
+
+                if (!planner.read_failed(i, block)) {
+                    CHECK(false, "Read of spec %zu failed and isn't retried", i);
+                    return result;
+                }
+            }
+
+            block_valid = true;
+        }
+
+        ++result.values;
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    std::mt19937 rng(1234);
+    ModbusReadPlanner unused_planner;
+
+    for (int iter = 0; iter < iterations; ++iter) {
+        size_t max_register_count = 11 + rng() % 22;
+
+        std::vector<Spec> contiguous_table = make_table(rng, 40, false);
+        for (size_t first = 0; first < contiguous_table.size(); ++first) {
+            ModbusReadBlock block = unused_planner.plan(contiguous_table.data(), contiguous_table.size(), first, max_register_count, 0, VIRTUAL_ADDRESS, spec_register_count);
+            ModbusReadBlock expected = plan_contiguous(contiguous_table, first, max_register_count);
+
+            CHECK(block.start_address == expected.start_address && block.register_count == expected.register_count && !block.gap_bridged,
+                  "Spec %zu without gaps: %zu + %zu, expected %zu + %zu", first, block.start_address, block.register_count, expected.start_address, expected.register_count);
+        }
+
+        std::vector<Spec> table = make_table(rng, 40, true);
+        for (size_t max_gap : {size_t{0}, size_t{1}, size_t{8}, size_t{32}}) {
+            for (size_t first = 0; first < table.size(); ++first) {
+                if (table[first].start_address == VIRTUAL_ADDRESS)
+                    continue;
+
+                ModbusReadBlock block = unused_planner.plan(table.data(), table.size(), first, max_register_count, max_gap, VIRTUAL_ADDRESS, spec_register_count);
+                check_block(table, first, block, max_register_count, max_gap);
+            }
+        }
+    }
+
+    // Polls tables with 40 values each, 32 registers per read at most.
+    size_t values_per_table = 0;
+    size_t requests[3] = {0, 0, 0};   // Without gaps, with gaps, with gaps on a device that rejects some gaps
+    size_t first_cycle_failed = 0;
+    size_t first_cycle_requests = 0;
+    std::mt19937 poll_rng(5678);
+    int tables = iterations / 10 + 1;
+
+    for (int t = 0; t < tables; ++t) {
+        std::vector<Spec> table = make_table(poll_rng, 40, true);
+        Device accepting_device;
+        Device rejecting_device = make_device(table);
+
+        for (size_t variant = 0; variant < 3; ++variant) {
+            size_t max_gap = variant == 0 ? 0 : 8;
+            const Device &device = variant == 2 ? rejecting_device : accepting_device;
+            ModbusReadPlanner planner;
+            planner.reset(table.size());
+
+            for (int cycle = 0; cycle < 3; ++cycle) {
+                PollResult result = poll_cycle(table, planner, device, 32, max_gap);
+
+                CHECK(cycle == 0 || result.failed == 0, "Table %d: %zu reads failed in cycle %d", t, result.failed, cycle);
+
+                if (cycle == 0) {
+                    values_per_table = result.values;
+
+                    if (variant == 2) {
+                        first_cycle_failed += result.failed;
+                        first_cycle_requests += result.requests;
+                    }
+                } else {
+                    CHECK(result.values == values_per_table, "Table %d: %zu values read, expected %zu", t, result.values, values_per_table);
+                }
+
+                if (cycle == 2)
+                    requests[variant] += result.requests;
+            }
+        }
+    }
+
+    printf("%d random tables with about 36 values each, at most 32 registers per read\n", tables);
+    printf("  contiguous reads only:                 %5.1f requests per cycle\n", static_cast<double>(requests[0]) / tables);
+    printf("  gaps of up to 8 registers bridged:     %5.1f requests per cycle\n", static_cast<double>(requests[1]) / tables);
+    printf("  same, device rejects some gaps:        %5.1f requests per cycle after the first, which had %.1f requests and %.1f failed\n",
+           static_cast<double>(requests[2]) / tables, static_cast<double>(first_cycle_requests) / tables, static_cast<double>(first_cycle_failed) / tables);
+
+    return host_test_result();
+}
@@ -0,0 +1,479 @@
+// Polls random value tables like MeterModbusTCP::read_next, pump_reads and
+// read_done_callback do: Blocks are planned with ModbusReadPlanner and read
+// through ModbusReadWindow, which keeps the reads of the next planned blocks
+// outstanding while the values of the first one are processed. Several
+// meters share one connection to a stand-in device in simulated time. The
+// device answers one transaction after the other, each after a network round
+// trip and a processing time, and rejects reads of some unmapped registers
+// in gaps with an exception. Transactions time out after 2 s. Some reads fail
+// before read() returns, like the shared client does if the connection is
+// gone. After an error the meter continues a second later with the same
+// value, after a cycle it pauses for a second.
+// Checks that a meter never has more reads outstanding than its window, that
+// the values of a cycle are processed in table order, each once, from the
+// registers of the value, that a failed read that bridged a gap is retried
+// without gaps and that every cycle without errors has as many requests as
+// with a window of 1.
+// Reports the time per cycle for a fast and a slow device, with one meter
+// and with two meters on the same connection.
+//
+// Usage: read_window_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "modbus_read_planner.h"
+#include "modbus_read_window.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#define VIRTUAL_ADDRESS 0xFFFFFFFEu
+#define REGISTER_TYPES 2
+#define MAX_REGISTER_COUNT 32
+#define MAX_GAP 8
+#define TIMEOUT_MS 2000
+#define PAUSE_MS 1000
+
+enum class Result {Success, Timeout, Exception, NotConnected};
+
+struct Spec {
+    uint32_t register_type;
+    size_t start_address;
+    size_t register_count;
+};
+
+static size_t spec_register_count(const Spec &spec)
+{
+    return spec.register_count;
+}
+
+static uint16_t register_value(uint32_t register_type, size_t address)
+{
+    return static_cast<uint16_t>(address * 7 + register_type);
+}
+
+// Sorted by address within blocks of the same register type, with gaps of 0 to 20 registers.
+static std::vector<Spec> make_table(std::mt19937 &rng, size_t spec_count)
+{
+    static const size_t register_counts[] = {1, 2, 2, 4};
+    std::vector<Spec> specs;
+    uint32_t register_type = 0;
+    size_t address = rng() % 1000;
+
+    while (specs.size() < spec_count) {
+        if (rng() % 10 == 0) {
+            specs.push_back({register_type, VIRTUAL_ADDRESS, 2});
+            continue;
+        }
+
+        if (rng() % 15 == 0) {
+            register_type = static_cast<uint32_t>(rng() % REGISTER_TYPES);
+            address = rng() % 1000;
+        }
+
+        size_t register_count = register_counts[rng() % 4];
+        specs.push_back({register_type, address, register_count});
+
+        size_t gap = rng() % 3 == 0 ? 0 : rng() % 21;
+        address += register_count + gap;
+    }
+
+    return specs;
+}
+
+struct Device {
+    uint32_t round_trip_ms;
+    uint32_t processing_ms;
+    uint32_t not_connected_percent; // Fails before read() returns.
+    bool rejects_gaps;              // Every fifth register in a gap raises an exception.
+};
+
+struct BlockRead {
+    ModbusReadBlock block;
+    uint32_t register_type;
+    uint16_t buffer[MAX_REGISTER_COUNT];
+    Result result;
+};
+
+typedef ModbusReadWindow<BlockRead>::Slot Slot;
+
+struct Sim;
+
+struct Meter {
+    Meter(Sim &sim_, std::vector<Spec> specs_, uint8_t window_) : sim(sim_), specs(std::move(specs_)), window(window_)
+    {
+        planner.reset(specs.size());
+        read_window.setup(window);
+    }
+
+    Sim &sim;
+    std::vector<Spec> specs;
+    uint8_t window;
+
+    ModbusReadPlanner planner;
+    ModbusReadWindow<BlockRead> read_window;
+    BlockRead *current_read = nullptr;
+    bool buffer_valid = false;
+    bool cycle_done = false;
+    size_t read_index = 0;
+    uint8_t in_flight = 0;
+
+    uint64_t cycle_start = 0;
+    uint64_t cycle_time_sum = 0;
+    uint32_t cycles = 0;
+    uint32_t cycle_requests = 0;
+    bool cycle_failed = false;
+    std::vector<uint32_t> clean_cycle_requests; // Of cycles without errors
+    size_t last_processed = SIZE_MAX;
+    size_t values_processed = 0;
+    size_t values_per_cycle = 0;
+    uint32_t errors = 0;
+    uint32_t retries = 0;
+    uint32_t timeouts = 0;
+
+    bool skip(size_t index) const
+    {
+        return specs[index].start_address == VIRTUAL_ADDRESS;
+    }
+
+    void start_cycle();
+    void read_next();
+    void pump_reads();
+    void read_returned(Slot *slot);
+    void read_done();
+    void pause();
+};
+
+struct Event {
+    uint64_t at;
+    Meter *meter;
+    Slot *slot; // nullptr: The meter continues after a pause.
+};
+
+struct Sim {
+    Sim(const Device &device_) : device(device_), rng(1234) {}
+
+    const Device &device;
+    std::mt19937 rng;
+    std::vector<Event> events;
+    uint64_t now = 0;
+    uint64_t device_free_at = 0;
+
+    bool rejected(uint32_t register_type, const ModbusReadBlock &block, const std::vector<Spec> &specs) const
+    {
+        if (!device.rejects_gaps)
+            return false;
+
+        for (size_t address = block.start_address; address < block.start_address + block.register_count; ++address) {
+            if (address % 5 != 0)
+                continue;
+
+            bool mapped = false;
+            for (const Spec &spec : specs) {
+                if (spec.register_type == register_type && spec.start_address != VIRTUAL_ADDRESS
+                 && address >= spec.start_address && address < spec.start_address + spec.register_count)
+                    mapped = true;
+            }
+
+            if (!mapped)
+                return true;
+        }
+
+        return false;
+    }
+
+    void dispatch(Meter &meter, Slot *slot)
+    {
+        BlockRead &read = slot->read;
+
+        if (static_cast<uint32_t>(rng() % 100) < device.not_connected_percent) {
+            read.result = Result::NotConnected;
+            meter.read_returned(slot);
+            return;
+        }
+
+        // The device processes the transactions of all meters on the connection one after the other.
+        uint64_t arrives_at = now + device.round_trip_ms / 2;
+        uint64_t processed_at = std::max(arrives_at, device_free_at) + device.processing_ms;
+        device_free_at = processed_at;
+        uint64_t answered_at = processed_at + device.round_trip_ms / 2;
+
+        if (answered_at - now > TIMEOUT_MS) {
+            read.result = Result::Timeout;
+            events.push_back({now + TIMEOUT_MS, &meter, slot});
+            return;
+        }
+
+        if (rejected(read.register_type, read.block, meter.specs)) {
+            read.result = Result::Exception;
+        } else {
+            read.result = Result::Success;
+
+            for (size_t i = 0; i < read.block.register_count; ++i)
+                read.buffer[i] = register_value(read.register_type, read.block.start_address + i);
+        }
+
+        events.push_back({answered_at, &meter, slot});
+    }
+
+    void run(std::vector<std::unique_ptr<Meter>> &meters, uint32_t cycles, uint64_t max_ms)
+    {
+        for (auto &meter : meters)
+            meter->start_cycle();
+
+        while (!events.empty() && now < max_ms) {
+            auto next = std::min_element(events.begin(), events.end(), [](const Event &a, const Event &b) {return a.at < b.at;});
+            Event e = *next;
+            events.erase(next);
+            now = e.at;
+
+            if (e.slot != nullptr) {
+                e.meter->read_returned(e.slot);
+            } else if (e.meter->cycles < cycles) {
+                if (e.meter->cycle_done) {
+                    e.meter->cycle_done = false;
+                    e.meter->start_cycle();
+                } else {
+                    e.meter->read_next();
+                }
+            }
+        }
+    }
+};
+
+void Meter::start_cycle()
+{
+    read_index = 0;
+    while (skip(read_index))
+        ++read_index;
+
+    read_next();
+}
+
+// MeterModbusTCP::read_next
+void Meter::read_next()
+{
+    const Spec &spec = specs[read_index];
+
+    if (buffer_valid
+     && current_read->register_type == spec.register_type
+     && current_read->block.start_address <= spec.start_address
+     && spec.start_address - current_read->block.start_address + spec.register_count <= current_read->block.register_count) {
+        read_done();
+        return;
+    }
+
+    if (cycle_requests == 0)
+        cycle_start = sim.now;
+
+    buffer_valid = false;
+
+    read_window.read(read_index);
+    pump_reads();
+}
+
+// MeterModbusTCP::pump_reads
+void Meter::pump_reads()
+{
+    read_window.pump([this](BlockRead &read, size_t first) {
+        read.block = planner.plan(specs.data(), specs.size(), first, MAX_REGISTER_COUNT, MAX_GAP, VIRTUAL_ADDRESS, spec_register_count);
+        read.register_type = specs[first].register_type;
+
+        return ModbusReadPlanner::next_block(specs.data(), specs.size(), first, read.block, spec_register_count, [this](size_t index) {
+            return skip(index);
+        });
+    },
+    [this](Slot *slot) {
+        ++in_flight;
+        ++cycle_requests;
+        CHECK(in_flight <= window, "%u reads outstanding, window is %u", in_flight, window);
+        CHECK(read_window.get_in_flight() <= window, "The window has %u reads outstanding, window is %u", read_window.get_in_flight(), window);
+
+        sim.dispatch(*this, slot);
+    },
+    [this](Slot *slot) {
+        current_read = &slot->read;
+        buffer_valid = true;
+        read_done();
+    });
+}
+
+void Meter::read_returned(Slot *slot)
+{
+    --in_flight;
+    read_window.read_returned(slot);
+    pump_reads();
+}
+
+// MeterModbusTCP::read_done_callback
+void Meter::read_done()
+{
+    if (current_read->result != Result::Success) {
+        ++errors;
+        cycle_failed = true;
+
+        if (current_read->result == Result::Timeout)
+            ++timeouts;
+        buffer_valid = false;
+
+        if (current_read->result == Result::Exception && planner.read_failed(read_index, current_read->block)) {
+            ++retries;
+            read_next();
+            return;
+        }
+
+        // The cycle continues with this value after a pause.
+        pause();
+        return;
+    }
+
+    const Spec &spec = specs[read_index];
+    size_t offset = spec.start_address - current_read->block.start_address;
+
+    CHECK(last_processed == SIZE_MAX || read_index > last_processed, "Spec %zu processed after spec %zu", read_index, last_processed);
+    last_processed = read_index;
+    ++values_processed;
+
+    for (size_t i = 0; i < spec.register_count; ++i) {
+        uint16_t value = current_read->buffer[offset + i];
+        uint16_t expected = register_value(spec.register_type, spec.start_address + i);
+        CHECK(value == expected, "Spec %zu register %zu: %u, expected %u", read_index, i, value, expected);
+    }
+
+    do {
+        read_index = (read_index + 1) % specs.size();
+    } while (read_index != 0 && skip(read_index));
+
+    if (read_index != 0) {
+        read_next();
+        return;
+    }
+
+    if (cycles == 0)
+        values_per_cycle = values_processed;
+    else
+        CHECK(values_processed == values_per_cycle, "%zu values processed in a cycle, expected %zu", values_processed, values_per_cycle);
+
+    if (!cycle_failed) {
+        clean_cycle_requests.push_back(cycle_requests);
+        cycle_time_sum += sim.now - cycle_start;
+    }
+
+    ++cycles;
+    cycle_done = true;
+    buffer_valid = false;
+    cycle_requests = 0;
+    cycle_failed = false;
+    last_processed = SIZE_MAX;
+    values_processed = 0;
+
+    pause();
+}
+
+void Meter::pause()
+{
+    sim.events.push_back({sim.now + PAUSE_MS, this, nullptr});
+}
+
+struct RunResult {
+    double cycle_ms;
+    std::vector<std::vector<uint32_t>> clean_cycle_requests;
+    uint32_t clean_cycles;
+    uint32_t timeouts;
+};
+
+// Runs until every meter did the cycles or for max_ms of simulated time.
+static RunResult run(const Device &device, const std::vector<std::vector<Spec>> &tables, uint8_t window, uint32_t cycles, uint64_t max_ms = UINT64_MAX)
+{
+    Sim sim(device);
+    std::vector<std::unique_ptr<Meter>> meters;
+
+    for (const auto &table : tables)
+        meters.emplace_back(new Meter(sim, table, window));
+
+    sim.run(meters, cycles, max_ms);
+
+    RunResult result = {0, {}, 0, 0};
+    uint64_t time_sum = 0;
+
+    for (auto &meter : meters) {
+        CHECK(max_ms != UINT64_MAX || meter->cycles == cycles, "%u of %u cycles done", meter->cycles, cycles);
+        CHECK(max_ms != UINT64_MAX || meter->in_flight == 0, "%u reads outstanding at the end", meter->in_flight);
+        CHECK(device.rejects_gaps || meter->retries == 0, "%u retries without rejected gaps", meter->retries);
+
+        result.clean_cycle_requests.push_back(meter->clean_cycle_requests);
+        result.clean_cycles += static_cast<uint32_t>(meter->clean_cycle_requests.size());
+        time_sum += meter->cycle_time_sum;
+        result.timeouts += meter->timeouts;
+    }
+
+    result.cycle_ms = result.clean_cycles == 0 ? 0 : static_cast<double>(time_sum) / result.clean_cycles;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    std::mt19937 rng(1234);
+    auto random = [&rng](uint32_t n) {return static_cast<uint32_t>(rng() % n);};
+
+    for (int i = 0; i < iterations; ++i) {
+        std::vector<std::vector<Spec>> tables;
+
+        for (uint32_t m = 0; m < 1 + random(3); ++m)
+            tables.push_back(make_table(rng, 10 + random(40)));
+
+        // At most 24 reads of up to 50 ms are outstanding: Nothing times out.
+        Device device = {random(100), random(50), 0, random(2) == 0};
+        RunResult reference = run(device, tables, 1, 4);
+
+        uint8_t window = static_cast<uint8_t>(2 + random(7));
+        RunResult windowed = run(device, tables, window, 4);
+
+        // Slow devices time out. The cycles don't have to finish in the minute.
+        Device failing_device = {random(100), random(400), random(20), random(2) == 0};
+        run(failing_device, tables, static_cast<uint8_t>(1 + random(8)), 4, 60000);
+
+        for (size_t m = 0; m < tables.size(); ++m) {
+            // Without errors, a cycle has the same requests with every window.
+            // The first cycles might have failed reads that bridged gaps.
+            const auto &a = reference.clean_cycle_requests[m];
+            const auto &b = windowed.clean_cycle_requests[m];
+
+            CHECK(!a.empty() && !b.empty() && a.back() == b.back(), "Meter %zu: %u requests per cycle with window %u, %u with window 1",
+                  m, b.empty() ? 0 : b.back(), window, a.empty() ? 0 : a.back());
+        }
+    }
+
+    // Tables of 40 values.
+    std::mt19937 table_rng(5678);
+    std::vector<Spec> table_a = make_table(table_rng, 40);
+    std::vector<Spec> table_b = make_table(table_rng, 40);
+    const Device fast = {20, 5, 0, false};
+    const Device slow = {20, 150, 0, false};
+    const uint32_t cycles = static_cast<uint32_t>(iterations / 10 + 2);
+
+    RunResult requests = run(fast, {table_a}, 1, 1);
+    printf("Tables of 40 values in %u requests, %u cycles per run\n", requests.clean_cycle_requests[0].back(), cycles);
+
+    for (uint8_t window : {uint8_t{1}, uint8_t{2}, uint8_t{4}, uint8_t{8}}) {
+        double fast_one = run(fast, {table_a}, window, cycles).cycle_ms;
+        double fast_two = run(fast, {table_a, table_b}, window, cycles).cycle_ms;
+        RunResult slow_one = run(slow, {table_a}, window, cycles, cycles * 60000ull);
+        RunResult slow_two = run(slow, {table_a, table_b}, window, cycles, cycles * 60000ull);
+
+        printf("  window %u: fast device (20 ms round trip, 5 ms per read) %6.1f ms per cycle, two meters %6.1f ms;"
+               " slow device (150 ms per read) %6.1f ms, two meters %6.1f ms, %u timeouts\n",
+               window, fast_one, fast_two, slow_one.cycle_ms, slow_two.cycle_ms, slow_one.timeouts + slow_two.timeouts);
+    }
+
+    return host_test_result();
+}
@@ -0,0 +1,223 @@
+// Checks speedwire_parse_values with datagrams laid out like those of
+// an SMA Energy Meter (600 bytes) and a Sunny Home Manager 2.0 (608 bytes),
+// with a reordered layout and with malformed datagrams.
+// Then compares the parser's throughput with the previous approach
+// of probing the datagram for each OBIS code.
+//
+// Usage: speedwire_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "speedwire_parser.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+struct Record {
+    uint8_t channel;
+    uint8_t index;
+    uint8_t type;
+    uint8_t tariff;
+};
+
+static uint64_t raw_value(const Record &r)
+{
+    // Distinct per record and large enough to use the upper bytes of counters.
+    return r.type == 8 ? 0x0000000100000000ull * r.index + 12345678ull * r.index : 1000ull * r.index + r.tariff;
+}
+
+static void put_be(std::vector<uint8_t> &buf, uint64_t value, size_t len)
+{
+    for (size_t i = len; i-- > 0;)
+        buf.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static std::vector<uint8_t> build_datagram(uint16_t protocol_id, uint16_t susy_id, const std::vector<Record> &records)
+{
+    std::vector<uint8_t> buf = {'S', 'M', 'A', 0, 0x00, 0x04, 0x02, 0xA0, 0x00, 0x00, 0x00, 0x01};
+
+    size_t length_pos = buf.size();
+    put_be(buf, 0, 2);          // data length, filled in below
+    put_be(buf, 0x0010, 2);     // SMA Net 2
+    put_be(buf, protocol_id, 2);
+    put_be(buf, susy_id, 2);
+    put_be(buf, 1900000001, 4); // serial number
+    put_be(buf, 123456, 4);     // ticker in ms
+
+    for (const Record &r : records) {
+        buf.push_back(r.channel);
+        buf.push_back(r.index);
+        buf.push_back(r.type);
+        buf.push_back(r.tariff);
+
+        if (r.channel == 0x90)
+            put_be(buf, 0x02001252, 4); // software version 2.0.18.R
+        else
+            put_be(buf, raw_value(r), r.type);
+    }
+
+    size_t data_len = buf.size() - 16;
+    buf[length_pos] = static_cast<uint8_t>(data_len >> 8);
+    buf[length_pos + 1] = static_cast<uint8_t>(data_len);
+
+    put_be(buf, 0, 4); // end tag
+
+    return buf;
+}
+
+// Record order as sent by the devices: Sum, then L1, L2 and L3, each with power and counter pairs.
+static std::vector<Record> device_records(bool with_frequency)
+{
+    std::vector<Record> records;
+
+    for (int phase_base : {0, 20, 40, 60}) {
+        for (int quantity : {1, 2, 3, 4, 9, 10}) {
+            records.push_back({0, static_cast<uint8_t>(phase_base + quantity), 4, 0});
+            records.push_back({0, static_cast<uint8_t>(phase_base + quantity), 8, 0});
+        }
+
+        if (phase_base == 0) {
+            records.push_back({0, 13, 4, 0});
+
+            if (with_frequency)
+                records.push_back({0, 14, 4, 0});
+        } else {
+            records.push_back({0, static_cast<uint8_t>(phase_base + 11), 4, 0});
+            records.push_back({0, static_cast<uint8_t>(phase_base + 12), 4, 0});
+            records.push_back({0, static_cast<uint8_t>(phase_base + 13), 4, 0});
+        }
+    }
+
+    records.push_back({0x90, 0, 0, 0});
+
+    return records;
+}
+
+static void check_values(const char *name, const std::vector<uint8_t> &datagram, const std::vector<Record> &records, int expected_found)
+{
+    float values[SPEEDWIRE_OBIS_COUNT];
+    std::fill(values, values + SPEEDWIRE_OBIS_COUNT, NAN);
+
+    int found = speedwire_parse_values(datagram.data(), datagram.size(), values);
+    CHECK(found == expected_found, "%s: found %d values, expected %d", name, found, expected_found);
+
+    for (size_t i = 0; i < SPEEDWIRE_OBIS_COUNT; ++i) {
+        const speedwire_obis_mapping &mapping = speedwire_obis_mappings[i];
+        const Record *record = nullptr;
+
+        for (const Record &r : records) {
+            if (r.channel == 0 && r.tariff == 0 && r.index == mapping.index && r.type == mapping.type)
+                record = &r;
+        }
+
+        if (record == nullptr) {
+            CHECK(isnan(values[i]), "%s: %u.%u.0 not sent but decoded as %f", name, mapping.index, mapping.type, static_cast<double>(values[i]));
+            continue;
+        }
+
+        float expected = static_cast<float>(raw_value(*record)) * mapping.scaling_factor;
+        CHECK(values[i] == expected, "%s: %u.%u.0 decoded as %f, expected %f", name, mapping.index, mapping.type, static_cast<double>(values[i]), static_cast<double>(expected));
+    }
+}
+
+static void check_rejected(const char *name, const std::vector<uint8_t> &datagram)
+{
+    float values[SPEEDWIRE_OBIS_COUNT];
+    int found = speedwire_parse_values(datagram.data(), datagram.size(), values);
+    CHECK(found == -1, "%s: not rejected, found %d values", name, found);
+}
+
+// The previous implementation: Probe the datagram in 4 byte steps for each OBIS code.
+static void probe_values(const uint8_t *buf, size_t buflen, float values[SPEEDWIRE_OBIS_COUNT])
+{
+    for (size_t i = 0; i < SPEEDWIRE_OBIS_COUNT; i++) {
+        const speedwire_obis_mapping &mapping = speedwire_obis_mappings[i];
+        values[i] = NAN;
+
+        for (size_t pos = 28; pos + 4 < buflen; pos += 4) {
+            const uint8_t *p = buf + pos;
+
+            if (p[0] == 0 && p[1] == mapping.index && p[2] == mapping.type && p[3] == 0) {
+                uint64_t raw = 0;
+
+                for (size_t b = 0; b < mapping.type; ++b)
+                    raw = raw << 8 | p[4 + b];
+
+                values[i] = static_cast<float>(raw) * mapping.scaling_factor;
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 100000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    std::vector<Record> em_records = device_records(false);
+    std::vector<Record> shm_records = device_records(true);
+
+    std::vector<uint8_t> em = build_datagram(0x6069, 270, em_records);
+    std::vector<uint8_t> shm = build_datagram(0x6069, 372, shm_records);
+
+    CHECK(em.size() == 600, "Energy Meter datagram has %zu bytes", em.size());
+    CHECK(shm.size() == 608, "Sunny Home Manager 2.0 datagram has %zu bytes", shm.size());
+
+    check_values("Energy Meter", em, em_records, SPEEDWIRE_OBIS_COUNT - 1);
+    check_values("Sunny Home Manager 2.0", shm, shm_records, SPEEDWIRE_OBIS_COUNT);
+
+    // A firmware update might reorder records or add unknown ones.
+    std::vector<Record> shuffled = shm_records;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937{1});
+    shuffled.insert(shuffled.begin() + 10, Record{0, 1, 8, 1});  // tariff 1 counter
+    shuffled.insert(shuffled.begin() + 20, Record{0, 79, 4, 0}); // unknown index
+    check_values("reordered", build_datagram(0x6069, 372, shuffled), shuffled, SPEEDWIRE_OBIS_COUNT);
+
+    check_rejected("inverter protocol", build_datagram(0x6065, 372, shm_records));
+
+    std::vector<uint8_t> truncated = shm;
+    truncated.resize(400);
+    check_rejected("truncated", truncated);
+
+    std::vector<uint8_t> bad_type = shm;
+    bad_type[28 + 2] = 5;
+    check_rejected("bad type", bad_type);
+
+    std::vector<uint8_t> bad_magic = shm;
+    bad_magic[0] = 'X';
+    check_rejected("bad magic", bad_magic);
+
+    check_rejected("too short", std::vector<uint8_t>(shm.begin(), shm.begin() + 20));
+
+    // Throughput
+    float values[SPEEDWIRE_OBIS_COUNT];
+    volatile float sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        speedwire_parse_values(shm.data(), shm.size(), values);
+        sink = sink + values[i % SPEEDWIRE_OBIS_COUNT];
+    }
+    auto walk_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        probe_values(shm.data(), shm.size(), values);
+        sink = sink + values[i % SPEEDWIRE_OBIS_COUNT];
+    }
+    auto probe_time = std::chrono::steady_clock::now() - start;
+
+    printf("record walk: %8.3f us per datagram\n", std::chrono::duration<double, std::micro>(walk_time).count() / iterations);
+    printf("probing:     %8.3f us per datagram\n", std::chrono::duration<double, std::micro>(probe_time).count() / iterations);
+
+    return host_test_result();
+}
@@ -0,0 +1,236 @@
+// Reads the register functions of the WARP, Bender and KEBA tables from
+// modbus_tcp.cpp and checks that every register pair they handle is in one
+// of the table's blocks in modbus_register_blocks.h. The register images
+// are filled from the blocks only: A register outside of them would never
+// be read. Handled registers are the case labels of a function's switch
+// over reg and the ranges of its "reg >= A && reg < B" conditions. Labels
+// of odd registers are skipped, as the functions are only called for the
+// first register of a pair. Built with and without the charge tracker, as
+// MODULE_CHARGE_TRACKER_AVAILABLE() changes both the blocks and the
+// functions.
+//
+// Usage: register_blocks_test
+// Exits with 1 if a check fails.
+
+#include "host_test.h"
+
+#include <ctype.h>
+#include <fstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// As in evse_common.h and nfc.h.
+#define CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE 20
+#define NFC_TAG_ID_LENGTH 10
+
+#define MODULE_CHARGE_TRACKER_AVAILABLE() CHARGE_TRACKER
+
+#include "modbus_register_blocks.h"
+
+struct RegisterFunction {
+    const char *name;
+    const ModbusRegisterBlock *blocks;
+    size_t block_count;
+};
+
+#define REGISTER_FUNCTION(name, blocks) {name, blocks, sizeof(blocks) / sizeof(blocks[0])}
+
+static const RegisterFunction register_functions[] = {
+    REGISTER_FUNCTION("getWarpInputRegister", warp_input_register_blocks),
+    REGISTER_FUNCTION("getWarpHoldingRegister", warp_holding_register_blocks),
+    REGISTER_FUNCTION("getBenderHoldingRegister", bender_holding_register_blocks),
+    REGISTER_FUNCTION("getKebaHoldingRegister", keba_holding_register_blocks),
+};
+
+static bool in_blocks(const RegisterFunction &function, uint32_t reg)
+{
+    for (size_t i = 0; i < function.block_count; ++i) {
+        if (reg >= function.blocks[i].start && reg < function.blocks[i].start + function.blocks[i].count)
+            return true;
+    }
+
+    return false;
+}
+
+static bool starts_with(const std::string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static bool parse_number(const std::string &s, size_t &pos, uint32_t &value)
+{
+    if (pos >= s.size() || !isdigit(static_cast<unsigned char>(s[pos])))
+        return false;
+
+    value = 0;
+    while (pos < s.size() && isdigit(static_cast<unsigned char>(s[pos])))
+        value = value * 10 + static_cast<uint32_t>(s[pos++] - '0');
+
+    return true;
+}
+
+// Evaluates sums of products of numbers and the constants above, up to the closing parenthesis.
+static bool evaluate(const std::string &s, size_t pos, uint32_t &result)
+{
+    static const struct {
+        const char *name;
+        uint32_t value;
+    } constants[] = {
+        {"CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE", CHARGING_SLOT_COUNT_SUPPORTED_BY_EVSE},
+        {"NFC_TAG_ID_LENGTH", NFC_TAG_ID_LENGTH},
+    };
+
+    result = 0;
+    uint32_t product = 1;
+
+    for (;;) {
+        while (pos < s.size() && s[pos] == ' ')
+            ++pos;
+
+        uint32_t factor;
+
+        if (!parse_number(s, pos, factor)) {
+            bool found = false;
+
+            for (const auto &constant : constants) {
+                if (s.compare(pos, strlen(constant.name), constant.name) == 0) {
+                    factor = constant.value;
+                    pos += strlen(constant.name);
+                    found = true;
+                }
+            }
+
+            if (!found)
+                return false;
+        }
+
+        product *= factor;
+
+        while (pos < s.size() && s[pos] == ' ')
+            ++pos;
+
+        if (pos >= s.size())
+            return false;
+
+        if (s[pos] == '*') {
+            ++pos;
+        } else if (s[pos] == '+') {
+            result += product;
+            product = 1;
+            ++pos;
+        } else if (s[pos] == ')') {
+            result += product;
+            return true;
+        } else {
+            return false;
+        }
+    }
+}
+
+static void check_register(const RegisterFunction &function, uint32_t reg, size_t line_number)
+{
+    CHECK(in_blocks(function, reg) && in_blocks(function, reg + 1), "%s, line %zu: Register %u is not in a register block", function.name, line_number, reg);
+}
+
+static void check_function(const std::vector<std::string> &lines, const RegisterFunction &function)
+{
+    std::string signature = std::string("Option<ModbusTcp::TwoRegs> ModbusTcp::") + function.name + "(";
+    size_t i = 0;
+
+    while (i < lines.size() && !starts_with(lines[i], signature.c_str()))
+        ++i;
+
+    CHECK(i < lines.size(), "%s not found", function.name);
+
+    std::vector<bool> active = {true};
+    bool switch_found = false;
+    size_t case_count = 0;
+
+    for (++i; i < lines.size() && lines[i] != "}"; ++i) {
+        const std::string &line = lines[i];
+        size_t line_number = i + 1;
+
+        if (starts_with(line, "#if MODULE_CHARGE_TRACKER_AVAILABLE()")) {
+            active.push_back(active.back() && CHARGE_TRACKER);
+            continue;
+        }
+
+        if (starts_with(line, "#else")) {
+            bool outer = active[active.size() - 2];
+            active.back() = outer && !active.back();
+            continue;
+        }
+
+        if (starts_with(line, "#endif")) {
+            active.pop_back();
+            continue;
+        }
+
+        CHECK(line.empty() || line[0] != '#', "%s, line %zu: Unknown preprocessor directive %s", function.name, line_number, line.c_str());
+
+        if (!active.back())
+            continue;
+
+        if (line == "    switch (reg) {")
+            switch_found = true;
+
+        // Cases of the switch over reg. Nested switches are indented further.
+        if (starts_with(line, "        case ")) {
+            size_t pos = strlen("        case ");
+            uint32_t reg;
+
+            if (parse_number(line, pos, reg) && pos < line.size() && line[pos] == ':') {
+                // The functions are called for the first register of a pair only: Odd labels are never reached.
+                if (reg % 2 == 0)
+                    check_register(function, reg, line_number);
+
+                ++case_count;
+            } else {
+                CHECK(false, "%s, line %zu: Can't parse %s", function.name, line_number, line.c_str());
+            }
+        }
+
+        for (size_t at = line.find("reg >= "); at != std::string::npos; at = line.find("reg >= ", at + 1)) {
+            size_t pos = at + strlen("reg >= ");
+            uint32_t first;
+            uint32_t end;
+
+            if (!parse_number(line, pos, first) || line.compare(pos, strlen(" && reg < "), " && reg < ") != 0
+             || !evaluate(line, pos + strlen(" && reg < "), end)) {
+                CHECK(false, "%s, line %zu: Can't parse the range in %s", function.name, line_number, line.c_str());
+                continue;
+            }
+
+            for (uint32_t reg = first & ~1u; reg < end; reg += 2)
+                check_register(function, reg, line_number);
+        }
+    }
+
+    CHECK(active.size() == 1, "%s: Unbalanced preprocessor directives", function.name);
+    CHECK(switch_found && case_count > 0, "%s: No cases of a switch over reg found", function.name);
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_host_test_args(argc, argv, {}))
+        return 1;
+
+    std::ifstream file(MODBUS_TCP_CPP);
+    CHECK(file.good(), "Can't open %s", MODBUS_TCP_CPP);
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line))
+        lines.push_back(line);
+
+    for (const RegisterFunction &function : register_functions)
+        check_function(lines, function);
+
+    printf("Checked %zu register functions in %s with%s the charge tracker\n",
+           sizeof(register_functions) / sizeof(register_functions[0]), MODBUS_TCP_CPP, CHARGE_TRACKER ? "" : "out");
+
+    return host_test_result();
+}
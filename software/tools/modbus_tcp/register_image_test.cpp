@@ -0,0 +1,345 @@
+// Builds the WARP input register table from stand-ins for the state objects
+// it is read from and compares reads from the register image with the
+// previous path, which ran the register switch for every register pair of
+// a request. Random requests cover odd start addresses, odd counts and gaps
+// with and without illegal data address exceptions. Checks that every
+// register of the switch is in a block, like register_blocks_test does for
+// modbus_tcp.cpp. Then measures a full table poll (every block, in requests
+// of at most 125 registers) over both paths and the image update itself.
+//
+// The stand-ins look up keys by address like ConfObject::get does for
+// string literals and check the value type like Config::asUint. They don't
+// model the Config wrappers and the main thread assertion, so the previous
+// path is somewhat faster here than on the ESP32.
+//
+// Usage: register_image_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "modbus_register_image.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define SLOT_COUNT 20
+#define ALL_VALUES_COUNT 85
+#define TAG_ID_LENGTH 10
+
+enum class Type : uint8_t {Uint, Int, Float, Bool};
+
+struct Value {
+    Type type;
+    union {
+        uint32_t u;
+        int32_t i;
+        float f;
+        bool b;
+    };
+};
+
+struct StateObject {
+    std::vector<const char *> keys;
+    std::vector<Value> values;
+
+    const Value *get(const char *key) const
+    {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == key)
+                return &values[i];
+        }
+        abort();
+    }
+};
+
+static uint32_t as_uint(const Value *v) { if (v->type != Type::Uint) abort(); return v->u; }
+static int32_t as_int(const Value *v) { if (v->type != Type::Int) abort(); return v->i; }
+static float as_float(const Value *v) { if (v->type != Type::Float) abort(); return v->f; }
+static bool as_bool(const Value *v) { if (v->type != Type::Bool) abort(); return v->b; }
+
+static const char IEC61851_STATE[] = "iec61851_state";
+static const char CHARGER_STATE[] = "charger_state";
+static const char ALLOWED_CHARGING_CURRENT[] = "allowed_charging_current";
+static const char UPTIME[] = "uptime";
+static const char USER_ID[] = "user_id";
+static const char TIMESTAMP_MINUTES[] = "timestamp_minutes";
+static const char EVSE_UPTIME_START[] = "evse_uptime_start";
+static const char METER_START[] = "meter_start";
+static const char ACTIVE[] = "active";
+static const char MAX_CURRENT[] = "max_current";
+static const char TYPE[] = "type";
+static const char POWER[] = "power";
+static const char ENERGY_ABS[] = "energy_abs";
+static const char ENERGY_REL[] = "energy_rel";
+static const char EXTERNAL_CONTROL[] = "external_control";
+
+static Value uint_value(uint32_t u) { Value v; v.type = Type::Uint; v.u = u; return v; }
+static Value int_value(int32_t i) { Value v; v.type = Type::Int; v.i = i; return v; }
+static Value float_value(float f) { Value v; v.type = Type::Float; v.f = f; return v; }
+static Value bool_value(bool b) { Value v; v.type = Type::Bool; v.b = b; return v; }
+
+struct State {
+    StateObject evse_state{{IEC61851_STATE, CHARGER_STATE, ALLOWED_CHARGING_CURRENT}, {uint_value(2), uint_value(3), uint_value(16000)}};
+    StateObject evse_ll_state{{UPTIME}, {uint_value(123456789)}};
+    StateObject current_charge{{USER_ID, TIMESTAMP_MINUTES, EVSE_UPTIME_START, METER_START},
+                               {int_value(3), uint_value(28000000), uint_value(120000000), float_value(1234.5f)}};
+    StateObject meter_state{{TYPE}, {uint_value(4)}};
+    StateObject meter_values{{POWER, ENERGY_ABS, ENERGY_REL}, {float_value(11000.0f), float_value(1240.25f), float_value(50.5f)}};
+    StateObject power_manager_state{{EXTERNAL_CONTROL}, {uint_value(0)}};
+    std::vector<StateObject> slots;
+    std::vector<float> all_values;
+
+    char tag_id[2 * TAG_ID_LENGTH];
+    uint32_t tag_last_seen = 5000;
+    uint8_t tag_type = 2;
+};
+
+static inline uint32_t swap_bytes(uint32_t x)
+{
+    return ((x & 0x000000FF) << 24) | ((x & 0x0000FF00) << 8) | ((x & 0x00FF0000) >> 8) | ((x & 0xFF000000) >> 24);
+}
+
+union TwoRegs {
+    uint32_t u;
+    float f;
+    struct {uint16_t upper; uint16_t lower;} regs;
+};
+
+// Same structure as ModbusTcp::getWarpInputRegister. Returns false for an illegal address.
+static bool get_input_register(const State &s, uint16_t reg, bool send_illegal_data_address, uint32_t *result)
+{
+    TwoRegs val{0};
+    bool report_illegal_data_address = false;
+
+    switch (reg) {
+        case 0: val.u = 3; break;
+        case 2: val.u = 2; break;
+        case 4: val.u = 6; break;
+        case 6: val.u = 0; break;
+        case 8: val.u = 1700000000; break;
+        case 10: val.u = 0x12345678; break;
+        case 12: val.u = 3600; break;
+
+        case 1000: val.u = as_uint(s.evse_state.get(IEC61851_STATE)); break;
+        case 1002: val.u = as_uint(s.evse_state.get(CHARGER_STATE)); break;
+        case 1004: val.u = static_cast<uint32_t>(as_int(s.current_charge.get(USER_ID))); break;
+        case 1006: val.u = as_uint(s.current_charge.get(TIMESTAMP_MINUTES)); break;
+        case 1008: {
+                uint32_t now = as_uint(s.evse_ll_state.get(UPTIME));
+                uint32_t start = as_uint(s.current_charge.get(EVSE_UPTIME_START));
+                val.u = start == 0 ? 0 : now - start;
+            } break;
+        case 1010: val.u = as_uint(s.evse_state.get(ALLOWED_CHARGING_CURRENT)); break;
+
+        case 2000: val.u = as_uint(s.meter_state.get(TYPE)); break;
+        case 2002: val.f = as_float(s.meter_values.get(POWER)); break;
+        case 2004: val.f = as_float(s.meter_values.get(ENERGY_ABS)); break;
+        case 2006: val.f = as_float(s.meter_values.get(ENERGY_REL)); break;
+        case 2008: {
+                if (as_int(s.current_charge.get(USER_ID)) == -1) {
+                    val.f = 0;
+                    break;
+                }
+                val.f = as_float(s.meter_values.get(ENERGY_ABS)) - as_float(s.current_charge.get(METER_START));
+            } break;
+
+        case 3100: val.u = 3; break;
+        case 3102: val.u = as_uint(s.power_manager_state.get(EXTERNAL_CONTROL)); break;
+
+        case 4010: val.u = s.tag_last_seen < 0x70 ? s.tag_last_seen + 0x70 : s.tag_last_seen; break;
+        case 4012: val.u = 0x30303000 + ('0' + s.tag_type); break;
+
+        default: report_illegal_data_address = true; break;
+    }
+
+    if (reg >= 1012 && reg < 1012 + 2 * SLOT_COUNT) {
+        report_illegal_data_address = false;
+        const StateObject &slot = s.slots[(reg - 1012u) / 2];
+        val.u = as_bool(slot.get(ACTIVE)) ? as_uint(slot.get(MAX_CURRENT)) : 0xFFFFFFFF;
+    } else if (reg >= 2100 && reg < 2100 + 2 * ALL_VALUES_COUNT) {
+        report_illegal_data_address = false;
+        val.f = s.all_values[(reg - 2100u) / 2];
+    } else if (reg >= 4000 && reg < 4000 + TAG_ID_LENGTH) {
+        report_illegal_data_address = false;
+        memcpy(&val, s.tag_id + (reg - 4000) * 2, 4);
+        val.u = swap_bytes(val.u);
+    }
+
+    if (send_illegal_data_address && report_illegal_data_address)
+        return false;
+
+    *result = val.u;
+    return true;
+}
+
+// The read loop of ModbusTcp::getWarpInputRegisters before the register image.
+static bool read_pairs(const State &s, uint16_t start_address, uint16_t data_count, uint16_t *data_values, bool send_illegal_data_address)
+{
+    int i = 0;
+    while (i < data_count) {
+        uint16_t reg = static_cast<uint16_t>((i + start_address) & (~1));
+
+        TwoRegs val;
+        if (!get_input_register(s, reg, send_illegal_data_address, &val.u))
+            return false;
+
+        val.u = swap_bytes(val.u);
+
+        if (i == 0 && (start_address % 2) == 1) {
+            data_values[i] = val.regs.lower;
+            ++i;
+        } else if (i == data_count - 1) {
+            data_values[i] = val.regs.upper;
+            ++i;
+        } else {
+            data_values[i] = val.regs.upper;
+            data_values[i + 1] = val.regs.lower;
+            i += 2;
+        }
+    }
+
+    return true;
+}
+
+static const ModbusRegisterBlock warp_input_register_blocks[] = {
+    {0, 14},
+    {1000, 12 + 2 * SLOT_COUNT},
+    {2000, 10},
+    {2100, 2 * ALL_VALUES_COUNT},
+    {3100, 4},
+    {4000, 14},
+};
+
+struct Request {
+    uint16_t start;
+    uint16_t count;
+};
+
+// Every block of the table in requests of at most 125 registers.
+static const Request full_table_poll[] = {
+    {0, 14},
+    {1000, 52},
+    {2000, 10},
+    {2100, 124},
+    {2224, 46},
+    {3100, 4},
+    {4000, 14},
+};
+
+int main(int argc, char **argv)
+{
+    int iterations = 10000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    State state;
+    for (uint32_t i = 0; i < SLOT_COUNT; ++i)
+        state.slots.push_back({{ACTIVE, MAX_CURRENT}, {bool_value(i % 3 != 0), uint_value(6000 + i * 1000)}});
+    for (int i = 0; i < ALL_VALUES_COUNT; ++i)
+        state.all_values.push_back(static_cast<float>(i) * 1.25f - 20.0f);
+    memcpy(state.tag_id, "04A1B2C3D4E5F6\0\0\0\0\0\0", sizeof(state.tag_id));
+
+    bool send_illegal_data_address = true;
+
+    ModbusRegisterImage image;
+    image.init(warp_input_register_blocks, sizeof(warp_input_register_blocks) / sizeof(warp_input_register_blocks[0]));
+    auto update_image = [&state, &image]() {
+        image.fill([&state](uint16_t reg) {
+            uint32_t value = 0;
+            get_input_register(state, reg, false, &value);
+            return value;
+        });
+    };
+    update_image();
+
+    CHECK(image.get_register_count() == 14 + 52 + 10 + 170 + 4 + 14, "Image has %zu registers", image.get_register_count());
+
+    // Every register the stand-in switch knows is in a block.
+    for (uint32_t reg = 0; reg < 65536; ++reg) {
+        uint16_t value;
+        bool in_image = image.read(static_cast<uint16_t>(reg), 1, &value, true);
+        CHECK(image.contains(static_cast<uint16_t>(reg)) == in_image, "contains(%u) is %d, read is %d", reg, !in_image, in_image);
+
+        uint32_t unused;
+        CHECK(reg % 2 == 1 || in_image || !get_input_register(state, static_cast<uint16_t>(reg), true, &unused), "Register %u is not in a block", reg);
+    }
+
+    // Random requests, mostly around the blocks.
+    std::mt19937 rng{1};
+    std::vector<uint16_t> expected(125);
+    std::vector<uint16_t> actual(125);
+
+    for (int i = 0; i < 20000; ++i) {
+        static const uint16_t anchors[] = {0, 1000, 1050, 2000, 2100, 2268, 3100, 4000, 4012};
+        uint16_t start = static_cast<uint16_t>(anchors[rng() % 9] + rng() % 40 - 20);
+        if (start > 60000)
+            start = static_cast<uint16_t>(rng() % 20);
+        uint16_t count = static_cast<uint16_t>(1 + rng() % 125);
+        send_illegal_data_address = rng() % 2 == 0;
+
+        std::fill(expected.begin(), expected.end(), 0xAAAA);
+        std::fill(actual.begin(), actual.end(), 0xAAAA);
+
+        bool expected_ok = read_pairs(state, start, count, expected.data(), send_illegal_data_address);
+        bool actual_ok = image.read(start, count, actual.data(), send_illegal_data_address);
+
+        CHECK(expected_ok == actual_ok, "Read of %u registers at %u (illegal addresses %d): %d, expected %d", count, start, send_illegal_data_address, actual_ok, expected_ok);
+        CHECK(!expected_ok || memcmp(expected.data(), actual.data(), count * sizeof(uint16_t)) == 0, "Read of %u registers at %u (illegal addresses %d) differs", count, start, send_illegal_data_address);
+    }
+
+    // Updates show up after the next image update.
+    state.meter_values.values[0].f = -42.0f;
+    update_image();
+    uint16_t power[2];
+    image.read(2002, 2, power, true);
+    uint16_t expected_power[2];
+    read_pairs(state, 2002, 2, expected_power, true);
+    CHECK(memcmp(power, expected_power, sizeof(power)) == 0, "Power not updated");
+
+    // Benchmark
+    send_illegal_data_address = true;
+    uint16_t buf[125];
+    volatile uint32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const Request &r : full_table_poll) {
+            read_pairs(state, r.start, r.count, buf, send_illegal_data_address);
+            sink = sink + buf[i % r.count];
+        }
+    }
+    auto pairs_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const Request &r : full_table_poll) {
+            image.read(r.start, r.count, buf, send_illegal_data_address);
+            sink = sink + buf[i % r.count];
+        }
+    }
+    auto image_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        update_image();
+        image.read(0, 2, buf, send_illegal_data_address);
+        sink = sink + buf[0];
+    }
+    auto update_time = std::chrono::steady_clock::now() - start;
+
+    auto us = [iterations](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count() / iterations;
+    };
+
+    printf("full table poll (%zu requests, %zu registers):\n", sizeof(full_table_poll) / sizeof(full_table_poll[0]), image.get_register_count());
+    printf("  register pairs: %8.3f us\n", us(pairs_time));
+    printf("  register image: %8.3f us\n", us(image_time));
+    printf("  image update:   %8.3f us (at most once per 100 ms while clients read)\n", us(update_time));
+
+    return host_test_result();
+}
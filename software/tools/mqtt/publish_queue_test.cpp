@@ -0,0 +1,438 @@
+// Applies random pushes, pops and requeues to the publish queue and to a
+// model and checks that both agree on the queued messages and counters.
+// Checks that messages that don't coalesce, like those of automation
+// actions, are neither replaced nor dropped.
+// Then runs a simulated main loop that publishes 20 states every 2 ms over
+// a connection throttled to about 256 KB/s: Once writing directly in the
+// loop, as Mqtt::publish did before, and once through the queue with a
+// sender thread. Reports the loop iteration times and checks that the
+// receiver ends up with the latest payload of every topic in both cases.
+//
+// Usage: publish_queue_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "mqtt_publish_queue.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_MESSAGES 256
+#define MAX_BYTES 8192
+#define BATCH_SIZE 8
+
+struct ModelMessage {
+    std::string topic;
+    std::string payload;
+    bool retain;
+    bool coalesce;
+};
+
+struct Model {
+    std::deque<ModelMessage> messages;
+    size_t max_messages;
+    size_t max_bytes;
+    uint32_t coalesced = 0;
+    uint32_t dropped = 0;
+
+    static size_t message_bytes(const ModelMessage &m) { return m.topic.size() + m.payload.size() + 2; }
+
+    size_t bytes() const
+    {
+        size_t sum = 0;
+        for (const ModelMessage &m : messages)
+            sum += message_bytes(m);
+        return sum;
+    }
+
+    MqttPublishQueue::PushResult push(const ModelMessage &msg)
+    {
+        size_t new_bytes = message_bytes(msg);
+
+        for (auto it = messages.rbegin(); msg.coalesce && it != messages.rend(); ++it) {
+            ModelMessage &queued = *it;
+
+            if (queued.topic != msg.topic)
+                continue;
+
+            if (!queued.coalesce)
+                break;
+
+            if (messages.size() > 1 && bytes() - message_bytes(queued) + new_bytes > max_bytes) {
+                ++dropped;
+                return MqttPublishQueue::PushResult::Full;
+            }
+
+            queued = msg;
+            ++coalesced;
+            return MqttPublishQueue::PushResult::Coalesced;
+        }
+
+        if (messages.size() >= max_messages || (!messages.empty() && bytes() + new_bytes > max_bytes)) {
+            ++dropped;
+            return MqttPublishQueue::PushResult::Full;
+        }
+
+        messages.push_back(msg);
+        return MqttPublishQueue::PushResult::Queued;
+    }
+
+    void requeue(const std::vector<ModelMessage> &requeued)
+    {
+        std::vector<ModelMessage> kept;
+        for (const ModelMessage &r : requeued) {
+            bool newer_queued = std::any_of(messages.begin(), messages.end(), [&r](const ModelMessage &m) {return r.coalesce && m.coalesce && m.topic == r.topic;});
+            if (!newer_queued)
+                kept.push_back(r);
+        }
+        messages.insert(messages.begin(), kept.begin(), kept.end());
+    }
+};
+
+static void check_model(const MqttPublishQueue &queue, const Model &model, const char *where)
+{
+    CHECK(queue.get_count() == model.messages.size(), "%s: %zu messages, expected %zu", where, queue.get_count(), model.messages.size());
+    CHECK(queue.get_bytes() == model.bytes(), "%s: %zu bytes, expected %zu", where, queue.get_bytes(), model.bytes());
+    CHECK(queue.get_coalesced() == model.coalesced, "%s: %u coalesced, expected %u", where, queue.get_coalesced(), model.coalesced);
+    CHECK(queue.get_dropped() == model.dropped, "%s: %u dropped, expected %u", where, queue.get_dropped(), model.dropped);
+}
+
+static bool same_message(const MqttPublishMessage &msg, const ModelMessage &m)
+{
+    return std::string(msg.topic, msg.topic_len) == m.topic &&
+           std::string(msg.payload, msg.payload_len) == m.payload &&
+           msg.topic[msg.topic_len] == '\0' && msg.payload[msg.payload_len] == '\0' &&
+           msg.retain == m.retain && msg.coalesce == m.coalesce;
+}
+
+static void model_test()
+{
+    std::mt19937 rng{1};
+    MqttPublishQueue queue;
+    Model model;
+    model.max_messages = 32;
+    model.max_bytes = 2048;
+    queue.set_limits(model.max_messages, model.max_bytes);
+
+    for (int op = 0; op < 200000; ++op) {
+        uint32_t r = static_cast<uint32_t>(rng() % 100);
+
+        if (r < 70) {
+            ModelMessage msg;
+            msg.topic = "warp/test/" + std::to_string(rng() % 48);
+            // Sometimes larger than the whole queue: Only accepted if the queue is empty.
+            msg.payload = std::string(rng() % 50 == 0 ? 2100 : rng() % 160, static_cast<char>('a' + rng() % 26));
+            msg.retain = rng() % 2 == 0;
+            // Mostly states. The others are like automation actions.
+            msg.coalesce = rng() % 4 != 0;
+
+            MqttPublishQueue::PushResult expected = model.push(msg);
+            MqttPublishQueue::PushResult result = queue.push(msg.topic.data(), msg.topic.size(), msg.payload.data(), msg.payload.size(), msg.retain, msg.coalesce);
+            CHECK(result == expected, "Op %d: push of %s returned %d, expected %d", op, msg.topic.c_str(), static_cast<int>(result), static_cast<int>(expected));
+        } else if (r < 97) {
+            MqttPublishMessage batch[BATCH_SIZE];
+            size_t max_count = 1 + rng() % BATCH_SIZE;
+            size_t count = queue.pop(batch, max_count);
+            CHECK(count == std::min(max_count, model.messages.size()), "Op %d: popped %zu", op, count);
+
+            std::vector<ModelMessage> popped;
+            for (size_t i = 0; i < count && !model.messages.empty(); ++i) {
+                CHECK(same_message(batch[i], model.messages.front()), "Op %d: popped message %zu differs", op, i);
+                popped.push_back(model.messages.front());
+                model.messages.pop_front();
+            }
+
+            // Newer payloads arrive while the batch is being sent.
+            for (int i = 0; i < 3; ++i) {
+                ModelMessage msg{"warp/test/" + std::to_string(rng() % 48), std::to_string(op), false, rng() % 4 != 0};
+                model.push(msg);
+                queue.push(msg.topic.data(), msg.topic.size(), msg.payload.data(), msg.payload.size(), msg.retain, msg.coalesce);
+            }
+
+            // Sending fails after some messages.
+            size_t sent = rng() % 2 == 0 ? count : rng() % (count + 1);
+            for (size_t i = 0; i < sent; ++i)
+                MqttPublishQueue::free_message(&batch[i]);
+
+            model.requeue(std::vector<ModelMessage>(popped.begin() + static_cast<ptrdiff_t>(sent), popped.end()));
+            queue.requeue(batch + sent, count - sent);
+        } else {
+            model.messages.clear();
+            queue.clear();
+        }
+
+        check_model(queue, model, "Random operations");
+    }
+
+    // Order and contents of what is left.
+    MqttPublishMessage batch[BATCH_SIZE];
+    size_t count;
+    while ((count = queue.pop(batch, BATCH_SIZE)) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            CHECK(!model.messages.empty() && same_message(batch[i], model.messages.front()), "Final pop: message differs");
+            if (!model.messages.empty())
+                model.messages.pop_front();
+            MqttPublishQueue::free_message(&batch[i]);
+        }
+    }
+    CHECK(model.messages.empty(), "Final pop: %zu messages missing", model.messages.size());
+}
+
+// Messages that don't coalesce are all sent in order and a state doesn't replace them.
+static void check_payloads(MqttPublishMessage *batch, size_t count, const std::vector<std::string> &expected, const char *where)
+{
+    CHECK(count == expected.size(), "%s: %zu messages, expected %zu", where, count, expected.size());
+
+    for (size_t i = 0; i < count && i < expected.size(); ++i)
+        CHECK(batch[i].payload == expected[i], "%s: message %zu is %s, expected %s", where, i, batch[i].payload, expected[i].c_str());
+}
+
+static void no_coalesce_test()
+{
+    MqttPublishQueue queue;
+    queue.set_limits(MAX_MESSAGES, MAX_BYTES);
+
+    const std::string topic = "warp/automation_action/test";
+    auto push = [&queue, &topic](const std::string &payload, bool coalesce) {
+        queue.push(topic.data(), topic.size(), payload.data(), payload.size(), false, coalesce);
+    };
+
+    push("state 1", true);
+    push("action 1", false);
+    push("action 2", false);
+    push("state 2", true);
+    push("state 3", true);
+
+    MqttPublishMessage batch[BATCH_SIZE];
+    size_t count = queue.pop(batch, BATCH_SIZE);
+    check_payloads(batch, count, {"state 1", "action 1", "action 2", "state 3"}, "Queued");
+
+    // Only the first one is sent. A newer state arrives before the others are requeued.
+    MqttPublishQueue::free_message(&batch[0]);
+    push("state 4", true);
+    queue.requeue(batch + 1, count - 1);
+
+    count = queue.pop(batch, BATCH_SIZE);
+    check_payloads(batch, count, {"action 1", "action 2", "state 4"}, "Requeued");
+
+    for (size_t i = 0; i < count; ++i)
+        MqttPublishQueue::free_message(&batch[i]);
+}
+
+// A connection to a slow broker: Small socket buffers and a reader that
+// reads 1 KB every 4 ms. Remembers the last payload of each topic.
+class ThrottledConnection
+{
+public:
+    ThrottledConnection()
+    {
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        int size = 4096;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        reader = std::thread([this] {read_all();});
+    }
+
+    void write_message(const char *topic, size_t topic_len, const char *payload, size_t payload_len)
+    {
+        std::string frame(topic, topic_len);
+        frame += '\0';
+        frame.append(payload, payload_len);
+        frame += '\0';
+
+        size_t done = 0;
+        while (done < frame.size()) {
+            ssize_t written = write(fds[0], frame.data() + done, frame.size() - done);
+            if (written <= 0)
+                return;
+            done += static_cast<size_t>(written);
+        }
+    }
+
+    // Closes the connection and waits until everything is read.
+    std::map<std::string, std::string> finish()
+    {
+        close(fds[0]);
+        reader.join();
+        close(fds[1]);
+        return last_payloads;
+    }
+
+    size_t received = 0;
+
+private:
+    void read_all()
+    {
+        std::string pending;
+        char buf[1024];
+        ssize_t len;
+
+        while ((len = read(fds[1], buf, sizeof(buf))) > 0) {
+            received += static_cast<size_t>(len);
+            pending.append(buf, static_cast<size_t>(len));
+
+            size_t topic_end;
+            size_t payload_end;
+            while ((topic_end = pending.find('\0')) != std::string::npos && (payload_end = pending.find('\0', topic_end + 1)) != std::string::npos) {
+                last_payloads[pending.substr(0, topic_end)] = pending.substr(topic_end + 1, payload_end - topic_end - 1);
+                pending.erase(0, payload_end + 1);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(4));
+        }
+    }
+
+    int fds[2];
+    std::thread reader;
+    std::map<std::string, std::string> last_payloads;
+};
+
+struct LoopResult {
+    std::vector<double> iteration_us;
+    std::map<std::string, std::string> expected;
+    std::map<std::string, std::string> received;
+    size_t bytes_sent = 0;
+    uint32_t coalesced = 0;
+    uint32_t dropped = 0;
+};
+
+// One main loop iteration: Every state changes and is published.
+template<typename F>
+static void run_loop(int iterations, LoopResult &r, F &&publish)
+{
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+
+        for (int state = 0; state < 20; ++state) {
+            std::string topic = "warp/meters/" + std::to_string(state) + "/values";
+            std::string payload = "[" + std::to_string(i) + std::string(90, ',') + "0]";
+            // A rejected state stays updated and is published in the next iteration.
+            if (publish(topic, payload))
+                r.expected[topic] = payload;
+        }
+
+        r.iteration_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+static LoopResult run_direct(int iterations)
+{
+    LoopResult r;
+    ThrottledConnection conn;
+
+    run_loop(iterations, r, [&conn, &r](const std::string &topic, const std::string &payload) {
+        conn.write_message(topic.data(), topic.size(), payload.data(), payload.size());
+        r.bytes_sent += topic.size() + payload.size() + 2;
+        return true;
+    });
+
+    r.received = conn.finish();
+    return r;
+}
+
+static LoopResult run_queued(int iterations)
+{
+    LoopResult r;
+    ThrottledConnection conn;
+    MqttPublishQueue queue;
+    queue.set_limits(MAX_MESSAGES, MAX_BYTES);
+    std::mutex mutex;
+    std::condition_variable notify;
+    bool notified = false;
+    bool stop = false;
+
+    // Same as Mqtt::sender_task.
+    std::thread sender([&] {
+        MqttPublishMessage batch[BATCH_SIZE];
+
+        while (true) {
+            size_t count;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                notify.wait(lock, [&] {return notified || stop || queue.get_count() > 0;});
+                notified = false;
+                count = queue.pop(batch, BATCH_SIZE);
+                if (count == 0 && stop)
+                    break;
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                conn.write_message(batch[i].topic, batch[i].topic_len, batch[i].payload, batch[i].payload_len);
+                r.bytes_sent += batch[i].topic_len + batch[i].payload_len + 2;
+                MqttPublishQueue::free_message(&batch[i]);
+            }
+        }
+    });
+
+    run_loop(iterations, r, [&](const std::string &topic, const std::string &payload) {
+        MqttPublishQueue::PushResult result;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            result = queue.push(topic.data(), topic.size(), payload.data(), payload.size(), true, true);
+            notified = true;
+        }
+        notify.notify_one();
+        return result != MqttPublishQueue::PushResult::Full;
+    });
+
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stop = true;
+        r.coalesced = queue.get_coalesced();
+        r.dropped = queue.get_dropped();
+    }
+    notify.notify_one();
+    sender.join();
+
+    r.received = conn.finish();
+    return r;
+}
+
+static void report(const char *name, LoopResult &r)
+{
+    CHECK(r.received == r.expected, "%s: The receiver doesn't have the latest payload of every topic", name);
+
+    std::vector<double> sorted = r.iteration_us;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double us : sorted)
+        sum += us;
+
+    printf("%-7s loop: mean %9.1f us, p99 %9.1f us, max %9.1f us; %7zu bytes sent, %5u coalesced, %u dropped\n",
+           name, sum / static_cast<double>(sorted.size()), sorted[sorted.size() * 99 / 100], sorted.back(), r.bytes_sent, r.coalesced, r.dropped);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 200;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    model_test();
+    no_coalesce_test();
+
+    LoopResult direct = run_direct(iterations);
+    LoopResult queued = run_queued(iterations);
+
+    printf("%d iterations, 20 states of 100 bytes every 2 ms, connection reads 1 KB every 4 ms\n", iterations);
+    report("direct", direct);
+    report("queued", queued);
+
+    return host_test_result();
+}
@@ -0,0 +1,231 @@
+// Feeds random traces through a history ring like update_minmax_filter does
+// and checks the min and max of the wedges against the linear rescan they
+// replaced and against a brute force over the window. History lengths start
+// at 1, so traces wrap around the ring many times, and values are drawn from
+// small ranges so that many of them are equal. Filters are restarted at
+// random points like after a meter reconnect. Checks that a wedge never holds
+// more positions than the history has.
+// Reports the time per update of both for a long window with a falling
+// trace, which makes the rescan run on every update.
+//
+// Usage: minmax_wedge_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "minmax_wedge.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// update_minmax_filter as it was before the wedges.
+struct LinearFilter {
+    std::vector<int32_t> values;
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MAX;
+    int32_t history_pos = 0;
+    int32_t history_min_pos = 0;
+    int32_t history_max_pos = 0;
+
+    explicit LinearFilter(int32_t history_length) : values(static_cast<size_t>(history_length)) {}
+
+    int32_t length() const { return static_cast<int32_t>(values.size()); }
+
+    void update(int32_t new_value)
+    {
+        if (min == INT32_MAX) {
+            min = new_value;
+            max = new_value;
+            history_pos = length() == 1 ? 0 : 1;
+            values[0] = new_value;
+            history_min_pos = 0;
+            history_max_pos = 0;
+            return;
+        }
+
+        values[static_cast<size_t>(history_pos)] = new_value;
+
+        if (new_value <= min) {
+            min = new_value;
+            history_min_pos = history_pos;
+        } else if (history_min_pos == history_pos) {
+            min = INT32_MAX;
+            for (int32_t i = history_pos + 1; i < length(); i++) {
+                if (values[static_cast<size_t>(i)] <= min) {
+                    min = values[static_cast<size_t>(i)];
+                    history_min_pos = i;
+                }
+            }
+            for (int32_t i = 0; i <= history_pos; i++) {
+                if (values[static_cast<size_t>(i)] <= min) {
+                    min = values[static_cast<size_t>(i)];
+                    history_min_pos = i;
+                }
+            }
+        }
+
+        if (new_value >= max) {
+            max = new_value;
+            history_max_pos = history_pos;
+        } else if (history_max_pos == history_pos) {
+            max = INT32_MIN;
+            for (int32_t i = history_pos + 1; i < length(); i++) {
+                if (values[static_cast<size_t>(i)] >= max) {
+                    max = values[static_cast<size_t>(i)];
+                    history_max_pos = i;
+                }
+            }
+            for (int32_t i = 0; i <= history_pos; i++) {
+                if (values[static_cast<size_t>(i)] >= max) {
+                    max = values[static_cast<size_t>(i)];
+                    history_max_pos = i;
+                }
+            }
+        }
+
+        history_pos++;
+        if (history_pos >= length()) {
+            history_pos = 0;
+        }
+    }
+};
+
+// update_minmax_filter with the wedges.
+struct WedgeFilter {
+    std::vector<int32_t> values;
+    std::vector<uint16_t> min_positions;
+    std::vector<uint16_t> max_positions;
+    minmax_wedge min_wedge;
+    minmax_wedge max_wedge;
+    int32_t min = INT32_MAX;
+    int32_t max = INT32_MAX;
+    int32_t history_pos = 0;
+
+    explicit WedgeFilter(int32_t history_length) :
+        values(static_cast<size_t>(history_length)),
+        min_positions(static_cast<size_t>(history_length)),
+        max_positions(static_cast<size_t>(history_length))
+    {
+        min_wedge.positions = min_positions.data();
+        max_wedge.positions = max_positions.data();
+    }
+
+    int32_t length() const { return static_cast<int32_t>(values.size()); }
+
+    void update(int32_t new_value)
+    {
+        if (min == INT32_MAX) {
+            min = new_value;
+            max = new_value;
+            history_pos = length() == 1 ? 0 : 1;
+            values[0] = new_value;
+            init_minmax_wedge(&min_wedge);
+            init_minmax_wedge(&max_wedge);
+            return;
+        }
+
+        values[static_cast<size_t>(history_pos)] = new_value;
+        min = update_minmax_wedge<true>(&min_wedge, values.data(), length(), history_pos);
+        max = update_minmax_wedge<false>(&max_wedge, values.data(), length(), history_pos);
+
+        history_pos++;
+        if (history_pos >= length()) {
+            history_pos = 0;
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    std::mt19937 rng(1234);
+    auto random = [&rng](uint32_t n) {return static_cast<int32_t>(rng() % n);};
+
+    for (int iter = 0; iter < iterations; ++iter) {
+        int32_t history_length = iter < 8 ? 1 + iter : 1 + random(300);
+        int32_t value_range = 1 + random(iter % 2 == 0 ? 4 : 100000);
+        int32_t updates = history_length * (2 + random(10)) + random(50);
+
+        LinearFilter linear(history_length);
+        WedgeFilter wedge(history_length);
+        std::vector<int32_t> trace;
+
+        for (int32_t i = 0; i < updates; ++i) {
+            int32_t value;
+
+            switch (random(4)) {
+                case 0:  value = trace.empty() ? 0 : trace.back(); break;                   // Repeat
+                case 1:  value = trace.empty() ? 0 : trace.back() - 1 - random(3); break;   // Falling
+                case 2:  value = trace.empty() ? 0 : trace.back() + 1 + random(3); break;   // Rising
+                default: value = random(static_cast<uint32_t>(value_range)) - value_range / 2;
+            }
+
+            if (random(200) == 0) {
+                linear.min = INT32_MAX;
+                wedge.min = INT32_MAX;
+                trace.clear();
+            }
+
+            trace.push_back(value);
+            linear.update(value);
+            wedge.update(value);
+
+            size_t window = std::min(trace.size(), static_cast<size_t>(history_length));
+            int32_t expected_min = INT32_MAX;
+            int32_t expected_max = INT32_MIN;
+            for (size_t j = trace.size() - window; j < trace.size(); ++j) {
+                expected_min = std::min(expected_min, trace[j]);
+                expected_max = std::max(expected_max, trace[j]);
+            }
+
+            CHECK(linear.min == expected_min && linear.max == expected_max, "Length %d, update %d: Linear min/max %d/%d, expected %d/%d",
+                  history_length, i, linear.min, linear.max, expected_min, expected_max);
+            CHECK(wedge.min == linear.min && wedge.max == linear.max, "Length %d, update %d: Wedge min/max %d/%d, linear %d/%d",
+                  history_length, i, wedge.min, wedge.max, linear.min, linear.max);
+            CHECK(wedge.history_pos == linear.history_pos, "Length %d, update %d: Position %d, linear %d", history_length, i, wedge.history_pos, linear.history_pos);
+            CHECK(wedge.min_wedge.count >= 1 && wedge.min_wedge.count <= history_length && wedge.max_wedge.count >= 1 && wedge.max_wedge.count <= history_length,
+                  "Length %d, update %d: Wedges hold %d and %d positions", history_length, i, wedge.min_wedge.count, wedge.max_wedge.count);
+
+            if (failures > 0)
+                break;
+        }
+    }
+
+    // A falling trace moves the max out of the window on every update.
+    const int32_t history_length = 1200;
+    const int32_t updates = iterations * 100;
+
+    LinearFilter linear(history_length);
+    WedgeFilter wedge(history_length);
+    int64_t checksum[2] = {0, 0};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < updates; ++i) {
+        linear.update(-i);
+        checksum[0] += linear.max;
+    }
+    auto linear_done = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < updates; ++i) {
+        wedge.update(-i);
+        checksum[1] += wedge.max;
+    }
+    auto wedge_done = std::chrono::steady_clock::now();
+
+    CHECK(checksum[0] == checksum[1], "Falling trace: Checksums differ");
+
+    double linear_ns = std::chrono::duration<double, std::nano>(linear_done - start).count() / updates;
+    double wedge_ns = std::chrono::duration<double, std::nano>(wedge_done - linear_done).count() / updates;
+
+    printf("Falling trace, history of %d values, %d updates\n", history_length, updates);
+    printf("  linear rescan: %8.1f ns per update\n", linear_ns);
+    printf("  wedges:        %8.1f ns per update\n", wedge_ns);
+
+    return host_test_result();
+}
@@ -0,0 +1,230 @@
+// Applies random renames and removals to the username index and to a model
+// of the username file and checks that both agree on every lookup.
+// Then measures, with a full table of 256 users, the username check of
+// users/add and the display name lookups of a 2000 record PDF export:
+// Scanning the file with one seek and read per entry as before against
+// the index, which only reads the file to confirm a hash match.
+//
+// Usage: username_index_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "username_index.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define USERNAME_LENGTH 32
+#define DISPLAY_NAME_LENGTH 32
+#define USERNAME_ENTRY_LENGTH (USERNAME_LENGTH + DISPLAY_NAME_LENGTH)
+
+struct Entry {
+    std::string username;
+    std::string display_name;
+};
+
+static void set(UsernameIndex &index, std::vector<Entry> &model, uint8_t user_id, const std::string &username, const std::string &display_name)
+{
+    model[user_id] = {username, display_name};
+    index.set(user_id, username.data(), username.size(), display_name.data(), display_name.size());
+}
+
+static void check_model(UsernameIndex &index, const std::vector<Entry> &model, const std::vector<std::string> &names)
+{
+    for (size_t i = 0; i < USERNAME_INDEX_USERS; ++i) {
+        uint8_t user_id = static_cast<uint8_t>(i);
+        CHECK(index.is_free(user_id) == model[i].username.empty(), "User %zu: is_free is %d", i, index.is_free(user_id));
+
+        char buf[DISPLAY_NAME_LENGTH];
+        size_t len = index.get_display_name(user_id, buf);
+        CHECK(std::string(buf, len) == model[i].display_name, "User %zu: display name [%.*s], expected [%s]", i, static_cast<int>(len), buf, model[i].display_name.c_str());
+    }
+
+    for (const std::string &name : names) {
+        // Same as users/modify: Skip one user ID.
+        for (int skip : {-1, 0, 7}) {
+            int expected = -1;
+            for (size_t i = 0; i < USERNAME_INDEX_USERS && expected < 0; ++i) {
+                if (static_cast<int>(i) != skip && model[i].username == name)
+                    expected = static_cast<int>(i);
+            }
+
+            int found = index.find(name.data(), name.size(), [&model, &name, skip](uint8_t user_id) {
+                return user_id != skip && model[user_id].username == name;
+            });
+
+            CHECK((found < 0) == (expected < 0), "[%s] skipping %d: found %d, expected %d", name.c_str(), skip, found, expected);
+            CHECK(found < 0 || model[static_cast<size_t>(found)].username == name, "[%s]: found %d with another username", name.c_str(), found);
+        }
+    }
+}
+
+static std::string random_name(std::mt19937 &rng, const char *prefix, size_t max_len)
+{
+    std::string name = prefix + std::to_string(rng() % 400);
+    size_t len = rng() % (max_len + 1);
+    while (name.size() < len)
+        name += static_cast<char>('a' + rng() % 26);
+    return name.substr(0, max_len);
+}
+
+// The username check of users/add before the index: Read every entry of the file.
+static bool scan_file(const char *path, const std::string &username)
+{
+    char buf[USERNAME_LENGTH + 1] = {0};
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    bool found = false;
+
+    for (long i = 0; i < size; i += USERNAME_ENTRY_LENGTH) {
+        fseek(f, i, SEEK_SET);
+        if (fread(buf, 1, USERNAME_LENGTH, f) == USERNAME_LENGTH && username == buf) {
+            found = true;
+            break;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+static void read_entry(const char *path, uint8_t user_id, size_t offset, char *buf)
+{
+    FILE *f = fopen(path, "rb");
+    fseek(f, static_cast<long>(user_id * USERNAME_ENTRY_LENGTH + offset), SEEK_SET);
+    if (fread(buf, 1, 32, f) != 32)
+        buf[0] = '\0';
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    std::mt19937 rng{1};
+    static UsernameIndex index;
+    std::vector<Entry> model(USERNAME_INDEX_USERS);
+
+    std::vector<std::string> names;
+    for (int i = 0; i < 400; ++i)
+        names.push_back("user" + std::to_string(i));
+
+    // Random renames, duplicate usernames and removals. Names are taken from a small set,
+    // so that most lookups hit and the probe sequences get long.
+    for (int round = 0; round < 20; ++round) {
+        for (int op = 0; op < 500; ++op) {
+            uint8_t user_id = static_cast<uint8_t>(rng());
+
+            if (rng() % 4 == 0)
+                set(index, model, user_id, "", "");
+            else
+                set(index, model, user_id, names[rng() % names.size()], random_name(rng, "Name ", DISPLAY_NAME_LENGTH));
+        }
+
+        check_model(index, model, names);
+    }
+
+    // Full table: every user ID is in use.
+    index.clear();
+    for (size_t i = 0; i < USERNAME_INDEX_USERS; ++i)
+        set(index, model, static_cast<uint8_t>(i), random_name(rng, "u", USERNAME_LENGTH - 1), random_name(rng, "Display ", DISPLAY_NAME_LENGTH));
+    check_model(index, model, names);
+
+    char path[] = "/tmp/username_index_testXXXXXX";
+    int fd = mkstemp(path);
+    FILE *f = fdopen(fd, "wb");
+    for (const Entry &e : model) {
+        char entry[USERNAME_ENTRY_LENGTH] = {};
+        memcpy(entry, e.username.data(), e.username.size());
+        memcpy(entry + USERNAME_LENGTH, e.display_name.data(), e.display_name.size());
+        fwrite(entry, 1, sizeof(entry), f);
+    }
+    fclose(f);
+
+    auto file_matches = [&path](uint8_t user_id, const std::string &username) {
+        char buf[USERNAME_LENGTH + 1] = {0};
+        read_entry(path, user_id, 0, buf);
+        return username == buf;
+    };
+
+    // users/add with a new username: Not found anywhere, so the whole file is read before.
+    std::string new_username = "new user";
+    volatile int sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        sink = sink + scan_file(path, new_username);
+    auto scan_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        sink = sink + index.find(new_username.data(), new_username.size(), [&](uint8_t user_id) {return file_matches(user_id, new_username);});
+    auto find_time = std::chrono::steady_clock::now() - start;
+
+    // An existing username: The index reads the one matching entry to confirm it.
+    const std::string &existing = model[200].username;
+    CHECK(scan_file(path, existing), "Scan doesn't find [%s]", existing.c_str());
+    CHECK(index.find(existing.data(), existing.size(), [&](uint8_t user_id) {return file_matches(user_id, existing);}) >= 0, "Index doesn't find [%s]", existing.c_str());
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        sink = sink + index.find(existing.data(), existing.size(), [&](uint8_t user_id) {return file_matches(user_id, existing);});
+    auto find_existing_time = std::chrono::steady_clock::now() - start;
+
+    // PDF export: Before, each user's display name was read from the file once per export.
+    // Now each record copies it from the index under the lock.
+    const int records = 2000;
+    std::vector<uint8_t> record_users(records);
+    for (uint8_t &user_id : record_users)
+        user_id = static_cast<uint8_t>(rng());
+
+    char buf[DISPLAY_NAME_LENGTH + 1];
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (size_t user_id = 0; user_id < USERNAME_INDEX_USERS; ++user_id) {
+            read_entry(path, static_cast<uint8_t>(user_id), USERNAME_LENGTH, buf);
+            sink = sink + buf[0];
+        }
+    }
+    auto pdf_file_time = std::chrono::steady_clock::now() - start;
+
+    std::mutex mutex;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (uint8_t user_id : record_users) {
+            std::lock_guard<std::mutex> lock{mutex};
+            sink = sink + static_cast<int>(index.get_display_name(user_id, buf));
+        }
+    }
+    auto pdf_index_time = std::chrono::steady_clock::now() - start;
+
+    for (uint8_t user_id : record_users) {
+        size_t len = index.get_display_name(user_id, buf);
+        CHECK(std::string(buf, len) == model[user_id].display_name, "PDF lookup of user %u is wrong", user_id);
+    }
+
+    remove(path);
+
+    auto us = [iterations](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count() / iterations;
+    };
+
+    printf("index: %zu bytes for %d users\n", index.get_memory_usage(), USERNAME_INDEX_USERS);
+    printf("users/add, new username:      file scan %9.3f us, index %9.3f us\n", us(scan_time), us(find_time));
+    printf("users/add, existing username: index %9.3f us (one entry read)\n", us(find_existing_time));
+    printf("PDF, %d records:            file %9.3f us (once per user), index %9.3f us (every record)\n", records, us(pdf_file_time), us(pdf_index_time));
+    printf("File times are from the host's page cache; LittleFS on flash is much slower per seek and read.\n");
+
+    return host_test_result();
+}
@@ -0,0 +1,14 @@
+# Generates web_assets.embedded.cpp/.h for web_assets_test into the directory given as argument.
+
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.realpath(__file__)), '..', '..'))
+
+import util
+
+util.embed_web_assets([
+    ('/', 'text/html; charset=utf-8', b'index gzip', b'index br', False),
+    ('/assets/main-ABCD1234.css', 'text/css; charset=utf-8', bytes(range(256)), None, True),
+    ('/assets/main-EFGH5678.js', 'text/javascript; charset=utf-8', b'\x1f\x8b' + b'js' * 20, b'\x1b' + b'js' * 10, True),
+], sys.argv[1], 'web_assets')
@@ -0,0 +1,95 @@
+// Checks accepts_content_coding with the Accept-Encoding headers of common
+// browsers and with q-values and wildcards, and find_web_asset and the table
+// generated by util.embed_web_assets (see embed_test_assets.py).
+// Then measures the header parsing that runs on every request for an asset.
+//
+// Usage: web_assets_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "web_assets.h"
+#include "web_assets.embedded.h"
+#include "host_test.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+struct AcceptCase {
+    const char *accept_encoding;
+    bool br;
+    bool gzip;
+};
+
+static const AcceptCase accept_cases[] = {
+    {"gzip, deflate, br, zstd", true, true},      // Chrome
+    {"gzip, deflate, br", true, true},            // Firefox, Safari
+    {"gzip, deflate", false, true},               // Chrome and Firefox over plain HTTP: They only offer Brotli over HTTPS
+    {"", false, false},
+    {"identity", false, false},
+    {"br", true, false},
+    {"BR;Q=1", true, false},
+    {"br;q=0", false, false},
+    {"br;q=0.000, gzip", false, true},
+    {"br;q=0.001", true, false},
+    {"br ; q=0.5 , gzip;q=1.0", true, true},
+    {"*", true, true},
+    {"*;q=0", false, false},
+    {"*, br;q=0", false, true},
+    {"br;q=0.2, *;q=0", true, false},
+    {"gzip;level=9;q=0", false, false},
+    {"brotli, xbr, br-x", false, false},
+    {"gzip,br", true, true},
+    {" \tbr\t", true, false},
+};
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    for (const AcceptCase &c : accept_cases) {
+        CHECK(accepts_content_coding(c.accept_encoding, "br") == c.br, "[%s]: br should be %d", c.accept_encoding, c.br);
+        CHECK(accepts_content_coding(c.accept_encoding, "gzip") == c.gzip, "[%s]: gzip should be %d", c.accept_encoding, c.gzip);
+    }
+
+    CHECK(web_assets_count == 3, "%d assets", web_assets_count);
+
+    const WebAsset *index = find_web_asset(web_assets, web_assets_count, "/");
+    CHECK(index != nullptr && !index->immutable && strcmp(index->content_type, "text/html; charset=utf-8") == 0, "Index is wrong");
+    CHECK(index != nullptr && std::string(index->gzip_data, index->gzip_length) == "index gzip", "Index gzip data is wrong");
+    CHECK(index != nullptr && std::string(index->brotli_data, index->brotli_length) == "index br", "Index Brotli data is wrong");
+    CHECK(find_web_asset(web_assets, web_assets_count, "/?foo=bar") == index, "Query string isn't ignored");
+
+    const WebAsset *css = find_web_asset(web_assets, web_assets_count, "/assets/main-ABCD1234.css");
+    CHECK(css != nullptr && css->immutable && css->brotli_data == nullptr && css->gzip_length == 256, "CSS is wrong");
+    for (size_t i = 0; css != nullptr && i < css->gzip_length; ++i)
+        CHECK(static_cast<uint8_t>(css->gzip_data[i]) == i, "CSS byte %zu is %u", i, static_cast<uint8_t>(css->gzip_data[i]));
+
+    const WebAsset *js = find_web_asset(web_assets, web_assets_count, "/assets/main-EFGH5678.js");
+    CHECK(js != nullptr && js->gzip_length == 42 && js->brotli_length == 21, "JS is wrong");
+
+    CHECK(find_web_asset(web_assets, web_assets_count, "/assets/main-EFGH5678.j") == nullptr, "Prefix matches");
+    CHECK(find_web_asset(web_assets, web_assets_count, "/assets/main-EFGH5678.jsx") == nullptr, "Longer path matches");
+    CHECK(find_web_asset(web_assets, web_assets_count, "/assets/") == nullptr, "Directory matches");
+
+    // Every request for an asset: Look it up and parse Chrome's Accept-Encoding.
+    volatile size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; ++i) {
+        const WebAsset *asset = find_web_asset(web_assets, web_assets_count, "/assets/main-EFGH5678.js");
+        bool brotli = accepts_content_coding("gzip, deflate, br, zstd", "br");
+        sink = sink + (brotli ? asset->brotli_length : asset->gzip_length);
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+    printf("%zu Accept-Encoding cases, %d assets\n", sizeof(accept_cases) / sizeof(accept_cases[0]), web_assets_count);
+    printf("lookup and negotiation: %.1f ns per request on the host\n", ns);
+
+    return host_test_result();
+}
@@ -0,0 +1,475 @@
+// Simulates the web socket worker with two fast clients and one slow client
+// that can take only about 100 bytes per worker run, plus a fast and a slow
+// client with the state-patch subprotocol. 12 states change on every run and
+// an event log stream adds a message now and then. Like WS::pushStateUpdate,
+// clients without the subprotocol get full states, clients with it get patches
+// or, if a patch or full state of the same path is still queued, the full state
+// that replaces it. A state whose push failed is pushed again on the next run.
+// Checks for each client that the stream arrives in order and complete, that
+// no state goes back to an older value and that every client ends up with
+// the latest value of every state. Compares with patches that are never
+// replaced and with the queue as it was before: First in, first out without
+// replacing, and a slow client blocks the worker. Checks that items only
+// replace each other if path and variant are the same, not just the hash.
+//
+// Usage: work_queue_test [--iterations N]
+// Exits with 1 if a check fails.
+
+#include "web_sockets_work_queue.h"
+#include "host_test.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define STATES 12
+#define FIELDS 4
+#define TEXT 1
+
+// Key variants, as WebSocketsClientFilter.
+#define WITH_SUBPROTOCOL 1
+#define WITHOUT_SUBPROTOCOL 2
+
+static const int fds_without_subprotocol[MAX_WEB_SOCKET_CLIENTS] = {10, 11, 12, -1, -1};
+static const int fds_with_subprotocol[MAX_WEB_SOCKET_CLIENTS] = {-1, -1, -1, 13, 14};
+static const int fds_all[MAX_WEB_SOCKET_CLIENTS] = {10, 11, 12, 13, 14};
+
+struct Client {
+    Client(int fd_, long bytes_per_run_) : fd(fd_), bytes_per_run(bytes_per_run_) {}
+
+    int fd;
+    long bytes_per_run;
+    long budget = 0;
+
+    std::map<int, std::vector<int>> state_values; // Latest field values received per state.
+    int last_log = -1;
+    size_t logs_received = 0;
+    size_t received = 0;
+    size_t patches_received = 0;
+    int max_state_age = 0;                        // In worker runs between the update and its delivery.
+    bool went_back = false;
+};
+
+struct Result {
+    std::vector<Client> clients;
+    uint32_t replaced = 0;
+    uint32_t dropped = 0;
+    size_t logs_queued = 0;
+    std::vector<std::vector<int>> values = std::vector<std::vector<int>>(STATES, std::vector<int>(FIELDS, 0));
+    std::vector<uint32_t> dirty = std::vector<uint32_t>(STATES, 0); // Fields not pushed yet, like the updated flags.
+};
+
+static std::vector<Client> make_clients()
+{
+    return {{10, 1000000}, {11, 1000000}, {12, 100}, {13, 1000000}, {14, 100}};
+}
+
+static bool is_fast(const Client &c)
+{
+    return c.bytes_per_run > 100;
+}
+
+static char *make_payload(const std::string &s)
+{
+    char *buf = static_cast<char *>(malloc(s.size()));
+    memcpy(buf, s.data(), s.size());
+    return buf;
+}
+
+static void set_field(Client &c, int state, int field, int value)
+{
+    std::vector<int> &fields = c.state_values[state];
+    fields.resize(FIELDS, 0);
+
+    if (fields[static_cast<size_t>(field)] > value)
+        c.went_back = true;
+
+    fields[static_cast<size_t>(field)] = value;
+}
+
+// Payloads are "s <state> <run> <value> <value> <value> <value>",
+// "p <state> <run> <field>=<value> ..." or "l <message number>".
+static void deliver(Client &c, const char *payload, size_t payload_len, int run)
+{
+    std::string s(payload, payload_len);
+    c.budget -= static_cast<long>(payload_len);
+    ++c.received;
+
+    if (s[0] == 's' || s[0] == 'p') {
+        int state, pushed_run, consumed;
+        sscanf(s.c_str() + 2, "%d %d%n", &state, &pushed_run, &consumed);
+        const char *rest = s.c_str() + 2 + consumed;
+
+        if (s[0] == 's') {
+            for (int field = 0; field < FIELDS; ++field) {
+                int value;
+                sscanf(rest, " %d%n", &value, &consumed);
+                rest += consumed;
+                set_field(c, state, field, value);
+            }
+        } else {
+            int field, value;
+            while (sscanf(rest, " %d=%d%n", &field, &value, &consumed) == 2) {
+                rest += consumed;
+                set_field(c, state, field, value);
+            }
+
+            ++c.patches_received;
+        }
+
+        c.max_state_age = std::max(c.max_state_age, run - pushed_run);
+    } else {
+        int log = atoi(s.c_str() + 2);
+        CHECK(log > c.last_log, "Client %d: Log message %d after %d", c.fd, log, c.last_log);
+        c.last_log = log;
+        ++c.logs_received;
+    }
+}
+
+// The producer of one run: While producing, one field of every state changes and every fifth run adds a log message.
+// push(fds, payload, key, replace_queued) returns false if the queue is full, can_replace(key) is WebSocketsWorkQueue::can_replace.
+template<typename Push, typename CanReplace>
+static void produce(int run, bool producing, bool patches_replaceable, Result &r, Push &&push, CanReplace &&can_replace)
+{
+    for (int state = 0; state < STATES; ++state) {
+        std::vector<int> &fields = r.values[static_cast<size_t>(state)];
+        uint32_t &dirty = r.dirty[static_cast<size_t>(state)];
+
+        if (producing) {
+            int field = (run + state) % FIELDS;
+            ++fields[static_cast<size_t>(field)];
+            dirty |= 1u << field;
+        }
+
+        if (dirty == 0)
+            continue;
+
+        std::string path = "meters/" + std::to_string(state) + "/values";
+        std::string head = std::to_string(state) + " " + std::to_string(run);
+        std::string full = "s " + head;
+        std::string patch = "p " + head;
+
+        for (int field = 0; field < FIELDS; ++field) {
+            full += " " + std::to_string(fields[static_cast<size_t>(field)]);
+
+            if ((dirty & (1u << field)) != 0)
+                patch += " " + std::to_string(field) + "=" + std::to_string(fields[static_cast<size_t>(field)]);
+        }
+
+        WebSocketsWorkKey full_key = WebSocketsWorkKey::for_path(path.data(), path.size(), WITHOUT_SUBPROTOCOL);
+        bool success = push(fds_without_subprotocol, full, &full_key, true);
+
+        WebSocketsWorkKey patch_key = WebSocketsWorkKey::for_path(path.data(), path.size(), WITH_SUBPROTOCOL);
+        const WebSocketsWorkKey *key = patches_replaceable ? &patch_key : nullptr;
+
+        if (can_replace(key))
+            success = push(fds_with_subprotocol, full, key, true) && success;
+        else
+            success = push(fds_with_subprotocol, patch, key, false) && success;
+
+        // Like the updated flags: Kept if a push failed, so that the next patch contains the change again.
+        if (success)
+            dirty = 0;
+    }
+
+    if (producing && run % 5 == 0) {
+        // Like the WS backend, a stream message that doesn't fit is retried on the next run.
+        if (push(fds_all, "l " + std::to_string(r.logs_queued), nullptr, false))
+            ++r.logs_queued;
+    }
+}
+
+// The worker finishes a patch in flight between can_replace and the push of the next patch:
+// The next patch must not replace the first one, which a client still needs.
+static void check_patch_race()
+{
+    WebSocketsWorkQueue queue;
+    const WebSocketsWorkKey key = WebSocketsWorkKey::for_path("evse/state", 10, WITH_SUBPROTOCOL);
+    const std::string first = "p 0 0 0=1";
+    const std::string second = "p 0 1 1=1";
+
+    queue.push(fds_with_subprotocol, make_payload(first), first.size(), TEXT, &key, false);
+
+    ws_work_item wi;
+    queue.begin_next(0, &wi);
+    CHECK(!queue.can_replace(&key), "A patch in flight can be replaced");
+
+    // Sent to the fast client only.
+    queue.finish(wi.seq, 1u << 3);
+    queue.push(fds_with_subprotocol, make_payload(second), second.size(), TEXT, &key, false);
+
+    CHECK(queue.size() == 2, "%zu items queued after the second patch, expected 2", queue.size());
+    CHECK(queue.can_replace(&key), "Queued patches can't be replaced by a full state");
+
+    const std::string full = "s 0 2 1 1 0 0";
+    queue.push(fds_with_subprotocol, make_payload(full), full.size(), TEXT, &key, true);
+    CHECK(queue.get_replaced() == 1, "The full state replaced %u items, expected 1", queue.get_replaced());
+}
+
+// Two paths with the same hash, and two variants of a path with a hash forced to be the same,
+// must not replace each other.
+static void check_key_collision()
+{
+    // Numbered paths of the same length don't collide: Random names do after about 100000.
+    std::unordered_map<uint32_t, std::string> seen;
+    std::mt19937 rng(1);
+    std::string path_a;
+    std::string path_b;
+
+    for (int i = 0; path_a.empty() && i < 1000000; ++i) {
+        std::string path = "meters/";
+        for (int c = 0; c < 8; ++c)
+            path += static_cast<char>('a' + rng() % 26);
+
+        auto inserted = seen.emplace(WebSocketsWorkKey::for_path(path.data(), path.size(), WITH_SUBPROTOCOL).hash, path);
+
+        if (!inserted.second) {
+            path_a = inserted.first->second;
+            path_b = path;
+        }
+    }
+
+    CHECK(!path_a.empty(), "No two paths with the same hash found");
+
+    WebSocketsWorkKey key_a = WebSocketsWorkKey::for_path(path_a.data(), path_a.size(), WITH_SUBPROTOCOL);
+    WebSocketsWorkKey key_b = WebSocketsWorkKey::for_path(path_b.data(), path_b.size(), WITH_SUBPROTOCOL);
+    WebSocketsWorkKey key_a_variant = WebSocketsWorkKey::for_path(path_a.data(), path_a.size(), WITHOUT_SUBPROTOCOL);
+    key_a_variant.hash = key_a.hash;
+
+    WebSocketsWorkQueue queue;
+    const std::string payload_a = "s 0 0 1 0 0 0";
+    const std::string payload_b = "s 1 0 1 0 0 0";
+    const std::string payload_a_variant = "s 0 0 1 0 0 0";
+
+    queue.push(fds_with_subprotocol, make_payload(payload_a), payload_a.size(), TEXT, &key_a, true);
+    CHECK(!queue.can_replace(&key_b), "%s can replace %s", path_b.c_str(), path_a.c_str());
+    CHECK(!queue.can_replace(&key_a_variant), "Another variant of %s can replace it", path_a.c_str());
+
+    queue.push(fds_with_subprotocol, make_payload(payload_b), payload_b.size(), TEXT, &key_b, true);
+    queue.push(fds_without_subprotocol, make_payload(payload_a_variant), payload_a_variant.size(), TEXT, &key_a_variant, true);
+    CHECK(queue.size() == 3 && queue.get_replaced() == 0, "%zu items queued and %u replaced, expected 3 and 0", queue.size(), queue.get_replaced());
+
+    // The path is copied: The key of a queued item doesn't depend on the caller's string.
+    std::string path_copy = path_a;
+    WebSocketsWorkKey key_copy = WebSocketsWorkKey::for_path(path_copy.data(), path_copy.size(), WITH_SUBPROTOCOL);
+    queue.push(fds_with_subprotocol, make_payload(payload_a), payload_a.size(), TEXT, &key_copy, true);
+    path_copy.assign(path_copy.size(), 'x');
+    CHECK(queue.size() == 3 && queue.get_replaced() == 1, "%zu items queued and %u replaced, expected 3 and 1", queue.size(), queue.get_replaced());
+    CHECK(queue.can_replace(&key_a), "%s can't be replaced after the caller's path changed", path_a.c_str());
+}
+
+static void check_clients(const Result &r, const std::vector<int> &left)
+{
+    for (const Client &c : r.clients) {
+        CHECK(!c.went_back, "Client %d: A state went back to an older value", c.fd);
+
+        if (std::find(left.begin(), left.end(), c.fd) != left.end())
+            continue;
+
+        for (int state = 0; state < STATES; ++state) {
+            auto it = c.state_values.find(state);
+
+            for (int field = 0; field < FIELDS; ++field) {
+                int value = it == c.state_values.end() ? 0 : it->second[static_cast<size_t>(field)];
+                int expected = r.values[static_cast<size_t>(state)][static_cast<size_t>(field)];
+                CHECK(value == expected, "Client %d: State %d field %d is %d, expected %d", c.fd, state, field, value, expected);
+            }
+        }
+
+        CHECK(c.logs_received == r.logs_queued, "Client %d: %zu of %zu log messages", c.fd, c.logs_received, r.logs_queued);
+    }
+}
+
+static Result run_queue(int runs, bool slow_clients_leave, bool patches_replaceable)
+{
+    Result r;
+    r.clients = make_clients();
+    WebSocketsWorkQueue queue;
+    std::vector<int> left;
+
+    auto push = [&](const int fds[MAX_WEB_SOCKET_CLIENTS], const std::string &s, const WebSocketsWorkKey *key, bool replace_queued) {
+        int present_fds[MAX_WEB_SOCKET_CLIENTS];
+
+        // Like copyClientFds: Only clients that are still connected.
+        for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i)
+            present_fds[i] = std::find(left.begin(), left.end(), fds[i]) == left.end() ? fds[i] : -1;
+
+        return queue.push(present_fds, make_payload(s), s.size(), TEXT, key, replace_queued) != WebSocketsWorkQueue::PushResult::Full;
+    };
+    auto can_replace = [&queue](const WebSocketsWorkKey *key) {return queue.can_replace(key);};
+
+    for (int run = 0; run < runs * 2; ++run) {
+        bool producing = run < runs;
+
+        produce(run, producing, patches_replaceable, r, push, can_replace);
+
+        if (slow_clients_leave && run == runs) {
+            for (int fd : {12, 14}) {
+                left.push_back(fd);
+                queue.remove_fd(fd);
+            }
+        }
+
+        // Same as work() in web_sockets.cpp.
+        for (Client &c : r.clients)
+            c.budget = c.bytes_per_run;
+
+        std::vector<int> blocked;
+        uint32_t seq = 0;
+        bool produced_while_sending = false;
+        ws_work_item wi;
+
+        while (queue.begin_next(seq, &wi)) {
+            std::string begun(wi.payload, wi.payload_len);
+
+            // The main thread keeps queueing while the worker sends. The item in flight must stay valid.
+            if (producing && !produced_while_sending && wi.seq % 7 == 0) {
+                produce(run, true, patches_replaceable, r, push, can_replace);
+                produced_while_sending = true;
+            }
+
+            CHECK(std::string(wi.payload, wi.payload_len) == begun, "Item in flight was changed");
+
+            uint32_t done_slots = 0;
+            for (int i = 0; i < MAX_WEB_SOCKET_CLIENTS; ++i) {
+                if (wi.fds[i] == -1)
+                    continue;
+
+                Client &c = *std::find_if(r.clients.begin(), r.clients.end(), [&wi, i](const Client &cl) {return cl.fd == wi.fds[i];});
+
+                if (std::find(blocked.begin(), blocked.end(), c.fd) != blocked.end())
+                    continue;
+
+                if (c.budget <= 0) {
+                    blocked.push_back(c.fd);
+                    continue;
+                }
+
+                deliver(c, wi.payload, wi.payload_len, run);
+                done_slots |= 1u << i;
+            }
+
+            seq = wi.seq;
+            queue.finish(seq, done_slots);
+        }
+    }
+
+    CHECK(queue.empty(), "Queue isn't empty after draining: %zu items", queue.size());
+    check_clients(r, left);
+
+    r.replaced = queue.get_replaced();
+    r.dropped = queue.get_dropped();
+    return r;
+}
+
+// The queue before: Items are sent in order to their clients and never replaced.
+// Sending to a full socket blocks the worker, so nobody gets anything after it until the next run.
+static Result run_fifo(int runs)
+{
+    struct Item {
+        const int *fds;
+        std::string payload;
+    };
+
+    Result r;
+    r.clients = make_clients();
+    std::deque<Item> queue;
+
+    auto push = [&](const int fds[MAX_WEB_SOCKET_CLIENTS], const std::string &s, const WebSocketsWorkKey *, bool) {
+        if (queue.size() >= MAX_WEB_SOCKET_WORK_ITEMS_IN_QUEUE) {
+            ++r.dropped;
+            return false;
+        }
+        queue.push_back({fds, s});
+        return true;
+    };
+    auto can_replace = [](const WebSocketsWorkKey *) {return false;};
+
+    for (int run = 0; run < runs * 2; ++run) {
+        produce(run, run < runs, false, r, push, can_replace);
+
+        for (Client &c : r.clients)
+            c.budget = c.bytes_per_run;
+
+        bool worker_blocked = false;
+        bool produced_while_sending = false;
+        while (!queue.empty() && !worker_blocked) {
+            if (run < runs && !produced_while_sending && queue.size() > 7) {
+                produce(run, true, false, r, push, can_replace);
+                produced_while_sending = true;
+            }
+
+            const Item &item = queue.front();
+
+            for (Client &c : r.clients) {
+                if (std::find(item.fds, item.fds + MAX_WEB_SOCKET_CLIENTS, c.fd) == item.fds + MAX_WEB_SOCKET_CLIENTS)
+                    continue;
+
+                if (c.budget <= 0)
+                    worker_blocked = true;
+                else
+                    deliver(c, item.payload.data(), item.payload.size(), run);
+            }
+
+            if (!worker_blocked)
+                queue.pop_front();
+        }
+    }
+
+    return r;
+}
+
+static void report(const char *name, const Result &r)
+{
+    printf("%s: %u replaced, %u dropped, %zu log messages\n", name, r.replaced, r.dropped, r.logs_queued);
+
+    for (const Client &c : r.clients) {
+        int current = 0;
+        for (int state = 0; state < STATES; ++state) {
+            auto it = c.state_values.find(state);
+            current += it != c.state_values.end() && it->second == r.values[static_cast<size_t>(state)];
+        }
+
+        printf("  client %d (%7ld bytes/run%s): %6zu payloads (%6zu patches), %4zu log messages, state values up to %4d runs old, %2d of %d states current at the end\n",
+               c.fd, c.bytes_per_run, c.fd >= 13 ? ", subprotocol" : "", c.received, c.patches_received, c.logs_received, c.max_state_age, current, STATES);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (!parse_host_test_args(argc, argv, {{"iterations", &iterations}}))
+        return 2;
+
+    check_patch_race();
+    check_key_collision();
+
+    Result queued = run_queue(iterations, false, true);
+    Result queued_leave = run_queue(iterations, true, true);
+    Result patches_kept = run_queue(iterations, false, false);
+    Result fifo = run_fifo(iterations);
+
+    for (const Client &c : queued.clients) {
+        if (is_fast(c))
+            CHECK(c.max_state_age == 0, "Fast client %d waited for a slow one: %d runs", c.fd, c.max_state_age);
+    }
+
+    // A full state replaces the patches the slow subprotocol client didn't get yet, so its queue never fills up.
+    CHECK(queued.dropped == 0, "%u items dropped", queued.dropped);
+
+    printf("%d runs with %d state updates each, then %d runs to drain the queue\n", iterations, STATES, iterations);
+    report("queue keyed by path", queued);
+    report("same, slow clients leave after the updates", queued_leave);
+    report("same, patches never replaced", patches_kept);
+    report("FIFO as before", fifo);
+
+    return host_test_result();
+}
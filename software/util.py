@@ -139,6 +139,20 @@ def store_digest(digest, dst_dir, var_name, env=None):
 
         os.replace(digest_path + '.tmp', digest_path)
 
+def write_data_lines(f, data):
+    written = 0
+    data_file = io.BytesIO(data)
+    b = data_file.read(12)
+
+    while len(b) != 0:
+        # read first to prevent trailing , after last byte
+        next_b = data_file.read(12)
+        f.write('    ' + ', '.join(['0x{:02x}'.format(x) for x in b]) + (',\n' if len(next_b) != 0 else '\n'))
+        written += len(b)
+        b = next_b
+
+    return written
+
 def embed_data_internal(data, cpp_path, h_path, var_name, var_type):
     try:
         os.remove(cpp_path)
@@ -157,18 +171,7 @@ def embed_data_internal(data, cpp_path, h_path, var_name, var_type):
             f.write('#include <stdint.h>\n\n')
 
         f.write('extern const {0} {1}_data[] = {{\n'.format(var_type, var_name))
-
-        written = 0
-        data_file = io.BytesIO(data)
-        b = data_file.read(12)
-
-        while len(b) != 0:
-            # read first to prevent trailing , after last byte
-            next_b = data_file.read(12)
-            f.write('    ' + ', '.join(['0x{:02x}'.format(x) for x in b]) + (',\n' if len(next_b) != 0 else '\n'))
-            written += len(b)
-            b = next_b
-
+        written = write_data_lines(f, data)
         f.write('};\n')
 
     os.replace(cpp_path + '.tmp', cpp_path)
@@ -208,6 +211,54 @@ def embed_data_with_digest(data, dst_dir, var_name, var_type, data_filter=lambda
         embed_data_internal(data_filter(data), cpp_path, h_path, var_name, var_type)
         store_digest(new_digest, dst_dir, var_name)
 
+# assets is a list of (path, content type, gzip data, Brotli data or None, immutable).
+# See WebAsset in src/web_assets.h.
+def embed_web_assets(assets, dst_dir, var_name):
+    cpp_path = os.path.join(dst_dir, var_name + '.embedded.cpp')
+    h_path = os.path.join(dst_dir, var_name + '.embedded.h')
+
+    for path in [cpp_path, h_path]:
+        try:
+            os.remove(path)
+        except FileNotFoundError:
+            pass
+
+    with open(cpp_path + '.tmp', 'w', encoding='utf-8') as f:
+        f.write('// WARNING: This file is generated by util.py\n\n')
+        f.write('#include "{0}.embedded.h"\n'.format(var_name))
+
+        entries = []
+
+        for i, (path, content_type, gzip_data, brotli_data, immutable) in enumerate(assets):
+            f.write('\nstatic const char {0}_{1}_gzip[] = {{\n'.format(var_name, i))
+            write_data_lines(f, gzip_data)
+            f.write('};\n')
+
+            if brotli_data is None:
+                brotli = 'nullptr, 0'
+            else:
+                f.write('\nstatic const char {0}_{1}_brotli[] = {{\n'.format(var_name, i))
+                write_data_lines(f, brotli_data)
+                f.write('};\n')
+                brotli = '{0}_{1}_brotli, {2}'.format(var_name, i, len(brotli_data))
+
+            entries.append('    {{{0}, {1}, {2}_{3}_gzip, {4}, {5}, {6}}},\n'.format(json.dumps(path), json.dumps(content_type), var_name, i, len(gzip_data), brotli, 'true' if immutable else 'false'))
+
+        f.write('\nextern const WebAsset {0}[] = {{\n'.format(var_name))
+        f.write(''.join(entries))
+        f.write('};\n')
+
+    os.replace(cpp_path + '.tmp', cpp_path)
+
+    with open(h_path + '.tmp', 'w', encoding='utf-8') as f:
+        f.write('// WARNING: This file is generated by util.py\n\n')
+        f.write('#pragma once\n\n')
+        f.write('#include "web_assets.h"\n\n')
+        f.write('extern const WebAsset {0}[];\n\n'.format(var_name))
+        f.write('#define {0}_count {1}\n'.format(var_name, len(assets)))
+
+    os.replace(h_path + '.tmp', h_path)
+
 def patch_beta_firmware(data, beta_version):
     data = bytearray(data)
     data[-10] = 200 + beta_version
@@ -258,6 +309,32 @@ def gzip_compress(data):
     from gzip import compress
     return compress(data)
 
+# Returns None if neither the brotli Python package nor Node.js is available.
+def brotli_compress(data):
+    try:
+        import brotli
+        return brotli.compress(data, mode=brotli.MODE_TEXT, quality=11)
+    except ImportError:
+        pass
+
+    # Node.js is needed to build the web interface anyway and its zlib has Brotli.
+    from shutil import which
+    node_path = which('node')
+    if node_path:
+        from subprocess import run
+        script = ("const zlib = require('zlib');"
+                  "const data = require('fs').readFileSync(0);"
+                  "process.stdout.write(zlib.brotliCompressSync(data, {params: {"
+                  "[zlib.constants.BROTLI_PARAM_MODE]: zlib.constants.BROTLI_MODE_TEXT,"
+                  "[zlib.constants.BROTLI_PARAM_QUALITY]: 11,"
+                  "[zlib.constants.BROTLI_PARAM_SIZE_HINT]: data.length}}));")
+        result = run([node_path, '-e', script], input=data, capture_output=True)
+        if result.returncode == 0:
+            return result.stdout
+
+    print("Brotli not available! Install Node.js or the brotli Python package to serve the web interface Brotli compressed")
+    return None
+
 def merge(left, right, path=[]):
     for key in right:
         if key in left:
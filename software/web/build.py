@@ -3,7 +3,8 @@ import sys
 import shutil
 import subprocess
 import pathlib
-from base64 import b64encode
+import hashlib
+from base64 import b64encode, b32encode
 import argparse
 import tinkerforge_util as tfutil
 
@@ -15,6 +16,9 @@ JS_ANALYZE = False
 
 BUILD_DIR = pathlib.Path('..', 'build')
 
+# Everything in here has its content hash in the file name and is served with Cache-Control: immutable.
+ASSETS_DIR = BUILD_DIR / 'assets'
+
 HTML_MINIFIER_TERSER_OPTIONS = [
     '--collapse-boolean-attributes',
     '--collapse-inline-tag-whitespace',
@@ -95,10 +99,15 @@ def main():
         'main.tsx',
         f'--metafile={BUILD_DIR / "meta.json"}',
         '--bundle',
+        '--splitting',
+        '--format=esm',
         '--target=es6',
+        '--supported:dynamic-import=true',
         '--alias:argon2-browser=../node_modules/argon2-browser/dist/argon2-bundled.min.js',
         '--alias:jquery=../node_modules/jquery/dist/jquery.slim.min',
-        f'--outfile={BUILD_DIR / "bundle.min.js"}'
+        f'--outdir={ASSETS_DIR}',
+        '--entry-names=[name]-[hash]',
+        '--chunk-names=[name]-[hash]'
     ]
 
     if JS_ANALYZE:
@@ -147,6 +156,23 @@ def main():
 
         (BUILD_DIR / 'main.min.css').write_text(css_src, encoding='utf-8')
 
+    # Same hash format as esbuild uses for the JavaScript files.
+    css_bytes = (BUILD_DIR / 'main.min.css').read_bytes()
+    css_name = 'main-{0}.css'.format(b32encode(hashlib.sha256(css_bytes).digest()[:5]).decode('ascii'))
+    (ASSETS_DIR / css_name).write_bytes(css_bytes)
+
+    js_names = [x.name for x in ASSETS_DIR.iterdir() if x.name.startswith('main-') and x.suffix == '.js']
+
+    if len(js_names) != 1:
+        print(f'Error: Expected one main-*.js from esbuild, found {len(js_names)}', file=sys.stderr)
+        exit(42)
+
+    # Relative paths, like the manifest: The web interface can be served from below a prefix.
+    html = pathlib.Path('index.html').read_text(encoding='utf-8')
+    html = html.replace('href="css/main.css"', f'href="assets/{css_name}"')
+    html = html.replace('<script src="js/bundle.js">', f'<script type="module" src="assets/{js_names[0]}">')
+    pathlib.Path('index.html').write_text(html, encoding='utf-8')
+
     print('html-minifier-terser...')
     subprocess.check_call([
         'npx',
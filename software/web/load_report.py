@@ -0,0 +1,115 @@
+#!/usr/bin/python3 -u
+
+# Loads the web interface from a device like a browser does and reports the
+# transferred bytes and the time until index.html and every script and style
+# sheet it references have arrived. Parsing and running the scripts is not
+# included. Cold load: Empty cache. Warm load: index.html is revalidated
+# with its ETag and assets served with Cache-Control: immutable come from the
+# cache. Works with firmwares that still embed everything into index.html.
+#
+# Usage: load_report.py host [--runs N]
+
+import sys
+import re
+import time
+import gzip
+import argparse
+import subprocess
+from concurrent.futures import ThreadPoolExecutor
+from urllib.request import urlopen, Request
+from urllib.error import HTTPError
+
+
+def decompress(data, encoding):
+    if encoding == 'gzip':
+        return gzip.decompress(data)
+
+    if encoding == 'br':
+        try:
+            import brotli
+            return brotli.decompress(data)
+        except ImportError:
+            return subprocess.run(['node', '-e', "process.stdout.write(require('zlib').brotliDecompressSync(require('fs').readFileSync(0)))"],
+                                  input=data, capture_output=True, check=True).stdout
+
+    return data
+
+
+def fetch(url, accept_encoding, headers={}):
+    request = Request(url, headers=dict(headers, **{'Accept-Encoding': accept_encoding}))
+
+    try:
+        with urlopen(request) as f:
+            return f.status, f.read(), f.headers
+    except HTTPError as e:
+        return e.code, e.fp.read(), e.headers
+
+
+def load(host, accept_encoding, cache):
+    start = time.monotonic()
+    requests = 1
+    transferred = 0
+
+    index_headers = {}
+    if 'etag' in cache:
+        index_headers['If-None-Match'] = cache['etag']
+
+    status, body, headers = fetch(f'http://{host}/', accept_encoding, index_headers)
+    transferred += len(body)
+
+    if status == 304:
+        html = cache['html']
+    else:
+        # Without the brotli package this starts Node.js, which a browser doesn't have to.
+        decompress_start = time.monotonic()
+        html = decompress(body, headers.get('Content-Encoding')).decode('utf-8')
+        start += time.monotonic() - decompress_start
+        cache['html'] = html
+
+        if headers.get('ETag') is not None:
+            cache['etag'] = headers['ETag']
+
+    # The browser fetches the scripts and style sheets in parallel.
+    assets = re.findall(r'(?:href|src)="?(assets/[^" >]+)', html)
+    to_fetch = [x for x in assets if x not in cache.get('immutable', set())]
+
+    with ThreadPoolExecutor(max_workers=max(len(to_fetch), 1)) as executor:
+        for asset, (asset_status, asset_body, asset_headers) in zip(to_fetch, executor.map(lambda x: fetch(f'http://{host}/{x}', accept_encoding), to_fetch)):
+            if asset_status != 200:
+                print(f'Error: {asset}: HTTP {asset_status}', file=sys.stderr)
+                sys.exit(1)
+
+            requests += 1
+            transferred += len(asset_body)
+
+            if 'immutable' in asset_headers.get('Cache-Control', ''):
+                cache.setdefault('immutable', set()).add(asset)
+
+    return requests, transferred, time.monotonic() - start, headers.get('Content-Encoding', '-')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('host')
+    parser.add_argument('--runs', type=int, default=5)
+    args = parser.parse_args()
+
+    for accept_encoding in ['gzip, deflate, br', 'gzip, deflate']:
+        for name in ['cold', 'warm']:
+            times = []
+
+            for _ in range(args.runs):
+                cache = {}
+
+                if name == 'warm':
+                    load(args.host, accept_encoding, cache)
+
+                requests, transferred, duration, encoding = load(args.host, accept_encoding, cache)
+                times.append(duration)
+
+            times.sort()
+            print(f'Accept-Encoding: {accept_encoding:17} {name}: {requests} requests, {transferred:7} bytes ({encoding}), assets arrived after {times[len(times) // 2] * 1000:7.1f} ms (median of {args.runs})')
+
+
+if __name__ == '__main__':
+    main()
@@ -3,7 +3,7 @@
 import sys
 import os
 import argparse
-from flask import Flask, Response, request
+from flask import Flask, Response, request, send_from_directory
 from flask_sock import Sock  # pip install flask-sock
 import websocket  # pip install websocket-client
 from urllib.request import urlopen, Request
@@ -65,10 +65,15 @@ def make_absolute_path(path):
 
 @app.route('/')
 def index():
-    with open(make_absolute_path('build/index.standalone.html'), 'r', encoding='utf-8') as f:
+    with open(make_absolute_path('build/index.min.html'), 'r', encoding='utf-8') as f:
         return f.read()
 
 
+@app.route('/assets/<path:name>')
+def assets(name):
+    return send_from_directory(make_absolute_path('build/assets'), name)
+
+
 @app.route('/<path:path>', methods=['GET', 'PUT'])
 def forward_html(path):
     try:
@@ -43,6 +43,9 @@ export interface state_slow {
     conf_array_buf_size: number;
     conf_object_buf_size: number;
     conf_union_buf_size: number;
+    conf_slot_allocs: number;
+    conf_slot_reallocs: number;
+    conf_slot_bytes_moved: number;
 }
 
 interface task_hwm {
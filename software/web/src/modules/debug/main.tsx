@@ -159,6 +159,11 @@ export class Debug extends Component {
                 <Row label={__("debug.content.conf_union_buf")}
                      l={<OutputFloat value={state_slow.conf_union_buf_size} digits={0} scale={0} unit="B"/>}/>
 
+                <Row label={__("debug.content.conf_slot_allocs")}
+                     l={<OutputFloat value={state_slow.conf_slot_allocs} digits={0} scale={0} unit=""/>}
+                     c={<OutputFloat value={state_slow.conf_slot_reallocs} digits={0} scale={0} unit=""/>}
+                     r={<OutputFloat value={state_slow.conf_slot_bytes_moved} digits={0} scale={0} unit="B"/>}/>
+
                 <FormSeparator heading={__("debug.content.stack_hwm_header")} first={false} />
 
                 <Row label={__("debug.content.task_name")}
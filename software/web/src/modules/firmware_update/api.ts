@@ -10,6 +10,13 @@ export interface state {
     update_version: string,
     install_progress: number,
     install_state: number,
+    install_timing: {
+        total: number,
+        receive: number,
+        hash: number,
+        flash: number,
+        stall: number,
+    },
 }
 
 export interface check_for_update {
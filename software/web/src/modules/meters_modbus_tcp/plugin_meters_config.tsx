@@ -354,6 +354,8 @@ export type ModbusTCPMetersConfig = [
         display_name: string;
         host: string;
         port: number;
+        max_register_gap: number;
+        max_transactions_in_flight: number;
         table: TableConfig;
     },
 ];
@@ -627,7 +629,7 @@ export function init() {
     return {
         [MeterClassID.ModbusTCP]: {
             name: () => __("meters_modbus_tcp.content.meter_class"),
-            new_config: () => [MeterClassID.ModbusTCP, {display_name: "", host: "", port: 502, table: null}] as MeterConfig,
+            new_config: () => [MeterClassID.ModbusTCP, {display_name: "", host: "", port: 502, max_register_gap: 8, max_transactions_in_flight: 1, table: null}] as MeterConfig,
             clone_config: (config: MeterConfig) => [config[0], {...config[1]}] as MeterConfig,
             get_edit_children: (config: ModbusTCPMetersConfig, on_config: (config: ModbusTCPMetersConfig) => void): ComponentChildren => {
                 let edit_children = [
@@ -661,6 +663,27 @@ export function init() {
                                 on_config(util.get_updated_union(config, {port: v}));
                             }} />
                     </FormRow>,
+                    <FormRow label={__("meters_modbus_tcp.content.max_register_gap")} label_muted={__("meters_modbus_tcp.content.max_register_gap_muted")}>
+                        <InputNumber
+                            required
+                            min={0}
+                            max={32}
+                            unit={__("meters_modbus_tcp.content.max_register_gap_unit")}
+                            value={config[1].max_register_gap}
+                            onValue={(v) => {
+                                on_config(util.get_updated_union(config, {max_register_gap: v}));
+                            }} />
+                    </FormRow>,
+                    <FormRow label={__("meters_modbus_tcp.content.max_transactions_in_flight")} label_muted={__("meters_modbus_tcp.content.max_transactions_in_flight_muted")}>
+                        <InputNumber
+                            required
+                            min={1}
+                            max={8}
+                            value={config[1].max_transactions_in_flight}
+                            onValue={(v) => {
+                                on_config(util.get_updated_union(config, {max_transactions_in_flight: v}));
+                            }} />
+                    </FormRow>,
                     <FormRow label={__("meters_modbus_tcp.content.table")}>
                         <InputSelect
                             required
@@ -14,6 +14,11 @@ let x = {
             "host_invalid": "Host ist ungültig",
             "port": "Port",
             "port_muted": "typischerweise 502",
+            "max_register_gap": "Maximale Registerlücke",
+            "max_register_gap_muted": "so nah beieinander liegende Werte werden mit einer Anfrage gelesen",
+            "max_register_gap_unit": "Register",
+            "max_transactions_in_flight": "Parallele Anfragen",
+            "max_transactions_in_flight_muted": "1 für Geräte, die nur eine Anfrage gleichzeitig bearbeiten. Für alle Zähler eines Geräts denselben Wert verwenden",
             "table": "Registertabelle",
             "table_select": "Auswählen...",
             "table_custom": "Benutzerdefiniert",
@@ -14,6 +14,11 @@ let x = {
             "host_invalid": "Host is invalid",
             "port": "Port",
             "port_muted": "typically 502",
+            "max_register_gap": "Maximum register gap",
+            "max_register_gap_muted": "values this close together are read with a single request",
+            "max_register_gap_unit": "registers",
+            "max_transactions_in_flight": "Parallel requests",
+            "max_transactions_in_flight_muted": "1 for devices that handle only one request at a time. Use the same value for all meters of a device",
             "table": "Register table",
             "table_select": "Select...",
             "table_custom": "Custom",
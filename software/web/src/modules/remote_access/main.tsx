@@ -34,7 +34,6 @@ import "./wireguard";
 import { config, RegistrationState } from "./api";
 import { InputNumber } from "../../ts/components/input_number";
 import { InputSelect } from "../../ts/components/input_select";
-import { ArgonType, hash } from "argon2-browser";
 import { CollapsedSection } from "../../ts/components/collapsed_section";
 import { Container, Modal, Row, Spinner } from "react-bootstrap";
 
@@ -172,6 +171,9 @@ export class RemoteAccess extends ConfigComponent<"remote_access/config", {}, Re
             return;
         }
 
+        // Argon2 is only needed here, so it is loaded on demand instead of with the web interface.
+        const { ArgonType, hash } = await import("argon2-browser");
+
         const loginHash = await hash({
             pass: this.state.password,
             salt: loginSalt,
@@ -72,6 +72,31 @@ export function update<T extends keyof ConfigMap>(topic: T, payload: ConfigMap[T
         update_cache_item(api_cache[topic], payload);
 }
 
+// Applies [JSON pointer, value] pairs sent by the firmware. Every pair replaces one value.
+export function patch<T extends keyof ConfigMap>(topic: T, ops: [string, any][]) {
+    for (let [pointer, value] of ops) {
+        let keys = pointer.split("/").slice(1).map(k => k.replace(/~1/g, "/").replace(/~0/g, "~"));
+        let last = keys.pop();
+        let parent: any = api_cache[topic];
+
+        for (let key of keys) {
+            if (is_primitive(parent))
+                break;
+            parent = parent[key];
+        }
+
+        if (last === undefined || is_primitive(parent)) {
+            console.log("Received patch for unknown value", topic, pointer);
+            continue;
+        }
+
+        if (is_primitive(parent[last]) || is_primitive(value))
+            parent[last] = value;
+        else
+            update_cache_item(parent[last], value);
+    }
+}
+
 export function get<T extends keyof ConfigMap>(topic: T) : Readonly<ConfigMap[T]> {
     // This should be unnecessary, but putting a tuple in a DeepSignal seems to drop
     // the tuple's type information. Typescript then thinks the tuple is an array.
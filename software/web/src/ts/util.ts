@@ -271,13 +271,16 @@ const wsOnMessageCallback = (e: MessageEvent) => {
     batch(() => {
         for (let item of messages.split("\n")) {
             let obj = JSON.parse(item);
-            if (!("topic" in obj) || !("payload" in obj)) {
+            if (!("topic" in obj) || (!("payload" in obj) && !("patch" in obj))) {
                 console.log("Received malformed event", obj);
                 return;
             }
 
             topics.push(obj["topic"]);
-            API.update(obj["topic"], obj["payload"]);
+            if ("patch" in obj)
+                API.patch(obj["topic"], obj["patch"]);
+            else
+                API.update(obj["topic"], obj["payload"]);
         }
 
         if (allow_render.peek()) {
@@ -315,7 +318,8 @@ export function setupEventSource(first: boolean, keep_as_first: boolean, continu
     if (ws != null) {
         ws.close();
     }
-    ws = new WebSocket((location.protocol == 'https:' ? 'wss://' : 'ws://') + location.host + '/ws');
+    // The firmware sends only the changed values of a state to clients using the state-patch subprotocol.
+    ws = new WebSocket((location.protocol == 'https:' ? 'wss://' : 'ws://') + location.host + '/ws', "state-patch");
 
     if (wsReconnectTimeout != null) {
         clearTimeout(wsReconnectTimeout);